@@ -0,0 +1,453 @@
+#include "AssetCache.h"
+#include "JobSystem.h"
+#include "FileWatcher.h"
+#include "GLState.h"
+#include <memory>
+#include <sys/stat.h>
+#ifdef _WIN32
+#include <direct.h>
+#define MAKE_DIR(dir) _mkdir(dir)
+#else
+#define MAKE_DIR(dir) mkdir(dir, 0755)
+#endif
+
+MeshCacheStats gMeshCacheStats;
+TextureCache gTextureCache;
+ProgramCache gProgramCache;
+
+//-------------------------------------------------------------------------//
+// MESH CACHE
+//-------------------------------------------------------------------------//
+
+//Blob layout: MeshBlobHeader | source path | attribute names | vertexData | indices.
+//Strings are NUL-separated and padded to 4 bytes so the arrays after them stay aligned.
+struct MeshBlobHeader {
+	uint32_t magic, version;
+	uint64_t sourceSize;
+	int64_t sourceTime;
+	uint32_t flipZ;
+	uint32_t pathSize, namesSize; //Padded byte counts.
+	uint32_t numAttributes, numFloats, numIndices;
+};
+
+static bool getSourceStamp(const string &fullName, uint64_t &size, int64_t &time)
+{
+	struct stat st;
+	if (stat(fullName.c_str(), &st) != 0) return false;
+	size = (uint64_t)st.st_size;
+	time = (int64_t)st.st_mtime;
+	return true;
+}
+static string getBlobName(const string &fullName, bool flipZ)
+{
+	char name[64];
+	uint64_t hash = hashBytes(fullName.data(), fullName.size());
+	hash = hashBytes(&flipZ, sizeof(flipZ), hash);
+	sprintf(name, "%016llx.meshb", (unsigned long long)hash);
+	return string(MESH_CACHE_DIR) + name;
+}
+static void padTo4(string &s) { while (s.size() % 4 != 0) s.push_back('\0'); }
+
+//A hit goes to GL without readFromPly()'s checks, so the blob is held to them here: attribute names inside their
+//section, whole vertices, and every index on one of them. names is where the section starts, the size is known good.
+static bool readBlobAttributes(const MeshBlobHeader *h, const char *names, vector<string> &attributes)
+{
+	attributes.clear();
+	const char *p = names, *namesEnd = names + h->namesSize;
+	for (uint32_t i = 0; i < h->numAttributes; ++i) {
+		const char *nul = (const char*)memchr(p, '\0', namesEnd - p);
+		if (nul == nullptr) return false;
+		attributes.push_back(string(p, nul));
+		p = nul + 1;
+	}
+	if (h->numAttributes == 0) return h->numFloats == 0 && h->numIndices == 0;
+	if (h->numFloats % h->numAttributes != 0) return false;
+
+	const int *indices = (const int*)(namesEnd + (size_t)h->numFloats * sizeof(float));
+	int numVertices = (int)(h->numFloats / h->numAttributes);
+	for (uint32_t i = 0; i < h->numIndices; ++i) if (indices[i] < 0 || indices[i] >= numVertices) return false;
+	return true;
+}
+
+bool CachedMesh::open(const string &fullName, bool flipZ)
+{
+	uint64_t sourceSize;
+	int64_t sourceTime;
+	if (!getSourceStamp(fullName, sourceSize, sourceTime) || !file.open(getBlobName(fullName, flipZ))) {
+		++gMeshCacheStats.misses;
+		return false;
+	}
+
+	//Any mismatch means the source changed (or the blob is from another build), so it gets rewritten.
+	const MeshBlobHeader *h = (const MeshBlobHeader*)file.data;
+	size_t expected = sizeof(MeshBlobHeader);
+	bool valid = file.size >= expected && h->magic == MESH_CACHE_MAGIC && h->version == MESH_CACHE_VERSION
+		&& h->sourceSize == sourceSize && h->sourceTime == sourceTime && h->flipZ == (uint32_t)flipZ;
+	if (valid) {
+		uint64_t size = (uint64_t)expected + h->pathSize + h->namesSize + (uint64_t)h->numFloats * sizeof(float) + (uint64_t)h->numIndices * sizeof(int);
+		valid = h->numFloats <= INT_MAX && h->numIndices <= INT_MAX && (uint64_t)file.size == size
+			&& strncmp(file.data + sizeof(MeshBlobHeader), fullName.c_str(), h->pathSize) == 0;
+	}
+	if (valid) valid = readBlobAttributes(h, file.data + sizeof(MeshBlobHeader) + h->pathSize, attributes);
+	if (!valid) {
+		file.close();
+		++gMeshCacheStats.misses;
+		return false;
+	}
+
+	const char *p = file.data + sizeof(MeshBlobHeader) + h->pathSize + h->namesSize;
+	vertexData = (const float*)p;
+	numFloats = (int)h->numFloats;
+	indices = (const int*)(p + (size_t)h->numFloats * sizeof(float));
+	numIndices = (int)h->numIndices;
+	++gMeshCacheStats.hits;
+	return true;
+}
+bool storeCachedMesh(const string &fullName, bool flipZ, const TriMesh &mesh)
+{
+	MeshBlobHeader h;
+	memset(&h, 0, sizeof(h));
+	if (!getSourceStamp(fullName, h.sourceSize, h.sourceTime)) return false;
+	h.magic = MESH_CACHE_MAGIC;
+	h.version = MESH_CACHE_VERSION;
+	h.flipZ = flipZ;
+
+	string path(fullName), names;
+	path.push_back('\0');
+	padTo4(path);
+	for (int i = 0; i < (int)mesh.attributes.size(); ++i) names.append(mesh.attributes[i].c_str(), mesh.attributes[i].size() + 1);
+	padTo4(names);
+	h.pathSize = (uint32_t)path.size();
+	h.namesSize = (uint32_t)names.size();
+	h.numAttributes = (uint32_t)mesh.attributes.size();
+	h.numFloats = (uint32_t)mesh.vertexData.size();
+	h.numIndices = (uint32_t)mesh.indices.size();
+
+	//Written under a temporary name and renamed, so a crash mid-write never leaves a blob that looks valid.
+	MAKE_DIR(MESH_CACHE_DIR);
+	//The temporary name is per thread, as two meshes may share a source file and load at once.
+	string blobName = getBlobName(fullName, flipZ);
+	ostringstream tmp;
+	tmp << blobName << "." << this_thread::get_id() << ".tmp";
+	string tmpName = tmp.str();
+	FILE *F = fopen(tmpName.c_str(), "wb");
+	if (F == nullptr) return false;
+	fwrite(&h, sizeof(h), 1, F);
+	fwrite(path.data(), 1, path.size(), F);
+	fwrite(names.data(), 1, names.size(), F);
+	if (!mesh.vertexData.empty()) fwrite(&mesh.vertexData[0], sizeof(float), mesh.vertexData.size(), F);
+	if (!mesh.indices.empty()) fwrite(&mesh.indices[0], sizeof(int), mesh.indices.size(), F);
+	bool ok = (ferror(F) == 0);
+	fclose(F);
+	remove(blobName.c_str()); //rename() will not replace an existing file on Windows.
+	if (!ok || rename(tmpName.c_str(), blobName.c_str()) != 0) {
+		remove(tmpName.c_str());
+		return false;
+	}
+	++gMeshCacheStats.writes;
+	return true;
+}
+void printMeshCacheStats(void)
+{
+	cout << "\tMesh cache (" << MESH_CACHE_DIR << "): " << gMeshCacheStats.hits << " hits, "
+		<< gMeshCacheStats.misses << " misses, " << gMeshCacheStats.writes << " blobs written.\n";
+}
+
+//-------------------------------------------------------------------------//
+// TEXTURE CACHE
+//-------------------------------------------------------------------------//
+
+RGBAImage* TextureCache::acquire(const string &fileName, GLuint magFilter, GLuint minFilter, bool createMipMap)
+{
+	//A missing file still gets an entry, so decodePNG() reports it like loadPNG() used to.
+	string fullName;
+	if (!getFullFileName(fileName, fullName)) fullName = fileName;
+	ostringstream key;
+	key << fullName << '|' << magFilter << '|' << minFilter << '|' << createMipMap;
+
+	auto it = entries.find(key.str());
+	if (it != entries.end()) {
+		Entry &e = it->second;
+		++e.refs;
+		++hits;
+		if (!e.pending && e.image->textureId == NULL_HANDLE && e.image->width > 0) { //Survived a window change.
+			e.image->sendToOpenGL(e.magFilter, e.minFilter, e.createMipMap);
+			++uploads;
+		}
+		return e.image;
+	}
+
+	Entry &e = entries[key.str()];
+	e.fullName = fullName;
+	e.image = new RGBAImage();
+	e.image->fileName = fileName;
+	e.refs = 1;
+	e.magFilter = magFilter;
+	e.minFilter = minFilter;
+	e.createMipMap = createMipMap;
+	e.pending = true;
+	owners[e.image] = &e;
+	++decodes;
+	Entry *entry = &e; //Map nodes don't move, and nothing is purged while jobs are out.
+	gJobs.submit([entry, fullName]() { entry->image->decodePNG(fullName); },
+		[this, entry]() {
+			entry->image->sendToOpenGL(entry->magFilter, entry->minFilter, entry->createMipMap);
+			entry->pending = false;
+			++uploads;
+		});
+	gJobs.runCompletions(); //Upload whatever is ready while the parse goes on.
+	gFileWatcher.watch(fullName);
+	return e.image;
+}
+void TextureCache::retain(RGBAImage *image)
+{
+	auto it = owners.find(image);
+	if (it != owners.end()) ++it->second->refs;
+}
+void TextureCache::release(RGBAImage *image)
+{
+	if (image == nullptr) return;
+	auto it = owners.find(image);
+	if (it == owners.end()) ERROR("Releasing a texture the cache doesn't own: " + image->fileName, false);
+	else if (--it->second->refs < 0) ERROR("Texture released more often than acquired: " + image->fileName, false);
+}
+void TextureCache::dropGL(void)
+{
+	for (auto it = entries.begin(); it != entries.end(); ++it) {
+		RGBAImage *image = it->second.image;
+		if (image->textureId != NULL_HANDLE) glDeleteTextures(1, &image->textureId);
+		if (image->samplerId != NULL_HANDLE) glDeleteSamplers(1, &image->samplerId);
+		gGLState.forgetTexture(image->textureId);
+		gGLState.forgetSampler(image->samplerId);
+		image->textureId = image->samplerId = NULL_HANDLE;
+	}
+}
+int TextureCache::reload(const string &fullName)
+{
+	int numReloads = 0;
+	for (auto it = entries.begin(); it != entries.end(); ++it) {
+		Entry *entry = &it->second;
+		if (entry->fullName != fullName || entry->pending) continue;
+
+		//Decoded aside, so a half-written or broken file leaves the old pixels alone.
+		RGBAImage *fresh = new RGBAImage();
+		shared_ptr<bool> ok(new bool(false));
+		entry->pending = true;
+		gJobs.submit([fresh, fullName, ok]() { *ok = fresh->decodePNG(fullName); },
+			[this, entry, fresh, ok]() {
+				if (*ok) {
+					entry->image->pixels.swap(fresh->pixels);
+					entry->image->width = fresh->width;
+					entry->image->height = fresh->height;
+					entry->image->refreshOpenGL(entry->createMipMap); //Skipped if dropGL() left it without a texture.
+					++reloads;
+				}
+				entry->pending = false;
+				delete fresh;
+			});
+		++numReloads;
+	}
+	return numReloads;
+}
+int TextureCache::purge(void)
+{
+	int numFreed = 0;
+	for (auto it = entries.begin(); it != entries.end();) {
+		if (it->second.refs > 0) { ++it; continue; }
+		owners.erase(it->second.image);
+		delete it->second.image;
+		it = entries.erase(it);
+		++numFreed;
+	}
+	return numFreed;
+}
+size_t TextureCache::getResidentBytes(bool onGPU) const
+{
+	size_t bytes = 0;
+	for (auto it = entries.cbegin(); it != entries.cend(); ++it) {
+		const RGBAImage *image = it->second.image;
+		if (!onGPU) bytes += image->pixels.size();
+		else if (image->textureId != NULL_HANDLE) {
+			size_t level = (size_t)image->width * image->height * 4;
+			bytes += it->second.createMipMap ? level * 4 / 3 : level; //A full chain adds a third.
+		}
+	}
+	return bytes;
+}
+void TextureCache::print(void) const
+{
+	int numHeld = 0;
+	for (auto it = entries.cbegin(); it != entries.cend(); ++it) if (it->second.refs > 0) ++numHeld;
+	cout << "	Texture cache: " << entries.size() << " textures (" << numHeld << " held), " << hits << " hits, "
+		<< decodes << " decodes, " << uploads << " uploads, " << reloads << " reloads.\n";
+	cout << "	Resident: " << getResidentBytes(false) / 1024 << " KB pixels, " << getResidentBytes(true) / 1024 << " KB in GL.\n";
+	for (auto it = entries.cbegin(); it != entries.cend(); ++it)
+		cout << "		" << it->second.refs << "x " << it->second.image->width << "x" << it->second.image->height << " " << it->first << endl;
+}
+
+//-------------------------------------------------------------------------//
+// PROGRAM CACHE
+//-------------------------------------------------------------------------//
+
+//Blob layout: ProgramBlobHeader | binary, exactly as glGetProgramBinary() returned it.
+struct ProgramBlobHeader {
+	uint32_t magic, version;
+	uint64_t driverHash, vertexHash, fragmentHash;
+	uint32_t binaryFormat, binarySize;
+};
+
+static bool hasProgramBinaries(void)
+{
+	if (!GLEW_ARB_get_program_binary) return false; //Core from 4.1, we ask for 4.0.
+	GLint numFormats = 0;
+	glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &numFormats);
+	return numFormats > 0;
+}
+static uint64_t getDriverHash(void)
+{
+	//A binary only loads into the driver that wrote it, so anything naming the driver is in its key.
+	GLenum names[3] = { GL_VENDOR, GL_RENDERER, GL_VERSION };
+	uint64_t hash = hashBytes(nullptr, 0);
+	for (int i = 0; i < 3; ++i) {
+		const char *str = (const char*)glGetString(names[i]);
+		if (str != nullptr) hash = hashBytes(str, strlen(str) + 1, hash);
+	}
+	return hash;
+}
+static string getProgramBlobName(uint64_t vertexHash, uint64_t fragmentHash)
+{
+	char name[64];
+	sprintf(name, "%016llx.progb", (unsigned long long)hashBytes(&fragmentHash, sizeof(fragmentHash), hashBytes(&vertexHash, sizeof(vertexHash))));
+	return string(PROGRAM_CACHE_DIR) + name;
+}
+
+GLuint ProgramCache::acquire(const string &vertexShaderName, const string &fragmentShaderName, vector<string> *sourceFiles, bool instanced)
+{
+	//Both get preprocessed either way, so sourceFiles has them all even when one is missing.
+	string vertexCode, fragmentCode;
+	bool hasVertex = preprocessShader(vertexShaderName, vertexCode, sourceFiles);
+	bool hasFragment = preprocessShader(fragmentShaderName, fragmentCode, sourceFiles);
+	if (!hasVertex || !hasFragment) return NULL_HANDLE;
+	if (instanced && !makeInstancedShader(vertexCode)) return NULL_HANDLE; //Its own source, so its own key and binary.
+
+	Key key(hashBytes(vertexCode.data(), vertexCode.size()), hashBytes(fragmentCode.data(), fragmentCode.size()));
+	auto it = entries.find(key);
+	if (it != entries.end()) {
+		++it->second.refs;
+		++shares;
+		return it->second.shaderProgram;
+	}
+
+	GLuint shaderProgram = loadBinary(key);
+	if (shaderProgram != NULL_HANDLE) ++binaryHits;
+	else {
+		GLuint vertexShader = compileShader(vertexCode, GL_VERTEX_SHADER, vertexShaderName);
+		GLuint fragmentShader = compileShader(fragmentCode, GL_FRAGMENT_SHADER, fragmentShaderName);
+		if (vertexShader != NULL_HANDLE && fragmentShader != NULL_HANDLE) shaderProgram = createShaderProgram(vertexShader, fragmentShader, true);
+		if (vertexShader != NULL_HANDLE) glDeleteShader(vertexShader); //Only flagged while the program holds them.
+		if (fragmentShader != NULL_HANDLE) glDeleteShader(fragmentShader);
+		if (shaderProgram == NULL_HANDLE) return NULL_HANDLE;
+		++compiles;
+		storeBinary(key, shaderProgram);
+	}
+
+	Entry &e = entries[key];
+	e.shaderProgram = shaderProgram;
+	e.refs = 1;
+	e.uniforms.reflect(shaderProgram);
+	owners[shaderProgram] = key;
+	return shaderProgram;
+}
+const UniformTable& ProgramCache::getUniforms(GLuint shaderProgram) const
+{
+	auto it = owners.find(shaderProgram);
+	if (it == owners.end()) return gNoUniforms;
+	return entries.find(it->second)->second.uniforms;
+}
+void ProgramCache::release(GLuint shaderProgram)
+{
+	if (shaderProgram == NULL_HANDLE) return;
+	auto it = owners.find(shaderProgram);
+	if (it == owners.end()) { //Left over from before the last dropGL(), or built outside the cache.
+		glDeleteProgram(shaderProgram);
+		gGLState.forgetProgram(shaderProgram);
+		return;
+	}
+	auto e = entries.find(it->second);
+	if (--e->second.refs > 0) return;
+	glDeleteProgram(shaderProgram);
+	gGLState.forgetProgram(shaderProgram);
+	entries.erase(e);
+	owners.erase(it);
+}
+void ProgramCache::dropGL(void)
+{
+	for (auto it = entries.begin(); it != entries.end(); ++it) {
+		glDeleteProgram(it->second.shaderProgram);
+		gGLState.forgetProgram(it->second.shaderProgram);
+	}
+	entries.clear();
+	owners.clear();
+}
+GLuint ProgramCache::loadBinary(const Key &key)
+{
+	if (!hasProgramBinaries()) return NULL_HANDLE;
+	MappedFile file;
+	if (!file.open(getProgramBlobName(key.first, key.second))) return NULL_HANDLE;
+
+	const ProgramBlobHeader *h = (const ProgramBlobHeader*)file.data;
+	if (file.size < sizeof(ProgramBlobHeader) || h->magic != PROGRAM_CACHE_MAGIC || h->version != PROGRAM_CACHE_VERSION
+		|| h->driverHash != getDriverHash() || h->vertexHash != key.first || h->fragmentHash != key.second
+		|| file.size != sizeof(ProgramBlobHeader) + h->binarySize) return NULL_HANDLE;
+
+	GLuint shaderProgram = glCreateProgram();
+	glProgramBinary(shaderProgram, h->binaryFormat, file.data + sizeof(ProgramBlobHeader), (GLsizei)h->binarySize);
+	GLint linked = GL_FALSE;
+	glGetProgramiv(shaderProgram, GL_LINK_STATUS, &linked);
+	if (!linked) { //Allowed even for a matching driver, e.g. after a settings change.
+		glDeleteProgram(shaderProgram);
+		return NULL_HANDLE;
+	}
+	bindUniformBlocks(shaderProgram); //Loading resets uniform state like a link does.
+	return shaderProgram;
+}
+void ProgramCache::storeBinary(const Key &key, GLuint shaderProgram)
+{
+	if (!hasProgramBinaries()) return;
+	GLint size = 0;
+	glGetProgramiv(shaderProgram, GL_PROGRAM_BINARY_LENGTH, &size);
+	if (size <= 0) return;
+	vector<char> binary(size);
+	GLenum format = 0;
+	GLsizei numWritten = 0;
+	glGetProgramBinary(shaderProgram, size, &numWritten, &format, &binary[0]);
+	if (numWritten <= 0) return;
+
+	ProgramBlobHeader h;
+	memset(&h, 0, sizeof(h));
+	h.magic = PROGRAM_CACHE_MAGIC;
+	h.version = PROGRAM_CACHE_VERSION;
+	h.driverHash = getDriverHash();
+	h.vertexHash = key.first;
+	h.fragmentHash = key.second;
+	h.binaryFormat = (uint32_t)format;
+	h.binarySize = (uint32_t)numWritten;
+
+	//Through a temporary name, as with mesh blobs. Only the GL thread writes these, so one name will do.
+	MAKE_DIR(PROGRAM_CACHE_DIR);
+	string blobName = getProgramBlobName(key.first, key.second);
+	string tmpName = blobName + ".tmp";
+	FILE *F = fopen(tmpName.c_str(), "wb");
+	if (F == nullptr) return;
+	fwrite(&h, sizeof(h), 1, F);
+	fwrite(&binary[0], 1, numWritten, F);
+	bool ok = (ferror(F) == 0);
+	fclose(F);
+	remove(blobName.c_str()); //rename() will not replace an existing file on Windows.
+	if (!ok || rename(tmpName.c_str(), blobName.c_str()) != 0) remove(tmpName.c_str());
+}
+void ProgramCache::print(void) const
+{
+	cout << "	Shader programs (" << PROGRAM_CACHE_DIR << "): " << compiles << " compiled, " << binaryHits << " binary cache hits, "
+		<< shares << " shared, " << entries.size() << " live.\n";
+}
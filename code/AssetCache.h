@@ -0,0 +1,105 @@
+#pragma once
+#include "EngineUtil.h"
+#include <atomic>
+
+//-------------------------------------------------------------------------//
+// MESH CACHE
+//-------------------------------------------------------------------------//
+
+//Derived data for PLY imports: attributes, vertexData and indices exactly as readFromPly() leaves them,
+//so a repeat import is a file mapping instead of a parse. One blob per source file under MESH_CACHE_DIR.
+//Blobs are keyed by resolved path, source size and mtime (plus flipZ, which changes the data), so editing
+//or replacing a .ply makes its blob miss and get rewritten.
+#define MESH_CACHE_DIR "meshCache/"
+#define MESH_CACHE_MAGIC 0x4D534547 //"GESM" read as little-endian bytes.
+#define MESH_CACHE_VERSION 2 //Bumped whenever readFromPly() changes what it accepts or leaves, so older blobs miss.
+
+struct MeshCacheStats { atomic<int> hits, misses, writes; }; //Atomic so loads may come from any thread.
+extern MeshCacheStats gMeshCacheStats;
+
+//A mapped blob. The pointers go away with the CachedMesh.
+class CachedMesh
+{
+public:
+	vector<string> attributes;
+	const float *vertexData;
+	const int *indices;
+	int numFloats, numIndices;
+
+	CachedMesh(void) : vertexData(nullptr), indices(nullptr), numFloats(0), numIndices(0) {}
+	bool open(const string &fullName, bool flipZ); //False on a miss or a stale blob. Counts either way.
+private:
+	MappedFile file;
+};
+bool storeCachedMesh(const string &fullName, bool flipZ, const TriMesh &mesh);
+void printMeshCacheStats(void);
+
+//-------------------------------------------------------------------------//
+// TEXTURE CACHE
+//-------------------------------------------------------------------------//
+
+//One RGBAImage per (resolved path, filters, mipmapping), shared by every material, drawable and emitter that
+//names it. Holders acquire() or retain(), then release(). An entry nobody holds stays resident until purge(),
+//so the next scene takes it back without decoding. GL objects die with the window, so dropGL() runs before it
+//closes, and entries that come back re-upload from their pixels.
+class TextureCache
+{
+public:
+	TextureCache(void) : hits(0), decodes(0), uploads(0), reloads(0) {}
+	//GL thread only. Decodes on gJobs, uploads through its completions, so loadScene()'s waitAll() covers it.
+	RGBAImage* acquire(const string &fileName, GLuint magFilter = GL_LINEAR, GLuint minFilter = GL_LINEAR_MIPMAP_LINEAR, bool createMipMap = true);
+	void retain(RGBAImage *image);
+	void release(RGBAImage *image); //Null is fine.
+	void dropGL(void);
+	int reload(const string &fullName); //Redecodes every entry of that file on gJobs, refreshed in place by the completions. Returns how many.
+	int purge(void); //Frees the entries nobody holds, returns how many.
+	size_t getResidentBytes(bool onGPU) const; //Decoded pixels, or texture memory including mipmaps.
+	void print(void) const;
+private:
+	struct Entry {
+		string fullName;
+		RGBAImage *image;
+		int refs;
+		GLuint magFilter, minFilter;
+		bool createMipMap, pending; //pending until the decode job's upload has run.
+	};
+	map<string, Entry> entries; //Keyed by resolved path and sampling.
+	map<RGBAImage*, Entry*> owners; //Back from a handle to its entry.
+	int hits, decodes, uploads, reloads;
+};
+extern TextureCache gTextureCache; //Never destroyed with live textures, see main().
+
+//-------------------------------------------------------------------------//
+// PROGRAM CACHE
+//-------------------------------------------------------------------------//
+
+//Shader programs keyed by the hashes of their preprocessed vertex and fragment source, so every material naming
+//the same shaders shares one program, linked once per window. Linked programs also go to PROGRAM_CACHE_DIR via
+//glGetProgramBinary(), keyed by the driver strings too, so later runs skip compiling. A blob the driver turns
+//down (new driver, other GPU, no binary formats) just means a normal compile, after which it is rewritten.
+#define PROGRAM_CACHE_DIR "programCache/"
+#define PROGRAM_CACHE_MAGIC 0x50534547 //"GESP" read as little-endian bytes.
+#define PROGRAM_CACHE_VERSION 1
+
+class ProgramCache
+{
+public:
+	ProgramCache(void) : compiles(0), binaryHits(0), shares(0) {}
+	//GL thread only. NULL_HANDLE if it fails to build, with the errors printed. sourceFiles as in preprocessShader().
+	//instanced builds the variant of makeInstancedShader(), NULL_HANDLE without errors if the shader has none.
+	GLuint acquire(const string &vertexShaderName, const string &fragmentShaderName, vector<string> *sourceFiles = nullptr, bool instanced = false);
+	void release(GLuint shaderProgram); //Deleted with its last holder. NULL_HANDLE is fine.
+	const UniformTable& getUniforms(GLuint shaderProgram) const; //Reflected once per program. gNoUniforms if it isn't ours.
+	void dropGL(void); //Before the window closes. Forgets every program, held or not.
+	void print(void) const;
+private:
+	typedef pair<uint64_t, uint64_t> Key; //Vertex and fragment source hashes.
+	struct Entry { GLuint shaderProgram; int refs; UniformTable uniforms; };
+	map<Key, Entry> entries;
+	map<GLuint, Key> owners; //Back from a handle to its entry.
+	int compiles, binaryHits, shares;
+
+	GLuint loadBinary(const Key &key);
+	void storeBinary(const Key &key, GLuint shaderProgram);
+};
+extern ProgramCache gProgramCache; //Never destroyed with live programs, see unloadScene().
@@ -0,0 +1,356 @@
+#include "Benchmarks.h"
+#include "JobSystem.h"
+#include "ParticlePool.h"
+#include "Scripts.h"
+
+extern string ONE_TOKENS; //Scene grammar, from main.cpp.
+
+//-------------------------------------------------------------------------//
+// TOKENIZER
+//-------------------------------------------------------------------------//
+
+//Every tenth node gets a child, roughly the shape of our level files.
+static void writeBenchScene(const char *fileName, int numNodes)
+{
+	FILE *F = fopen(fileName, "w");
+	if (F == nullptr) ERROR(string("Could not write ") + fileName);
+	fprintf(F, "worldSettings windowTitle \"Tokenizer Benchmark\" {\n\twidth 800\n\theight 600\n\tspp 4\n\tbackgroundColor [0.5 0.5 0.8]\n}\n\n");
+	for (int i = 0; i < numNodes; ++i) {
+		fprintf(F, "node {\n\tname \"node%d\"\n", i);
+		fprintf(F, "\ttranslation [%f %f %f]\n\trotation [0 %f 0]\n\tscale [1 1 1]\n", (i % 100) * 1.5f, (i % 7) * -0.25f, (i / 100) * 2.0f, (i % 360) * 0.0174533f);
+		fprintf(F, "\tmaxRenderDist 100\n\tmeshInstance {\n\t\tmesh \"cube\"\n\t\tmaterial \"basic\"\n\t}\n");
+		if (i % 10 == 0) fprintf(F, "\tnode {\n\t\tname \"child%d\"\n\t\ttranslation [0 1 0]\n\t\tmaxRenderDist 50\n\t\tisUpdated 0\n\t}\n", i);
+		fprintf(F, "}\n");
+	}
+	fclose(F);
+}
+
+//Walks the scene grammar like the loaders do, minus creating objects. Instantiated once per input type,
+//so both paths run exactly the same dispatch and only the tokenizing underneath differs.
+template<class Input, class Token, class Chars> static double walkBenchScene(Input &F, const Chars &oneCharTokens, int &numNodes)
+{
+	Token token;
+	string name;
+	float v[3];
+	int ints[1];
+	double checksum = 0.0;
+	while (getToken(F, token, oneCharTokens)) {
+		if (token == "node") ++numNodes;
+		else if (token == "name" || token == "mesh" || token == "material" || token == "windowTitle") getToken(F, name, oneCharTokens);
+		else if (token == "translation" || token == "rotation" || token == "scale" || token == "backgroundColor") {
+			int n = getFloats(F, v, 3);
+			for (int i = 0; i < n; ++i) checksum += v[i];
+		}
+		else if (token == "maxRenderDist") { getFloats(F, v, 1); checksum += v[0]; }
+		else if (token == "width" || token == "height" || token == "spp" || token == "isUpdated") { getInts(F, ints, 1); checksum += ints[0]; }
+	}
+	return checksum;
+}
+
+void benchTokenizer(int numNodes)
+{
+	const char *fileName = "benchTokenizer.scene";
+	printf("Writing %d node scene to '%s'...\n", numNodes, fileName);
+	writeBenchScene(fileName, numNodes);
+
+	//Old path: getc() per byte, a string per token and sscanf per number.
+	int fileNodes = 0;
+	double start = TIME();
+	FILE *F = fopen(fileName, "rb");
+	double fileChecksum = walkBenchScene<FILE*, string>(F, ONE_TOKENS, fileNodes);
+	fclose(F);
+	double fileTime = TIME() - start;
+
+	//New path: mapped buffer, table lookups, TokenViews and in-place number parsing.
+	int tokenizerNodes = 0;
+	double tokenizerChecksum, tokenizerTime;
+	{ //Scoped so the mapping is gone before remove() below, which Windows would refuse otherwise.
+		start = TIME();
+		Tokenizer T;
+		T.open(fileName);
+		tokenizerChecksum = walkBenchScene<Tokenizer, TokenView>(T, SCENE_CHARS, tokenizerNodes);
+		tokenizerTime = TIME() - start;
+	}
+
+	printf("getToken(FILE*): %8.3f s, %d nodes\n", fileTime, fileNodes);
+	printf("Tokenizer:       %8.3f s, %d nodes\n", tokenizerTime, tokenizerNodes);
+	if (tokenizerTime > 0.0) printf("Speedup:         %8.1fx\n", fileTime / tokenizerTime);
+	if (fileNodes != tokenizerNodes || fabs(fileChecksum - tokenizerChecksum) > 1e-6 * fabs(fileChecksum))
+		ERROR("Tokenizer and getToken(FILE*) disagree on the benchmark scene!", false);
+	remove(fileName);
+}
+
+//-------------------------------------------------------------------------//
+// PLY LOADING
+//-------------------------------------------------------------------------//
+
+//A res x res grid with every attribute our exporters write, so the binary file has uchar colors to convert.
+static void makeBenchGrid(TriMesh &mesh, int res)
+{
+	const char *names[] = { "x", "y", "z", "nx", "ny", "nz", "s", "t", "red", "green", "blue" };
+	mesh.attributes.assign(names, names + 11);
+	for (int j = 0; j <= res; ++j) {
+		for (int i = 0; i <= res; ++i) {
+			float s = (float)i / res, t = (float)j / res;
+			float v[] = { s * 10.0f, sinf(s * 6.0f) * cosf(t * 6.0f), t * 10.0f, 0.0f, 1.0f, 0.0f, s, t,
+				(float)(i % 256) / 255.0f, (float)(j % 256) / 255.0f, (float)((i + j) % 256) / 255.0f };
+			mesh.vertexData.insert(mesh.vertexData.end(), v, v + 11);
+		}
+	}
+	for (int j = 0; j < res; ++j) {
+		for (int i = 0; i < res; ++i) {
+			int a = j*(res + 1) + i, b = a + 1, c = a + res + 1, d = c + 1;
+			int tris[] = { a, c, b, b, c, d };
+			mesh.indices.insert(mesh.indices.end(), tris, tris + 6);
+		}
+	}
+}
+static double timePlyLoads(const string &fileName, int reps, TriMesh &result)
+{
+	double start = TIME();
+	for (int i = 0; i < reps; ++i) {
+		TriMesh mesh;
+		if (!mesh.readFromPly(fileName)) ERROR("Could not read " + fileName);
+		if (i == reps - 1) { //Keep the last load for the comparison.
+			swap(mesh.attributes, result.attributes);
+			swap(mesh.vertexData, result.vertexData);
+			swap(mesh.indices, result.indices);
+		}
+	}
+	return (TIME() - start) / reps;
+}
+static long fileSize(const string &fileName)
+{
+	FILE *F = fopen(fileName.c_str(), "rb");
+	if (F == nullptr) return 0;
+	fseek(F, 0, SEEK_END);
+	long size = ftell(F);
+	fclose(F);
+	return size;
+}
+
+void benchPly(const vector<string> &fileNames, int reps)
+{
+	vector<string> sources = fileNames;
+	if (sources.empty()) {
+		TriMesh grid;
+		makeBenchGrid(grid, 400);
+		grid.writeToPly("benchPlyGrid.ply", false);
+		sources.push_back("benchPlyGrid.ply");
+	}
+	for (size_t k = 0; k < sources.size(); ++k) {
+		//Rewrite each mesh both ways, so the two timings are over the same data.
+		TriMesh source;
+		if (!source.readFromPly(sources[k])) { ERROR("Could not read " + sources[k], false); continue; }
+		string asciiName = "benchPly.ascii.ply", binaryName = "benchPly.binary.ply";
+		source.writeToPly(asciiName, false);
+		source.writeToPly(binaryName, true);
+
+		TriMesh ascii, binary;
+		double asciiTime = timePlyLoads(asciiName, reps, ascii);
+		double binaryTime = timePlyLoads(binaryName, reps, binary);
+
+		printf("%s: %d vertices, %d triangles, %d attributes\n", sources[k].c_str(),
+			(int)(source.vertexData.size() / source.attributes.size()), (int)source.indices.size() / 3, (int)source.attributes.size());
+		printf("  ascii:  %8.2f ms per load, %9ld bytes\n", asciiTime * 1000.0, fileSize(asciiName));
+		printf("  binary: %8.2f ms per load, %9ld bytes\n", binaryTime * 1000.0, fileSize(binaryName));
+		if (binaryTime > 0.0) printf("  speedup: %7.1fx\n", asciiTime / binaryTime);
+
+		bool same = ascii.attributes == binary.attributes && ascii.indices == binary.indices && ascii.vertexData.size() == binary.vertexData.size();
+		for (size_t i = 0; same && i < ascii.vertexData.size(); ++i) same = fabs(ascii.vertexData[i] - binary.vertexData[i]) <= 1e-6f * (1.0f + fabs(ascii.vertexData[i]));
+		if (!same) ERROR("ASCII and binary loads of " + sources[k] + " disagree!", false);
+		remove(asciiName.c_str());
+		remove(binaryName.c_str());
+	}
+	if (fileNames.empty()) remove(sources[0].c_str());
+}
+
+//-------------------------------------------------------------------------//
+// ASSET LOADING
+//-------------------------------------------------------------------------//
+
+//The worker half of loadScene() (PLY parsing, PNG decoding and flipY) over generated assets, at each
+//worker count up to one per core. Uploads need a context, so this stops where the completions would start.
+void benchLoading(int numAssets)
+{
+	vector<string> meshNames, imageNames;
+	TriMesh grid;
+	makeBenchGrid(grid, 150);
+	RGBAImage image;
+	image.width = image.height = 512;
+	image.pixels.resize(image.width * image.height * 4);
+	for (size_t i = 0; i < image.pixels.size(); ++i) image.pixels[i] = (unsigned char)((i * 7) ^ (i >> 9)); //Noisy enough not to compress away.
+	for (int i = 0; i < numAssets; ++i) {
+		char name[64];
+		sprintf(name, "benchLoad%d.ply", i);
+		meshNames.push_back(name);
+		grid.writeToPly(name, false);
+		sprintf(name, "benchLoad%d.png", i);
+		imageNames.push_back(name);
+		image.writeToPNG(name);
+	}
+	printf("%d ASCII meshes of %d vertices, %d 512x512 PNGs\n", numAssets, (int)(grid.vertexData.size() / grid.attributes.size()), numAssets);
+
+	int numCores = max((int)thread::hardware_concurrency(), 1);
+	vector<int> workerCounts(1, 0);
+	for (int n = 1; n < numCores; n *= 2) workerCounts.push_back(n);
+	workerCounts.push_back(numCores);
+	double serialTime = 0.0;
+	for (int w = 0; w < (int)workerCounts.size(); ++w) {
+		int numWorkers = workerCounts[w];
+		vector<TriMesh*> meshes(numAssets);
+		vector<RGBAImage*> images(numAssets);
+		gJobs.start(numWorkers);
+		double start = PRECISE_TIME(); //Wall time. TIME() is CPU time summed over every thread on POSIX, so it hides any speedup.
+		for (int i = 0; i < numAssets; ++i) {
+			TriMesh *mesh = meshes[i] = new TriMesh();
+			RGBAImage *img = images[i] = new RGBAImage();
+			string meshName = meshNames[i], imageName = imageNames[i];
+			gJobs.submit([=]() { mesh->readFromPly(meshName); });
+			gJobs.submit([=]() { img->decodePNG(imageName); });
+		}
+		gJobs.waitAll();
+		double time = PRECISE_TIME() - start;
+		if (numWorkers == 0) serialTime = time;
+		printf("%2d workers: %8.3f s, %5.2fx\n", numWorkers, time, serialTime / time);
+		for (int i = 0; i < numAssets; ++i) {
+			if (meshes[i]->indices.size() != grid.indices.size() || images[i]->width != image.width) ERROR("Bad load in the loading benchmark!", false);
+			delete meshes[i];
+			delete images[i];
+		}
+	}
+	gJobs.stop();
+
+	for (int i = 0; i < numAssets; ++i) {
+		remove(meshNames[i].c_str());
+		remove(imageNames[i].c_str());
+	}
+}
+
+//-------------------------------------------------------------------------//
+// PARTICLES
+//-------------------------------------------------------------------------//
+
+static bool isSameFloats(const vector<float> &a, const vector<float> &b)
+{
+	return a.size() == b.size() && (a.empty() || memcmp(&a[0], &b[0], a.size() * sizeof(float)) == 0);
+}
+static bool isSamePool(const ParticlePool &a, const ParticlePool &b)
+{
+	return a.getNumAlive() == b.getNumAlive() && a.aliveMask == b.aliveMask
+		&& isSameFloats(a.positionX, b.positionX) && isSameFloats(a.positionY, b.positionY) && isSameFloats(a.positionZ, b.positionZ)
+		&& isSameFloats(a.velocityX, b.velocityX) && isSameFloats(a.velocityY, b.velocityY) && isSameFloats(a.velocityZ, b.velocityZ)
+		&& isSameFloats(a.timeToLive, b.timeToLive);
+}
+
+//Integration only, so every kernel steps the same particles. About half run out of lifetime during the steps, so
+//the masks see both states. An odd count leaves a scalar tail behind the vectors.
+void benchParticles(int numParticles, int numSteps)
+{
+	numParticles = max(numParticles, 1) | 1;
+	ParticlePool start;
+	start.setCapacity(numParticles);
+	unsigned int seed = 12345;
+	for (int i = 0; i < numParticles; ++i) {
+		float r[7];
+		for (int k = 0; k < 7; ++k) {
+			seed = seed * 1664525u + 1013904223u;
+			r[k] = (float)(seed >> 8) / (float)(1 << 24);
+		}
+		int p = start.spawn();
+		start.positionX[p] = r[0] * 100.0f - 50.0f;
+		start.positionY[p] = r[1] * 100.0f - 50.0f;
+		start.positionZ[p] = r[2] * 100.0f - 50.0f;
+		start.velocityX[p] = r[3] * 10.0f - 5.0f;
+		start.velocityY[p] = r[4] * 10.0f;
+		start.velocityZ[p] = r[5] * 10.0f - 5.0f;
+		start.timeToLive[p] = r[6] * 2 * numSteps * (float)FIXED_DT; //About half outlive the run.
+	}
+	ParticleStep step = { (float)FIXED_DT, glm::vec3(0, -9.8f, 0), 0.5f };
+	printf("%d particles, %d steps, %d bytes each, best kernel %s\n", numParticles, numSteps, ParticlePool::getBytesPerParticle(), PARTICLE_KERNEL_NAMES[gParticleKernel]);
+
+	ParticlePool scalar;
+	double scalarTime = 0.0;
+	for (int k = PK_SCALAR; k <= gParticleKernel; ++k) {
+		ParticlePool pool = start;
+		double begin = TIME();
+		for (int s = 0; s < numSteps; ++s) pool.integrate(step, (PARTICLE_KERNEL)k);
+		double time = TIME() - begin;
+		if (k == PK_SCALAR) {
+			scalar = pool;
+			scalarTime = time;
+		}
+		double updatesPerMs = (time > 0.0) ? (double)numParticles * numSteps / (time * 1000.0) : 0.0;
+		printf("  %-6s %8.3f ms per step, %8.2fM updates per ms, %5.2fx\n", PARTICLE_KERNEL_NAMES[k], time * 1000.0 / numSteps, updatesPerMs / 1e6, (time > 0.0) ? scalarTime / time : 0.0);
+		if (!isSamePool(pool, scalar)) ERROR(string("The ") + PARTICLE_KERNEL_NAMES[k] + " particle kernel disagrees with the scalar one!", false);
+	}
+
+	double begin = TIME();
+	int numKilled = scalar.removeDead();
+	printf("  removeDead: %8.3f ms, %d of %d particles\n", (TIME() - begin) * 1000.0, numKilled, numParticles);
+	for (int i = 0; i < scalar.getNumAlive(); ++i)
+		if (!(scalar.timeToLive[i] > 0.0f)) { ERROR("removeDead() kept a dead particle!", false); break; }
+}
+
+//Emitters on their own nodes in a grid, seeded by index, so every worker count steps the same particles and has to
+//end with the same ones. Each run fills the pools untimed first, as a scene would be a while into play.
+void benchEmitters(int numEmitters, int particlesPerEmitter, int numSteps)
+{
+	int numCores = max((int)thread::hardware_concurrency(), 1);
+	vector<int> workerCounts(1, 0);
+	for (int n = 1; n < numCores; n *= 2) workerCounts.push_back(n);
+	workerCounts.push_back(numCores);
+	printf("%d emitters of %d particles, %d steps, %s kernel\n", numEmitters, particlesPerEmitter, numSteps, PARTICLE_KERNEL_NAMES[gParticleKernel]);
+
+	Camera camera;
+	char value[64];
+	vector<ParticleVertex> expected, result;
+	int particleBudget = gParticleRenderer.particleBudget;
+	double timeBudget = gParticleRenderer.timeBudget;
+	gParticleRenderer.particleBudget = 0; //A time budget would change what's stepped with the worker count.
+	gParticleRenderer.timeBudget = 0.0;
+	double serialTime = 0.0;
+	for (int w = 0; w < (int)workerCounts.size(); ++w) {
+		vector<SceneGraphNode*> nodes(numEmitters);
+		vector<EmitterScript*> emitters(numEmitters);
+		for (int i = 0; i < numEmitters; ++i) {
+			SceneGraphNode *node = nodes[i] = new SceneGraphNode();
+			node->T.translation = glm::vec3((i % 16) * 4.0f, 0.0f, (i / 16) * 4.0f);
+			EmitterScript *e = emitters[i] = new EmitterScript(node);
+			node->scripts.push_back(e);
+			sprintf(value, "%d", particlesPerEmitter);
+			e->setProperty("particleMax", value);
+			sprintf(value, "%f", 1.0f / particlesPerEmitter); //A lifetime's worth of spawns fills the pool.
+			e->setProperty("emitRate", value);
+			sprintf(value, "%d", i);
+			e->setProperty("seed", value);
+			e->setProperty("timeToLive", "1.0");
+			e->setProperty("avgVelocity", "[0,4,0]");
+			e->setProperty("velocitySpread", "[1,1,1]");
+			e->setProperty("gravity", "[0,-9.8,0]");
+			e->setProperty("drag", "0.1");
+		}
+
+		gJobs.start(workerCounts[w]);
+		int numWarmup = (int)(1.0 / FIXED_DT) + 1;
+		double start = 0.0;
+		for (int s = 0; s < numWarmup + numSteps; ++s) {
+			if (s == numWarmup) start = PRECISE_TIME(); //Wall time, as TIME() sums CPU time over the workers on POSIX.
+			for (int i = 0; i < numEmitters; ++i) emitters[i]->update(camera, FIXED_DT);
+			gParticleRenderer.simulate(camera);
+		}
+		double time = PRECISE_TIME() - start;
+		if (workerCounts[w] == 0) serialTime = time;
+
+		result.clear();
+		for (int i = 0; i < numEmitters; ++i) emitters[i]->writeParticles(result, 1.0f);
+		printf("%2d workers: %8.3f ms per step, %d particles, %5.2fx\n", workerCounts[w], time * 1000.0 / numSteps, (int)result.size(), (time > 0.0) ? serialTime / time : 0.0);
+		if (w == 0) expected = result;
+		else if (result.size() != expected.size() || (!result.empty() && memcmp(&result[0], &expected[0], result.size() * sizeof(ParticleVertex)) != 0))
+			ERROR("Emitters stepped on workers disagree with the serial run!", false);
+		for (int i = 0; i < numEmitters; ++i) delete nodes[i]; //And their emitters.
+	}
+	gJobs.stop();
+	gParticleRenderer.particleBudget = particleBudget;
+	gParticleRenderer.timeBudget = timeBudget;
+}
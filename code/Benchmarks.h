@@ -0,0 +1,13 @@
+#pragma once
+#include "EngineUtil.h"
+
+//-------------------------------------------------------------------------//
+// BENCHMARKS
+//-------------------------------------------------------------------------//
+
+//Command-line benchmarks, see main(). Each needs no window and prints its own timings.
+void benchTokenizer(int numNodes = 100000); //Times getToken(FILE*) against the Tokenizer on a generated scene.
+void benchPly(const vector<string> &fileNames, int reps = 10); //Loads each mesh (or a generated grid) as ASCII and as binary PLY.
+void benchLoading(int numAssets = 32); //Times the loader jobs with 0 (inline) up to one worker per core.
+void benchParticles(int numParticles = 1000000, int numSteps = 100); //Each integration kernel against the scalar one, which they must match bit for bit.
+void benchEmitters(int numEmitters = 256, int particlesPerEmitter = 4000, int numSteps = 100); //Steps a synthetic scene of emitters on 0 up to one worker per core.
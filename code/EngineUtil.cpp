@@ -1,5 +1,26 @@
 // Local includes
 #include "EngineUtil.h"
+#include "AssetCache.h"
+#include "FileWatcher.h"
+#include "GLState.h"
+#include "Octree.h"
+#include <mutex>
+#include <set>
+#include <algorithm>
+
+// Platform includes for file mapping and directory listing. NOGDI keeps wingdi.h from defining ERROR over ours.
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#define NOGDI
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
 
 //-------------------------------------------------------------------------//
 // MISCELLANEOUS
@@ -19,10 +40,31 @@ double TIME(void)
 {
 	return (double)clock() / (double)CLOCKS_PER_SEC;
 }
+double PRECISE_TIME(void)
+{
+#ifdef _WIN32
+	static LARGE_INTEGER frequency = { 0 };
+	if (frequency.QuadPart == 0) QueryPerformanceFrequency(&frequency);
+	LARGE_INTEGER now;
+	QueryPerformanceCounter(&now);
+	return (double)now.QuadPart / (double)frequency.QuadPart;
+#else
+	return chrono::duration<double>(chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+}
 void SLEEP(int millis)
 {
 	this_thread::sleep_for(chrono::milliseconds(millis));
 }
+uint64_t hashBytes(const void *data, size_t size, uint64_t hash)
+{
+	const unsigned char *bytes = (const unsigned char*)data;
+	for (size_t i = 0; i < size; ++i) {
+		hash ^= bytes[i];
+		hash *= 1099511628211ULL;
+	}
+	return hash;
+}
 
 //-------------------------------------------------------------------------//
 // OPENGL STUFF
@@ -45,6 +87,7 @@ GLFWwindow* createOpenGLWindow(int width, int height, const char *title, int sam
 		ERROR("Failed to open GLFW window.", true);
 	}
 	glfwMakeContextCurrent(window);
+	gGLState.reset(); //Nothing is bound in a new context, whatever the last one had.
 
 	// Ensure we can capture the escape key being pressed
 	glfwSetInputMode(window, GLFW_STICKY_KEYS, GL_FALSE);
@@ -55,6 +98,7 @@ GLFWwindow* createOpenGLWindow(int width, int height, const char *title, int sam
 		glfwTerminate();
 		ERROR("Failed to initialize GLEW.", true);
 	}
+	useDriverGL();
 
 	glEnable(GL_DEPTH_TEST);
 	//glDepthFunc(GL_LESS);
@@ -66,19 +110,102 @@ GLFWwindow* createOpenGLWindow(int width, int height, const char *title, int sam
 	printf("OpenGL Version: %s\n", GL_version);
 	return window;
 }
-GLuint loadShader(const string &fileName, GLuint shaderType)
+static bool isIdentifierChar(char c) { return isalnum((unsigned char)c) || c == '_'; }
+static size_t skipSpaceBack(const string &code, size_t end) { while (end > 0 && isspace((unsigned char)code[end - 1])) --end; return end; }
+static bool endsWithWord(const string &code, size_t end, const char *word) //The word right before end, as a whole token.
+{
+	size_t length = strlen(word);
+	if (end < length || code.compare(end - length, length, word) != 0) return false;
+	return end == length || !isIdentifierChar(code[end - length - 1]);
+}
+static bool removeUniformDeclaration(string &code, const char *type, const char *name) //Only the plain "uniform type name;" form.
+{
+	bool removed = false;
+	size_t length = strlen(name);
+	for (size_t i = code.find(name); i != string::npos; i = code.find(name, i + 1)) {
+		if ((i > 0 && isIdentifierChar(code[i - 1])) || (i + length < code.size() && isIdentifierChar(code[i + length]))) continue;
+		size_t typeEnd = skipSpaceBack(code, i);
+		if (typeEnd == i || !endsWithWord(code, typeEnd, type)) continue;
+		size_t uniformEnd = skipSpaceBack(code, typeEnd - strlen(type));
+		if (!endsWithWord(code, uniformEnd, "uniform")) continue;
+		size_t semicolon = code.find_first_not_of(" \t\r\n", i + length);
+		if (semicolon == string::npos || code[semicolon] != ';') continue;
+		size_t start = uniformEnd - strlen("uniform");
+		code.erase(start, semicolon + 1 - start);
+		i = start;
+		removed = true;
+	}
+	return removed;
+}
+static void insertAfterVersion(string &code, const string &text) //#version has to stay the first line.
+{
+	size_t start = code.find("#version");
+	if (start != string::npos) {
+		start = code.find('\n', start);
+		if (start == string::npos) code += '\n';
+		start = (start == string::npos) ? code.size() : start + 1;
+	}
+	else start = 0;
+	code.insert(start, text);
+}
+static void useCameraBlock(string &shaderCode)
+{
+	//The camera uniforms turn into the ubCamera block under their old names, so shaders need no edits to share
+	//gCameraUBO. uObjectPerpsectM is multiplied out here instead of per object on the CPU.
+	string defines;
+	if (removeUniformDeclaration(shaderCode, "mat4", "uObjectPerpsectM")) {
+		removeUniformDeclaration(shaderCode, "mat4", "uObjectWorldM"); //Declared below instead, as the define needs it.
+		defines += "uniform mat4 uObjectWorldM;\n#define uObjectPerpsectM (uViewProjectM * uObjectWorldM)\n";
+	}
+	const char *names[2][2] = { { "uViewPosition", "uEyePosition" }, { "uViewDirection", "uEyeDirection" } };
+	for (int i = 0; i < 2; ++i) {
+		if (removeUniformDeclaration(shaderCode, "vec4", names[i][0])) defines += string("#define ") + names[i][0] + " " + names[i][1] + "\n";
+		else if (removeUniformDeclaration(shaderCode, "vec3", names[i][0])) defines += string("#define ") + names[i][0] + " " + names[i][1] + ".xyz\n";
+	}
+	if (defines.empty()) return; //Nothing from the camera, so no block to bind either.
+	insertAfterVersion(shaderCode, string(CAMERA_BLOCK_GLSL) + defines);
+}
+bool makeInstancedShader(string &vertexShaderCode)
+{
+	//The per-object matrices become per-instance attributes under their old names. Shaders that want to tell the
+	//variants apart can test INSTANCED.
+	bool hasWorld = removeUniformDeclaration(vertexShaderCode, "mat4", "uObjectWorldM");
+	bool hasInverse = removeUniformDeclaration(vertexShaderCode, "mat4", "uObjectWorldInverseM");
+	if (!hasWorld && !hasInverse) return false; //Every instance would land in the same place.
+
+	insertAfterVersion(vertexShaderCode,
+		"#define INSTANCED 1\n"
+		"in mat4 iObjectWorldM;\n"
+		"in mat4 iObjectWorldInverseM;\n"
+		"#define uObjectWorldM iObjectWorldM\n"
+		"#define uObjectWorldInverseM iObjectWorldInverseM\n");
+	return true;
+}
+bool preprocessShader(const string &fileName, string &shaderCode, vector<string> *sourceFiles)
 {
 	// load the shader as a file
 	string mainCode;
 	if (!loadFileAsString(fileName, mainCode)) {
 		ERROR("Could not load file '" + fileName + "'", false);
-		return NULL_HANDLE;
+		return false;
 	}
 
-	string shaderCode;
+	shaderCode = "";
 	string alreadyIncluded = fileName;
 	replaceIncludes(mainCode, shaderCode, "#include", alreadyIncluded, true);
 
+	//alreadyIncluded is now every file the code came from, separated by '|'. Edits to any of them recompile it.
+	for (size_t start = 0; start <= alreadyIncluded.size();) {
+		size_t end = alreadyIncluded.find('|', start);
+		if (end == string::npos) end = alreadyIncluded.size();
+		string fullName;
+		if (getFullFileName(alreadyIncluded.substr(start, end - start), fullName)) {
+			gFileWatcher.watch(fullName);
+			if (sourceFiles != nullptr) sourceFiles->push_back(fullName);
+		}
+		start = end + 1;
+	}
+	useCameraBlock(shaderCode);
 
 	// print the shader code
 #ifdef PRINT_GLSL
@@ -86,7 +213,10 @@ GLuint loadShader(const string &fileName, GLuint shaderType)
 	cout << shaderCode << endl;
 	cout << "--------------------------------------------------------------\n";
 #endif
-
+	return true;
+}
+GLuint compileShader(const string &shaderCode, GLuint shaderType, const string &fileName)
+{
 	// transfer shader code to card and compile
 	GLuint shaderHandle = glCreateShader(shaderType); // create handle for the shader
 	const char* source = shaderCode.c_str();          // get C style string for shader code
@@ -101,7 +231,7 @@ GLuint loadShader(const string &fileName, GLuint shaderType)
 		ERROR("compiling shader '" + fileName + "'", false);
 		GLint msgLength = 0;
 		glGetShaderiv(shaderHandle, GL_INFO_LOG_LENGTH, &msgLength);
-		std::vector<char> msg(msgLength);
+		std::vector<char> msg(msgLength + 1);
 		glGetShaderInfoLog(shaderHandle, msgLength, &msgLength, &msg[0]);
 		printf("%s\n", &msg[0]);
 		glDeleteShader(shaderHandle);
@@ -110,7 +240,13 @@ GLuint loadShader(const string &fileName, GLuint shaderType)
 
 	return shaderHandle;
 }
-GLuint createShaderProgram(GLuint vertexShader, GLuint fragmentShader)
+GLuint loadShader(const string &fileName, GLuint shaderType, vector<string> *sourceFiles)
+{
+	string shaderCode;
+	if (!preprocessShader(fileName, shaderCode, sourceFiles)) return NULL_HANDLE;
+	return compileShader(shaderCode, shaderType, fileName);
+}
+GLuint createShaderProgram(GLuint vertexShader, GLuint fragmentShader, bool retrievable)
 {
 	// Create and link the shader program
 	GLuint shaderProgram = glCreateProgram(); // create handle
@@ -120,6 +256,9 @@ GLuint createShaderProgram(GLuint vertexShader, GLuint fragmentShader)
 	}
 	glAttachShader(shaderProgram, vertexShader);    // attach vertex shader
 	glAttachShader(shaderProgram, fragmentShader);  // attach fragment shader
+	if (retrievable && GLEW_ARB_get_program_binary) glProgramParameteri(shaderProgram, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+	glBindAttribLocation(shaderProgram, V_INSTANCE_WORLD_M, "iObjectWorldM"); //Only instanced variants have these.
+	glBindAttribLocation(shaderProgram, V_INSTANCE_WORLD_INVERSE_M, "iObjectWorldInverseM");
 	glLinkProgram(shaderProgram);
 
 	// check to see if the linking was successful
@@ -128,20 +267,71 @@ GLuint createShaderProgram(GLuint vertexShader, GLuint fragmentShader)
 	if (!linked) {
 		ERROR("could not link the shader program", false);
 		GLint msgLength = 0;
-		glGetShaderiv(shaderProgram, GL_INFO_LOG_LENGTH, &msgLength);
-		std::vector<char> msg(msgLength);
-		glGetShaderInfoLog(shaderProgram, msgLength, &msgLength, &msg[0]);
+		glGetProgramiv(shaderProgram, GL_INFO_LOG_LENGTH, &msgLength);
+		std::vector<char> msg(msgLength + 1);
+		glGetProgramInfoLog(shaderProgram, msgLength, &msgLength, &msg[0]);
 		printf("%s\n", &msg[0]);
 		glDeleteProgram(shaderProgram);
 		return NULL_HANDLE;
 	}
 
+	bindUniformBlocks(shaderProgram);
+	return shaderProgram;
+}
+void bindUniformBlocks(GLuint shaderProgram)
+{
 	//Attach UBO to uniform block in GLSL via the same binding point.
 	GLint locLightUB = glGetUniformBlockIndex(shaderProgram, "ubGlobalLights");
 	glUniformBlockBinding(shaderProgram, locLightUB, 1); //Associates UB to binding point 1.
 	glBindBufferBase(GL_UNIFORM_BUFFER, 1, gLightsUBO); //Associates UBO to binding point 1. 
 
-	return shaderProgram;
+	GLuint cameraBlock = glGetUniformBlockIndex(shaderProgram, "ubCamera"); //Only where useCameraBlock() added it.
+	if (cameraBlock != GL_INVALID_INDEX) glUniformBlockBinding(shaderProgram, cameraBlock, CAMERA_UBO_BINDING);
+	glBindBufferBase(GL_UNIFORM_BUFFER, CAMERA_UBO_BINDING, gCameraUBO);
+}
+
+int gUniformLookups = 0;
+const UniformTable gNoUniforms;
+static const char *UNIFORM_SLOT_NAMES[NUM_UNIFORM_SLOTS] = {
+	"uObjectWorldM", "uObjectWorldInverseM", "uObjectPerpsectM", "uViewDirection", "uViewPosition",
+	"uDiffuseTex", "uSpriteFrame"
+};
+static bool isUniformNameLess(const UniformTable::Uniform &u, const string &name) { return u.name < name; }
+static const UniformTable::Uniform* findUniform(const vector<UniformTable::Uniform> &uniforms, const string &name)
+{
+	auto it = lower_bound(uniforms.begin(), uniforms.end(), name, isUniformNameLess);
+	return (it != uniforms.end() && it->name == name) ? &*it : nullptr;
+}
+void UniformTable::reflect(GLuint shaderProgram)
+{
+	uniforms.clear();
+	for (int s = 0; s < NUM_UNIFORM_SLOTS; ++s) slots[s] = -1;
+	if (shaderProgram == NULL_HANDLE) return;
+
+	GLint numUniforms = 0, maxLength = 0;
+	glGetProgramiv(shaderProgram, GL_ACTIVE_UNIFORMS, &numUniforms);
+	glGetProgramiv(shaderProgram, GL_ACTIVE_UNIFORM_MAX_LENGTH, &maxLength);
+	vector<char> name(maxLength + 1);
+	for (GLint i = 0; i < numUniforms; ++i) {
+		Uniform u;
+		GLsizei length = 0;
+		glGetActiveUniform(shaderProgram, i, (GLsizei)name.size(), &length, &u.size, &u.type, &name[0]);
+		u.name.assign(&name[0], length);
+		if (u.name.size() > 3 && u.name.compare(u.name.size() - 3, 3, "[0]") == 0) u.name.resize(u.name.size() - 3);
+		u.location = glGetUniformLocation(shaderProgram, u.name.c_str());
+		if (u.location != -1) uniforms.push_back(u); //-1 are uniform block members, set through their buffer.
+	}
+	sort(uniforms.begin(), uniforms.end(), [](const Uniform &a, const Uniform &b) { return a.name < b.name; });
+
+	for (int s = 0; s < NUM_UNIFORM_SLOTS; ++s) {
+		const Uniform *u = findUniform(uniforms, UNIFORM_SLOT_NAMES[s]);
+		if (u != nullptr) slots[s] = u->location;
+	}
+}
+const UniformTable::Uniform* UniformTable::find(const string &name) const
+{
+	++gUniformLookups;
+	return findUniform(uniforms, name);
 }
 
 //-------------------------------------------------------------------------//
@@ -165,19 +355,121 @@ void printMat(const glm::mat4x4 &m)
 //-------------------------------------------------------------------------//
 
 vector<string> PATH;
+static mutex PATH_LOCK; //Loader jobs resolve names on workers while libraries keep adding to PATH.
+
+//Lookups are answered from directory listings instead of an fopen() per PATH entry. A PATH entry is listed when
+//added, and any folder a name reaches into (e.g. "textures/brick.png") on its first lookup, so resolving is a
+//few set finds and one check that the hit is still there. A hit that was deleted since is dropped from its listing
+//and the search goes on down PATH. A name no listing has is probed the old way, which covers files written after
+//their listing.
+static map<string, set<string> > PATH_INDEX; //Directory, spelled as PATH entry plus the name's folders, to its files.
+
+static string getIndexKey(const string &name)
+{
+#ifdef _WIN32
+	string key(name); //The file system ignores case, so the index does too.
+	for (size_t i = 0; i < key.size(); ++i) key[i] = (char)tolower((unsigned char)key[i]);
+	return key;
+#else
+	return name;
+#endif
+}
+static void splitPath(const string &fullName, string &dir, string &name)
+{
+	size_t separatorIndex = fullName.find_last_of("/\\");
+	dir = (separatorIndex == string::npos) ? "" : fullName.substr(0, separatorIndex + 1);
+	name = fullName.substr(dir.size());
+}
+static void listDirectory(const string &dir, set<string> &names)
+{
+#ifdef _WIN32
+	WIN32_FIND_DATAA entry;
+	HANDLE find = FindFirstFileA((dir.empty() ? string("*") : dir + "*").c_str(), &entry);
+	if (find == INVALID_HANDLE_VALUE) return;
+	do {
+		if ((entry.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) == 0) names.insert(getIndexKey(entry.cFileName));
+	} while (FindNextFileA(find, &entry));
+	FindClose(find);
+#else
+	DIR *d = opendir(dir.empty() ? "." : dir.c_str());
+	if (d == NULL) return;
+	for (dirent *entry = readdir(d); entry != NULL; entry = readdir(d))
+		if (entry->d_type != DT_DIR) names.insert(entry->d_name); //DT_UNKNOWN too, a stray folder name only costs a failed open.
+	closedir(d);
+#endif
+}
+static const set<string>& getListing(const string &dir) //With PATH_LOCK held.
+{
+	auto it = PATH_INDEX.find(dir);
+	if (it != PATH_INDEX.end()) return it->second;
+	set<string> &names = PATH_INDEX[dir];
+	listDirectory(dir, names);
+	return names;
+}
+static void dropListings(const string &p) //p and every folder below it, relisted on their next lookup.
+{
+	for (auto it = PATH_INDEX.begin(); it != PATH_INDEX.end();) {
+		if (it->first == p || (!p.empty() && it->first.compare(0, p.size(), p) == 0)) it = PATH_INDEX.erase(it);
+		else ++it;
+	}
+}
+static bool isIndexed(const string &fullName)
+{
+	string dir, name;
+	splitPath(fullName, dir, name);
+	return getListing(dir).count(getIndexKey(name)) != 0;
+}
+static void forgetIndexed(const string &fullName)
+{
+	string dir, name;
+	splitPath(fullName, dir, name);
+	PATH_INDEX[dir].erase(getIndexKey(name));
+}
+static bool isFile(const string &fullName) //One attribute lookup, cheaper than the fopen() it stands in for.
+{
+#ifdef _WIN32
+	DWORD attributes = GetFileAttributesA(fullName.c_str());
+	return attributes != INVALID_FILE_ATTRIBUTES && (attributes & FILE_ATTRIBUTE_DIRECTORY) == 0;
+#else
+	struct stat info;
+	return stat(fullName.c_str(), &info) == 0 && !S_ISDIR(info.st_mode);
+#endif
+}
+
 const vector<string>& getPATH() { return PATH; }
 void addToPath(const string &p)
 {
-	PATH.push_back(p);
+	lock_guard<mutex> guard(PATH_LOCK);
+	dropListings(p); //Adding a path again refreshes it.
+	if (find(PATH.begin(), PATH.end(), p) == PATH.end()) PATH.push_back(p); //A repeat could never win a lookup.
+	getListing(p);
 }
 void removeFromPath(const string &p)
 {
-	for (int i = (int)p.length() - 1; i >= 0; i--) {
+	lock_guard<mutex> guard(PATH_LOCK);
+	for (int i = (int)PATH.size() - 1; i >= 0; i--) {
 		if (PATH[i] == p) PATH.erase(PATH.begin() + i);
 	}
+	dropListings(p);
+}
+void addFileDirectoryToPath(const string &fileName)
+{
+	int separatorIndex = fileName.find_last_of("/");
+	if (separatorIndex < 0) separatorIndex = fileName.find_last_of("\\");
+	if (separatorIndex > 0) addToPath(fileName.substr(0, separatorIndex + 1));
 }
 bool getFullFileName(const string &fileName, string &fullName)
 {
+	lock_guard<mutex> guard(PATH_LOCK);
+	for (int i = -1; i < (int)PATH.size(); i++) {
+		if (i < 0) fullName = fileName;
+		else fullName = PATH[i] + fileName;
+		if (!isIndexed(fullName)) continue;
+		if (isFile(fullName)) return true;
+		forgetIndexed(fullName); //Deleted since it was listed, a later PATH entry may still have it.
+	}
+
+	//Maybe written since its folder was listed, so probe and remember where it turned up.
 	for (int i = -1; i < (int)PATH.size(); i++) {
 		if (i < 0) fullName = fileName;
 		else fullName = PATH[i] + fileName;
@@ -185,6 +477,9 @@ bool getFullFileName(const string &fileName, string &fullName)
 		FILE *f = fopen(fullName.c_str(), "rb");
 		if (f != NULL) {
 			fclose(f);
+			string dir, name;
+			splitPath(fullName, dir, name);
+			PATH_INDEX[dir].insert(getIndexKey(name));
 			return true;
 		}
 	}
@@ -282,6 +577,147 @@ int getInts(FILE *f, int *a, int num)
 	}
 	return count;
 }
+CharClasses::CharClasses(const string &oneCharTokens)
+{
+	//Same precedence as getToken(FILE*): spaces first, then oneCharTokens, then quotes.
+	for (int c = 0; c < 256; ++c) {
+		if (isspace(c)) table[c] = SPACE;
+		else if (oneCharTokens.find((char)c) != string::npos) table[c] = ONE_CHAR;
+		else if (c == '\"' || c == '\'') table[c] = QUOTE;
+		else table[c] = NORMAL;
+	}
+}
+const CharClasses LIST_CHARS("[],");
+const CharClasses PLAIN_CHARS("");
+bool Tokenizer::open(const string &fileName)
+{
+	string fullName;
+	if (getFullFileName(fileName, fullName) && file.open(fullName)) {
+		cout << "Opening file '" << fileName << "'" << endl;
+		attach(file.data, file.size);
+		return true;
+	}
+	cur = end = nullptr;
+	ERROR("Could not open file " + fileName, false);
+	return false;
+}
+bool getToken(Tokenizer &t, TokenView &token, const CharClasses &oneCharTokens)
+{
+	const unsigned char *table = oneCharTokens.table;
+	const char *p = t.cur;
+	while (p < t.end && table[(unsigned char)*p] == CharClasses::SPACE) ++p; // spaces before token, ignore
+	token.ptr = p;
+	token.len = 0;
+	if (p >= t.end) { // end of file, done
+		t.cur = p;
+		return false;
+	}
+
+	switch (table[(unsigned char)*p]) {
+	case CharClasses::ONE_CHAR: // oneCharToken, done
+		token.len = 1;
+		t.cur = p + 1;
+		return true;
+	case CharClasses::QUOTE: { // quoted string, runs til end quote, which may be empty
+		char endQuote = *p++;
+		const char *close = (const char*)memchr(p, endQuote, t.end - p);
+		token.ptr = p;
+		token.len = (close ? close : t.end) - p;
+		t.cur = close ? close + 1 : t.end;
+		return close != nullptr || token.len > 0;
+	}
+	default: // stops before a space, oneCharToken or quote, leaving it for the next call
+		while (p < t.end && table[(unsigned char)*p] == CharClasses::NORMAL) ++p;
+		token.len = p - token.ptr;
+		t.cur = p;
+		return true;
+	}
+}
+bool getToken(Tokenizer &t, string &token, const CharClasses &oneCharTokens)
+{
+	TokenView view;
+	bool found = getToken(t, view, oneCharTokens);
+	token.assign(view.ptr, view.len);
+	return found;
+}
+int getFloats(Tokenizer &t, float *a, int num)
+{
+	TokenView token;
+	int count = 0;
+	while (getToken(t, token, LIST_CHARS)) {
+		if (token == "]") {
+			break;
+		}
+		else if (isdigit((unsigned char)token.ptr[0]) || token.ptr[0] == '-') {
+			parseFloat(token.ptr, token.ptr + token.len, a[count]);
+			count++;
+			if (count == num) break;
+		}
+	}
+	return count;
+}
+int getInts(Tokenizer &t, int *a, int num)
+{
+	TokenView token;
+	int count = 0;
+	while (getToken(t, token, LIST_CHARS)) {
+		if (token == "]") {
+			break;
+		}
+		else if (isdigit((unsigned char)token.ptr[0]) || token.ptr[0] == '-') {
+			parseInt(token.ptr, token.ptr + token.len, a[count]);
+			count++;
+			if (count == num) break;
+		}
+	}
+	return count;
+}
+const char* parseInt(const char *p, const char *end, int &val)
+{
+	const char *start = p;
+	bool negative = false;
+	if (p < end && (*p == '-' || *p == '+')) negative = (*p++ == '-');
+	if (p >= end || !isdigit((unsigned char)*p)) return start;
+
+	long long result = 0; //Saturates rather than overflowing on long digit runs.
+	for (; p < end && isdigit((unsigned char)*p); ++p) result = min(result * 10 + (*p - '0'), (long long)INT_MAX + 1);
+	if (negative) val = (int)max(-result, (long long)INT_MIN);
+	else val = (int)min(result, (long long)INT_MAX);
+	return p;
+}
+const char* parseFloat(const char *p, const char *end, float &val)
+{
+	static const double POW10[] = { 1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+		1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22 }; //All exact in a double.
+	const char *start = p;
+	bool negative = false;
+	if (p < end && (*p == '-' || *p == '+')) negative = (*p++ == '-');
+
+	//Gather up to 18 significant digits as an integer, then scale once. Plenty for a float.
+	unsigned long long mantissa = 0;
+	int exponent = 0, numDigits = 0;
+	for (; p < end && isdigit((unsigned char)*p); ++p, ++numDigits) {
+		if (mantissa < 100000000000000000ULL) mantissa = mantissa * 10 + (*p - '0');
+		else ++exponent;
+	}
+	if (p < end && *p == '.') {
+		for (++p; p < end && isdigit((unsigned char)*p); ++p, ++numDigits) {
+			if (mantissa < 100000000000000000ULL) { mantissa = mantissa * 10 + (*p - '0'); --exponent; }
+		}
+	}
+	if (numDigits == 0) return start;
+	if (p < end && (*p == 'e' || *p == 'E')) {
+		int e;
+		const char *q = parseInt(p + 1, end, e);
+		if (q != p + 1) { exponent += e; p = q; }
+	}
+
+	double result = (double)mantissa;
+	if (exponent < 0) result /= (-exponent <= 22) ? POW10[-exponent] : pow(10.0, -exponent);
+	else if (exponent > 0) result *= (exponent <= 22) ? POW10[exponent] : pow(10.0, exponent);
+	val = (float)(negative ? -result : result);
+	return p;
+}
 bool loadFileAsString(const string &fileName, string &fileContents)
 {
 	printf("loading file '%s'\n", fileName.c_str());
@@ -335,6 +771,49 @@ void replaceIncludes(string &src, string &dest, const string &directive,
 		}
 	}
 }
+bool MappedFile::open(const string &fullName)
+{
+	close();
+#ifdef _WIN32
+	HANDLE file = CreateFileA(fullName.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (file == INVALID_HANDLE_VALUE) return false;
+	LARGE_INTEGER fileSize;
+	if (!GetFileSizeEx(file, &fileSize)) { CloseHandle(file); return false; }
+	size = (size_t)fileSize.QuadPart;
+	fileHandle = file;
+	if (size == 0) { data = ""; return true; } //Cannot map an empty file, but an empty view is still valid.
+	HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+	if (mapping == NULL) { close(); return false; }
+	mapHandle = mapping;
+	data = (const char*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+#else
+	int fd = ::open(fullName.c_str(), O_RDONLY);
+	if (fd < 0) return false;
+	struct stat st;
+	if (fstat(fd, &st) != 0) { ::close(fd); return false; }
+	size = (size_t)st.st_size;
+	fileHandle = (void*)(intptr_t)(fd + 1); //+1 so fd 0 is not mistaken for "no handle".
+	if (size == 0) { data = ""; return true; }
+	void *view = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	data = (view == MAP_FAILED) ? nullptr : (const char*)view;
+#endif
+	if (data == nullptr) { close(); return false; }
+	return true;
+}
+void MappedFile::close(void)
+{
+#ifdef _WIN32
+	if (data != nullptr && size > 0) UnmapViewOfFile(data);
+	if (mapHandle != nullptr) CloseHandle((HANDLE)mapHandle);
+	if (fileHandle != nullptr) CloseHandle((HANDLE)fileHandle);
+#else
+	if (data != nullptr && size > 0) munmap((void*)data, size);
+	if (fileHandle != nullptr) ::close((int)(intptr_t)fileHandle - 1);
+#endif
+	data = nullptr;
+	size = 0;
+	fileHandle = mapHandle = nullptr;
+}
 
 //-------------------------------------------------------------------------//
 // RGBAImage
@@ -342,14 +821,24 @@ void replaceIncludes(string &src, string &dest, const string &directive,
 
 RGBAImage::~RGBAImage()
 {
-	if (textureId != NULL_HANDLE) glDeleteTextures(1, &textureId);
-	if (samplerId != NULL_HANDLE) glDeleteSamplers(1, &samplerId);
+	if (textureId != NULL_HANDLE) {
+		glDeleteTextures(1, &textureId);
+		gGLState.forgetTexture(textureId);
+	}
+	if (samplerId != NULL_HANDLE) {
+		glDeleteSamplers(1, &samplerId);
+		gGLState.forgetSampler(samplerId);
+	}
 }
 bool RGBAImage::loadPNG(const string &fileName, bool doFlipY)
 {
 	this->fileName = fileName;
 	string fullName;
 	getFullFileName(fileName, fullName);
+	return decodePNG(fullName, doFlipY);
+}
+bool RGBAImage::decodePNG(const string &fullName, bool doFlipY)
+{
 	unsigned error = lodepng::decode(pixels, width, height, fullName.c_str());
 	if (error) {
 		ERROR(lodepng_error_text(error), false);
@@ -391,14 +880,86 @@ void RGBAImage::sendToOpenGL(GLuint magFilter, GLuint minFilter, bool createMipM
 	if (width <= 0 || height <= 0) return;
 
 	glGenTextures(1, &textureId);
-	glBindTexture(GL_TEXTURE_2D, textureId); //Handled in Material init for uniforms.
+	gGLState.bindTexture(0, GL_TEXTURE_2D, textureId); //Any unit will do, applyMaterial() binds for drawing.
 	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, &pixels[0]); //<-- The big call that actually creates the info used by the buffer made in glGenTextures()?
 	if (createMipMap) glGenerateMipmap(GL_TEXTURE_2D);
 
-	glGenSamplers(1, &samplerId);
-	glBindSampler(textureId, samplerId);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, magFilter);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, minFilter);
+
+	//A sampler bound to a unit overrides the texture's own parameters, so it carries the same filters.
+	glGenSamplers(1, &samplerId);
+	glSamplerParameteri(samplerId, GL_TEXTURE_MAG_FILTER, magFilter);
+	glSamplerParameteri(samplerId, GL_TEXTURE_MIN_FILTER, minFilter);
+}
+void RGBAImage::refreshOpenGL(bool createMipMap)
+{
+	if (textureId == NULL_HANDLE || width <= 0 || height <= 0) return;
+
+	gGLState.bindTexture(0, GL_TEXTURE_2D, textureId);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, &pixels[0]); //Not glTexSubImage2D(), the size may have changed.
+	if (createMipMap) glGenerateMipmap(GL_TEXTURE_2D);
+}
+
+//-------------------------------------------------------------------------//
+
+void Bounds::fromPoints(const float *points, int numPoints, int stride)
+{
+	*this = Bounds();
+	if (numPoints <= 0) return;
+	boxMin = boxMax = glm::vec3(points[0], points[1], points[2]);
+	for (int i = 1; i < numPoints; ++i) {
+		glm::vec3 p(points[i * stride], points[i * stride + 1], points[i * stride + 2]);
+		boxMin = glm::min(boxMin, p);
+		boxMax = glm::max(boxMax, p);
+	}
+	//The box's center, not the tightest sphere, but one more pass gets the radius exact for it.
+	center = (boxMin + boxMax) * 0.5f;
+	float radiusSqr = 0.0f;
+	for (int i = 0; i < numPoints; ++i) {
+		glm::vec3 d = glm::vec3(points[i * stride], points[i * stride + 1], points[i * stride + 2]) - center;
+		radiusSqr = std::max(radiusSqr, glm::dot(d, d));
+	}
+	radius = sqrtf(radiusSqr);
+}
+Bounds Bounds::transformed(const glm::mat4x4 &M) const
+{
+	if (isEmpty()) return *this;
+	Bounds world;
+	world.center = glm::vec3(M * glm::vec4(center, 1));
+	float maxScaleSqr = std::max(glm::dot(glm::vec3(M[0]), glm::vec3(M[0])), std::max(glm::dot(glm::vec3(M[1]), glm::vec3(M[1])), glm::dot(glm::vec3(M[2]), glm::vec3(M[2]))));
+	world.radius = radius * sqrtf(maxScaleSqr);
+
+	//The box's half extents through the absolute matrix, so it still holds every rotated corner.
+	glm::vec3 boxCenter = glm::vec3(M * glm::vec4((boxMin + boxMax) * 0.5f, 1));
+	glm::vec3 halfExtent = (boxMax - boxMin) * 0.5f, worldHalfExtent(0);
+	for (int c = 0; c < 3; ++c) worldHalfExtent += glm::abs(glm::vec3(M[c])) * halfExtent[c];
+	world.boxMin = boxCenter - worldHalfExtent;
+	world.boxMax = boxCenter + worldHalfExtent;
+	return world;
+}
+void Frustum::fromMatrix(const glm::mat4x4 &worldViewProject)
+{
+	//Each plane is the last row plus or minus another, as clip space keeps -w <= x, y, z <= w. glm indexes [column][row].
+	const glm::mat4x4 &M = worldViewProject;
+	glm::vec4 rows[4];
+	for (int r = 0; r < 4; ++r) rows[r] = glm::vec4(M[0][r], M[1][r], M[2][r], M[3][r]);
+	for (int i = 0; i < 3; ++i) {
+		planes[i * 2] = rows[3] + rows[i];
+		planes[i * 2 + 1] = rows[3] - rows[i];
+	}
+	for (int i = 0; i < 6; ++i) planes[i] /= glm::length(glm::vec3(planes[i]));
+}
+bool Frustum::intersects(const Bounds &world) const
+{
+	if (world.isEmpty()) return true;
+	glm::vec3 boxCenter = (world.boxMin + world.boxMax) * 0.5f, halfExtent = (world.boxMax - world.boxMin) * 0.5f;
+	for (int i = 0; i < 6; ++i) {
+		glm::vec3 n = glm::vec3(planes[i]);
+		if (glm::dot(n, world.center) + planes[i].w < -world.radius) return false;
+		if (glm::dot(n, boxCenter) + glm::dot(glm::abs(n), halfExtent) + planes[i].w < 0.0f) return false; //Its corner furthest along n.
+	}
+	return true;
 }
 
 //-------------------------------------------------------------------------//
@@ -409,6 +970,12 @@ void Camera::refreshTransform(float screenWidth, float screenHeight)
 	glm::mat4x4 project = glm::perspective((float)fovy,
 		(float)(screenWidth / screenHeight), (float)znear, (float)zfar);
 	worldViewProject = project * worldView;
+
+	block.view = worldView;
+	block.project = project;
+	block.viewProject = worldViewProject;
+	block.eye = glm::vec4(eye, 1);
+	block.direction = glm::vec4(glm::normalize(center - eye), 0);
 }
 void Camera::translateLocal(const glm::vec3 &t) {
 	glm::vec3 zz = glm::normalize(eye - center);
@@ -438,98 +1005,362 @@ void Camera::rotateLocal(const glm::vec3 &axis, const float angle) {
 
 //-------------------------------------------------------------------------//
 
+Material::~Material(void)
+{
+	for (auto it = textures.begin(); it != textures.end(); ++it) {
+		gTextureCache.release((*it)->val);
+		delete *it;
+	}
+	for (auto it = colors.begin(); it != colors.end(); ++it) delete *it;
+	for (auto it = shaderProgramHandles.begin(); it != shaderProgramHandles.end(); ++it) gProgramCache.release(*it);
+	gProgramCache.release(instancedProgram);
+}
+void Material::addTexture(const string &uniformName, RGBAImage *image)
+{
+	textures.push_back(new NameIdVal<RGBAImage*>());
+	textures.back()->name = uniformName;
+	textures.back()->val = image;
+}
+void Material::setShaderProgram(GLuint shaderProgram)
+{
+	shaderProgramHandles.push_back(shaderProgram);
+	if ((int)shaderProgramHandles.size() == activeShaderProgram + 1) uniforms = &gProgramCache.getUniforms(shaderProgram);
+}
 void Material::bindMaterial(void) {
 
-	if (shaderProgramHandles[activeShaderProgram] == NULL_HANDLE) {
+	if (shaderProgramHandles.empty() || shaderProgramHandles[activeShaderProgram] == NULL_HANDLE) {
 		ERROR("Cannot get uniforms because the shader program handle is not set.", false);
 		return;
 	}
 
-	glUseProgram(shaderProgramHandles[activeShaderProgram]);
-
-	//Set up textures.
+	//"Once the shader program is compiled, the indices of the different uniforms then do not change."
 	for (int i = 0; i < (int)textures.size(); ++i) {
-		textures[i]->id = glGetUniformLocation(shaderProgramHandles[activeShaderProgram], textures[i]->name.c_str()); //The problem is this name is incorrect!
-		if (textures[i]->id != -1) {
-			//glGenSamplers(1, &textures[i]->samplerId);
-			//glGenTextures(1, &textures[i]->textureId);
-			glActiveTexture(GL_TEXTURE0 + i); //Set active texture unit in GL context.
-			glUniform1i(textures[i]->id, i); //Set the handle to the texture being used?
-			if (textures[i]->name == "uSpecularExponentTex") glBindTexture(GL_TEXTURE_1D, textures[i]->textureId); //This tex is 1D.
-			else glBindTexture(GL_TEXTURE_2D, textures[i]->textureId); //Associate texture and GL target.
-			//Important find--glBindTexture() needs to be called BEFORE glTexImage2D(), to not generate a bunch of stupid empty images every time.
-			//Note that we axed the sendToOpenGL() method of RGBAImage*, all that code is here.
-			//glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, textures[i]->width, textures[i]->height, 0, GL_RGBA, GL_UNSIGNED_BYTE, &textures[i]->pixels[0]); //<-- THIS is the method we do NOT want to call repeatedly.
-			//glGenerateMipmap(GL_TEXTURE_2D); //<-- Possibly also a memory biter.
-			glBindSampler(textures[i]->textureId, textures[i]->samplerId); //Associate texture and sampler. Already done in sendToOpenGL().
-			//glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-			//glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-		}
+		const UniformTable::Uniform *u = uniforms->find(textures[i]->name);
+		textures[i]->id = (u != nullptr) ? u->location : -1;
 #ifdef _DEBUG
-		else ERROR("\n\tFailure in texture setup loop.", false);
+		if (u == nullptr) ERROR("\n\tFailure in texture setup loop.", false);
 #endif
 	}
-
 	for (int i = 0; i < (int)colors.size(); ++i) {
-		colors[i]->id = glGetUniformLocation(shaderProgramHandles[activeShaderProgram], colors[i]->name.c_str());
-		if (colors[i]->id != -1) glUniform4fv(colors[i]->id, 1, &colors[i]->val[0]);
-#ifdef _DEBUG
-		//else ERROR("\n\tFailure in color setup loop.", false);
-#endif
-
+		const UniformTable::Uniform *u = uniforms->find(colors[i]->name);
+		colors[i]->id = (u != nullptr) ? u->location : -1;
 	}
 
+	gGLState.useProgram(shaderProgramHandles[activeShaderProgram]);
+	applyMaterial();
+}
+void Material::applyMaterial(bool instanced)
+{
+	//Programs are shared between materials, so the values go in every draw. Only the lookups are done once.
+	for (int i = 0; i < (int)textures.size(); ++i) {
+		GLint location = instanced ? instancedLocations[i] : textures[i]->id;
+		if (location == -1) continue;
+		gGLState.setUniform1i(location, i); //The sampler reads from unit i.
+		gGLState.bindTexture(i, (textures[i]->name == "uSpecularExponentTex") ? GL_TEXTURE_1D : GL_TEXTURE_2D, textures[i]->val->textureId); //This tex is 1D.
+		gGLState.bindSampler(i, textures[i]->val->samplerId); //Samplers bind to units, not textures.
+	}
+	for (int i = 0; i < (int)colors.size(); ++i)
+		gGLState.setUniform4fv(instanced ? instancedLocations[textures.size() + i] : colors[i]->id, &colors[i]->val[0]);
+}
+bool Material::buildInstancedProgram(void)
+{
+	if (activeShaderProgram != 0 || shaderProgramHandles.empty()) return false; //The variant is of the named shaders only.
+	if (triedInstanced) return instancedProgram != NULL_HANDLE;
+	triedInstanced = true;
 
-} // ONLY will run once, no streaming updates.
+	instancedProgram = gProgramCache.acquire(vertexShaderName, fragmentShaderName, nullptr, true); //Already watched.
+	instancedUniforms = &gProgramCache.getUniforms(instancedProgram);
+	instancedLocations.clear();
+	for (int i = 0; i < (int)textures.size(); ++i) {
+		const UniformTable::Uniform *u = instancedUniforms->find(textures[i]->name);
+		instancedLocations.push_back((u != nullptr) ? u->location : -1);
+	}
+	for (int i = 0; i < (int)colors.size(); ++i) {
+		const UniformTable::Uniform *u = instancedUniforms->find(colors[i]->name);
+		instancedLocations.push_back((u != nullptr) ? u->location : -1);
+	}
+	return instancedProgram != NULL_HANDLE;
+}
+bool Material::reloadShaders(void)
+{
+	vector<string> files;
+	GLuint shaderProgram = gProgramCache.acquire(vertexShaderName, fragmentShaderName, &files);
+	shaderFiles = files; //Even on failure, so an include added by the broken edit is watched too.
+	if (shaderProgram == NULL_HANDLE) return false; //Errors are already printed, keep drawing with the old program.
+
+	//The names build the first program, see finishMaterial().
+	if (shaderProgramHandles.empty()) setShaderProgram(shaderProgram);
+	else {
+		gProgramCache.release(shaderProgramHandles[0]);
+		shaderProgramHandles[0] = shaderProgram;
+		if (activeShaderProgram == 0) uniforms = &gProgramCache.getUniforms(shaderProgram);
+	}
+	gProgramCache.release(instancedProgram); //Rebuilt from the new sources on its next use.
+	instancedProgram = NULL_HANDLE;
+	instancedUniforms = &gNoUniforms;
+	triedInstanced = false;
+	bindMaterial(); //Uniform locations and sampler units belong to the program.
+	return true;
+}
 
 //-------------------------------------------------------------------------//
 // TRIANGLE MESH
 //-------------------------------------------------------------------------//
 
+//PLY headers declare typed properties per element; the body follows in header order, as text or packed little-endian.
+enum PLY_TYPE { PLY_INVALID, PLY_CHAR, PLY_UCHAR, PLY_SHORT, PLY_USHORT, PLY_INT, PLY_UINT, PLY_FLOAT, PLY_DOUBLE };
+static const int PLY_TYPE_SIZES[] = { 0, 1, 1, 2, 2, 4, 4, 4, 8 };
+struct PlyProperty {
+	string name;
+	PLY_TYPE type;
+	PLY_TYPE countType; //PLY_INVALID unless this is a list, e.g. list uchar int vertex_indices.
+};
+struct PlyElement {
+	string name;
+	int count;
+	vector<PlyProperty> properties;
+};
+static PLY_TYPE getPlyType(const TokenView &t)
+{
+	if (t == "char" || t == "int8") return PLY_CHAR;
+	if (t == "uchar" || t == "uint8") return PLY_UCHAR;
+	if (t == "short" || t == "int16") return PLY_SHORT;
+	if (t == "ushort" || t == "uint16") return PLY_USHORT;
+	if (t == "int" || t == "int32") return PLY_INT;
+	if (t == "uint" || t == "uint32") return PLY_UINT;
+	if (t == "float" || t == "float32") return PLY_FLOAT;
+	if (t == "double" || t == "float64") return PLY_DOUBLE;
+	return PLY_INVALID;
+}
+static double readPlyScalar(const char *p, PLY_TYPE type) //Unaligned-safe, little-endian host assumed.
+{
+	switch (type) {
+	case PLY_CHAR: return *(const signed char*)p;
+	case PLY_UCHAR: return *(const unsigned char*)p;
+	case PLY_SHORT: { int16_t v; memcpy(&v, p, sizeof(v)); return v; }
+	case PLY_USHORT: { uint16_t v; memcpy(&v, p, sizeof(v)); return v; }
+	case PLY_INT: { int32_t v; memcpy(&v, p, sizeof(v)); return v; }
+	case PLY_UINT: { uint32_t v; memcpy(&v, p, sizeof(v)); return v; }
+	case PLY_FLOAT: { float v; memcpy(&v, p, sizeof(v)); return v; }
+	case PLY_DOUBLE: { double v; memcpy(&v, p, sizeof(v)); return v; }
+	default: return 0.0;
+	}
+}
+static int readPlyInt(const char *p, PLY_TYPE type) //Counts and indices, so a uint past INT_MAX saturates.
+{
+	return (int)min(readPlyScalar(p, type), (double)INT_MAX);
+}
+//One property column of a packed vertex block into its slot of interleaved vertexData. Strided loops don't
+//vectorize, so the column goes through in blocks: gathered into a contiguous array of its own type, converted to
+//float in a plain loop over that, which does vectorize, and scattered out. The blocks stay in L1 throughout.
+#define PLY_CONVERT_BLOCK 256
+template<class T> static void convertPlyColumn(const char *src, size_t srcStride, float *dst, size_t dstStride, int count)
+{
+	T raw[PLY_CONVERT_BLOCK];
+	float converted[PLY_CONVERT_BLOCK];
+	for (int first = 0; first < count; first += PLY_CONVERT_BLOCK) {
+		int n = min(count - first, PLY_CONVERT_BLOCK);
+		const char *in = src + first*srcStride;
+		for (int j = 0; j < n; ++j) memcpy(&raw[j], in + j*srcStride, sizeof(T));
+		for (int j = 0; j < n; ++j) converted[j] = (float)raw[j];
+		float *out = dst + first*dstStride;
+		for (int j = 0; j < n; ++j) out[j*dstStride] = converted[j];
+	}
+}
+static void convertPlyColumn(PLY_TYPE type, const char *src, size_t srcStride, float *dst, size_t dstStride, int count)
+{
+	switch (type) {
+	case PLY_CHAR: convertPlyColumn<int8_t>(src, srcStride, dst, dstStride, count); break;
+	case PLY_UCHAR: convertPlyColumn<uint8_t>(src, srcStride, dst, dstStride, count); break;
+	case PLY_SHORT: convertPlyColumn<int16_t>(src, srcStride, dst, dstStride, count); break;
+	case PLY_USHORT: convertPlyColumn<uint16_t>(src, srcStride, dst, dstStride, count); break;
+	case PLY_INT: convertPlyColumn<int32_t>(src, srcStride, dst, dstStride, count); break;
+	case PLY_UINT: convertPlyColumn<uint32_t>(src, srcStride, dst, dstStride, count); break;
+	case PLY_FLOAT: convertPlyColumn<float>(src, srcStride, dst, dstStride, count); break;
+	case PLY_DOUBLE: convertPlyColumn<double>(src, srcStride, dst, dstStride, count); break;
+	default: break;
+	}
+}
+static void skipLine(Tokenizer &f)
+{
+	const char *newline = (const char*)memchr(f.cur, '\n', f.end - f.cur);
+	f.cur = newline ? newline + 1 : f.end;
+}
+static bool isFaceIndexList(const PlyProperty &p) { return p.countType != PLY_INVALID && (p.name == "vertex_indices" || p.name == "vertex_index"); }
+
 bool TriMesh::readFromPly(const string &fileName, bool flipZ)
 {
-	FILE *f = openFileForReading(fileName);
-	if (f == NULL) return false;
-	string token, t;
+	Tokenizer f;
+	if (!f.open(fileName)) return false;
+	TokenView token, t;
 	int numVertices = 0;
-	int numFaces = 0;
 	int numTriangles = 0;
 	vector<int> faceIndices;
+	bool binary = false;
+	vector<PlyElement> elements;
 
-	// get num vertices
-	while (getToken(f, token, "")) {
-		//cout << token << endl;
-		if (token == "vertex") break;
+	// parse the header
+	if (!getToken(f, token, PLAIN_CHARS) || token != "ply") {
+		ERROR(fileName + " is not a PLY file.", false);
+		return false;
 	}
-	getToken(f, token, "");
-	numVertices = atoi(token.c_str());
-
-	// get vertex attributes
-	while (getToken(f, token, "")) {
-		if (token == "property") {
-			getToken(f, t, ""); // token should be "float"
-			getToken(f, t, ""); // attribute name
-			attributes.push_back(t);
+	while (getToken(f, token, PLAIN_CHARS)) {
+		//cout << token << endl;
+		if (token == "format") {
+			getToken(f, t, PLAIN_CHARS);
+			if (t == "binary_little_endian") binary = true;
+			else if (t != "ascii") {
+				ERROR(fileName + ": only ascii and binary_little_endian PLY are supported.", false);
+				return false;
+			}
+			skipLine(f); // version
 		}
-		else if (token == "face") {
-			getToken(f, t, "");
-			numFaces = atoi(t.c_str());
+		else if (token == "comment" || token == "obj_info") skipLine(f);
+		else if (token == "element") {
+			elements.push_back(PlyElement());
+			getToken(f, t, PLAIN_CHARS);
+			elements.back().name = t.str();
+			elements.back().count = 0;
+			getToken(f, t, PLAIN_CHARS);
+			parseInt(t.ptr, t.ptr + t.len, elements.back().count);
+			if (elements.back().count < 0) {
+				ERROR(fileName + ": negative count for element " + elements.back().name + " in PLY header.", false);
+				return false;
+			}
+		}
+		else if (token == "property") {
+			PlyProperty p;
+			p.countType = PLY_INVALID;
+			getToken(f, t, PLAIN_CHARS);
+			if (t == "list") {
+				getToken(f, t, PLAIN_CHARS);
+				p.countType = getPlyType(t);
+				getToken(f, t, PLAIN_CHARS);
+			}
+			p.type = getPlyType(t);
+			getToken(f, t, PLAIN_CHARS); // property name
+			p.name = t.str();
+			if (elements.empty() || p.type == PLY_INVALID || (p.countType == PLY_INVALID && t.len == 0)) {
+				ERROR(fileName + ": bad property " + p.name + " in PLY header.", false);
+				return false;
+			}
+			elements.back().properties.push_back(p);
+		}
+		else if (token == "end_header") {
+			skipLine(f); // the body starts on the next line, which matters for binary
 			break;
 		}
 	}
 
-	// read to end of header
-	while (getToken(f, token, "")) {
-		if (token == "end_header") break;
-	}
+	// read the body, element by element
+	const char *p = f.cur;
+	for (int e = 0; e < (int)elements.size(); ++e) {
+		const PlyElement &element = elements[e];
+		const vector<PlyProperty> &props = element.properties;
+		//Every item takes a byte at least, in either format, so a count past that is garbage and sizes nothing.
+		if (element.count > f.end - p) { ERROR(fileName + " is truncated.", false); return false; }
+
+		if (element.name == "vertex") {
+			numVertices = element.count;
+			size_t numAttributes = props.size(), stride = 0;
+			bool allFloats = true;
+			for (size_t i = 0; i < numAttributes; ++i) {
+				if (props[i].countType != PLY_INVALID) { ERROR(fileName + ": list properties on vertices are not supported.", false); return false; }
+				attributes.push_back(props[i].name);
+				stride += PLY_TYPE_SIZES[props[i].type];
+				allFloats = allFloats && props[i].type == PLY_FLOAT;
+			}
 
-	// get vertices
-	float val;
-	for (int i = 0; i < (int)(numVertices*attributes.size()); i++) {
-		//getToken(f, token, "");
-		//vertexData.push_back((float)atof(token.c_str()));
-		fscanf(f, "%f", &val);
-		vertexData.push_back(val);
+			if ((uint64_t)numVertices*numAttributes > (uint64_t)(f.end - p)) { ERROR(fileName + " is truncated.", false); return false; }
+			size_t first = vertexData.size();
+			vertexData.resize(first + numVertices*numAttributes);
+			float *dst = vertexData.empty() ? nullptr : &vertexData[first];
+			if (binary) {
+				if ((size_t)(f.end - p) < stride*numVertices) { ERROR(fileName + " is truncated.", false); return false; }
+				if (allFloats) memcpy(dst, p, stride*numVertices); // already in our layout
+				else {
+					size_t offset = 0;
+					for (size_t i = 0; i < numAttributes; ++i) {
+						convertPlyColumn(props[i].type, p + offset, stride, dst + i, numAttributes, numVertices);
+						offset += PLY_TYPE_SIZES[props[i].type];
+					}
+				}
+				p += stride*numVertices;
+			}
+			else {
+				// parsed in place rather than through fscanf
+				f.cur = p;
+				float val = 0.0f;
+				for (size_t i = 0; i < numVertices*numAttributes; i++) {
+					if (!getToken(f, token, PLAIN_CHARS)) { ERROR(fileName + " is truncated.", false); return false; }
+					parseFloat(token.ptr, token.ptr + token.len, val);
+					dst[i] = val;
+				}
+				p = f.cur;
+			}
+		}
+		else if (element.name == "face") {
+			indices.reserve(indices.size() + (size_t)element.count * 3);
+			f.cur = p;
+			for (int i = 0; i < element.count; i++) {
+				for (size_t k = 0; k < props.size(); ++k) {
+					const PlyProperty &prop = props[k];
+					int count = 1;
+					if (binary) {
+						if (prop.countType != PLY_INVALID) {
+							if (p + PLY_TYPE_SIZES[prop.countType] > f.end) { ERROR(fileName + " is truncated.", false); return false; }
+							count = readPlyInt(p, prop.countType);
+							p += PLY_TYPE_SIZES[prop.countType];
+							if (count < 0) { ERROR(fileName + ": negative list count.", false); return false; }
+						}
+						size_t size = (size_t)count * PLY_TYPE_SIZES[prop.type];
+						if ((size_t)(f.end - p) < size) { ERROR(fileName + " is truncated.", false); return false; }
+						if (isFaceIndexList(prop)) {
+							faceIndices.resize(count);
+							if (prop.type == PLY_INT || prop.type == PLY_UINT) { if (count > 0) memcpy(&faceIndices[0], p, size); }
+							else for (int j = 0; j < count; ++j) faceIndices[j] = readPlyInt(p + j*PLY_TYPE_SIZES[prop.type], prop.type);
+						}
+						p += size;
+					}
+					else {
+						if (prop.countType != PLY_INVALID) {
+							if (!getToken(f, token, PLAIN_CHARS)) { ERROR(fileName + " is truncated.", false); return false; }
+							parseInt(token.ptr, token.ptr + token.len, count);
+							if (count < 0) { ERROR(fileName + ": negative list count.", false); return false; }
+							if (count > f.end - f.cur) { ERROR(fileName + " is truncated.", false); return false; }
+						}
+						if (isFaceIndexList(prop)) faceIndices.resize(count);
+						for (int j = 0; j < count; j++) { // get all vertices in face
+							if (!getToken(f, t, PLAIN_CHARS)) { ERROR(fileName + " is truncated.", false); return false; }
+							if (isFaceIndexList(prop)) parseInt(t.ptr, t.ptr + t.len, faceIndices[j]);
+						}
+					}
+					if (!isFaceIndexList(prop)) continue;
+					for (int j = 2; j < count; j++) { // make triangle fan
+						indices.push_back(faceIndices[0]);
+						indices.push_back(faceIndices[j - 1]);
+						indices.push_back(faceIndices[j]);
+						numTriangles++;
+					}
+				}
+			}
+			if (!binary) p = f.cur;
+		}
+		else { // skip elements we don't use, e.g. edges
+			for (int i = 0; i < element.count; i++) {
+				if (!binary) { f.cur = p; skipLine(f); p = f.cur; continue; }
+				for (size_t k = 0; k < props.size(); ++k) {
+					int count = 1;
+					if (props[k].countType != PLY_INVALID) {
+						if (PLY_TYPE_SIZES[props[k].countType] > f.end - p) { ERROR(fileName + " is truncated.", false); return false; }
+						count = readPlyInt(p, props[k].countType);
+						p += PLY_TYPE_SIZES[props[k].countType];
+					}
+					if (count < 0 || (int64_t)count * PLY_TYPE_SIZES[props[k].type] > f.end - p) { ERROR(fileName + " is truncated.", false); return false; }
+					p += count * PLY_TYPE_SIZES[props[k].type];
+				}
+			}
+		}
 	}
 
 	// divide color values by 255, and flip normal directions if needed
@@ -547,24 +1378,11 @@ bool TriMesh::readFromPly(const string &fileName, bool flipZ)
 			}
 		}
 	}
-
-	// get faces
-	int idx;
-	for (int i = 0; i < numFaces; i++) {
-		faceIndices.clear();
-		getToken(f, token, "");
-		int numVerts = atoi(token.c_str());
-		for (int j = 0; j < numVerts; j++) { // get all vertices in face
-			//getToken(f, t, "");
-			//faceIndices.push_back(atoi(t.c_str()));
-			fscanf(f, "%d", &idx);
-			faceIndices.push_back(idx);
-		}
-		for (int j = 2; j < numVerts; j++) { // make triangle fan
-			indices.push_back(faceIndices[0]);
-			indices.push_back(faceIndices[j - 1]);
-			indices.push_back(faceIndices[j]);
-			numTriangles++;
+	//Faces may come from anywhere, and an index past the vertices would have the draw read past the buffer.
+	for (size_t i = 0; i < indices.size(); ++i) {
+		if (indices[i] < 0 || indices[i] >= numVertices) {
+			ERROR(fileName + ": face index " + to_string(indices[i]) + " is outside its " + to_string(numVertices) + " vertices.", false);
+			return false;
 		}
 	}
 	numIndices = (int)indices.size();
@@ -574,22 +1392,95 @@ bool TriMesh::readFromPly(const string &fileName, bool flipZ)
 	//	indices.size()/3,
 	//	attributes.size());
 
-	fclose(f);
 	return true;
 }
+bool TriMesh::writeToPly(const string &fileName, bool binary)
+{
+	//Colors go out as uchar like our exporters write them, everything else as float. Faces are the triangles in indices.
+	FILE *F = fopen(fileName.c_str(), "wb");
+	if (F == nullptr) return false;
+	int numAttributes = (int)attributes.size();
+	int numVertices = numAttributes ? (int)vertexData.size() / numAttributes : 0;
+	vector<bool> isColor(numAttributes);
+	for (int i = 0; i < numAttributes; ++i) isColor[i] = (attributes[i] == "red" || attributes[i] == "green" || attributes[i] == "blue");
+
+	fprintf(F, "ply\nformat %s 1.0\n", binary ? "binary_little_endian" : "ascii");
+	fprintf(F, "element vertex %d\n", numVertices);
+	for (int i = 0; i < numAttributes; ++i) fprintf(F, "property %s %s\n", isColor[i] ? "uchar" : "float", attributes[i].c_str());
+	fprintf(F, "element face %d\nproperty list uchar int vertex_indices\nend_header\n", (int)indices.size() / 3);
+
+	for (int j = 0; j < numVertices; ++j) {
+		for (int i = 0; i < numAttributes; ++i) {
+			float v = vertexData[j*numAttributes + i];
+			if (isColor[i]) {
+				float scaled = v * 255.0f + 0.5f;
+				unsigned char c = (unsigned char)(scaled < 0.0f ? 0.0f : (scaled > 255.0f ? 255.0f : scaled));
+				if (binary) fwrite(&c, 1, 1, F);
+				else fprintf(F, "%d ", (int)c);
+			}
+			else if (binary) fwrite(&v, sizeof(float), 1, F);
+			else fprintf(F, "%.9g ", v);
+		}
+		if (!binary) fprintf(F, "\n");
+	}
+	for (int i = 0; i + 2 < (int)indices.size(); i += 3) {
+		if (binary) {
+			unsigned char three = 3;
+			fwrite(&three, 1, 1, F);
+			fwrite(&indices[i], sizeof(int), 3, F);
+		}
+		else fprintf(F, "3 %d %d %d\n", indices[i], indices[i + 1], indices[i + 2]);
+	}
+	bool ok = (ferror(F) == 0);
+	fclose(F);
+	return ok;
+}
 #define V_POSITION 0
 #define V_NORMAL 1
 #define V_ST 2
 #define V_COLOR 3
 int NUM_COMPONENTS[] = { 3, 3, 2, 3 };
+bool TriMesh::loadFromPly(const string &fileName, bool flipZ)
+{
+	string fullName;
+	if (!getFullFileName(fileName, fullName)) {
+		ERROR("Could not open file " + fileName, false);
+		return false;
+	}
+	CachedMesh cached;
+	return readFromPlyCached(fullName, flipZ, cached) && sendToOpenGL(cached);
+}
+bool TriMesh::readFromPlyCached(const string &fullName, bool flipZ, CachedMesh &cached)
+{
+	//Hit: the data stays in the mapped blob until it's uploaded, vertexData and indices stay empty.
+	if (cached.open(fullName, flipZ)) {
+		attributes = cached.attributes;
+		return true;
+	}
+
+	//Miss: parse as usual and leave a blob for next time.
+	if (!readFromPly(fullName, flipZ)) return false;
+	storeCachedMesh(fullName, flipZ, *this);
+	return true;
+}
 bool TriMesh::sendToOpenGL(void)
+{
+	return sendToOpenGL(vertexData.empty() ? nullptr : &vertexData[0], (int)vertexData.size(),
+		indices.empty() ? nullptr : &indices[0], (int)indices.size());
+}
+bool TriMesh::sendToOpenGL(const CachedMesh &cached)
+{
+	if (cached.vertexData == nullptr) return sendToOpenGL(); //Missed, so readFromPly() filled our own arrays.
+	return sendToOpenGL(cached.vertexData, cached.numFloats, cached.indices, cached.numIndices);
+}
+bool TriMesh::sendToOpenGL(const float *vertices, int numFloats, const int *faceIndices, int numFaceIndices)
 {
 	// Create vertex array object.  The vertex array object
 	// holds the structure of how the vertices are stored. VAOs
 	// also are bound for rendering.
 	//
 	glGenVertexArrays(1, &vao); // generate 1 array
-	glBindVertexArray(vao);
+	gGLState.bindVertexArray(vao);
 
 	// Make and bind the vertex buffer object.  The vbo
 	// holds the raw data that will be indexed by the vao.
@@ -597,7 +1488,7 @@ bool TriMesh::sendToOpenGL(void)
 	GLuint vbo; // vertex buffer object
 	glGenBuffers(1, &vbo); // generate 1 buffer
 	glBindBuffer(GL_ARRAY_BUFFER, vbo);
-	glBufferData(GL_ARRAY_BUFFER, vertexData.size()*sizeof(float), &vertexData[0], GL_STATIC_DRAW);
+	glBufferData(GL_ARRAY_BUFFER, numFloats*sizeof(float), vertices, GL_STATIC_DRAW);
 
 	// At this point, we have to tell the vertex array what kind
 	// of data it holds, and where it is located in the vertex buffer.
@@ -606,6 +1497,11 @@ bool TriMesh::sendToOpenGL(void)
 	//
 	int stride = (int)attributes.size() * sizeof(float); // size of a vertex in bytes
 
+	// Bound the positions while they're at hand, for culling.
+	bounds = Bounds();
+	for (int i = 0; i < (int)attributes.size(); i++)
+		if (attributes[i] == "x" && vertices != nullptr) bounds.fromPoints(vertices + i, numFloats / (int)attributes.size(), (int)attributes.size());
+
 	for (int i = 0; i < (int)attributes.size(); i++) {
 		int bindIndex = -1;
 		//int numComponents = 0;
@@ -623,34 +1519,56 @@ bool TriMesh::sendToOpenGL(void)
 		}
 	}
 
-	// unbind the VBO and VAO
+	// unbind the VBO, the attribute pointers already hold it
 	glBindBuffer(GL_ARRAY_BUFFER, 0);
-	glBindVertexArray(0);
 
-
-	// Generate the index buffer
+	// Generate the index buffer while the VAO is bound, so the VAO
+	// records it and draw() only has to bind the VAO.
 	glGenBuffers(1, &ibo);
 	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ibo);
-	glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(int),
-		&indices[0], GL_STATIC_DRAW);
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0); // unbind
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, numFaceIndices * sizeof(int),
+		faceIndices, GL_STATIC_DRAW);
+	gGLState.bindVertexArray(0); // unbind, keeping the index buffer in the VAO
 
 	glDeleteBuffers(1, &vbo);
+	numIndices = numFaceIndices;
 
 	return true;
 }
+TriMesh::~TriMesh(void)
+{
+	if (vao != NULL_HANDLE) {
+		glDeleteVertexArrays(1, &vao);
+		gGLState.forgetVertexArray(vao);
+	}
+	if (ibo != NULL_HANDLE) glDeleteBuffers(1, &ibo);
+}
 void TriMesh::draw(void)
 {
-	glBindVertexArray(vao); // bind the vertices
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ibo); // bind the indices
-
-	glEnable(GL_BLEND);
-	glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+	gGLState.bindVertexArray(vao); // bind the vertices, and with them the indices
+	gGLState.setBlend(true); //Every mesh blends, so this stays on rather than toggling per draw.
 
 	// draw the triangles.  modes: GL_TRIANGLES, GL_LINES, GL_POINTS
 	glDrawElements(GL_TRIANGLES, numIndices, GL_UNSIGNED_INT, (void*)0);
+}
+void TriMesh::drawInstanced(GLuint instanceBuffer, size_t offset, int numInstances)
+{
+	gGLState.bindVertexArray(vao);
+	gGLState.setBlend(true);
+
+	//A column per location, advancing once per instance. Pointed at this batch's InstanceData, then disabled again
+	//so plain draw() never reads past a buffer that has since shrunk.
+	glBindBuffer(GL_ARRAY_BUFFER, instanceBuffer);
+	for (int c = 0; c < 8; ++c) {
+		glEnableVertexAttribArray(V_INSTANCE_WORLD_M + c);
+		glVertexAttribPointer(V_INSTANCE_WORLD_M + c, 4, GL_FLOAT, GL_FALSE, sizeof(InstanceData), (void*)(offset + c * sizeof(glm::vec4)));
+		glVertexAttribDivisor(V_INSTANCE_WORLD_M + c, 1);
+	}
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+	glDrawElementsInstanced(GL_TRIANGLES, numIndices, GL_UNSIGNED_INT, (void*)0, numInstances);
 
-	glDisable(GL_BLEND);
+	for (int c = 0; c < 8; ++c) glDisableVertexAttribArray(V_INSTANCE_WORLD_M + c);
 }
 
 //-------------------------------------------------------------------------//
@@ -679,13 +1597,12 @@ void Sprite::prepareToDraw(const Camera& camera, Transform& T, Material& materia
 	}
 
 	//Set the new sprite frame in the shader.
-	glUseProgram(material.shaderProgramHandles[material.activeShaderProgram]);
-	GLint loc = glGetUniformLocation(material.shaderProgramHandles[material.activeShaderProgram], "uSpriteFrame"); //a vec4 (x,y,z,w) <-> (x,y,w,h).
-	if (loc != -1) glUniform4fv(loc, 1, glm::value_ptr(frames[activeFrame]));
+	gGLState.useProgram(material.shaderProgramHandles[material.activeShaderProgram]);
+	GLint loc = (*material.uniforms)[U_SPRITE_FRAME]; //a vec4 (x,y,z,w) <-> (x,y,w,h).
+	if (loc != -1) gGLState.setUniform4fv(loc, glm::value_ptr(frames[activeFrame]));
 #ifdef _DEBUG
 	else ERROR("Could not load uniform uSpriteFrame.", false);
 #endif
-	glUseProgram(0);
 }
 void Billboard::prepareToDraw(const Camera &camera, Transform& T, Material& material)
 {
@@ -701,35 +1618,56 @@ void Billboard::prepareToDraw(const Camera &camera, Transform& T, Material& mate
 	}
 }
 
+Drawable::Drawable(const Drawable &d) : triMesh(d.triMesh), material(d.material), type(d.type), diffuseTexture(d.diffuseTexture)
+{
+	gTextureCache.retain(diffuseTexture);
+}
+Drawable& Drawable::operator=(const Drawable &d)
+{
+	gTextureCache.retain(d.diffuseTexture); //Before releasing ours, in case they're the same.
+	gTextureCache.release(diffuseTexture);
+	triMesh = d.triMesh;
+	material = d.material;
+	type = d.type;
+	diffuseTexture = d.diffuseTexture;
+	return *this;
+}
+Drawable::~Drawable(void)
+{
+	gTextureCache.release(diffuseTexture);
+}
 void Drawable::prepareToDraw(const Camera &camera, Transform& T, Material& material) {
+	if (diffuseTexture == nullptr) return;
+	gGLState.useProgram(material.shaderProgramHandles[material.activeShaderProgram]);
+	bindDiffuseTexture(*material.uniforms);
+}
+void Drawable::bindDiffuseTexture(const UniformTable &uniforms)
+{
 	if (diffuseTexture == nullptr) return;
 	//Handle setting the diffuse texture uniform, if there is one. Assumes uniform name is a sampler2D named uDiffuseTex.
-	glUseProgram(material.shaderProgramHandles[material.activeShaderProgram]);
-	diffuseTexture->id = glGetUniformLocation(material.shaderProgramHandles[material.activeShaderProgram], "uDiffuseTex");
+	diffuseTexture->id = uniforms[U_DIFFUSE_TEX];
 	if (diffuseTexture->id != -1) {
-		glActiveTexture(GL_TEXTURE0 + 0); //Set active texture unit in GL context.
-		glUniform1i(diffuseTexture->id, 0); //Set the handle to the texture being used? Matches the # added to GL_TEXTURE0 above.
-		glBindTexture(GL_TEXTURE_2D, diffuseTexture->textureId); //Associate texture and GL target. 
-		glBindSampler(diffuseTexture->textureId, diffuseTexture->samplerId); //Associate texture and sampler. Already done in sendToOpenGL().
+		gGLState.setUniform1i(diffuseTexture->id, 0); //The sampler reads from unit 0.
+		gGLState.bindTexture(0, GL_TEXTURE_2D, diffuseTexture->textureId); //Associate texture and GL target. 
+		gGLState.bindSampler(0, diffuseTexture->samplerId); //Samplers bind to units, not textures.
 	}
 #ifdef _DEBUG
 	else ERROR("Could not load uniform uDiffuseTex.", false);
 #endif
-	glUseProgram(0);
 }
 void Drawable::draw(Camera &camera) 
 {
-	glUseProgram(material->shaderProgramHandles[material->activeShaderProgram]);
-
-	material->bindMaterial();
-	if (material->name == "sprite") {
-		glEnable(GL_BLEND);
-		glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
-	}
-
-	triMesh->draw();
-
-	glUseProgram(0);
+	gGLState.useProgram(material->shaderProgramHandles[material->activeShaderProgram]);
+	material->applyMaterial();
+	triMesh->draw(); //Blends for sprites and everything else alike.
+}
+void drawObject(Camera &camera, Drawable &drawable, Transform &T)
+{
+	Material *material = drawable.material;
+	drawable.prepareToDraw(camera, T, *material);
+	gGLState.useProgram(material->shaderProgramHandles[material->activeShaderProgram]);
+	setObjectUniforms(*material->uniforms, camera, T);
+	drawable.draw(camera);
 }
 
 //-------------------------------------------------------------------------//
@@ -745,6 +1683,35 @@ void initLightBuffer() {
 	glBufferData(GL_UNIFORM_BUFFER, sizeof(Light)* MAX_LIGHTS, gLights, GL_STREAM_DRAW); //Unlike glBufferSubData(), actually allocates data!
 	glBindBuffer(GL_UNIFORM_BUFFER, 0);
 }
+GLuint gCameraUBO = NULL_HANDLE;
+void initCameraBuffer(void)
+{
+	if (gCameraUBO != NULL_HANDLE) return;
+	glGenBuffers(1, &gCameraUBO);
+	glBindBuffer(GL_UNIFORM_BUFFER, gCameraUBO);
+	glBufferData(GL_UNIFORM_BUFFER, sizeof(CameraBlock), nullptr, GL_STREAM_DRAW);
+	glBindBuffer(GL_UNIFORM_BUFFER, 0);
+	glBindBufferBase(GL_UNIFORM_BUFFER, CAMERA_UBO_BINDING, gCameraUBO); //Context state, so once is enough.
+}
+void uploadCameraBuffer(const Camera &camera)
+{
+	glBindBuffer(GL_UNIFORM_BUFFER, gCameraUBO);
+	glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(CameraBlock), &camera.block);
+	glBindBuffer(GL_UNIFORM_BUFFER, 0);
+}
+void setObjectUniforms(const UniformTable &uniforms, const Camera &camera, const Transform &T)
+{
+	gGLState.setUniformMatrix4fv(uniforms[U_OBJECT_WORLD_M], glm::value_ptr(T.transform));
+	gGLState.setUniformMatrix4fv(uniforms[U_OBJECT_WORLD_INVERSE_M], glm::value_ptr(T.invTransform));
+
+	//The rest comes from gCameraUBO, unless a shader declares them in a form useCameraBlock() doesn't rewrite.
+	if (uniforms[U_OBJECT_PERSPECT_M] != -1) {
+		glm::mat4x4 objectWorldViewPerspect = camera.worldViewProject * T.transform;
+		gGLState.setUniformMatrix4fv(uniforms[U_OBJECT_PERSPECT_M], glm::value_ptr(objectWorldViewPerspect));
+	}
+	if (uniforms[U_VIEW_DIRECTION] != -1) gGLState.setUniform4fv(uniforms[U_VIEW_DIRECTION], glm::value_ptr(camera.block.direction));
+	if (uniforms[U_VIEW_POSITION] != -1) gGLState.setUniform4fv(uniforms[U_VIEW_POSITION], glm::value_ptr(camera.block.eye));
+}
 void Light::typeToString() {
 	switch (type)
 	{
@@ -765,8 +1732,14 @@ SceneGraphNode::SceneGraphNode(void) {
 	T.rotation = glm::quat(glm::vec3(0, 0, 0)); //Lookup over an allocation.
 	activeLOD = 0;
 	isUpdated = isRendered = true;
+	parent = nullptr; //Roots are found by this during save, so it can't be left dangling.
+	collider = nullptr;
+	octreeCell = nullptr;
+	octreeSlot = -1;
+	octreeRefreshes = 0;
 }
 SceneGraphNode::~SceneGraphNode(void) {
+	gOctree.remove(this);
 	for (auto it = LODstack.begin(); it != LODstack.end(); ++it) delete *it; 
 	//for (auto it = cameras.begin(); it != cameras.end(); ++it) delete *it; //Handled by gCameras.
 	for (auto it = sounds.begin(); it != sounds.end(); ++it) if (*it != nullptr) (*it)->drop();
@@ -780,6 +1753,10 @@ void SceneGraphNode::setTranslation(const glm::vec3 &t) {
 		cameras[i]->eye = t; //However, center needs to still be eye-center away from eye.
 		cameras[i]->center = t + cameras[i]->center; //Should preserve eye and center, both translated to the new t.
 	}
+	markMoved();
+}
+void SceneGraphNode::markMoved(void) {
+	gOctree.markMoved(this);
 }
 void SceneGraphNode::update(Camera &camera, double dt) 
 {
@@ -789,7 +1766,12 @@ void SceneGraphNode::update(Camera &camera, double dt)
 	if (parent == nullptr) T.refreshTransform();
 
 	//Update collider position to match current translation.
-	if (collider != nullptr) collider->center = T.translation + collider->offset;
+	if (collider != nullptr) {
+		collider->center = T.translation + collider->offset;
+		collider->T.translation = collider->center;
+		collider->T.scale = glm::vec3(collider->radius);
+		collider->T.refreshTransform();
+	}
 
 	//Update children.
 	for (int i = 0; i < (int)children.size(); ++i) {
@@ -823,45 +1805,8 @@ void SceneGraphNode::draw(Camera &camera) {
 
 	//printMat(transform);
 	if (!isRendered || activeLOD == -1) return; //Do not render objects beyond their renderThreshold of switchingDistances[0].
-	LODstack[activeLOD]->prepareToDraw(camera, T, *LODstack[activeLOD]->material);
-
-	glUseProgram(this->LODstack[activeLOD]->material->shaderProgramHandles[LODstack[activeLOD]->material->activeShaderProgram]);
-
-	GLint loc;
-
-	loc = glGetUniformLocation(LODstack[activeLOD]->material->shaderProgramHandles[LODstack[activeLOD]->material->activeShaderProgram], "uObjectWorldM");
-	if (loc != -1) glUniformMatrix4fv(loc, 1, GL_FALSE, glm::value_ptr(T.transform));
-#ifdef _DEBUG
-	//else ERROR("Could not load uniform uObjectWorldM.", false);
-#endif
-
-	loc = glGetUniformLocation(LODstack[activeLOD]->material->shaderProgramHandles[LODstack[activeLOD]->material->activeShaderProgram], "uObjectWorldInverseM");
-	if (loc != -1) glUniformMatrix4fv(loc, 1, GL_FALSE, glm::value_ptr(T.invTransform));
-#ifdef _DEBUG
-	//else ERROR("Could not load uniform uObjectWorldInverseM.", false);
-#endif
-
-	glm::mat4x4 objectWorldViewPerspect = camera.worldViewProject * T.transform;
-	loc = glGetUniformLocation(LODstack[activeLOD]->material->shaderProgramHandles[LODstack[activeLOD]->material->activeShaderProgram], "uObjectPerpsectM");
-	if (loc != -1) glUniformMatrix4fv(loc, 1, GL_FALSE, glm::value_ptr(objectWorldViewPerspect));
-#ifdef _DEBUG
-	//else ERROR("Could not load uniform uObjectPerpsectM.", false);
-#endif
-
-	loc = glGetUniformLocation(LODstack[activeLOD]->material->shaderProgramHandles[LODstack[activeLOD]->material->activeShaderProgram], "uViewDirection");
-	if (loc != -1) glUniform4fv(loc, 1, glm::value_ptr(camera.center));
-#ifdef _DEBUG
-	//else ERROR("Could not load uniform uViewPosition.", false);
-#endif
-
-	loc = glGetUniformLocation(LODstack[activeLOD]->material->shaderProgramHandles[LODstack[activeLOD]->material->activeShaderProgram], "uViewPosition");
-	if (loc != -1) glUniform4fv(loc, 1, glm::value_ptr(camera.eye));
-#ifdef _DEBUG
-	//else ERROR("Could not load uniform uViewDirection.", false);
-#endif
-
-	LODstack[activeLOD]->draw(camera);
-	if (collider != nullptr && collider->isRendered) collider->meshInstance->draw(camera);
+	drawObject(camera, *LODstack[activeLOD], T);
+	if (collider != nullptr && collider->isRendered) drawObject(camera, *collider->meshInstance, collider->T);
 }
 
 //-------------------------------------------
@@ -972,7 +1917,7 @@ void Material::toSDL(FILE *F) {
 	fprintf(F, "\tvertexShader \"%s\"\n", vertexShaderName.c_str());
 	fprintf(F, "\tfragmentShader \"%s\"\n", fragmentShaderName.c_str());
 	for (int i = 0; i < colors.size(); ++i) fprintf(F, "\tcolor %s [%f %f %f]\n", colors[i]->name.c_str(), colors[i]->val.r, colors[i]->val.g, colors[i]->val.b);
-	for (int i = 0; i < textures.size(); ++i) fprintf(F, "\ttexture %s \"%s\"\n", textures[i]->name.c_str(), textures[i]->fileName.c_str());
+	for (int i = 0; i < textures.size(); ++i) fprintf(F, "\ttexture %s \"%s\"\n", textures[i]->name.c_str(), textures[i]->val->fileName.c_str());
 	fprintf(F, "}\n");
 }
 void Sprite::toSDL(FILE *F, int tabAmt) {
@@ -1122,22 +2067,19 @@ void initText2D(const char * texturePath, int numTexRows, int numTexCols) {
 	
 
 	// Bind shader
-	glUseProgram(textShaderProgramHandle);
+	gGLState.useProgram(textShaderProgramHandle);
 
 	// Bind texture
-	glActiveTexture(GL_TEXTURE0);
 	// Set our "myTextureSampler" sampler to user Texture Unit 0
-	glUniform1i(textTex->id, 0);
-	glBindTexture(GL_TEXTURE_2D, textTex->textureId);
+	gGLState.setUniform1i(textTex->id, 0);
+	gGLState.bindTexture(0, GL_TEXTURE_2D, textTex->textureId);
 
 	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, textTex->width, textTex->height, 0, GL_RGBA, GL_UNSIGNED_BYTE, &textTex->pixels[0]);
 	glGenerateMipmap(GL_TEXTURE_2D);
 
-	glBindSampler(textTex->textureId, textTex->samplerId); //Associate texture and sampler. Already done in sendToOpenGL().
+	gGLState.bindSampler(0, textTex->samplerId); //Samplers bind to units, not textures.
 	//glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
 	//glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-
-	glUseProgram(0);
 }
 
 void printText2D(const char * text, int x, int y, int size) {
@@ -1188,13 +2130,13 @@ void printText2D(const char * text, int x, int y, int size) {
 	glBufferData(GL_ARRAY_BUFFER, UVs.size() * sizeof(glm::vec2), &UVs[0], GL_STATIC_DRAW);
 
 	// Bind shader
-	glUseProgram(textShaderProgramHandle);
+	gGLState.useProgram(textShaderProgramHandle);
 
 	// Bind texture
-	//glActiveTexture(GL_TEXTURE0);
 	// Set our "myTextureSampler" sampler to user Texture Unit 0
-	glUniform1i(textTex->id, 0);
-	glBindTexture(GL_TEXTURE_2D, textTex->textureId);
+	gGLState.setUniform1i(textTex->id, 0);
+	gGLState.bindTexture(0, GL_TEXTURE_2D, textTex->textureId);
+	gGLState.bindSampler(0, textTex->samplerId);
 
 	// 1st attribute buffer : vertices
 	glEnableVertexAttribArray(0);
@@ -1206,18 +2148,13 @@ void printText2D(const char * text, int x, int y, int size) {
 	glBindBuffer(GL_ARRAY_BUFFER, textUVboID);
 	glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 0, (void*)0);
 
-	glEnable(GL_BLEND);
-	glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+	gGLState.setBlend(true); //Left on like the mesh draws leave it, as are the program and texture.
 
 	// Draw call
 	glDrawArrays(GL_TRIANGLES, 0, vertices.size());
 
-	glDisable(GL_BLEND);
-
 	glDisableVertexAttribArray(0);
 	glDisableVertexAttribArray(1);
-
-	glUseProgram(0);
 }
 
 void cleanupText2D() {
@@ -1229,9 +2166,13 @@ void cleanupText2D() {
 	glDeleteBuffers(1, &textUVboID);
 
 	// Delete texture
-	glDeleteTextures(1, &textTex->id);
+	gGLState.forgetTexture(textTex->textureId);
+	gGLState.forgetSampler(textTex->samplerId);
+	glDeleteTextures(1, &textTex->textureId);
+	glDeleteSamplers(1, &textTex->samplerId);
 
 	// Delete shader
+	gGLState.forgetProgram(textShaderProgramHandle);
 	glDeleteProgram(textShaderProgramHandle);
 }
 */
\ No newline at end of file
@@ -7,6 +7,9 @@
 // some standard includes
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <limits.h>
 #include <iostream>
 #include <fstream>
 #include <sstream>
@@ -25,6 +28,7 @@ using namespace std;
 #define GLM_FORCE_RADIANS
 //#define PRINT_GLSL //Uncomment to print full shader code, separated to speed up Debug build time.
 #include <GL/glew.h>
+#include "GLDevice.h" //Every gl*() from here on goes through gGL.
 #include <GLFW/glfw3.h>
 #include <glm/glm.hpp>
 #include <glm/ext.hpp>
@@ -39,7 +43,9 @@ using namespace irrklang;
 
 void ERROR(const string &msg, bool doExit = true);
 double TIME(void);
+double PRECISE_TIME(void); //Seconds off the performance counter, for spans too short for TIME()'s clock ticks.
 void SLEEP(int millis);
+uint64_t hashBytes(const void *data, size_t size, uint64_t hash = 14695981039346656037ULL); //FNV-1a, chain calls through hash.
 
 //For controlling the number of time steps we take between update() or render() calls. Used by Sprite's tick.
 extern const double FIXED_DT; //Represents the non-integral amount of frames between last and current game loop. Weak to pausing.
@@ -63,8 +69,33 @@ public:
 GLFWwindow* createOpenGLWindow(int width, int height, const char *title, int samplesPerPixel = 0);
 
 #define NULL_HANDLE 0
-GLuint loadShader(const string &fileName, GLuint shaderType);
-GLuint createShaderProgram(GLuint vertexShader, GLuint fragmentShader);
+bool preprocessShader(const string &fileName, string &shaderCode, vector<string> *sourceFiles = nullptr); //Appends the resolved file and its includes.
+bool makeInstancedShader(string &vertexShaderCode); //Preprocessed code in, instanced variant out. False if nothing in it is per object.
+GLuint compileShader(const string &shaderCode, GLuint shaderType, const string &fileName); //fileName is only for errors.
+GLuint loadShader(const string &fileName, GLuint shaderType, vector<string> *sourceFiles = nullptr); //Both of the above.
+GLuint createShaderProgram(GLuint vertexShader, GLuint fragmentShader, bool retrievable = false); //retrievable for glGetProgramBinary().
+void bindUniformBlocks(GLuint shaderProgram); //Needed by every new program, linked or loaded from a binary.
+
+//Every active uniform of a linked program, reflected once so draws index fixed slots instead of asking GL by name.
+enum UNIFORM_SLOT {
+	U_OBJECT_WORLD_M, U_OBJECT_WORLD_INVERSE_M, U_OBJECT_PERSPECT_M, U_VIEW_DIRECTION, U_VIEW_POSITION,
+	U_DIFFUSE_TEX, U_SPRITE_FRAME,
+	NUM_UNIFORM_SLOTS
+};
+extern int gUniformLookups; //Uniforms looked up by name since the last reset. Steady-state frames should make none.
+class UniformTable
+{
+public:
+	struct Uniform { string name; GLint location, size; GLenum type; };
+	vector<Uniform> uniforms; //Sorted by name, arrays without their "[0]".
+	GLint slots[NUM_UNIFORM_SLOTS]; //-1 where the program lacks one.
+
+	UniformTable(void) { reflect(NULL_HANDLE); }
+	void reflect(GLuint shaderProgram);
+	const Uniform* find(const string &name) const; //Null if inactive. Counts as a lookup, so keep it out of draws.
+	GLint operator[](UNIFORM_SLOT slot) const { return slots[slot]; }
+};
+extern const UniformTable gNoUniforms; //For a missing or failed program.
 
 //-------------------------------------------------------------------------//
 // GLM UTILITY STUFF
@@ -81,6 +112,7 @@ void printMat(const glm::mat4x4 &m);
 const vector<string>& getPATH();
 void addToPath(const string &p);
 void removeFromPath(const string &p);
+void addFileDirectoryToPath(const string &fileName); //Adds the folder part of fileName, if it has one.
 bool getFullFileName(const string &fileName, string &fullName);
 FILE *openFileForReading(const string &fileName);
 bool getToken(FILE *f, string &token, const string &oneCharTokens);
@@ -90,6 +122,65 @@ bool loadFileAsString(const string &fileName, string &buffer);
 void replaceIncludes(string &src, string &dest, const string &directive,
 	string &alreadyIncluded, bool onlyOnce);
 
+//Read-only view of a whole file, memory-mapped so loaders can point straight into it.
+class MappedFile
+{
+public:
+	const char *data;
+	size_t size;
+
+	MappedFile(void) : data(nullptr), size(0), fileHandle(nullptr), mapHandle(nullptr) {}
+	~MappedFile() { close(); }
+	bool open(const string &fullName); //Takes an already resolved name, see getFullFileName().
+	void close(void);
+	bool isOpen(void) const { return data != nullptr; }
+private:
+	MappedFile(const MappedFile&);
+	MappedFile& operator=(const MappedFile&);
+	void *fileHandle, *mapHandle;
+};
+
+//In-memory replacement for getToken(FILE*): same grammar, but it walks a mapped buffer and hands back
+//pointers into it instead of building a string per token. The FILE* versions above stay for tools and comparison.
+struct TokenView //Stand-in for string_view, which VS2013 lacks. Only valid while its Tokenizer stays open.
+{
+	const char *ptr;
+	size_t len;
+
+	TokenView(void) : ptr(""), len(0) {}
+	bool operator==(const char *s) const { return len == strlen(s) && memcmp(ptr, s, len) == 0; } //Length first: strncmp could read past a shorter s.
+	bool operator!=(const char *s) const { return !(*this == s); }
+	string str(void) const { return string(ptr, len); }
+};
+class CharClasses //Built once per oneCharTokens set, replacing a find() per character with a table lookup.
+{
+public:
+	enum CLASS { NORMAL, SPACE, ONE_CHAR, QUOTE };
+	unsigned char table[256];
+	CharClasses(const string &oneCharTokens);
+};
+extern const CharClasses LIST_CHARS; //"[],", as used by getFloats() and getInts().
+extern const CharClasses PLAIN_CHARS; //No one-char tokens, as used for PLY files.
+extern const CharClasses SCENE_CHARS; //ONE_TOKENS of the scene grammar, defined with the loaders in main.cpp.
+class Tokenizer
+{
+public:
+	const char *cur, *end;
+
+	Tokenizer(void) : cur(nullptr), end(nullptr) {}
+	bool open(const string &fileName); //Resolves through PATH and maps the file, like openFileForReading().
+	void attach(const char *data, size_t size) { cur = data; end = data + size; } //For buffers the caller owns.
+	bool atEnd(void) const { return cur >= end; }
+private:
+	MappedFile file;
+};
+bool getToken(Tokenizer &t, TokenView &token, const CharClasses &oneCharTokens);
+bool getToken(Tokenizer &t, string &token, const CharClasses &oneCharTokens);
+int getFloats(Tokenizer &t, float *a, int num);
+int getInts(Tokenizer &t, int *a, int num);
+const char* parseFloat(const char *p, const char *end, float &val); //In place, returns p if no digits were read.
+const char* parseInt(const char *p, const char *end, int &val);
+
 void initSoundEngine(void);
 ISound *loadSound();
 
@@ -108,9 +199,11 @@ public:
 	RGBAImage(void) { width = 0; height = 0; textureId = NULL_HANDLE; samplerId = NULL_HANDLE; }
 	~RGBAImage();
 	bool loadPNG(const string &fileName, bool doFlipY = true);
+	bool decodePNG(const string &fullName, bool doFlipY = true); //loadPNG() minus the PATH lookup. No GL, so safe on a worker.
 	bool writeToPNG(const string &fileName);
 	void flipY(void);
 	void sendToOpenGL(GLuint magFilter, GLuint minFilter, bool createMipMap);
+	void refreshOpenGL(bool createMipMap); //New pixels into the same textureId, so nothing holding it needs rebinding.
 
 	unsigned int &operator()(int x, int y) {
 		return pixel(x, y);
@@ -150,6 +243,37 @@ public:
 
 //-------------------------------------------------------------------------//
 
+//A sphere and a box around the same points, local to a mesh or already in world space.
+struct Bounds {
+	glm::vec3 center;
+	float radius; //Negative when there is nothing to bound, which is never culled.
+	glm::vec3 boxMin, boxMax;
+
+	Bounds(void) : center(0), radius(-1.0f), boxMin(0), boxMax(0) {}
+	bool isEmpty(void) const { return radius < 0.0f; }
+	void fromPoints(const float *points, int numPoints, int stride); //stride in floats, from the first x to the next.
+	Bounds transformed(const glm::mat4x4 &M) const; //Both still enclose the transformed points, just less tightly.
+};
+//Six planes out of a world-view-projection matrix, normals facing in and normalized.
+class Frustum
+{
+public:
+	glm::vec4 planes[6];
+
+	void fromMatrix(const glm::mat4x4 &worldViewProject);
+	bool intersects(const Bounds &world) const; //Conservative: the sphere, then the box, against every plane.
+};
+
+//-------------------------------------------------------------------------//
+
+//What every program sees of the active camera, in the std140 layout of the ubCamera block (see useCameraBlock()).
+#define CAMERA_UBO_BINDING 2 //Lights are on 1.
+#define CAMERA_BLOCK_GLSL "layout(std140) uniform ubCamera {\n\tmat4 uViewM;\n\tmat4 uProjectM;\n\tmat4 uViewProjectM;\n\tvec4 uEyePosition;\n\tvec4 uEyeDirection;\n};\n"
+struct CameraBlock {
+	glm::mat4x4 view, project, viewProject;
+	glm::vec4 eye, direction; //w of 1 and 0.
+};
+
 class Camera
 {
 public:
@@ -161,6 +285,7 @@ public:
 	float znear, zfar; // near and far clip planes
 
 	glm::mat4x4 worldViewProject;
+	CameraBlock block; //Filled by refreshTransform(), uploaded by uploadCameraBuffer() once per frame for the active camera.
 
 	void refreshTransform(float screenWidth, float screenHeight);
 	void translateGlobal(const glm::vec3 &t) { eye += t; center += t; }
@@ -192,6 +317,18 @@ extern GLuint gLightsUBO;
 extern int gNumLights;
 extern Light gLights[MAX_LIGHTS];
 void initLightBuffer(void);
+extern GLuint gCameraUBO;
+void initCameraBuffer(void);
+void uploadCameraBuffer(const Camera &camera);
+void setObjectUniforms(const UniformTable &uniforms, const Camera &camera, const Transform &T); //With the program in use.
+
+//Instanced variants of a shader (see makeInstancedShader()) read the per-object matrices from these attributes instead,
+//a vec4 column per location after the mesh's own ones. The instance buffer holds one InstanceData per instance.
+#define V_INSTANCE_WORLD_M 4
+#define V_INSTANCE_WORLD_INVERSE_M 8
+struct InstanceData {
+	glm::mat4x4 worldM, worldInverseM;
+};
 
 // RENDER PACKET: MATERIAL, MESH & DRAWABLE
 class Material
@@ -201,21 +338,28 @@ public:
 	string name, vertexShaderName, fragmentShaderName;
 	int activeShaderProgram;
 	vector<GLuint> shaderProgramHandles;
-	vector<RGBAImage*> textures; //Holds all shader-relevant maps aside from the diffuse texture or sprite sheet contained in Drawable.
+	const UniformTable *uniforms; //Of the active program, owned by gProgramCache. Never null.
+	GLuint instancedProgram; //Variant of the first program, built by buildInstancedProgram() on first use.
+	bool triedInstanced; //So a shader that can't be instanced is only tried once.
+	const UniformTable *instancedUniforms;
+	vector<GLint> instancedLocations; //Of textures, then colors, in instancedProgram.
+	vector<string> shaderFiles; //Resolved sources and includes of the vertex and fragment shaders, for hot reload.
+	vector<NameIdVal<RGBAImage*>* > textures; //Sampler uniform name and location, with an image held from gTextureCache. Holds all shader-relevant maps aside from the diffuse texture or sprite sheet contained in Drawable.
 	vector<NameIdVal<glm::vec4>* > colors;
 	//"You want to be able to reuse the same shader and just send colors to the material."
 	//"Really you should have a MATERIAL CLASS that looks up the indices one time and stores those indices."
 	//"Once the shader program is compiled, the indices of the different uniforms then do not change."
-	Material(void) { colors.push_back(new NameIdVal<glm::vec4>()); colors.back()->name = "uDiffuseColor"; colors.back()->val = glm::vec4(1); }
-	~Material(void)
-	{
-		for (auto it = textures.begin(); it != textures.end(); ++it) delete *it;
-		for (auto it = shaderProgramHandles.begin(); it != shaderProgramHandles.end(); ++it) glDeleteProgram(*it);
-	}
-	void setShaderProgram(GLuint shaderProgram) { shaderProgramHandles.push_back(shaderProgram); }
-	void bindMaterial(void);
+	Material(void) : activeShaderProgram(0), uniforms(&gNoUniforms), instancedProgram(NULL_HANDLE), triedInstanced(false), instancedUniforms(&gNoUniforms) { colors.push_back(new NameIdVal<glm::vec4>()); colors.back()->name = "uDiffuseColor"; colors.back()->val = glm::vec4(1); }
+	~Material(void);
+	void setShaderProgram(GLuint shaderProgram); //Takes over the caller's gProgramCache reference.
+	void addTexture(const string &uniformName, RGBAImage *image); //Takes over the caller's gTextureCache reference.
+	void bindMaterial(void); //Resolves the texture and color locations, then applies them. Again after adding any.
+	void applyMaterial(bool instanced = false); //Per draw, through the locations bindMaterial() or buildInstancedProgram() resolved.
+	bool buildInstancedProgram(void); //True once instancedProgram is usable. Only for the first program.
+	bool reloadShaders(void); //Relinks the program from vertexShaderName and fragmentShaderName. Keeps the old one on failure.
 	void toSDL(FILE *F);
 };
+class CachedMesh; //AssetCache.h
 class TriMesh
 {
 public:
@@ -225,15 +369,23 @@ public:
 	vector<float> vertexData;
 	vector<int> indices;
 	int numIndices;
+	Bounds bounds; //Local, of the positions sendToOpenGL() uploaded.
 
 	GLuint vao; // vertex array handle
 	GLuint ibo; // index buffer handle
 
-	~TriMesh() { glDeleteBuffers(1, &vao); glDeleteBuffers(1, &ibo); }
+	TriMesh(void) : inLibrary(false), numIndices(0), vao(NULL_HANDLE), ibo(NULL_HANDLE) {}
+	~TriMesh(void);
 	void setName(const string &str) { name = str; }
+	bool loadFromPly(const string &fileName, bool flipZ = false); //readFromPlyCached() then sendToOpenGL().
+	bool readFromPlyCached(const string &fullName, bool flipZ, CachedMesh &cached); //No GL, so safe on a worker. A hit leaves the data in cached.
 	bool readFromPly(const string &fileName, bool flipZ = false);
+	bool writeToPly(const string &fileName, bool binary = true);
 	bool sendToOpenGL(void);
+	bool sendToOpenGL(const CachedMesh &cached); //Whatever readFromPlyCached() produced.
+	bool sendToOpenGL(const float *vertices, int numFloats, const int *faceIndices, int numFaceIndices); //Uploads as laid out by attributes.
 	void draw(void);
+	void drawInstanced(GLuint instanceBuffer, size_t offset, int numInstances); //offset in bytes to the first InstanceData.
 	void toSDL(FILE *F);
 };
 class Drawable {
@@ -242,16 +394,21 @@ public:
 	Material *material;
 	enum TYPE { TRIMESHINSTANCE, SPRITE, BILLBOARD };
 	TYPE type;
-	RGBAImage* diffuseTexture; //Used by the material, kept here to make them unique per object. May be sprite sheets.
+	RGBAImage* diffuseTexture; //Used by the material, kept here to make them unique per object. May be sprite sheets. Held from gTextureCache.
 
-	Drawable(void) { triMesh = nullptr; material = nullptr; }
+	Drawable(void) { triMesh = nullptr; material = nullptr; diffuseTexture = nullptr; }
+	Drawable(const Drawable &d); //Copies share diffuseTexture, so each holds a reference.
+	Drawable& operator=(const Drawable &d);
+	virtual ~Drawable(void);
 	Material* getMaterial() { return material; }
 	void setMesh(TriMesh *mesh) { triMesh = mesh; }
 	void setMaterial(Material *material_) { material = material_; }
 	virtual void draw(Camera& camera); //Not pure anymore, handles general mesh render.
 	virtual void prepareToDraw(const Camera& camera, Transform& T, Material& material); //Handle subclass-specific preparation.
+	void bindDiffuseTexture(const UniformTable &uniforms); //To unit 0, with the program in use.
 	virtual void toSDL(FILE *F, int tabAmt = 0) = 0;
 };
+void drawObject(Camera &camera, Drawable &drawable, Transform &T); //prepareToDraw(), the object uniforms, then draw().
 
 // DRAWABLES
 class Sprite : public Drawable {
@@ -296,8 +453,9 @@ struct SphereCollider {
 	glm::vec3 center; //Actual collider center in world coords.
 	glm::vec3 offset; //From node position, see node::update().
 	float radius;
-	TriMeshInstance *meshInstance; //Drawn by node::draw() if visible.
-	SphereCollider(glm::vec3 offset, float radius) : offset(offset), radius(radius), isRendered(true), meshInstance(new TriMeshInstance()) {}
+	TriMeshInstance *meshInstance; //Drawn with the node if visible.
+	Transform T; //The mesh scaled to radius at center, see node::update().
+	SphereCollider(glm::vec3 offset, float radius) : offset(offset), radius(radius), isRendered(true), meshInstance(new TriMeshInstance()) { T.rotation = glm::quat(glm::vec3(0, 0, 0)); }
 	bool intersects(const SphereCollider& c) {
 		return glm::dot(this->center - c.center, this->center - c.center) < (this->radius + c.radius)*(this->radius + c.radius); //Uses squared distances.
 	}
@@ -305,17 +463,20 @@ struct SphereCollider {
 
 
 class SceneGraphNode; //Because a Script references one.
+struct OctreeCell;
 class Script {
 public:
 	string type;
 	bool active;
 	SceneGraphNode* node; //The node this script is attached to.
 	Script(SceneGraphNode* n) : node(n) { active = true; }
+	virtual ~Script(void) {} //Nodes delete their scripts through Script*.
 	virtual Script* clone(SceneGraphNode *n) = 0;
 	virtual void postParseInit() = 0;
 	virtual bool setProperty(const string& propertyName, const string& propertyVal) = 0;
 	virtual void update(Camera& cam, double dt) = 0;
 	virtual void toSDL(FILE *F, const char* tabs) = 0;
+	virtual bool holdsOtherNodes(void) const { return false; } //Keeps pointers to nodes besides its own, or adds to their children.
 };
 
 class SceneGraphNode {
@@ -333,12 +494,16 @@ public:
 	Transform T;
 	SphereCollider * collider;
 	vector<ISound*> sounds;
-	void addScale(const glm::vec3 &s) { T.scale += s; }
-	void setScale(const glm::vec3 &s) { T.scale = s; }
-	void addRotation(const glm::vec3 &axis, const float angle) { T.rotation *= glm::quat(angle, axis); }
-	void setRotation(const glm::quat &r) { T.rotation = r; } //for (int i = 0; i < (int)cameras.size(); ++i) cameras[i]->rotateGlobal(r); }
-	void addTranslation(const glm::vec3 &t) { T.translation += t; for (int i = 0; i < (int)cameras.size(); ++i) cameras[i]->translateLocal(t); }
+	OctreeCell *octreeCell; //Where gOctree keeps it, nullptr until its first setTranslation().
+	int octreeSlot; //In octreeCell->entries.
+	int octreeRefreshes; //Left before gOctree stops refreshing it, 0 unless it moved lately.
+	void addScale(const glm::vec3 &s) { T.scale += s; markMoved(); }
+	void setScale(const glm::vec3 &s) { T.scale = s; markMoved(); }
+	void addRotation(const glm::vec3 &axis, const float angle) { T.rotation *= glm::quat(angle, axis); markMoved(); } //Rotation alone moves children.
+	void setRotation(const glm::quat &r) { T.rotation = r; markMoved(); } //for (int i = 0; i < (int)cameras.size(); ++i) cameras[i]->rotateGlobal(r); }
+	void addTranslation(const glm::vec3 &t) { T.translation += t; for (int i = 0; i < (int)cameras.size(); ++i) cameras[i]->translateLocal(t); markMoved(); }
 	void setTranslation(const glm::vec3 &t);
+	void markMoved(void); //Anything setting T directly calls this, or gOctree goes on looking for it where it was.
 	void hasCollided(SceneGraphNode *n) { cout << "Hit.\n"; } //cout << name << "\thit\t" << n->name << endl; }
 
 	SceneGraphNode(void);
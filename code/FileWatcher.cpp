@@ -0,0 +1,239 @@
+#include "FileWatcher.h"
+#include <sys/stat.h>
+#include <algorithm>
+
+// Platform includes for change notification. NOGDI keeps wingdi.h from defining ERROR over ours.
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#define NOGDI
+#include <windows.h>
+#else
+#include <sys/inotify.h>
+#include <poll.h>
+#include <unistd.h>
+#include <errno.h>
+#endif
+
+FileWatcher gFileWatcher;
+
+//-------------------------------------------------------------------------//
+// FILE WATCHER
+//-------------------------------------------------------------------------//
+
+#ifdef _WIN32
+struct FileWatcher::Backend {
+	HANDLE wakeEvent; //Set on stop() and whenever a directory is added, so the wait list gets rebuilt.
+	vector<HANDLE> dirHandles; //Under lock, parallel to dirNames.
+	vector<string> dirNames;
+};
+#else
+struct FileWatcher::Backend {
+	int notifyFd, wakePipe[2]; //The pipe only ever carries the stop() byte.
+	map<int, vector<string> > watchDirs; //Under lock, inotify watch descriptor to every spelling of its directory.
+};
+#endif
+
+static void splitFileName(const string &fullName, string &dir, string &name)
+{
+	size_t separatorIndex = fullName.find_last_of("/\\");
+	dir = (separatorIndex == string::npos) ? "" : fullName.substr(0, separatorIndex + 1);
+	name = fullName.substr(dir.size());
+}
+static string getOSDirectory(const string &dir) { return dir.empty() ? "." : dir; }
+static void getFileStamp(const string &fullName, long long &size, long long &time)
+{
+	struct stat st;
+	if (stat(fullName.c_str(), &st) != 0) size = time = -1;
+	else { size = (long long)st.st_size; time = (long long)st.st_mtime; }
+}
+
+void FileWatcher::start(void)
+{
+	if (backend != nullptr) return;
+	backend = new Backend();
+#ifdef _WIN32
+	backend->wakeEvent = CreateEventA(NULL, FALSE, FALSE, NULL);
+	bool ok = (backend->wakeEvent != NULL);
+#else
+	backend->wakePipe[0] = backend->wakePipe[1] = -1;
+	backend->notifyFd = inotify_init1(IN_CLOEXEC | IN_NONBLOCK);
+	bool ok = (backend->notifyFd >= 0 && pipe(backend->wakePipe) == 0);
+	if (!ok) {
+		if (backend->notifyFd >= 0) close(backend->notifyFd);
+	}
+#endif
+	if (!ok) {
+		ERROR("Could not start the file watcher, hot reload is off.", false);
+		delete backend;
+		backend = nullptr;
+		return;
+	}
+
+	lock_guard<mutex> guard(lock);
+	quitting = false;
+	for (auto it = dirs.cbegin(); it != dirs.cend(); ++it) watchDirectory(it->first);
+	watcher = thread(&FileWatcher::watchLoop, this);
+}
+void FileWatcher::stop(void)
+{
+	if (backend == nullptr) return;
+	{
+		lock_guard<mutex> guard(lock);
+		quitting = true;
+	}
+#ifdef _WIN32
+	SetEvent(backend->wakeEvent);
+	watcher.join();
+	for (int i = 0; i < (int)backend->dirHandles.size(); ++i) FindCloseChangeNotification(backend->dirHandles[i]);
+	CloseHandle(backend->wakeEvent);
+#else
+	char quit = 0;
+	if (write(backend->wakePipe[1], &quit, 1) != 1) ERROR("Could not wake the file watcher.", false);
+	watcher.join();
+	close(backend->notifyFd); //Also drops every watch.
+	close(backend->wakePipe[0]);
+	close(backend->wakePipe[1]);
+#endif
+	delete backend;
+	backend = nullptr;
+}
+void FileWatcher::watch(const string &fullName)
+{
+	string dir, name;
+	splitFileName(fullName, dir, name);
+
+	lock_guard<mutex> guard(lock);
+	auto d = dirs.find(dir);
+	if (d == dirs.end()) {
+		d = dirs.insert(make_pair(dir, map<string, Stamp>())).first;
+		if (backend != nullptr) watchDirectory(dir);
+	}
+	if (d->second.count(name) != 0) return;
+	Stamp &stamp = d->second[name];
+	getFileStamp(fullName, stamp.size, stamp.time);
+}
+void FileWatcher::takeChanges(vector<string> &fullNames)
+{
+	lock_guard<mutex> guard(lock);
+	fullNames.assign(changes.begin(), changes.end());
+	changes.clear();
+	changed.store(false, memory_order_relaxed);
+}
+void FileWatcher::restamp(const string &dir, map<string, Stamp> &files, set<string> &pending)
+{
+	for (auto it = files.begin(); it != files.end(); ++it) {
+		Stamp now;
+		getFileStamp(dir + it->first, now.size, now.time);
+		if (now.size == it->second.size && now.time == it->second.time) continue;
+		it->second = now;
+		pending.insert(dir + it->first);
+	}
+}
+void FileWatcher::publish(set<string> &pending)
+{
+	lock_guard<mutex> guard(lock);
+	changes.insert(pending.begin(), pending.end());
+	pending.clear();
+	changed.store(true, memory_order_release);
+}
+
+#ifdef _WIN32
+void FileWatcher::watchDirectory(const string &dir)
+{
+	//One wait slot is the wake event, so that bounds the number of directories.
+	if ((int)backend->dirHandles.size() >= MAXIMUM_WAIT_OBJECTS - 1) {
+		ERROR("Too many directories to watch, not watching " + getOSDirectory(dir), false);
+		return;
+	}
+	HANDLE handle = FindFirstChangeNotificationA(getOSDirectory(dir).c_str(), FALSE,
+		FILE_NOTIFY_CHANGE_LAST_WRITE | FILE_NOTIFY_CHANGE_SIZE | FILE_NOTIFY_CHANGE_FILE_NAME);
+	if (handle == INVALID_HANDLE_VALUE) {
+		ERROR("Could not watch " + getOSDirectory(dir), false);
+		return;
+	}
+	backend->dirHandles.push_back(handle);
+	backend->dirNames.push_back(dir);
+	SetEvent(backend->wakeEvent);
+}
+void FileWatcher::watchLoop(void)
+{
+	set<string> pending; //Written, but the directory isn't quiet yet.
+	while (true) {
+		vector<HANDLE> handles(1, backend->wakeEvent);
+		vector<string> names;
+		{
+			lock_guard<mutex> guard(lock);
+			if (quitting) break;
+			handles.insert(handles.end(), backend->dirHandles.begin(), backend->dirHandles.end());
+			names = backend->dirNames;
+		}
+
+		DWORD result = WaitForMultipleObjects((DWORD)handles.size(), &handles[0], FALSE, pending.empty() ? INFINITE : FILE_WATCH_SETTLE_MS);
+		if (result == WAIT_TIMEOUT) { publish(pending); continue; }
+		if (result == WAIT_FAILED) { ERROR("File watcher stopped, hot reload is off.", false); break; }
+		DWORD index = result - WAIT_OBJECT_0;
+		if (index == 0 || index >= handles.size()) continue; //New directory or stop().
+		FindNextChangeNotification(handles[index]);
+
+		//The notification doesn't say which file, so the watched ones are checked against their stamps.
+		lock_guard<mutex> guard(lock);
+		auto d = dirs.find(names[index - 1]);
+		if (d != dirs.end()) restamp(d->first, d->second, pending);
+	}
+}
+#else
+void FileWatcher::watchDirectory(const string &dir)
+{
+	//Whole directories, as editors that save through a rename would leave a watch on the file itself dangling.
+	int wd = inotify_add_watch(backend->notifyFd, getOSDirectory(dir).c_str(), IN_CLOSE_WRITE | IN_MOVED_TO);
+	//"shaders/" and "./shaders/" get the same descriptor back, so it keeps every spelling dirs has the files under.
+	if (wd < 0) ERROR("Could not watch " + getOSDirectory(dir), false);
+	else {
+		vector<string> &spellings = backend->watchDirs[wd];
+		if (find(spellings.begin(), spellings.end(), dir) == spellings.end()) spellings.push_back(dir);
+	}
+}
+void FileWatcher::watchLoop(void)
+{
+	set<string> pending; //Written, but the directory isn't quiet yet.
+	union { inotify_event event; char bytes[4096]; } buffer; //The union keeps the events aligned.
+	while (true) {
+		pollfd fds[2] = { { backend->notifyFd, POLLIN, 0 }, { backend->wakePipe[0], POLLIN, 0 } };
+		int numReady = poll(fds, 2, pending.empty() ? -1 : FILE_WATCH_SETTLE_MS);
+		if (numReady < 0) {
+			if (errno == EINTR) continue;
+			ERROR("File watcher stopped, hot reload is off.", false);
+			break;
+		}
+		if (fds[1].revents != 0) break; //stop().
+		if (numReady == 0) { publish(pending); continue; }
+
+		ssize_t numBytes = read(backend->notifyFd, buffer.bytes, sizeof(buffer.bytes));
+		if (numBytes < 0) {
+			if (errno == EAGAIN || errno == EINTR) continue; //Nothing pending after all.
+			ERROR("File watcher stopped, hot reload is off.", false);
+			break;
+		}
+		lock_guard<mutex> guard(lock);
+		for (ssize_t i = 0; i < numBytes;) {
+			const inotify_event *e = (const inotify_event*)(buffer.bytes + i);
+			i += sizeof(inotify_event) + e->len;
+			if (e->mask & IN_Q_OVERFLOW) { //Events were dropped, so which files changed is only known from their stamps.
+				for (auto d = dirs.begin(); d != dirs.end(); ++d) restamp(d->first, d->second, pending);
+				continue;
+			}
+			auto w = backend->watchDirs.find(e->wd);
+			if (e->len == 0 || w == backend->watchDirs.end()) continue;
+			for (int j = 0; j < (int)w->second.size(); ++j) {
+				auto d = dirs.find(w->second[j]);
+				if (d == dirs.end()) continue;
+				auto f = d->second.find(e->name);
+				if (f == d->second.end()) continue;
+				getFileStamp(d->first + f->first, f->second.size, f->second.time); //Kept current, so an overflow only queues what it missed.
+				pending.insert(d->first + f->first);
+			}
+		}
+	}
+}
+#endif
@@ -0,0 +1,48 @@
+#pragma once
+#include "EngineUtil.h"
+#include <atomic>
+#include <mutex>
+#include <set>
+
+//-------------------------------------------------------------------------//
+// FILE WATCHER
+//-------------------------------------------------------------------------//
+
+//Watches every file that can be hot reloaded (shader sources with their includes, cached textures) from one
+//background thread: inotify on Linux, directory change notifications on Windows. The game loop only calls
+//hasChanges(), a relaxed atomic load, so nothing is spent per frame until a watched file is really written.
+#define FILE_WATCH_SETTLE_MS 50 //Editors often save in several writes, so changes go out once a directory is quiet.
+
+class FileWatcher
+{
+public:
+	FileWatcher(void) : changed(false), quitting(false), backend(nullptr) {}
+	~FileWatcher() { stop(); }
+	void start(void); //Files watched before this are picked up too.
+	void stop(void);
+	bool isRunning(void) const { return backend != nullptr; }
+
+	void watch(const string &fullName); //Any thread. Takes a name resolved by getFullFileName().
+	bool hasChanges(void) const { return changed.load(memory_order_relaxed); }
+	void takeChanges(vector<string> &fullNames); //Hands back the full names written since the last call.
+
+private:
+	struct Stamp { long long size, time; };
+	struct Backend; //Platform handles, see FileWatcher.cpp.
+
+	map<string, map<string, Stamp> > dirs; //Directory (as spelled in fullName, "" for none) to watched file names.
+	set<string> changes;
+	atomic<bool> changed;
+	bool quitting;
+	Backend *backend;
+	thread watcher;
+	mutex lock;
+
+	void watchDirectory(const string &dir); //With lock held.
+	void restamp(const string &dir, map<string, Stamp> &files, set<string> &pending); //With lock held. Queues what changed since its stamp.
+	void publish(set<string> &pending);
+	void watchLoop(void);
+	FileWatcher(const FileWatcher&); //Owns a thread, not copyable.
+	FileWatcher& operator=(const FileWatcher&);
+};
+extern FileWatcher gFileWatcher;
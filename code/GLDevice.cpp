@@ -0,0 +1,327 @@
+#define GL_DEVICE_DRIVER_NAMES
+#include "EngineUtil.h"
+#include <algorithm>
+
+GLDevice gGL;
+GLRecording gGLRecording;
+
+//-------------------------------------------------------------------------//
+// GL DEVICE
+//-------------------------------------------------------------------------//
+
+#define GL_DEVICE_NAME(ret, name, params, kind) "gl" #name,
+#define GL_DEVICE_KIND(ret, name, params, kind) kind,
+static const char *GL_FUNCTION_NAMES[NUM_GL_FUNCTIONS] = { GL_DEVICE_FUNCTIONS(GL_DEVICE_NAME) };
+static const GL_CALL_KIND GL_FUNCTION_KINDS[NUM_GL_FUNCTIONS] = { GL_DEVICE_FUNCTIONS(GL_DEVICE_KIND) };
+static const char *GL_CALL_KIND_NAMES[NUM_CALL_KINDS] = { "state", "draw", "upload", "object", "query" };
+static bool gIsRecording = false;
+
+//The casts only paper over const differences between glew versions, e.g. in glShaderSource().
+#define GL_DEVICE_DRIVER(ret, name, params, kind) gGL.name = (ret (GLAPIENTRY*)params)gl##name;
+void useDriverGL(void)
+{
+	GL_DEVICE_FUNCTIONS(GL_DEVICE_DRIVER)
+	gIsRecording = false;
+}
+bool isRecordingGL(void)
+{
+	return gIsRecording;
+}
+
+void GLRecording::clear(void)
+{
+	for (int i = 0; i < NUM_GL_FUNCTIONS; ++i) calls[i] = 0;
+	bytesUploaded = numVertices = 0;
+}
+int GLRecording::getNumCalls(void) const
+{
+	int total = 0;
+	for (int i = 0; i < NUM_GL_FUNCTIONS; ++i) total += calls[i];
+	return total;
+}
+int GLRecording::getNumCalls(GL_CALL_KIND kind) const
+{
+	int total = 0;
+	for (int i = 0; i < NUM_GL_FUNCTIONS; ++i) if (GL_FUNCTION_KINDS[i] == kind) total += calls[i];
+	return total;
+}
+void GLRecording::print(int numFrames) const
+{
+	double n = (double)max(numFrames, 1);
+	printf("\t%.1f GL calls (", getNumCalls() / n);
+	for (int k = 0; k < NUM_CALL_KINDS; ++k) printf("%s%s %.1f", (k > 0) ? ", " : "", GL_CALL_KIND_NAMES[k], getNumCalls((GL_CALL_KIND)k) / n);
+	printf("), %.0f bytes uploaded, %.0f vertices drawn.\n", bytesUploaded / n, numVertices / n);
+	for (int i = 0; i < NUM_GL_FUNCTIONS; ++i) if (calls[i] > 0) printf("\t\t%-28s %.1f\n", GL_FUNCTION_NAMES[i], calls[i] / n);
+}
+
+//-------------------------------------------------------------------------//
+// RECORDING DEVICE
+//-------------------------------------------------------------------------//
+
+//What a program would report of its non-block uniforms, taken from the declarations in its shaders' source.
+struct RecordedUniform {
+	string name;
+	GLint size; //Array length, 1 otherwise.
+	GLenum type;
+};
+struct RecordedShader {
+	vector<RecordedUniform> uniforms;
+	vector<string> blocks;
+};
+struct RecordedProgram {
+	vector<GLuint> shaders;
+	vector<RecordedUniform> uniforms; //Their index is their location.
+	vector<string> blocks;
+};
+static GLuint gNextName = 1; //One sequence for every kind of object, 0 stays the null handle.
+static map<GLuint, RecordedShader> gRecordedShaders;
+static map<GLuint, RecordedProgram> gRecordedPrograms;
+
+static GLenum getUniformType(const string &type)
+{
+	static const struct { const char *name; GLenum type; } TYPES[] = {
+		{ "float", GL_FLOAT }, { "vec2", GL_FLOAT_VEC2 }, { "vec3", GL_FLOAT_VEC3 }, { "vec4", GL_FLOAT_VEC4 },
+		{ "int", GL_INT }, { "bool", GL_BOOL }, { "mat3", GL_FLOAT_MAT3 }, { "mat4", GL_FLOAT_MAT4 },
+		{ "sampler1D", GL_SAMPLER_1D }, { "sampler2D", GL_SAMPLER_2D }, { "samplerCube", GL_SAMPLER_CUBE }
+	};
+	for (int i = 0; i < (int)(sizeof(TYPES) / sizeof(TYPES[0])); ++i) if (type == TYPES[i].name) return TYPES[i].type;
+	return GL_FLOAT;
+}
+static bool isIdentifierChar(char c) { return isalnum((unsigned char)c) || c == '_'; }
+static size_t skipSpace(const string &code, size_t i) { while (i < code.size() && isspace((unsigned char)code[i])) ++i; return i; }
+static size_t readIdentifier(const string &code, size_t i, string &identifier)
+{
+	size_t start = i;
+	while (i < code.size() && isIdentifierChar(code[i])) ++i;
+	identifier.assign(code, start, i - start);
+	return i;
+}
+//"uniform type name[, name...];" and "uniform Block { ... }", outside of // comments. Good enough for our shaders,
+//which reach here already preprocessed.
+static void recordShaderSource(const string &code, RecordedShader &shader)
+{
+	shader.uniforms.clear();
+	shader.blocks.clear();
+	for (size_t i = code.find("uniform"); i != string::npos; i = code.find("uniform", i)) {
+		size_t lineStart = code.rfind('\n', i);
+		lineStart = (lineStart == string::npos) ? 0 : lineStart + 1;
+		bool isWord = (i == 0 || !isIdentifierChar(code[i - 1])) && (i + 7 < code.size() && !isIdentifierChar(code[i + 7]));
+		bool isComment = code.find("//", lineStart) < i;
+		i += 7;
+		if (!isWord || isComment) continue;
+
+		string type;
+		i = readIdentifier(code, skipSpace(code, i), type);
+		if (type == "lowp" || type == "mediump" || type == "highp") i = readIdentifier(code, skipSpace(code, i), type);
+		i = skipSpace(code, i);
+		if (i < code.size() && code[i] == '{') {
+			shader.blocks.push_back(type);
+			i = code.find('}', i);
+			continue;
+		}
+		while (i < code.size()) {
+			RecordedUniform u;
+			i = readIdentifier(code, skipSpace(code, i), u.name);
+			if (u.name.empty()) break;
+			u.type = getUniformType(type);
+			u.size = 1;
+			i = skipSpace(code, i);
+			if (i < code.size() && code[i] == '[') {
+				u.size = max(atoi(code.c_str() + i + 1), 1);
+				i = code.find(']', i);
+				if (i == string::npos) break;
+				i = skipSpace(code, i + 1);
+			}
+			shader.uniforms.push_back(u);
+			if (i >= code.size() || code[i] != ',') break;
+			++i;
+		}
+	}
+}
+static int getTexelSize(GLenum format, GLenum type)
+{
+	int numComponents = 1;
+	if (format == GL_RGBA || format == GL_BGRA) numComponents = 4;
+	else if (format == GL_RGB || format == GL_BGR) numComponents = 3;
+	else if (format == GL_RG) numComponents = 2;
+	int componentSize = 1;
+	if (type == GL_FLOAT || type == GL_INT || type == GL_UNSIGNED_INT) componentSize = 4;
+	else if (type == GL_SHORT || type == GL_UNSIGNED_SHORT || type == GL_HALF_FLOAT) componentSize = 2;
+	return numComponents * componentSize;
+}
+static void copyString(const string &s, GLsizei bufSize, GLsizei *length, GLchar *buffer)
+{
+	GLsizei n = (bufSize > 0) ? min((GLsizei)s.size(), bufSize - 1) : 0;
+	if (bufSize > 0) {
+		memcpy(buffer, s.c_str(), n);
+		buffer[n] = '\0';
+	}
+	if (length != nullptr) *length = n;
+}
+static void genNames(GLsizei n, GLuint *names) { for (GLsizei i = 0; i < n; ++i) names[i] = gNextName++; }
+static void count(GL_FUNCTION f) { ++gGLRecording.calls[f]; }
+
+static void GLAPIENTRY recordActiveTexture(GLenum) { count(GLF_ActiveTexture); }
+static void GLAPIENTRY recordAttachShader(GLuint program, GLuint shader) { count(GLF_AttachShader); gRecordedPrograms[program].shaders.push_back(shader); }
+static void GLAPIENTRY recordBindAttribLocation(GLuint, GLuint, const GLchar*) { count(GLF_BindAttribLocation); }
+static void GLAPIENTRY recordBindBuffer(GLenum, GLuint) { count(GLF_BindBuffer); }
+static void GLAPIENTRY recordBindBufferBase(GLenum, GLuint, GLuint) { count(GLF_BindBufferBase); }
+static void GLAPIENTRY recordBindSampler(GLuint, GLuint) { count(GLF_BindSampler); }
+static void GLAPIENTRY recordBindTexture(GLenum, GLuint) { count(GLF_BindTexture); }
+static void GLAPIENTRY recordBindVertexArray(GLuint) { count(GLF_BindVertexArray); }
+static void GLAPIENTRY recordBlendFunc(GLenum, GLenum) { count(GLF_BlendFunc); }
+static void GLAPIENTRY recordBufferData(GLenum, GLsizeiptr size, const void *data, GLenum)
+{
+	count(GLF_BufferData);
+	if (data != nullptr) gGLRecording.bytesUploaded += size;
+}
+static void GLAPIENTRY recordBufferSubData(GLenum, GLintptr, GLsizeiptr size, const void*) { count(GLF_BufferSubData); gGLRecording.bytesUploaded += size; }
+static void GLAPIENTRY recordClear(GLbitfield) { count(GLF_Clear); }
+static void GLAPIENTRY recordClearColor(GLfloat, GLfloat, GLfloat, GLfloat) { count(GLF_ClearColor); }
+static void GLAPIENTRY recordCompileShader(GLuint) { count(GLF_CompileShader); }
+static GLuint GLAPIENTRY recordCreateProgram(void)
+{
+	count(GLF_CreateProgram);
+	gRecordedPrograms[gNextName] = RecordedProgram();
+	return gNextName++;
+}
+static GLuint GLAPIENTRY recordCreateShader(GLenum)
+{
+	count(GLF_CreateShader);
+	gRecordedShaders[gNextName] = RecordedShader();
+	return gNextName++;
+}
+static void GLAPIENTRY recordCullFace(GLenum) { count(GLF_CullFace); }
+static void GLAPIENTRY recordDeleteBuffers(GLsizei, const GLuint*) { count(GLF_DeleteBuffers); }
+static void GLAPIENTRY recordDeleteProgram(GLuint program) { count(GLF_DeleteProgram); gRecordedPrograms.erase(program); }
+static void GLAPIENTRY recordDeleteSamplers(GLsizei, const GLuint*) { count(GLF_DeleteSamplers); }
+static void GLAPIENTRY recordDeleteShader(GLuint shader) { count(GLF_DeleteShader); gRecordedShaders.erase(shader); } //Linked programs keep what they took.
+static void GLAPIENTRY recordDeleteTextures(GLsizei, const GLuint*) { count(GLF_DeleteTextures); }
+static void GLAPIENTRY recordDeleteVertexArrays(GLsizei, const GLuint*) { count(GLF_DeleteVertexArrays); }
+static void GLAPIENTRY recordDepthFunc(GLenum) { count(GLF_DepthFunc); }
+static void GLAPIENTRY recordDisable(GLenum) { count(GLF_Disable); }
+static void GLAPIENTRY recordDisableVertexAttribArray(GLuint) { count(GLF_DisableVertexAttribArray); }
+static void GLAPIENTRY recordDrawArrays(GLenum, GLint, GLsizei n) { count(GLF_DrawArrays); gGLRecording.numVertices += n; }
+static void GLAPIENTRY recordDrawArraysInstanced(GLenum, GLint, GLsizei n, GLsizei numInstances)
+{
+	count(GLF_DrawArraysInstanced);
+	gGLRecording.numVertices += (int64_t)n * numInstances;
+}
+static void GLAPIENTRY recordDrawElements(GLenum, GLsizei n, GLenum, const void*) { count(GLF_DrawElements); gGLRecording.numVertices += n; }
+static void GLAPIENTRY recordDrawElementsInstanced(GLenum, GLsizei n, GLenum, const void*, GLsizei numInstances)
+{
+	count(GLF_DrawElementsInstanced);
+	gGLRecording.numVertices += (int64_t)n * numInstances;
+}
+static void GLAPIENTRY recordEnable(GLenum) { count(GLF_Enable); }
+static void GLAPIENTRY recordEnableVertexAttribArray(GLuint) { count(GLF_EnableVertexAttribArray); }
+static void GLAPIENTRY recordGenBuffers(GLsizei n, GLuint *buffers) { count(GLF_GenBuffers); genNames(n, buffers); }
+static void GLAPIENTRY recordGenerateMipmap(GLenum) { count(GLF_GenerateMipmap); }
+static void GLAPIENTRY recordGenSamplers(GLsizei n, GLuint *samplers) { count(GLF_GenSamplers); genNames(n, samplers); }
+static void GLAPIENTRY recordGenTextures(GLsizei n, GLuint *textures) { count(GLF_GenTextures); genNames(n, textures); }
+static void GLAPIENTRY recordGenVertexArrays(GLsizei n, GLuint *arrays) { count(GLF_GenVertexArrays); genNames(n, arrays); }
+static void GLAPIENTRY recordGetActiveUniform(GLuint program, GLuint index, GLsizei bufSize, GLsizei *length, GLint *size, GLenum *type, GLchar *name)
+{
+	count(GLF_GetActiveUniform);
+	const vector<RecordedUniform> &uniforms = gRecordedPrograms[program].uniforms;
+	if (index >= uniforms.size()) {
+		copyString("", bufSize, length, name);
+		return;
+	}
+	const RecordedUniform &u = uniforms[index];
+	copyString((u.size > 1) ? u.name + "[0]" : u.name, bufSize, length, name); //As drivers name arrays.
+	*size = u.size;
+	*type = u.type;
+}
+static void GLAPIENTRY recordGetIntegerv(GLenum, GLint *data) { count(GLF_GetIntegerv); *data = 0; }
+static void GLAPIENTRY recordGetProgramBinary(GLuint, GLsizei, GLsizei *length, GLenum *binaryFormat, void*)
+{
+	count(GLF_GetProgramBinary);
+	if (length != nullptr) *length = 0;
+	*binaryFormat = 0;
+}
+static void GLAPIENTRY recordGetProgramInfoLog(GLuint, GLsizei bufSize, GLsizei *length, GLchar *infoLog) { count(GLF_GetProgramInfoLog); copyString("", bufSize, length, infoLog); }
+static void GLAPIENTRY recordGetProgramiv(GLuint program, GLenum pname, GLint *params)
+{
+	count(GLF_GetProgramiv);
+	const RecordedProgram &p = gRecordedPrograms[program];
+	*params = 0;
+	if (pname == GL_LINK_STATUS) *params = GL_TRUE;
+	else if (pname == GL_ACTIVE_UNIFORMS) *params = (GLint)p.uniforms.size();
+	else if (pname == GL_ACTIVE_UNIFORM_MAX_LENGTH)
+		for (int i = 0; i < (int)p.uniforms.size(); ++i) *params = max(*params, (GLint)p.uniforms[i].name.size() + 4); //[0] and the terminator.
+}
+static void GLAPIENTRY recordGetShaderInfoLog(GLuint, GLsizei bufSize, GLsizei *length, GLchar *infoLog) { count(GLF_GetShaderInfoLog); copyString("", bufSize, length, infoLog); }
+static void GLAPIENTRY recordGetShaderiv(GLuint, GLenum pname, GLint *params) { count(GLF_GetShaderiv); *params = (pname == GL_COMPILE_STATUS) ? GL_TRUE : 0; }
+static const GLubyte* GLAPIENTRY recordGetString(GLenum) { count(GLF_GetString); return (const GLubyte*)"recording device"; }
+static GLuint GLAPIENTRY recordGetUniformBlockIndex(GLuint program, const GLchar *uniformBlockName)
+{
+	count(GLF_GetUniformBlockIndex);
+	const vector<string> &blocks = gRecordedPrograms[program].blocks;
+	auto it = find(blocks.begin(), blocks.end(), string(uniformBlockName));
+	return (it == blocks.end()) ? GL_INVALID_INDEX : (GLuint)(it - blocks.begin());
+}
+static GLint GLAPIENTRY recordGetUniformLocation(GLuint program, const GLchar *name)
+{
+	count(GLF_GetUniformLocation);
+	const vector<RecordedUniform> &uniforms = gRecordedPrograms[program].uniforms;
+	string plainName(name);
+	if (plainName.size() > 3 && plainName.compare(plainName.size() - 3, 3, "[0]") == 0) plainName.resize(plainName.size() - 3);
+	for (int i = 0; i < (int)uniforms.size(); ++i) if (uniforms[i].name == plainName) return i;
+	return -1;
+}
+static void GLAPIENTRY recordLinkProgram(GLuint program)
+{
+	count(GLF_LinkProgram);
+	RecordedProgram &p = gRecordedPrograms[program];
+	p.uniforms.clear();
+	p.blocks.clear();
+	for (int s = 0; s < (int)p.shaders.size(); ++s) {
+		const RecordedShader &shader = gRecordedShaders[p.shaders[s]];
+		for (int i = 0; i < (int)shader.uniforms.size(); ++i) {
+			bool isKnown = false; //Both stages may declare the same one.
+			for (int j = 0; j < (int)p.uniforms.size() && !isKnown; ++j) isKnown = p.uniforms[j].name == shader.uniforms[i].name;
+			if (!isKnown) p.uniforms.push_back(shader.uniforms[i]);
+		}
+		for (int i = 0; i < (int)shader.blocks.size(); ++i)
+			if (find(p.blocks.begin(), p.blocks.end(), shader.blocks[i]) == p.blocks.end()) p.blocks.push_back(shader.blocks[i]);
+	}
+}
+static void GLAPIENTRY recordProgramBinary(GLuint, GLenum, const void*, GLsizei length) { count(GLF_ProgramBinary); gGLRecording.bytesUploaded += length; }
+static void GLAPIENTRY recordProgramParameteri(GLuint, GLenum, GLint) { count(GLF_ProgramParameteri); }
+static void GLAPIENTRY recordSamplerParameteri(GLuint, GLenum, GLint) { count(GLF_SamplerParameteri); }
+static void GLAPIENTRY recordShaderSource(GLuint shader, GLsizei numStrings, const GLchar *const *strings, const GLint *lengths)
+{
+	count(GLF_ShaderSource);
+	string code;
+	for (GLsizei i = 0; i < numStrings; ++i) {
+		if (lengths != nullptr && lengths[i] >= 0) code.append(strings[i], lengths[i]);
+		else code.append(strings[i]);
+	}
+	recordShaderSource(code, gRecordedShaders[shader]);
+}
+static void GLAPIENTRY recordTexImage2D(GLenum, GLint, GLint, GLsizei width, GLsizei height, GLint, GLenum format, GLenum type, const void *pixels)
+{
+	count(GLF_TexImage2D);
+	if (pixels != nullptr) gGLRecording.bytesUploaded += (int64_t)width * height * getTexelSize(format, type);
+}
+static void GLAPIENTRY recordTexParameteri(GLenum, GLenum, GLint) { count(GLF_TexParameteri); }
+static void GLAPIENTRY recordTexSubImage2D(GLenum, GLint, GLint, GLint, GLsizei width, GLsizei height, GLenum format, GLenum type, const void*)
+{
+	count(GLF_TexSubImage2D);
+	gGLRecording.bytesUploaded += (int64_t)width * height * getTexelSize(format, type);
+}
+static void GLAPIENTRY recordUniform1i(GLint, GLint) { count(GLF_Uniform1i); }
+static void GLAPIENTRY recordUniform4fv(GLint, GLsizei, const GLfloat*) { count(GLF_Uniform4fv); }
+static void GLAPIENTRY recordUniformBlockBinding(GLuint, GLuint, GLuint) { count(GLF_UniformBlockBinding); }
+static void GLAPIENTRY recordUniformMatrix4fv(GLint, GLsizei, GLboolean, const GLfloat*) { count(GLF_UniformMatrix4fv); }
+static void GLAPIENTRY recordUseProgram(GLuint) { count(GLF_UseProgram); }
+static void GLAPIENTRY recordVertexAttribDivisor(GLuint, GLuint) { count(GLF_VertexAttribDivisor); }
+static void GLAPIENTRY recordVertexAttribPointer(GLuint, GLint, GLenum, GLboolean, GLsizei, const void*) { count(GLF_VertexAttribPointer); }
+
+#define GL_DEVICE_RECORDING(ret, name, params, kind) gGL.name = record##name;
+void useRecordingGL(void)
+{
+	GL_DEVICE_FUNCTIONS(GL_DEVICE_RECORDING)
+	gIsRecording = true;
+}
@@ -0,0 +1,233 @@
+#pragma once
+#include <GL/glew.h>
+#include <stdint.h>
+
+//-------------------------------------------------------------------------//
+// GL DEVICE
+//-------------------------------------------------------------------------//
+
+//Every GL entry point the engine calls, as one table of function pointers, gGL. Below, each gl*() name is redefined
+//to go through it, the same trick glew plays for its own entry points, so the code everywhere else still reads as
+//plain GL. useDriverGL() points the table at the real driver once glew is up. useRecordingGL() points it at a
+//recorder that needs no window or context: it hands out names, reports every shader as compiled and linked with the
+//uniforms its source declares, and counts what would have reached the driver in gGLRecording. That's --headless.
+//A gl*() call missing from this list goes straight to the driver, and crashes headless, so add it here first.
+enum GL_CALL_KIND { C_STATE, C_DRAW, C_UPLOAD, C_OBJECT, C_QUERY, NUM_CALL_KINDS };
+
+//F(return type, name without gl, parameters, kind)
+#define GL_DEVICE_FUNCTIONS(F) \
+	F(void, ActiveTexture, (GLenum texture), C_STATE) \
+	F(void, AttachShader, (GLuint program, GLuint shader), C_OBJECT) \
+	F(void, BindAttribLocation, (GLuint program, GLuint index, const GLchar *name), C_OBJECT) \
+	F(void, BindBuffer, (GLenum target, GLuint buffer), C_STATE) \
+	F(void, BindBufferBase, (GLenum target, GLuint index, GLuint buffer), C_STATE) \
+	F(void, BindSampler, (GLuint unit, GLuint sampler), C_STATE) \
+	F(void, BindTexture, (GLenum target, GLuint texture), C_STATE) \
+	F(void, BindVertexArray, (GLuint array), C_STATE) \
+	F(void, BlendFunc, (GLenum sfactor, GLenum dfactor), C_STATE) \
+	F(void, BufferData, (GLenum target, GLsizeiptr size, const void *data, GLenum usage), C_UPLOAD) \
+	F(void, BufferSubData, (GLenum target, GLintptr offset, GLsizeiptr size, const void *data), C_UPLOAD) \
+	F(void, Clear, (GLbitfield mask), C_DRAW) \
+	F(void, ClearColor, (GLfloat red, GLfloat green, GLfloat blue, GLfloat alpha), C_STATE) \
+	F(void, CompileShader, (GLuint shader), C_OBJECT) \
+	F(GLuint, CreateProgram, (void), C_OBJECT) \
+	F(GLuint, CreateShader, (GLenum type), C_OBJECT) \
+	F(void, CullFace, (GLenum mode), C_STATE) \
+	F(void, DeleteBuffers, (GLsizei n, const GLuint *buffers), C_OBJECT) \
+	F(void, DeleteProgram, (GLuint program), C_OBJECT) \
+	F(void, DeleteSamplers, (GLsizei count, const GLuint *samplers), C_OBJECT) \
+	F(void, DeleteShader, (GLuint shader), C_OBJECT) \
+	F(void, DeleteTextures, (GLsizei n, const GLuint *textures), C_OBJECT) \
+	F(void, DeleteVertexArrays, (GLsizei n, const GLuint *arrays), C_OBJECT) \
+	F(void, DepthFunc, (GLenum func), C_STATE) \
+	F(void, Disable, (GLenum cap), C_STATE) \
+	F(void, DisableVertexAttribArray, (GLuint index), C_STATE) \
+	F(void, DrawArrays, (GLenum mode, GLint first, GLsizei count), C_DRAW) \
+	F(void, DrawArraysInstanced, (GLenum mode, GLint first, GLsizei count, GLsizei instancecount), C_DRAW) \
+	F(void, DrawElements, (GLenum mode, GLsizei count, GLenum type, const void *indices), C_DRAW) \
+	F(void, DrawElementsInstanced, (GLenum mode, GLsizei count, GLenum type, const void *indices, GLsizei instancecount), C_DRAW) \
+	F(void, Enable, (GLenum cap), C_STATE) \
+	F(void, EnableVertexAttribArray, (GLuint index), C_STATE) \
+	F(void, GenBuffers, (GLsizei n, GLuint *buffers), C_OBJECT) \
+	F(void, GenerateMipmap, (GLenum target), C_UPLOAD) \
+	F(void, GenSamplers, (GLsizei count, GLuint *samplers), C_OBJECT) \
+	F(void, GenTextures, (GLsizei n, GLuint *textures), C_OBJECT) \
+	F(void, GenVertexArrays, (GLsizei n, GLuint *arrays), C_OBJECT) \
+	F(void, GetActiveUniform, (GLuint program, GLuint index, GLsizei bufSize, GLsizei *length, GLint *size, GLenum *type, GLchar *name), C_QUERY) \
+	F(void, GetIntegerv, (GLenum pname, GLint *data), C_QUERY) \
+	F(void, GetProgramBinary, (GLuint program, GLsizei bufSize, GLsizei *length, GLenum *binaryFormat, void *binary), C_QUERY) \
+	F(void, GetProgramInfoLog, (GLuint program, GLsizei bufSize, GLsizei *length, GLchar *infoLog), C_QUERY) \
+	F(void, GetProgramiv, (GLuint program, GLenum pname, GLint *params), C_QUERY) \
+	F(void, GetShaderInfoLog, (GLuint shader, GLsizei bufSize, GLsizei *length, GLchar *infoLog), C_QUERY) \
+	F(void, GetShaderiv, (GLuint shader, GLenum pname, GLint *params), C_QUERY) \
+	F(const GLubyte*, GetString, (GLenum name), C_QUERY) \
+	F(GLuint, GetUniformBlockIndex, (GLuint program, const GLchar *uniformBlockName), C_QUERY) \
+	F(GLint, GetUniformLocation, (GLuint program, const GLchar *name), C_QUERY) \
+	F(void, LinkProgram, (GLuint program), C_OBJECT) \
+	F(void, ProgramBinary, (GLuint program, GLenum binaryFormat, const void *binary, GLsizei length), C_UPLOAD) \
+	F(void, ProgramParameteri, (GLuint program, GLenum pname, GLint value), C_OBJECT) \
+	F(void, SamplerParameteri, (GLuint sampler, GLenum pname, GLint param), C_STATE) \
+	F(void, ShaderSource, (GLuint shader, GLsizei count, const GLchar *const *string, const GLint *length), C_OBJECT) \
+	F(void, TexImage2D, (GLenum target, GLint level, GLint internalformat, GLsizei width, GLsizei height, GLint border, GLenum format, GLenum type, const void *pixels), C_UPLOAD) \
+	F(void, TexParameteri, (GLenum target, GLenum pname, GLint param), C_STATE) \
+	F(void, TexSubImage2D, (GLenum target, GLint level, GLint xoffset, GLint yoffset, GLsizei width, GLsizei height, GLenum format, GLenum type, const void *pixels), C_UPLOAD) \
+	F(void, Uniform1i, (GLint location, GLint v0), C_STATE) \
+	F(void, Uniform4fv, (GLint location, GLsizei count, const GLfloat *value), C_STATE) \
+	F(void, UniformBlockBinding, (GLuint program, GLuint uniformBlockIndex, GLuint uniformBlockBinding), C_STATE) \
+	F(void, UniformMatrix4fv, (GLint location, GLsizei count, GLboolean transpose, const GLfloat *value), C_STATE) \
+	F(void, UseProgram, (GLuint program), C_STATE) \
+	F(void, VertexAttribDivisor, (GLuint index, GLuint divisor), C_STATE) \
+	F(void, VertexAttribPointer, (GLuint index, GLint size, GLenum type, GLboolean normalized, GLsizei stride, const void *pointer), C_STATE)
+
+#define GL_DEVICE_MEMBER(ret, name, params, kind) ret (GLAPIENTRY *name)params;
+#define GL_DEVICE_ENUM(ret, name, params, kind) GLF_##name,
+struct GLDevice {
+	GL_DEVICE_FUNCTIONS(GL_DEVICE_MEMBER)
+};
+enum GL_FUNCTION { GL_DEVICE_FUNCTIONS(GL_DEVICE_ENUM) NUM_GL_FUNCTIONS };
+extern GLDevice gGL;
+
+void useDriverGL(void); //After every glewInit(), the pointers come from the context.
+void useRecordingGL(void);
+bool isRecordingGL(void);
+
+//What the recorder saw since the last clear().
+struct GLRecording {
+	int calls[NUM_GL_FUNCTIONS];
+	int64_t bytesUploaded; //Buffer, texture and program binary data handed over. Allocations without data don't count.
+	int64_t numVertices; //Drawn, indexed or not, times the instances.
+
+	GLRecording(void) { clear(); }
+	void clear(void);
+	int getNumCalls(void) const;
+	int getNumCalls(GL_CALL_KIND kind) const;
+	void print(int numFrames = 1) const; //Averaged over numFrames.
+};
+extern GLRecording gGLRecording;
+
+#ifndef GL_DEVICE_DRIVER_NAMES //Only GLDevice.cpp, which needs the real ones, defines this.
+#undef glActiveTexture
+#define glActiveTexture gGL.ActiveTexture
+#undef glAttachShader
+#define glAttachShader gGL.AttachShader
+#undef glBindAttribLocation
+#define glBindAttribLocation gGL.BindAttribLocation
+#undef glBindBuffer
+#define glBindBuffer gGL.BindBuffer
+#undef glBindBufferBase
+#define glBindBufferBase gGL.BindBufferBase
+#undef glBindSampler
+#define glBindSampler gGL.BindSampler
+#undef glBindTexture
+#define glBindTexture gGL.BindTexture
+#undef glBindVertexArray
+#define glBindVertexArray gGL.BindVertexArray
+#undef glBlendFunc
+#define glBlendFunc gGL.BlendFunc
+#undef glBufferData
+#define glBufferData gGL.BufferData
+#undef glBufferSubData
+#define glBufferSubData gGL.BufferSubData
+#undef glClear
+#define glClear gGL.Clear
+#undef glClearColor
+#define glClearColor gGL.ClearColor
+#undef glCompileShader
+#define glCompileShader gGL.CompileShader
+#undef glCreateProgram
+#define glCreateProgram gGL.CreateProgram
+#undef glCreateShader
+#define glCreateShader gGL.CreateShader
+#undef glCullFace
+#define glCullFace gGL.CullFace
+#undef glDeleteBuffers
+#define glDeleteBuffers gGL.DeleteBuffers
+#undef glDeleteProgram
+#define glDeleteProgram gGL.DeleteProgram
+#undef glDeleteSamplers
+#define glDeleteSamplers gGL.DeleteSamplers
+#undef glDeleteShader
+#define glDeleteShader gGL.DeleteShader
+#undef glDeleteTextures
+#define glDeleteTextures gGL.DeleteTextures
+#undef glDeleteVertexArrays
+#define glDeleteVertexArrays gGL.DeleteVertexArrays
+#undef glDepthFunc
+#define glDepthFunc gGL.DepthFunc
+#undef glDisable
+#define glDisable gGL.Disable
+#undef glDisableVertexAttribArray
+#define glDisableVertexAttribArray gGL.DisableVertexAttribArray
+#undef glDrawArrays
+#define glDrawArrays gGL.DrawArrays
+#undef glDrawArraysInstanced
+#define glDrawArraysInstanced gGL.DrawArraysInstanced
+#undef glDrawElements
+#define glDrawElements gGL.DrawElements
+#undef glDrawElementsInstanced
+#define glDrawElementsInstanced gGL.DrawElementsInstanced
+#undef glEnable
+#define glEnable gGL.Enable
+#undef glEnableVertexAttribArray
+#define glEnableVertexAttribArray gGL.EnableVertexAttribArray
+#undef glGenBuffers
+#define glGenBuffers gGL.GenBuffers
+#undef glGenerateMipmap
+#define glGenerateMipmap gGL.GenerateMipmap
+#undef glGenSamplers
+#define glGenSamplers gGL.GenSamplers
+#undef glGenTextures
+#define glGenTextures gGL.GenTextures
+#undef glGenVertexArrays
+#define glGenVertexArrays gGL.GenVertexArrays
+#undef glGetActiveUniform
+#define glGetActiveUniform gGL.GetActiveUniform
+#undef glGetIntegerv
+#define glGetIntegerv gGL.GetIntegerv
+#undef glGetProgramBinary
+#define glGetProgramBinary gGL.GetProgramBinary
+#undef glGetProgramInfoLog
+#define glGetProgramInfoLog gGL.GetProgramInfoLog
+#undef glGetProgramiv
+#define glGetProgramiv gGL.GetProgramiv
+#undef glGetShaderInfoLog
+#define glGetShaderInfoLog gGL.GetShaderInfoLog
+#undef glGetShaderiv
+#define glGetShaderiv gGL.GetShaderiv
+#undef glGetString
+#define glGetString gGL.GetString
+#undef glGetUniformBlockIndex
+#define glGetUniformBlockIndex gGL.GetUniformBlockIndex
+#undef glGetUniformLocation
+#define glGetUniformLocation gGL.GetUniformLocation
+#undef glLinkProgram
+#define glLinkProgram gGL.LinkProgram
+#undef glProgramBinary
+#define glProgramBinary gGL.ProgramBinary
+#undef glProgramParameteri
+#define glProgramParameteri gGL.ProgramParameteri
+#undef glSamplerParameteri
+#define glSamplerParameteri gGL.SamplerParameteri
+#undef glShaderSource
+#define glShaderSource gGL.ShaderSource
+#undef glTexImage2D
+#define glTexImage2D gGL.TexImage2D
+#undef glTexParameteri
+#define glTexParameteri gGL.TexParameteri
+#undef glTexSubImage2D
+#define glTexSubImage2D gGL.TexSubImage2D
+#undef glUniform1i
+#define glUniform1i gGL.Uniform1i
+#undef glUniform4fv
+#define glUniform4fv gGL.Uniform4fv
+#undef glUniformBlockBinding
+#define glUniformBlockBinding gGL.UniformBlockBinding
+#undef glUniformMatrix4fv
+#define glUniformMatrix4fv gGL.UniformMatrix4fv
+#undef glUseProgram
+#define glUseProgram gGL.UseProgram
+#undef glVertexAttribDivisor
+#define glVertexAttribDivisor gGL.VertexAttribDivisor
+#undef glVertexAttribPointer
+#define glVertexAttribPointer gGL.VertexAttribPointer
+#endif
@@ -0,0 +1,156 @@
+#include "GLState.h"
+
+GLState gGLState;
+
+//-------------------------------------------------------------------------//
+// GL STATE CACHE
+//-------------------------------------------------------------------------//
+
+static const char *GL_STATE_CALL_NAMES[NUM_STATE_CALLS] = { "programs", "vertex arrays", "active texture", "textures", "samplers", "blend", "uniforms" };
+
+void GLState::reset(void)
+{
+	program = vao = GL_STATE_UNKNOWN;
+	activeUnit = blend = -1;
+	blendSrc = blendDst = GL_STATE_UNKNOWN;
+	for (int i = 0; i < GL_STATE_MAX_TEXTURE_UNITS; ++i) units[i].texture1D = units[i].texture2D = units[i].sampler = GL_STATE_UNKNOWN;
+	uniformValues.clear();
+	programUniforms = nullptr;
+}
+void GLState::endFrame(void)
+{
+	for (int i = 0; i < NUM_STATE_CALLS; ++i) {
+		lastFrame[i] = calls[i];
+		calls[i] = GLCallCount();
+	}
+}
+GLCallCount GLState::getTotal(const GLCallCount *counts)
+{
+	GLCallCount total;
+	for (int i = 0; i < NUM_STATE_CALLS; ++i) {
+		total.issued += counts[i].issued;
+		total.elided += counts[i].elided;
+	}
+	return total;
+}
+void GLState::printStats(void) const
+{
+	GLCallCount total = getTotal(lastFrame);
+	printf("\tGL state calls issued / elided: %d / %d (", total.issued, total.elided);
+	for (int i = 0; i < NUM_STATE_CALLS; ++i)
+		printf("%s%s %d / %d", (i > 0) ? ", " : "", GL_STATE_CALL_NAMES[i], lastFrame[i].issued, lastFrame[i].elided);
+	printf(").\n");
+}
+bool GLState::isChange(GL_STATE_CALL call, bool changed)
+{
+	if (changed) ++calls[call].issued;
+	else ++calls[call].elided;
+	return changed;
+}
+
+void GLState::useProgram(GLuint shaderProgram)
+{
+	if (!isChange(S_PROGRAM, shaderProgram != program)) return;
+	glUseProgram(shaderProgram);
+	program = shaderProgram;
+	programUniforms = (shaderProgram == NULL_HANDLE) ? nullptr : &uniformValues[shaderProgram];
+}
+void GLState::bindVertexArray(GLuint vertexArray)
+{
+	if (!isChange(S_VERTEX_ARRAY, vertexArray != vao)) return;
+	glBindVertexArray(vertexArray);
+	vao = vertexArray;
+}
+void GLState::setActiveUnit(int unit)
+{
+	if (!isChange(S_ACTIVE_TEXTURE, unit != activeUnit)) return;
+	glActiveTexture(GL_TEXTURE0 + unit);
+	activeUnit = unit;
+}
+void GLState::bindTexture(int unit, GLenum target, GLuint texture)
+{
+	GLuint *bound = nullptr;
+	if (unit >= 0 && unit < GL_STATE_MAX_TEXTURE_UNITS) {
+		if (target == GL_TEXTURE_1D) bound = &units[unit].texture1D;
+		else if (target == GL_TEXTURE_2D) bound = &units[unit].texture2D;
+	}
+	if (!isChange(S_TEXTURE, bound == nullptr || *bound != texture)) return;
+	setActiveUnit(unit);
+	glBindTexture(target, texture);
+	if (bound != nullptr) *bound = texture;
+}
+void GLState::bindSampler(int unit, GLuint sampler)
+{
+	bool known = (unit >= 0 && unit < GL_STATE_MAX_TEXTURE_UNITS);
+	if (!isChange(S_SAMPLER, !known || units[unit].sampler != sampler)) return;
+	glBindSampler(unit, sampler); //Takes the unit itself, the active one doesn't matter.
+	if (known) units[unit].sampler = sampler;
+}
+void GLState::setBlend(bool enabled, GLenum srcFactor, GLenum dstFactor)
+{
+	if (isChange(S_BLEND, blend != (int)enabled)) {
+		if (enabled) glEnable(GL_BLEND);
+		else glDisable(GL_BLEND);
+		blend = enabled;
+	}
+	if (!enabled) return; //The factors only matter while blending.
+	if (!isChange(S_BLEND, srcFactor != blendSrc || dstFactor != blendDst)) return;
+	glBlendFunc(srcFactor, dstFactor);
+	blendSrc = srcFactor;
+	blendDst = dstFactor;
+}
+
+bool GLState::setUniform(GLint location, const void *value, int numWords)
+{
+	if (programUniforms == nullptr || location >= GL_STATE_MAX_UNIFORM_LOCATION) return isChange(S_UNIFORM, true);
+	vector<UniformValue> &values = *programUniforms;
+	if (location >= (int)values.size()) {
+		UniformValue unset;
+		unset.numWords = 0;
+		values.resize(location + 1, unset);
+	}
+	UniformValue &v = values[location];
+	if (!isChange(S_UNIFORM, v.numWords != numWords || memcmp(v.words, value, numWords * sizeof(GLuint)) != 0)) return false;
+	v.numWords = numWords;
+	memcpy(v.words, value, numWords * sizeof(GLuint));
+	return true;
+}
+void GLState::setUniform1i(GLint location, GLint value)
+{
+	if (location < 0) return;
+	if (setUniform(location, &value, 1)) glUniform1i(location, value);
+}
+void GLState::setUniform4fv(GLint location, const GLfloat *value)
+{
+	if (location < 0) return;
+	if (setUniform(location, value, 4)) glUniform4fv(location, 1, value);
+}
+void GLState::setUniformMatrix4fv(GLint location, const GLfloat *value)
+{
+	if (location < 0) return;
+	if (setUniform(location, value, 16)) glUniformMatrix4fv(location, 1, GL_FALSE, value);
+}
+
+void GLState::forgetProgram(GLuint shaderProgram)
+{
+	uniformValues.erase(shaderProgram);
+	if (program != shaderProgram) return;
+	program = GL_STATE_UNKNOWN; //Still current until the next glUseProgram(), which then really deletes it.
+	programUniforms = nullptr;
+}
+void GLState::forgetTexture(GLuint texture)
+{
+	//Deleting a bound texture rebinds 0 in its place.
+	for (int i = 0; i < GL_STATE_MAX_TEXTURE_UNITS; ++i) {
+		if (units[i].texture1D == texture) units[i].texture1D = NULL_HANDLE;
+		if (units[i].texture2D == texture) units[i].texture2D = NULL_HANDLE;
+	}
+}
+void GLState::forgetSampler(GLuint sampler)
+{
+	for (int i = 0; i < GL_STATE_MAX_TEXTURE_UNITS; ++i) if (units[i].sampler == sampler) units[i].sampler = NULL_HANDLE;
+}
+void GLState::forgetVertexArray(GLuint vertexArray)
+{
+	if (vao == vertexArray) vao = NULL_HANDLE;
+}
@@ -0,0 +1,67 @@
+#pragma once
+#include "EngineUtil.h"
+
+//-------------------------------------------------------------------------//
+// GL STATE CACHE
+//-------------------------------------------------------------------------//
+
+//Shadows the GL state the draw paths touch, so a call that would set what is already set never reaches the driver.
+//Everything in EngineUtil.cpp and Scripts.cpp binds through gGLState and leaves its state bound afterwards instead of
+//unbinding, which is what lets consecutive draws of a sorted RenderQueue elide most of their calls. Anything that
+//deletes a program, texture, sampler or vertex array tells the cache, as GL may hand the name out again.
+#define GL_STATE_MAX_TEXTURE_UNITS 16 //Units past this, and other targets than 1D and 2D, go straight through.
+#define GL_STATE_MAX_UNIFORM_LOCATION 256 //Likewise for locations past this.
+#define GL_STATE_UNKNOWN 0xFFFFFFFFu //Never a GL name, so the next bind always goes out.
+
+enum GL_STATE_CALL { S_PROGRAM, S_VERTEX_ARRAY, S_ACTIVE_TEXTURE, S_TEXTURE, S_SAMPLER, S_BLEND, S_UNIFORM, NUM_STATE_CALLS };
+
+struct GLCallCount {
+	int issued, elided;
+	GLCallCount(void) : issued(0), elided(0) {}
+};
+
+class GLState
+{
+public:
+	GLCallCount calls[NUM_STATE_CALLS]; //Since the last endFrame().
+	GLCallCount lastFrame[NUM_STATE_CALLS];
+
+	GLState(void) { reset(); }
+	void reset(void); //On a new context, where nothing is known yet.
+	void endFrame(void); //Moves calls to lastFrame.
+	static GLCallCount getTotal(const GLCallCount *counts);
+	void printStats(void) const; //Of lastFrame.
+
+	void useProgram(GLuint shaderProgram);
+	void bindVertexArray(GLuint vao);
+	void bindTexture(int unit, GLenum target, GLuint texture); //Makes unit the active one if it has to bind.
+	void bindSampler(int unit, GLuint sampler);
+	void setBlend(bool enabled, GLenum srcFactor = GL_SRC_ALPHA, GLenum dstFactor = GL_ONE_MINUS_SRC_ALPHA);
+
+	//Uniform values are per program, so these go to the program of the last useProgram().
+	void setUniform1i(GLint location, GLint value);
+	void setUniform4fv(GLint location, const GLfloat *value);
+	void setUniformMatrix4fv(GLint location, const GLfloat *value);
+
+	//Call alongside the matching glDelete*().
+	void forgetProgram(GLuint shaderProgram);
+	void forgetTexture(GLuint texture);
+	void forgetSampler(GLuint sampler);
+	void forgetVertexArray(GLuint vao);
+
+private:
+	struct TextureUnit { GLuint texture1D, texture2D, sampler; };
+	struct UniformValue { int numWords; GLuint words[16]; }; //numWords 0 until first set.
+
+	GLuint program, vao;
+	int activeUnit, blend; //blend is -1 while unknown.
+	GLenum blendSrc, blendDst;
+	TextureUnit units[GL_STATE_MAX_TEXTURE_UNITS];
+	map<GLuint, vector<UniformValue> > uniformValues; //Program to values by location.
+	vector<UniformValue> *programUniforms; //Of program, nullptr while it is unknown.
+
+	bool isChange(GL_STATE_CALL call, bool changed); //Counts the call either way.
+	void setActiveUnit(int unit);
+	bool setUniform(GLint location, const void *value, int numWords); //True when the value has to go out.
+};
+extern GLState gGLState;
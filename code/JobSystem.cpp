@@ -0,0 +1,96 @@
+#include "JobSystem.h"
+#include <algorithm>
+
+JobSystem gJobs;
+
+//-------------------------------------------------------------------------//
+// JOB SYSTEM
+//-------------------------------------------------------------------------//
+
+void JobSystem::start(int numWorkers)
+{
+	stop();
+	if (numWorkers < 0) numWorkers = max((int)thread::hardware_concurrency() - 1, 1);
+	quitting = false;
+	for (int i = 0; i < numWorkers; ++i) workers.push_back(thread(&JobSystem::workerLoop, this));
+}
+void JobSystem::stop(void)
+{
+	if (workers.empty()) return;
+	{
+		lock_guard<mutex> guard(lock);
+		quitting = true;
+	}
+	jobReady.notify_all();
+	for (int i = 0; i < (int)workers.size(); ++i) workers[i].join();
+	workers.clear();
+}
+void JobSystem::submit(const Task &work, const Task &completion)
+{
+	if (workers.empty()) { //Serial fallback, same order a single worker would give.
+		work();
+		if (completion) completion();
+		return;
+	}
+	{
+		lock_guard<mutex> guard(lock);
+		jobs.push_back(make_pair(work, completion));
+		++numPending;
+	}
+	jobReady.notify_one();
+}
+void JobSystem::afterAll(const Task &step)
+{
+	steps.push_back(step);
+}
+void JobSystem::workerLoop(void)
+{
+	for (;;) {
+		pair<Task, Task> job;
+		{
+			unique_lock<mutex> guard(lock);
+			jobReady.wait(guard, [this]() { return quitting || !jobs.empty(); });
+			if (jobs.empty()) return; //Quitting and drained.
+			job = move(jobs.front());
+			jobs.pop_front();
+		}
+		job.first();
+		{
+			lock_guard<mutex> guard(lock);
+			if (job.second) completions.push_back(move(job.second));
+			else --numPending;
+		}
+		jobDone.notify_one();
+	}
+}
+int JobSystem::runCompletions(void)
+{
+	deque<Task> ready;
+	{
+		lock_guard<mutex> guard(lock);
+		ready.swap(completions);
+	}
+	for (int i = 0; i < (int)ready.size(); ++i) ready[i]();
+	if (!ready.empty()) {
+		lock_guard<mutex> guard(lock);
+		numPending -= (int)ready.size();
+	}
+	return (int)ready.size();
+}
+void JobSystem::waitAll(void)
+{
+	for (;;) {
+		runCompletions();
+		bool idle;
+		{
+			unique_lock<mutex> guard(lock);
+			jobDone.wait(guard, [this]() { return numPending == 0 || !completions.empty(); });
+			idle = (numPending == 0);
+		}
+		if (!idle) continue;
+		if (steps.empty()) return;
+		vector<Task> ready; //Steps may submit more work, so they get a fresh list and we go around again.
+		ready.swap(steps);
+		for (int i = 0; i < (int)ready.size(); ++i) ready[i]();
+	}
+}
@@ -0,0 +1,46 @@
+#pragma once
+#include "EngineUtil.h"
+#include <functional>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+
+//-------------------------------------------------------------------------//
+// JOB SYSTEM
+//-------------------------------------------------------------------------//
+
+//Worker threads for the CPU half of asset loading: file reads, PLY parsing, PNG decoding.
+//Only the GL thread owns the context, so each job can carry a completion that is queued back to it.
+//Uploads, shader programs and bindMaterial() all run from runCompletions() or waitAll(), in GL thread order.
+class JobSystem
+{
+public:
+	typedef function<void()> Task;
+
+	JobSystem(void) : numPending(0), quitting(false) {}
+	~JobSystem() { stop(); }
+	void start(int numWorkers = -1); //-1 is one per core, minus the GL thread. 0 runs every job inline.
+	void stop(void); //Lets the workers finish what was submitted, then joins them.
+	int getNumWorkers(void) const { return (int)workers.size(); }
+
+	//All of these are for the GL thread only.
+	void submit(const Task &work, const Task &completion = Task()); //work on a worker, then completion back here.
+	void afterAll(const Task &step); //Runs in the next waitAll(), once every job and completion before it is done.
+	int runCompletions(void); //Doesn't block. Returns how many ran.
+	void waitAll(void);
+
+private:
+	vector<thread> workers;
+	deque<pair<Task, Task> > jobs;
+	deque<Task> completions;
+	vector<Task> steps;
+	int numPending; //Submitted jobs whose completion has not run yet.
+	bool quitting;
+	mutex lock;
+	condition_variable jobReady, jobDone;
+
+	void workerLoop(void);
+	JobSystem(const JobSystem&); //Owns threads, not copyable.
+	JobSystem& operator=(const JobSystem&);
+};
+extern JobSystem gJobs;
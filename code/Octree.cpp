@@ -0,0 +1,262 @@
+#include "Octree.h"
+#include <algorithm>
+
+Octree gOctree;
+
+//-------------------------------------------------------------------------//
+// LOOSE OCTREE
+//-------------------------------------------------------------------------//
+
+bool OctreeCell::isInTight(const glm::vec3 &p) const
+{
+	return fabs(p.x - center.x) <= halfSize && fabs(p.y - center.y) <= halfSize && fabs(p.z - center.z) <= halfSize;
+}
+Bounds OctreeCell::getLooseBounds(void) const
+{
+	Bounds b;
+	float looseHalfSize = halfSize * 2.0f;
+	b.center = center;
+	b.radius = looseHalfSize * 1.7320508f; //sqrt(3), the sphere through the corners.
+	b.boxMin = center - glm::vec3(looseHalfSize);
+	b.boxMax = center + glm::vec3(looseHalfSize);
+	return b;
+}
+
+//A sphere around the node's origin that holds every LOD at any rotation, so spinning in place never moves it.
+//The collider is added as it was placed by the last update(). Empty if a mesh has no positions to bound.
+Bounds Octree::getNodeBounds(const SceneGraphNode *node)
+{
+	const glm::mat4x4 &M = node->T.transform;
+	Bounds b;
+	b.center = glm::vec3(M[3]);
+	float maxScaleSqr = std::max(glm::dot(glm::vec3(M[0]), glm::vec3(M[0])), std::max(glm::dot(glm::vec3(M[1]), glm::vec3(M[1])), glm::dot(glm::vec3(M[2]), glm::vec3(M[2]))));
+	float meshRadius = 0.0f;
+	for (int i = 0; i < (int)node->LODstack.size(); ++i) {
+		const TriMesh *mesh = node->LODstack[i]->triMesh;
+		if (mesh == nullptr) continue;
+		if (mesh->bounds.isEmpty()) {
+			b.boxMin = b.boxMax = b.center;
+			return b;
+		}
+		meshRadius = std::max(meshRadius, glm::length(mesh->bounds.center) + mesh->bounds.radius);
+	}
+	b.radius = meshRadius * sqrtf(maxScaleSqr);
+	if (node->collider != nullptr) b.radius = std::max(b.radius, glm::length(node->collider->center - b.center) + node->collider->radius);
+	b.boxMin = b.center - glm::vec3(b.radius);
+	b.boxMax = b.center + glm::vec3(b.radius);
+	return b;
+}
+
+void Octree::clear(void)
+{
+	for (int i = 0; i < (int)moved.size(); ++i) moved[i]->octreeRefreshes = 0;
+	moved.clear();
+	if (root != nullptr) deleteCell(root);
+	root = nullptr;
+	numNodes = numCells = 0;
+}
+void Octree::deleteCell(OctreeCell *cell)
+{
+	for (int i = 0; i < (int)cell->entries.size(); ++i) cell->entries[i].node->octreeCell = nullptr;
+	for (int i = 0; i < 8; ++i) if (cell->children[i] != nullptr) deleteCell(cell->children[i]);
+	delete cell;
+}
+
+void Octree::markMoved(SceneGraphNode *node)
+{
+	//Twice, as a script moving its own node runs after that node's transform refresh in update(). Its move only
+	//reaches T.transform the update() after, and the second refresh() picks it up then.
+	if (node->octreeRefreshes == 0) moved.push_back(node);
+	node->octreeRefreshes = 2;
+	for (int i = 0; i < (int)node->children.size(); ++i) markMoved(node->children[i]);
+}
+void Octree::refresh(void)
+{
+	int numKept = 0;
+	for (int i = 0; i < (int)moved.size(); ++i) {
+		SceneGraphNode *node = moved[i];
+		Bounds b = getNodeBounds(node);
+		OctreeCell *cell = node->octreeCell;
+		bool fits = (cell != nullptr) && (b.isEmpty() ? cell == root : (cell->isInTight(b.center) && b.radius <= cell->halfSize));
+		if (fits) cell->entries[node->octreeSlot].bounds = b;
+		else {
+			if (cell != nullptr) detach(node);
+			insert(node, b);
+		}
+		if (--node->octreeRefreshes > 0) moved[numKept++] = node;
+	}
+	moved.resize(numKept);
+}
+void Octree::remove(SceneGraphNode *node)
+{
+	if (node->octreeRefreshes > 0) {
+		moved.erase(find(moved.begin(), moved.end(), node));
+		node->octreeRefreshes = 0;
+	}
+	if (node->octreeCell != nullptr) detach(node);
+}
+
+void Octree::insert(SceneGraphNode *node, const Bounds &bounds)
+{
+	if (root == nullptr) {
+		root = new OctreeCell(glm::vec3(0), OCTREE_ROOT_HALF_SIZE);
+		numCells = 1;
+	}
+	OctreeCell *cell = root;
+	if (!bounds.isEmpty()) {
+		for (int i = 0; i < OCTREE_MAX_ROOT_GROWTH && !(root->isInTight(bounds.center) && bounds.radius <= root->halfSize); ++i) growToward(bounds.center);
+		cell = root;
+		while (cell->halfSize * 0.5f >= std::max(bounds.radius, OCTREE_MIN_HALF_SIZE) && cell->isInTight(bounds.center)) {
+			int octant = (bounds.center.x >= cell->center.x ? 1 : 0) | (bounds.center.y >= cell->center.y ? 2 : 0) | (bounds.center.z >= cell->center.z ? 4 : 0);
+			if (cell->children[octant] == nullptr) {
+				if ((int)cell->entries.size() < OCTREE_CELL_CAPACITY) break; //Room left, no need to split yet.
+				float h = cell->halfSize * 0.5f;
+				OctreeCell *child = new OctreeCell(cell->center + glm::vec3((octant & 1) ? h : -h, (octant & 2) ? h : -h, (octant & 4) ? h : -h), h);
+				child->parent = cell;
+				child->octant = octant;
+				cell->children[octant] = child;
+				++numCells;
+			}
+			cell = cell->children[octant];
+		}
+	}
+	OctreeEntry e = { node, bounds };
+	cell->entries.push_back(e);
+	node->octreeCell = cell;
+	node->octreeSlot = (int)cell->entries.size() - 1;
+	for (OctreeCell *c = cell; c != nullptr; c = c->parent) ++c->numInSubtree;
+	++numNodes;
+}
+void Octree::detach(SceneGraphNode *node)
+{
+	OctreeCell *cell = node->octreeCell;
+	vector<OctreeEntry> &entries = cell->entries;
+	int slot = node->octreeSlot;
+	entries[slot] = entries.back();
+	entries[slot].node->octreeSlot = slot;
+	entries.pop_back();
+	node->octreeCell = nullptr;
+	for (OctreeCell *c = cell; c != nullptr; c = c->parent) --c->numInSubtree;
+	--numNodes;
+
+	while (cell != root && cell->numInSubtree == 0) { //Its children went first, by the same rule.
+		OctreeCell *parent = cell->parent;
+		parent->children[cell->octant] = nullptr;
+		delete cell;
+		--numCells;
+		cell = parent;
+	}
+}
+//The root becomes one octant of a root twice its size, whose center lies a corner further toward p.
+void Octree::growToward(const glm::vec3 &p)
+{
+	glm::vec3 s(p.x >= root->center.x ? 1.0f : -1.0f, p.y >= root->center.y ? 1.0f : -1.0f, p.z >= root->center.z ? 1.0f : -1.0f);
+	if (root->numInSubtree == 0) { //Nothing to keep, so it just moves.
+		root->center += s * root->halfSize;
+		root->halfSize *= 2.0f;
+		return;
+	}
+	OctreeCell *newRoot = new OctreeCell(root->center + s * root->halfSize, root->halfSize * 2.0f);
+	int octant = (s.x < 0.0f ? 1 : 0) | (s.y < 0.0f ? 2 : 0) | (s.z < 0.0f ? 4 : 0);
+	newRoot->children[octant] = root;
+	newRoot->numInSubtree = root->numInSubtree;
+	root->parent = newRoot;
+	root->octant = octant;
+	root = newRoot;
+	++numCells;
+}
+
+//-------------------------------------------------------------------------//
+
+//The root's own entries are tested whatever its box says, as it also keeps what fits nowhere else.
+void Octree::queryFrustum(const Frustum &frustum, vector<SceneGraphNode*> &found)
+{
+	lastFrustum = OctreeQueryStats();
+	size_t first = found.size();
+	if (root != nullptr) queryFrustum(root, frustum, found, lastFrustum);
+	lastFrustum.nodesFound = (int)(found.size() - first);
+}
+void Octree::queryFrustum(const OctreeCell *cell, const Frustum &frustum, vector<SceneGraphNode*> &found, OctreeQueryStats &stats) const
+{
+	++stats.cellsVisited;
+	if (cell != root && !frustum.intersects(cell->getLooseBounds())) return;
+	for (int i = 0; i < (int)cell->entries.size(); ++i) {
+		++stats.nodesTested;
+		if (frustum.intersects(cell->entries[i].bounds)) found.push_back(cell->entries[i].node);
+	}
+	for (int i = 0; i < 8; ++i) if (cell->children[i] != nullptr) queryFrustum(cell->children[i], frustum, found, stats);
+}
+
+void Octree::querySphere(const glm::vec3 &center, float radius, vector<SceneGraphNode*> &found, OctreeQueryStats *stats) const
+{
+	OctreeQueryStats s;
+	size_t first = found.size();
+	if (root != nullptr) querySphere(root, center, radius, found, s);
+	s.nodesFound = (int)(found.size() - first);
+	if (stats != nullptr) *stats = s;
+}
+void Octree::querySphere(const OctreeCell *cell, const glm::vec3 &center, float radius, vector<SceneGraphNode*> &found, OctreeQueryStats &stats) const
+{
+	++stats.cellsVisited;
+	if (cell != root) {
+		glm::vec3 looseHalf(cell->halfSize * 2.0f);
+		glm::vec3 d = glm::max(glm::abs(center - cell->center) - looseHalf, glm::vec3(0)); //To the nearest point of the box.
+		if (glm::dot(d, d) > radius * radius) return;
+	}
+	for (int i = 0; i < (int)cell->entries.size(); ++i) {
+		++stats.nodesTested;
+		const Bounds &b = cell->entries[i].bounds;
+		float reach = radius + std::max(b.radius, 0.0f); //An empty one is just its origin.
+		glm::vec3 d = b.center - center;
+		if (glm::dot(d, d) <= reach * reach) found.push_back(cell->entries[i].node);
+	}
+	for (int i = 0; i < 8; ++i) if (cell->children[i] != nullptr) querySphere(cell->children[i], center, radius, found, stats);
+}
+
+void Octree::queryRay(const glm::vec3 &origin, const glm::vec3 &direction, float maxDistance, vector<OctreeHit> &hits, OctreeQueryStats *stats) const
+{
+	OctreeQueryStats s;
+	size_t first = hits.size();
+	glm::vec3 dir = glm::normalize(direction), invDir;
+	for (int c = 0; c < 3; ++c) invDir[c] = (dir[c] != 0.0f) ? 1.0f / dir[c] : ((dir[c] >= 0.0f) ? 1e30f : -1e30f); //Parallel slabs never end.
+	if (root != nullptr) queryRay(root, origin, invDir, dir, maxDistance, hits, s);
+	sort(hits.begin() + first, hits.end());
+	s.nodesFound = (int)(hits.size() - first);
+	if (stats != nullptr) *stats = s;
+}
+void Octree::queryRay(const OctreeCell *cell, const glm::vec3 &origin, const glm::vec3 &invDirection, const glm::vec3 &direction, float maxDistance, vector<OctreeHit> &hits, OctreeQueryStats &stats) const
+{
+	++stats.cellsVisited;
+	if (cell != root) { //Slab test against the loose box, clipped to [0, maxDistance].
+		glm::vec3 looseHalf(cell->halfSize * 2.0f);
+		glm::vec3 t0 = (cell->center - looseHalf - origin) * invDirection, t1 = (cell->center + looseHalf - origin) * invDirection;
+		glm::vec3 tNear = glm::min(t0, t1), tFar = glm::max(t0, t1);
+		float enter = std::max(std::max(tNear.x, tNear.y), std::max(tNear.z, 0.0f));
+		float exit = std::min(std::min(tFar.x, tFar.y), std::min(tFar.z, maxDistance));
+		if (enter > exit) return;
+	}
+	for (int i = 0; i < (int)cell->entries.size(); ++i) {
+		++stats.nodesTested;
+		const Bounds &b = cell->entries[i].bounds;
+		if (b.isEmpty()) continue; //Nothing to hit.
+		glm::vec3 oc = origin - b.center;
+		float along = glm::dot(oc, direction), startSqr = glm::dot(oc, oc) - b.radius * b.radius;
+		float t = 0.0f;
+		if (startSqr > 0.0f) { //Starts outside.
+			float disc = along * along - startSqr;
+			if (along > 0.0f || disc < 0.0f) continue; //Heading away, or passing by.
+			t = -along - sqrtf(disc);
+		}
+		if (t > maxDistance) continue;
+		OctreeHit hit = { cell->entries[i].node, t };
+		hits.push_back(hit);
+	}
+	for (int i = 0; i < 8; ++i) if (cell->children[i] != nullptr) queryRay(cell->children[i], origin, invDirection, direction, maxDistance, hits, stats);
+}
+
+void Octree::printStats(void) const
+{
+	printf("\tOctree: %d nodes in %d cells", numNodes, numCells);
+	if (root != nullptr) printf(", root %.1f across", root->halfSize * 2.0f);
+	printf(".\n\tVisibility query: %d cells visited, %d nodes tested, %d found.\n", lastFrustum.cellsVisited, lastFrustum.nodesTested, lastFrustum.nodesFound);
+}
@@ -0,0 +1,90 @@
+#pragma once
+#include "EngineUtil.h"
+
+//-------------------------------------------------------------------------//
+// LOOSE OCTREE
+//-------------------------------------------------------------------------//
+
+//Every node of gNodes sits in one cell whose halfSize covers its bounding radius and whose tight box holds its
+//center, going as deep as there are cells. Cells are queried by their loose box, twice the tight one, which then
+//holds all of every sphere stored in them. A node that moves only leaves its cell once its center crosses out of
+//the tight box. A cell only grows children once it holds OCTREE_CELL_CAPACITY nodes, so sparse regions stay shallow.
+//Nodes register themselves on their first setTranslation() and report moves through markMoved(), so the tree is
+//brought up to date in refresh() for what moved instead of for everything.
+#define OCTREE_CELL_CAPACITY 16
+#define OCTREE_MIN_HALF_SIZE 0.25f //Cells stop splitting here, or a pile of points would go arbitrarily deep.
+#define OCTREE_ROOT_HALF_SIZE 64.0f //Of the first root, centered on the origin. It doubles toward whatever lies outside.
+#define OCTREE_MAX_ROOT_GROWTH 16 //Past that, a node stays in the root whether it fits or not.
+
+struct OctreeEntry {
+	SceneGraphNode *node;
+	Bounds bounds; //World sphere and its box, empty for nodes whose meshes have no positions. See getNodeBounds().
+};
+
+struct OctreeCell {
+	glm::vec3 center;
+	float halfSize; //Of the tight box, the loose one is twice this.
+	int octant; //The index in parent->children.
+	OctreeCell *parent;
+	OctreeCell *children[8]; //nullptr for empty octants, which are pruned.
+	vector<OctreeEntry> entries;
+	int numInSubtree;
+
+	OctreeCell(const glm::vec3 &c, float h) : center(c), halfSize(h), octant(-1), parent(nullptr), numInSubtree(0) {
+		for (int i = 0; i < 8; ++i) children[i] = nullptr;
+	}
+	bool isInTight(const glm::vec3 &p) const;
+	Bounds getLooseBounds(void) const;
+};
+
+struct OctreeHit {
+	SceneGraphNode *node;
+	float distance; //Along the ray to where it enters the node's sphere, 0 if it starts inside.
+	bool operator<(const OctreeHit &rhs) const { return distance < rhs.distance; }
+};
+
+//Work done by a query, to compare against the number of nodes.
+struct OctreeQueryStats {
+	int cellsVisited, nodesTested, nodesFound;
+	OctreeQueryStats(void) : cellsVisited(0), nodesTested(0), nodesFound(0) {}
+};
+
+class Octree
+{
+public:
+	OctreeQueryStats lastFrustum; //Of the last queryFrustum(), i.e. the renderer's.
+
+	Octree(void) : root(nullptr), numNodes(0), numCells(0) {}
+	~Octree(void) { clear(); }
+	void clear(void); //Forgets every node and cell.
+
+	void markMoved(SceneGraphNode *node); //Inserts it if it isn't in yet. Its children move along, so they're marked too.
+	void refresh(void); //Once transforms are current, moves what was marked to its new cell.
+	void remove(SceneGraphNode *node); //From the node's destructor.
+
+	//Results are appended, so the callers can reuse their vectors between frames.
+	void queryFrustum(const Frustum &frustum, vector<SceneGraphNode*> &found);
+	void querySphere(const glm::vec3 &center, float radius, vector<SceneGraphNode*> &found, OctreeQueryStats *stats = nullptr) const;
+	void queryRay(const glm::vec3 &origin, const glm::vec3 &direction, float maxDistance, vector<OctreeHit> &hits, OctreeQueryStats *stats = nullptr) const; //Nearest first.
+
+	int getNumNodes(void) const { return numNodes; }
+	void printStats(void) const;
+
+private:
+	OctreeCell *root;
+	int numNodes, numCells;
+	vector<SceneGraphNode*> moved; //Each with node->octreeRefreshes > 0.
+
+	static Bounds getNodeBounds(const SceneGraphNode *node);
+	void insert(SceneGraphNode *node, const Bounds &bounds);
+	void detach(SceneGraphNode *node); //Out of its cell, pruning the cells left empty.
+	void growToward(const glm::vec3 &p);
+	void deleteCell(OctreeCell *cell);
+	void queryFrustum(const OctreeCell *cell, const Frustum &frustum, vector<SceneGraphNode*> &found, OctreeQueryStats &stats) const;
+	void querySphere(const OctreeCell *cell, const glm::vec3 &center, float radius, vector<SceneGraphNode*> &found, OctreeQueryStats &stats) const;
+	void queryRay(const OctreeCell *cell, const glm::vec3 &origin, const glm::vec3 &invDirection, const glm::vec3 &direction, float maxDistance, vector<OctreeHit> &hits, OctreeQueryStats &stats) const;
+
+	Octree(const Octree&); //Owns its cells.
+	Octree& operator=(const Octree&);
+};
+extern Octree gOctree;
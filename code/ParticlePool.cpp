@@ -0,0 +1,218 @@
+#include "ParticlePool.h"
+
+//MSVC lets any function use any intrinsic. GCC and Clang only allow what the build targets, so the SIMD kernels opt in
+//one by one with a target attribute, and the rest of the build stays baseline. Elsewhere only the scalar kernel exists.
+#if defined(_MSC_VER)
+#include <intrin.h> //__cpuid() and _xgetbv(), along with every SSE and AVX intrinsic.
+#define PARTICLE_SIMD
+#define PARTICLE_TARGET(isa)
+#elif defined(__i386__) || defined(__x86_64__)
+#include <cpuid.h>
+#include <immintrin.h>
+#define PARTICLE_SIMD
+#define PARTICLE_TARGET(isa) __attribute__((target(isa)))
+#endif
+
+//-------------------------------------------------------------------------//
+// PARTICLE POOL
+//-------------------------------------------------------------------------//
+
+void ParticlePool::setCapacity(int capacity)
+{
+	capacity = max(capacity, 0);
+	positionX.resize(capacity);
+	positionY.resize(capacity);
+	positionZ.resize(capacity);
+	velocityX.resize(capacity);
+	velocityY.resize(capacity);
+	velocityZ.resize(capacity);
+	timeToLive.resize(capacity);
+	rotation.resize(capacity);
+	frame.resize(capacity);
+	aliveMask.resize((capacity + 31) / 32);
+	numAlive = min(numAlive, capacity);
+}
+int ParticlePool::spawn(void)
+{
+	if (numAlive == getCapacity()) return -1;
+	return numAlive++;
+}
+void ParticlePool::kill(int i)
+{
+	assert(i >= 0 && i < numAlive);
+	int last = --numAlive;
+	if (i == last) return;
+	positionX[i] = positionX[last];
+	positionY[i] = positionY[last];
+	positionZ[i] = positionZ[last];
+	velocityX[i] = velocityX[last];
+	velocityY[i] = velocityY[last];
+	velocityZ[i] = velocityZ[last];
+	timeToLive[i] = timeToLive[last];
+	rotation[i] = rotation[last];
+	frame[i] = frame[last];
+}
+
+//-------------------------------------------------------------------------//
+// INTEGRATION KERNELS
+//-------------------------------------------------------------------------//
+
+const char *PARTICLE_KERNEL_NAMES[NUM_PARTICLE_KERNELS] = { "scalar", "SSE", "AVX" };
+
+//The AVX kernel also needs the OS to save the upper halves of the registers, which XGETBV reports. XGETBV itself
+//faults without OSXSAVE, so it's only read once that bit is known to be set.
+#if defined(_MSC_VER)
+static void readCPUID(uint32_t &ecx, uint32_t &edx)
+{
+	int info[4];
+	__cpuid(info, 1);
+	ecx = (uint32_t)info[2];
+	edx = (uint32_t)info[3];
+}
+static uint64_t readXCR0(void) { return _xgetbv(0); }
+#elif defined(PARTICLE_SIMD)
+static void readCPUID(uint32_t &ecx, uint32_t &edx)
+{
+	unsigned int eax, ebx, c = 0, d = 0;
+	__get_cpuid(1, &eax, &ebx, &c, &d); //Leaves them 0 where there's no leaf 1, so no SIMD.
+	ecx = c;
+	edx = d;
+}
+static uint64_t readXCR0(void)
+{
+	uint32_t eax, edx;
+	__asm__ volatile("xgetbv" : "=a"(eax), "=d"(edx) : "c"(0));
+	return ((uint64_t)edx << 32) | eax;
+}
+#endif
+static PARTICLE_KERNEL findParticleKernel(void)
+{
+#ifdef PARTICLE_SIMD
+	uint32_t ecx, edx;
+	readCPUID(ecx, edx);
+	bool hasSSE = (edx & (1 << 25)) != 0;
+	bool hasAVX = (ecx & (1 << 28)) != 0 && (ecx & (1 << 27)) != 0 && (readXCR0() & 6) == 6; //AVX, OSXSAVE, XMM and YMM state.
+	return hasAVX ? PK_AVX : (hasSSE ? PK_SSE : PK_SCALAR);
+#else
+	return PK_SCALAR;
+#endif
+}
+PARTICLE_KERNEL gParticleKernel = findParticleKernel();
+
+//The SIMD kernels do whole mask words of 32 particles from first and return where they stopped, for the scalar one to
+//finish. A word's bits are gathered in a register and stored once, as a read-modify-write of the mask per vector
+//would chain every iteration to the last one's store. The arrays are taken as raw pointers for the same reason:
+//otherwise every mask store makes the compiler reload them.
+struct ParticleArrays {
+	float *px, *py, *pz, *vx, *vy, *vz, *ttl;
+	uint32_t *mask;
+	ParticleArrays(ParticlePool &p) : px(&p.positionX[0]), py(&p.positionY[0]), pz(&p.positionZ[0]),
+		vx(&p.velocityX[0]), vy(&p.velocityY[0]), vz(&p.velocityZ[0]), ttl(&p.timeToLive[0]), mask(&p.aliveMask[0]) {}
+};
+static void integrateScalar(const ParticleArrays &a, const ParticleStep &step, int first, int last)
+{
+	float dt = step.dt, keep = 1.0f - step.drag * step.dt;
+	float gx = step.gravity.x * dt, gy = step.gravity.y * dt, gz = step.gravity.z * dt;
+	uint32_t bits = 0;
+	for (int i = first; i < last; ++i) {
+		float vx = (a.vx[i] + gx) * keep;
+		float vy = (a.vy[i] + gy) * keep;
+		float vz = (a.vz[i] + gz) * keep;
+		a.vx[i] = vx;
+		a.vy[i] = vy;
+		a.vz[i] = vz;
+		a.px[i] = a.px[i] + vx * dt;
+		a.py[i] = a.py[i] + vy * dt;
+		a.pz[i] = a.pz[i] + vz * dt;
+		float ttl = a.ttl[i] - dt;
+		a.ttl[i] = ttl;
+		bits |= (uint32_t)(ttl > 0.0f) << (i & 31);
+		if ((i & 31) == 31 || i == last - 1) { //first is a multiple of 32, so words start at 0 bits.
+			a.mask[i >> 5] = bits;
+			bits = 0;
+		}
+	}
+}
+#ifdef PARTICLE_SIMD
+PARTICLE_TARGET("sse") static int integrateSSE(const ParticleArrays &a, const ParticleStep &step, int first, int last)
+{
+	float keep = 1.0f - step.drag * step.dt;
+	__m128 dt = _mm_set1_ps(step.dt), k = _mm_set1_ps(keep), zero = _mm_setzero_ps();
+	__m128 gx = _mm_set1_ps(step.gravity.x * step.dt), gy = _mm_set1_ps(step.gravity.y * step.dt), gz = _mm_set1_ps(step.gravity.z * step.dt);
+	int end = first + ((last - first) & ~31);
+	for (int w = first; w < end; w += 32) {
+		uint32_t bits = 0;
+		for (int i = w; i < w + 32; i += 4) {
+			__m128 vx = _mm_mul_ps(_mm_add_ps(_mm_loadu_ps(a.vx + i), gx), k);
+			__m128 vy = _mm_mul_ps(_mm_add_ps(_mm_loadu_ps(a.vy + i), gy), k);
+			__m128 vz = _mm_mul_ps(_mm_add_ps(_mm_loadu_ps(a.vz + i), gz), k);
+			_mm_storeu_ps(a.vx + i, vx);
+			_mm_storeu_ps(a.vy + i, vy);
+			_mm_storeu_ps(a.vz + i, vz);
+			_mm_storeu_ps(a.px + i, _mm_add_ps(_mm_loadu_ps(a.px + i), _mm_mul_ps(vx, dt)));
+			_mm_storeu_ps(a.py + i, _mm_add_ps(_mm_loadu_ps(a.py + i), _mm_mul_ps(vy, dt)));
+			_mm_storeu_ps(a.pz + i, _mm_add_ps(_mm_loadu_ps(a.pz + i), _mm_mul_ps(vz, dt)));
+			__m128 ttl = _mm_sub_ps(_mm_loadu_ps(a.ttl + i), dt);
+			_mm_storeu_ps(a.ttl + i, ttl);
+			bits |= (uint32_t)_mm_movemask_ps(_mm_cmpgt_ps(ttl, zero)) << (i & 31);
+		}
+		a.mask[w >> 5] = bits;
+	}
+	return end;
+}
+PARTICLE_TARGET("avx") static int integrateAVX(const ParticleArrays &a, const ParticleStep &step, int first, int last)
+{
+	float keep = 1.0f - step.drag * step.dt;
+	__m256 dt = _mm256_set1_ps(step.dt), k = _mm256_set1_ps(keep), zero = _mm256_setzero_ps();
+	__m256 gx = _mm256_set1_ps(step.gravity.x * step.dt), gy = _mm256_set1_ps(step.gravity.y * step.dt), gz = _mm256_set1_ps(step.gravity.z * step.dt);
+	int end = first + ((last - first) & ~31);
+	for (int w = first; w < end; w += 32) {
+		uint32_t bits = 0;
+		for (int i = w; i < w + 32; i += 8) {
+			__m256 vx = _mm256_mul_ps(_mm256_add_ps(_mm256_loadu_ps(a.vx + i), gx), k);
+			__m256 vy = _mm256_mul_ps(_mm256_add_ps(_mm256_loadu_ps(a.vy + i), gy), k);
+			__m256 vz = _mm256_mul_ps(_mm256_add_ps(_mm256_loadu_ps(a.vz + i), gz), k);
+			_mm256_storeu_ps(a.vx + i, vx);
+			_mm256_storeu_ps(a.vy + i, vy);
+			_mm256_storeu_ps(a.vz + i, vz);
+			_mm256_storeu_ps(a.px + i, _mm256_add_ps(_mm256_loadu_ps(a.px + i), _mm256_mul_ps(vx, dt)));
+			_mm256_storeu_ps(a.py + i, _mm256_add_ps(_mm256_loadu_ps(a.py + i), _mm256_mul_ps(vy, dt)));
+			_mm256_storeu_ps(a.pz + i, _mm256_add_ps(_mm256_loadu_ps(a.pz + i), _mm256_mul_ps(vz, dt)));
+			__m256 ttl = _mm256_sub_ps(_mm256_loadu_ps(a.ttl + i), dt);
+			_mm256_storeu_ps(a.ttl + i, ttl);
+			bits |= (uint32_t)_mm256_movemask_ps(_mm256_cmp_ps(ttl, zero, _CMP_GT_OQ)) << (i & 31);
+		}
+		a.mask[w >> 5] = bits;
+	}
+	_mm256_zeroupper(); //Or the SSE code after pays for the switch.
+	return end;
+}
+#endif
+void ParticlePool::integrate(const ParticleStep &step, int first, int last, PARTICLE_KERNEL kernel)
+{
+	assert(first % 32 == 0 && last <= numAlive);
+	if (first >= last) return; //Every word in range is written below, so the mask needs no clearing.
+
+	ParticleArrays arrays(*this);
+	int done = first;
+#ifdef PARTICLE_SIMD
+	if (kernel == PK_AVX) done = integrateAVX(arrays, step, first, last);
+	else if (kernel == PK_SSE) done = integrateSSE(arrays, step, first, last);
+#endif
+	integrateScalar(arrays, step, done, last);
+}
+int ParticlePool::removeDead(void)
+{
+	int numKilled = 0, n = numAlive;
+	for (int w = (n + 31) / 32 - 1; w >= 0; --w) {
+		int numBits = min(n - w * 32, 32); //Only the last word is partial.
+		uint32_t dead = ~aliveMask[w] & ((numBits == 32) ? 0xFFFFFFFFu : ((1u << numBits) - 1));
+		for (int b = numBits - 1; dead != 0; --b) {
+			if ((dead & (1u << b)) == 0) continue;
+			kill(w * 32 + b);
+			dead &= ~(1u << b);
+			++numKilled;
+		}
+	}
+	return numKilled;
+}
@@ -0,0 +1,54 @@
+#pragma once
+#include "EngineUtil.h"
+
+//-------------------------------------------------------------------------//
+// PARTICLE POOL
+//-------------------------------------------------------------------------//
+
+//An emitter's particles as structure-of-arrays, one array per field and a component per array, sized once from
+//particleMax. The live ones are always [0, numAlive), so spawn() takes the slot after them and kill() moves the last
+//one into the hole: both O(1), with no allocation after setCapacity(). Killing reorders, so loops that kill as they
+//go revisit the index they just killed instead of stepping past it. 8 floats and a frame index, 34 bytes a particle.
+//Motion is one integrate() over all of them, in SIMD lanes where the CPU has them, then removeDead() off its mask.
+
+//What one fixed step does to every particle, in this order:
+//	velocity = (velocity + gravity*dt) * (1 - drag*dt)
+//	position = position + velocity*dt
+//	timeToLive = timeToLive - dt, alive while it stays above 0.
+struct ParticleStep {
+	float dt;
+	glm::vec3 gravity;
+	float drag; //Fraction of the velocity lost per second.
+};
+
+//The same operations in the same order on every path, and no fused multiply-adds, so every kernel gives
+//bit-identical results and the choice only changes speed. See benchParticles().
+enum PARTICLE_KERNEL { PK_SCALAR, PK_SSE, PK_AVX, NUM_PARTICLE_KERNELS };
+extern const char *PARTICLE_KERNEL_NAMES[NUM_PARTICLE_KERNELS];
+extern PARTICLE_KERNEL gParticleKernel; //The widest one this CPU and OS run, found at startup.
+
+class ParticlePool
+{
+public:
+	vector<float> positionX, positionY, positionZ;
+	vector<float> velocityX, velocityY, velocityZ;
+	vector<float> timeToLive;
+	vector<float> rotation; //Radians about the view axis.
+	vector<unsigned short> frame; //Index into the emitter's sprite frames.
+	vector<uint32_t> aliveMask; //From the last integrate(), bit i%32 of word i/32 is set while particle i lives.
+
+	ParticlePool(void) : numAlive(0) {}
+	void setCapacity(int capacity); //Keeps the live particles that still fit.
+	int getCapacity(void) const { return (int)timeToLive.size(); }
+	int getNumAlive(void) const { return numAlive; }
+	int spawn(void); //Index of the new particle, its fields left to the caller. -1 when full.
+	void kill(int i);
+	void clear(void) { numAlive = 0; }
+	void integrate(const ParticleStep &step, PARTICLE_KERNEL kernel = gParticleKernel) { integrate(step, 0, numAlive, kernel); }
+	void integrate(const ParticleStep &step, int first, int last, PARTICLE_KERNEL kernel = gParticleKernel); //first a multiple of 32, so ranges never share a mask word.
+	int removeDead(void); //The ones aliveMask has cleared, last first so every swap brings in a live one. Returns how many.
+	static int getBytesPerParticle(void) { return 8 * sizeof(float) + sizeof(unsigned short); }
+
+private:
+	int numAlive;
+};
@@ -0,0 +1,405 @@
+#include "ParticleRenderer.h"
+#include "GLState.h"
+#include "Scripts.h"
+#include "JobSystem.h"
+#include <algorithm>
+#include <cfloat>
+
+ParticleRenderer gParticleRenderer;
+
+//-------------------------------------------------------------------------//
+// PARTICLE RENDERER
+//-------------------------------------------------------------------------//
+
+//Corners come from gl_VertexID as a 4-vertex strip, (0,0) (1,0) (0,1) (1,1). The rows of the view matrix are the
+//camera's axes in world space, which is all it takes to face the camera without a matrix per particle.
+static const char *PARTICLE_VERTEX_SHADER =
+	"#version 400 core\n"
+	CAMERA_BLOCK_GLSL
+	"layout(location = 0) in vec3 iPosition;\n"
+	"layout(location = 1) in vec2 iSizeRotation;\n"
+	"layout(location = 2) in vec4 iFrame;\n"
+	"layout(location = 3) in vec4 iColor;\n"
+	"out vec2 vUV;\n"
+	"out vec4 vColor;\n"
+	"void main() {\n"
+	"\tvec2 corner = vec2(gl_VertexID & 1, gl_VertexID >> 1);\n"
+	"\tfloat c = cos(iSizeRotation.y), s = sin(iSizeRotation.y);\n"
+	"\tvec2 offset = mat2(c, s, -s, c) * (corner - 0.5) * iSizeRotation.x;\n"
+	"\tvec3 right = vec3(uViewM[0][0], uViewM[1][0], uViewM[2][0]);\n"
+	"\tvec3 up = vec3(uViewM[0][1], uViewM[1][1], uViewM[2][1]);\n"
+	"\tgl_Position = uViewProjectM * vec4(iPosition + right * offset.x + up * offset.y, 1.0);\n"
+	"\tvUV = vec2(iFrame.x + corner.x * iFrame.z, 1.0 - (iFrame.y + (1.0 - corner.y) * iFrame.w));\n" //Frames are top-left, images are flipped.
+	"\tvColor = iColor;\n"
+	"}\n";
+static const char *PARTICLE_FRAGMENT_SHADER =
+	"#version 400 core\n"
+	"uniform sampler2D uDiffuseTex;\n"
+	"uniform int uTextured;\n"
+	"in vec2 vUV;\n"
+	"in vec4 vColor;\n"
+	"out vec4 fColor;\n"
+	"void main() {\n"
+	"\tfColor = (uTextured != 0) ? texture(uDiffuseTex, vUV) * vColor : vColor;\n"
+	"}\n";
+
+//LSD over 11-bit digits, 2048 buckets, so PARTICLE_DEPTH_BITS of key take two passes. A pass whose digit is the
+//same for every key moves nothing and is skipped, as in RenderQueue's sort.
+static void radixSortDepth(vector<ParticleSortKey> &keys, vector<ParticleSortKey> &scratch)
+{
+	size_t n = keys.size();
+	if (n < 2) return;
+	scratch.resize(n);
+	for (int shift = 0; shift < PARTICLE_DEPTH_BITS; shift += 11) {
+		size_t offsets[2048] = { 0 };
+		for (size_t i = 0; i < n; ++i) ++offsets[(keys[i].key >> shift) & 0x7FF];
+		if (offsets[(keys[0].key >> shift) & 0x7FF] == n) continue;
+
+		size_t start = 0;
+		for (int d = 0; d < 2048; ++d) {
+			size_t count = offsets[d];
+			offsets[d] = start;
+			start += count;
+		}
+		for (size_t i = 0; i < n; ++i) scratch[offsets[(keys[i].key >> shift) & 0x7FF]++] = keys[i];
+		keys.swap(scratch);
+	}
+}
+
+void ParticleRenderer::addEmitter(EmitterScript *emitter)
+{
+	emitters.push_back(emitter);
+}
+void ParticleRenderer::removeEmitter(EmitterScript *emitter)
+{
+	for (int i = 0; i < (int)emitters.size(); ++i) {
+		if (emitters[i] != emitter) continue;
+		emitters[i] = emitters.back(); //Draw order between emitters isn't kept anyway.
+		emitters.pop_back();
+		return;
+	}
+}
+void ParticleRenderer::simulate(const Camera &camera)
+{
+	double start = PRECISE_TIME();
+	allocate(camera);
+	double stepStart = PRECISE_TIME();
+	step();
+	double end = PRECISE_TIME();
+	simulateTime = end - start;
+
+	//The time budget needs the cost of a particle, which changes with the CPU, the kernel and the workers. Only
+	//step() scales with particles, and below a floor the job dispatch in it outweighs them, so those steps don't count.
+	int numStepped = 0;
+	for (int i = 0; i < (int)allocations.size(); ++i) numStepped += allocations[i].emitter->getNumParticles();
+	if (numStepped < PARTICLE_TIMING_MIN) return;
+	double t = (end - stepStart) / numStepped;
+	timePerParticle = (timePerParticle > 0.0) ? timePerParticle * 0.9 + t * 0.1 : t;
+}
+static float getAllocationWeight(const EmitterAllocation &a)
+{
+	return max(a.coverage, 1e-6f); //A speck on screen still gets a few.
+}
+void ParticleRenderer::allocate(const Camera &camera)
+{
+	allocations.clear();
+	for (int i = 0; i < (int)emitters.size(); ++i) {
+		if (!emitters[i]->hasPendingStep()) continue;
+		EmitterAllocation a = { emitters[i], 0.0f, 0.0f, true, emitters[i]->getCapacity(), INT_MAX, 1.0f };
+		allocations.push_back(a);
+	}
+	numOutOfView = 0;
+	if (!isBudgeted()) {
+		effectiveBudget = 0;
+		for (int i = 0; i < (int)allocations.size(); ++i) allocations[i].emitter->setAllowance(INT_MAX, 1.0f);
+		return;
+	}
+	int budget = (particleBudget > 0) ? particleBudget : INT_MAX;
+	if (timeBudget > 0.0 && timePerParticle > 0.0) budget = (int)min((double)budget, timeBudget / timePerParticle);
+	effectiveBudget = budget;
+
+	//What's out of view spawns nothing, but its live particles count against the budget until they die.
+	Frustum frustum;
+	frustum.fromMatrix(camera.worldViewProject);
+	float screenHeight = 2.0f * tan(camera.fovy * 0.5f); //At a distance of 1.
+	int remaining = budget;
+	double totalWeight = 0.0;
+	fillOrder.clear();
+	for (int i = 0; i < (int)allocations.size(); ++i) {
+		EmitterAllocation &a = allocations[i];
+		Bounds reach = a.emitter->getReach();
+		a.distance = glm::length(reach.center - camera.eye);
+		float span = min(2.0f * reach.radius / (max(a.distance, reach.radius) * screenHeight), 1.0f); //Around the camera, all of it.
+		a.coverage = span * span;
+		a.inView = frustum.intersects(reach);
+		if (!a.inView) {
+			a.allowance = 0;
+			a.rateScale = 0.0f;
+			remaining -= a.emitter->getNumParticles();
+			++numOutOfView;
+			continue;
+		}
+		fillOrder.push_back(i);
+		totalWeight += getAllocationWeight(a);
+	}
+	remaining = max(remaining, 0);
+
+	//Shares by weight, filling the emitters that want the least per weight first. Each share is then final, as
+	//whatever one leaves goes to those after it, who want as much per weight or more.
+	sort(fillOrder.begin(), fillOrder.end(), [this](int i, int j) {
+		const EmitterAllocation &a = allocations[i], &b = allocations[j];
+		return (double)a.demand * getAllocationWeight(b) < (double)b.demand * getAllocationWeight(a);
+	});
+	for (int k = 0; k < (int)fillOrder.size(); ++k) {
+		EmitterAllocation &a = allocations[fillOrder[k]];
+		double weight = getAllocationWeight(a);
+		int share = (totalWeight > 0.0) ? (int)min(remaining * weight / totalWeight, (double)remaining) : remaining;
+		a.allowance = min(a.demand, share);
+		a.rateScale = (a.demand > 0) ? (float)a.allowance / a.demand : 1.0f;
+		remaining -= a.allowance;
+		totalWeight -= weight;
+	}
+	for (int i = 0; i < (int)allocations.size(); ++i) allocations[i].emitter->setAllowance(allocations[i].allowance, allocations[i].rateScale);
+}
+void ParticleRenderer::step(void)
+{
+	//A job per emitter spawns, and finishes the step too unless the emitter is too big for one job.
+	bigEmitters.clear();
+	for (int i = 0; i < (int)emitters.size(); ++i) {
+		EmitterScript *e = emitters[i];
+		if (!e->hasPendingStep()) continue; //Inactive, or its node isn't updated.
+		gJobs.submit([e]() {
+			e->beginStep();
+			if (e->getNumParticles() > PARTICLE_JOB_SIZE) return;
+			e->integrate(0, e->getNumParticles());
+			e->endStep();
+		});
+	}
+	gJobs.waitAll();
+
+	//The big ones spread their particles over the workers, each range with its own mask words, then compact.
+	for (int i = 0; i < (int)emitters.size(); ++i) if (emitters[i]->hasPendingStep()) bigEmitters.push_back(emitters[i]);
+	if (bigEmitters.empty()) return;
+	for (int i = 0; i < (int)bigEmitters.size(); ++i) {
+		EmitterScript *e = bigEmitters[i];
+		for (int first = 0; first < e->getNumParticles(); first += PARTICLE_JOB_SIZE) {
+			int last = min(first + PARTICLE_JOB_SIZE, e->getNumParticles());
+			gJobs.submit([e, first, last]() { e->integrate(first, last); });
+		}
+	}
+	gJobs.waitAll();
+	for (int i = 0; i < (int)bigEmitters.size(); ++i) {
+		EmitterScript *e = bigEmitters[i];
+		gJobs.submit([e]() { e->endStep(); });
+	}
+	gJobs.waitAll();
+}
+bool ParticleRenderer::buildProgram(void)
+{
+	if (triedProgram) return program != NULL_HANDLE;
+	triedProgram = true; //A program that failed once fails every frame, so don't retry.
+
+	GLuint vs = compileShader(PARTICLE_VERTEX_SHADER, GL_VERTEX_SHADER, "particle vertex shader");
+	GLuint fs = compileShader(PARTICLE_FRAGMENT_SHADER, GL_FRAGMENT_SHADER, "particle fragment shader");
+	if (vs != NULL_HANDLE && fs != NULL_HANDLE) program = createShaderProgram(vs, fs);
+	if (vs != NULL_HANDLE) glDeleteShader(vs);
+	if (fs != NULL_HANDLE) glDeleteShader(fs);
+	if (program == NULL_HANDLE) return false;
+
+	UniformTable uniforms;
+	uniforms.reflect(program);
+	const UniformTable::Uniform *u = uniforms.find("uTextured");
+	texturedLoc = (u != nullptr) ? u->location : -1;
+	gGLState.useProgram(program);
+	if (uniforms[U_DIFFUSE_TEX] != -1) gGLState.setUniform1i(uniforms[U_DIFFUSE_TEX], 0); //The sampler reads from unit 0.
+
+	glGenVertexArrays(1, &vao);
+	glGenBuffers(1, &buffer);
+	gGLState.bindVertexArray(vao);
+	glEnableVertexAttribArray(P_POSITION);
+	glEnableVertexAttribArray(P_SIZE_ROTATION);
+	glEnableVertexAttribArray(P_FRAME);
+	glEnableVertexAttribArray(P_COLOR);
+	glVertexAttribDivisor(P_POSITION, 1);
+	glVertexAttribDivisor(P_SIZE_ROTATION, 1);
+	glVertexAttribDivisor(P_FRAME, 1);
+	glVertexAttribDivisor(P_COLOR, 1);
+	return true;
+}
+void ParticleRenderer::pointAttributes(int first)
+{
+	//GL 4.0 has no base instance for instanced draws, so each range moves the pointers to its start instead.
+	size_t offset = first * sizeof(ParticleVertex);
+	glVertexAttribPointer(P_POSITION, 3, GL_FLOAT, GL_FALSE, sizeof(ParticleVertex), (void*)(offset + offsetof(ParticleVertex, position)));
+	glVertexAttribPointer(P_SIZE_ROTATION, 2, GL_FLOAT, GL_FALSE, sizeof(ParticleVertex), (void*)(offset + offsetof(ParticleVertex, size)));
+	glVertexAttribPointer(P_FRAME, 4, GL_FLOAT, GL_FALSE, sizeof(ParticleVertex), (void*)(offset + offsetof(ParticleVertex, frame)));
+	glVertexAttribPointer(P_COLOR, 4, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(ParticleVertex), (void*)(offset + offsetof(ParticleVertex, color)));
+}
+void ParticleRenderer::draw(Camera &camera, float alpha)
+{
+	//Gather first, so the whole frame's particles go up in one upload.
+	vertices.clear();
+	ranges.clear();
+	sortVertices.clear();
+	sortTextures.clear();
+	sortedEmitters.clear();
+	for (int i = 0; i < (int)emitters.size(); ++i) {
+		EmitterScript *e = emitters[i];
+		if (e->isDepthSorted()) {
+			SortedEmitter s;
+			s.texture = e->getTexture();
+			s.first = (int)sortVertices.size();
+			e->writeParticles(sortVertices, alpha);
+			s.count = (int)sortVertices.size() - s.first;
+			if (s.count == 0) continue;
+			sortTextures.resize(sortVertices.size(), s.texture);
+			sortedEmitters.push_back(s);
+			continue;
+		}
+		EmitterRange r = { e->getTexture(), (int)vertices.size(), 0 };
+		e->writeParticles(vertices, alpha);
+		r.count = (int)vertices.size() - r.first;
+		if (r.count > 0) ranges.push_back(r);
+	}
+	sortByDepth(camera); //After the rest, which blending over them needs.
+	numParticles = (int)vertices.size();
+	numDraws = 0;
+	if (vertices.empty() || !buildProgram()) return;
+
+	glBindBuffer(GL_ARRAY_BUFFER, buffer);
+	glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(ParticleVertex), &vertices[0], GL_STREAM_DRAW); //Orphans last frame's.
+
+	gGLState.useProgram(program);
+	gGLState.bindVertexArray(vao);
+	gGLState.setBlend(true);
+	for (int i = 0; i < (int)ranges.size(); ++i) {
+		const EmitterRange &r = ranges[i];
+		if (r.texture != nullptr) {
+			gGLState.bindTexture(0, GL_TEXTURE_2D, r.texture->textureId);
+			gGLState.bindSampler(0, r.texture->samplerId);
+		}
+		if (texturedLoc != -1) gGLState.setUniform1i(texturedLoc, r.texture != nullptr);
+		pointAttributes(r.first);
+		glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4, r.count);
+		++numDraws;
+	}
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+void ParticleRenderer::sortByDepth(const Camera &camera)
+{
+	numSorted = (int)sortVertices.size();
+	numSortGroups = 0;
+	sortTime = 0.0;
+	if (sortVertices.empty()) return;
+	double start = PRECISE_TIME();
+
+	//Bounds and depth range of each emitter's cards, depth along the view direction.
+	glm::vec3 forward = glm::normalize(camera.center - camera.eye);
+	for (int i = 0; i < (int)sortedEmitters.size(); ++i) {
+		SortedEmitter &s = sortedEmitters[i];
+		s.boundsMin = glm::vec3(FLT_MAX);
+		s.boundsMax = glm::vec3(-FLT_MAX);
+		s.nearDepth = FLT_MAX;
+		s.farDepth = -FLT_MAX;
+		s.group = i;
+		for (int k = s.first; k < s.first + s.count; ++k) {
+			const ParticleVertex &v = sortVertices[k];
+			float radius = v.size * 0.5f;
+			s.boundsMin = glm::min(s.boundsMin, v.position - glm::vec3(radius));
+			s.boundsMax = glm::max(s.boundsMax, v.position + glm::vec3(radius));
+			float depth = glm::dot(v.position - camera.eye, forward);
+			s.nearDepth = min(s.nearDepth, depth);
+			s.farDepth = max(s.farDepth, depth);
+		}
+	}
+
+	//Emitters whose bounds overlap, directly or through others, sort as one group. Groups whose bounds don't overlap
+	//can't interleave, so drawing them whole from the farthest is enough. Few emitters sort, so pairs are cheap.
+	for (int i = 1; i < (int)sortedEmitters.size(); ++i) {
+		for (int j = 0; j < i; ++j) {
+			const SortedEmitter &a = sortedEmitters[i], &b = sortedEmitters[j];
+			if (a.group == b.group) continue;
+			if (a.boundsMin.x > b.boundsMax.x || b.boundsMin.x > a.boundsMax.x) continue;
+			if (a.boundsMin.y > b.boundsMax.y || b.boundsMin.y > a.boundsMax.y) continue;
+			if (a.boundsMin.z > b.boundsMax.z || b.boundsMin.z > a.boundsMax.z) continue;
+			int from = max(a.group, b.group), to = min(a.group, b.group); //Group by its first emitter.
+			for (int k = 0; k <= i; ++k) if (sortedEmitters[k].group == from) sortedEmitters[k].group = to;
+		}
+	}
+	groupOrder.clear();
+	for (int i = 0; i < (int)sortedEmitters.size(); ++i) {
+		SortedEmitter &s = sortedEmitters[i];
+		if (s.group == i) {
+			groupOrder.push_back(i);
+			continue;
+		}
+		SortedEmitter &g = sortedEmitters[s.group]; //The first holds its group's depth range from here.
+		g.nearDepth = min(g.nearDepth, s.nearDepth);
+		g.farDepth = max(g.farDepth, s.farDepth);
+	}
+	sort(groupOrder.begin(), groupOrder.end(), [this](int a, int b) { return sortedEmitters[a].farDepth > sortedEmitters[b].farDepth; });
+	numSortGroups = (int)groupOrder.size();
+
+	//Each group's particles keyed by depth quantized over its own range, farthest 0, then merged into runs of a texture.
+	int firstSortedRange = (int)ranges.size();
+	const float maxKey = (float)((1u << PARTICLE_DEPTH_BITS) - 1);
+	for (int g = 0; g < (int)groupOrder.size(); ++g) {
+		const SortedEmitter &first = sortedEmitters[groupOrder[g]];
+		float range = first.farDepth - first.nearDepth;
+		float scale = (range > 0.0f) ? maxKey / range : 0.0f;
+		keys.clear();
+		for (int i = groupOrder[g]; i < (int)sortedEmitters.size(); ++i) {
+			const SortedEmitter &s = sortedEmitters[i];
+			if (s.group != groupOrder[g]) continue;
+			for (int k = s.first; k < s.first + s.count; ++k) {
+				float depth = glm::dot(sortVertices[k].position - camera.eye, forward);
+				ParticleSortKey key = { (uint32_t)min((first.farDepth - depth) * scale, maxKey), (uint32_t)k };
+				keys.push_back(key);
+			}
+		}
+		radixSortDepth(keys, keyScratch);
+		for (int i = 0; i < (int)keys.size(); ++i) {
+			const RGBAImage *texture = sortTextures[keys[i].index];
+			if ((int)ranges.size() == firstSortedRange || ranges.back().texture != texture) {
+				EmitterRange r = { texture, (int)vertices.size(), 0 };
+				ranges.push_back(r);
+			}
+			vertices.push_back(sortVertices[keys[i].index]);
+			++ranges.back().count;
+		}
+	}
+	sortTime = PRECISE_TIME() - start;
+}
+void ParticleRenderer::dropGL(void)
+{
+	if (program != NULL_HANDLE) {
+		glDeleteProgram(program);
+		gGLState.forgetProgram(program);
+	}
+	if (vao != NULL_HANDLE) {
+		glDeleteVertexArrays(1, &vao);
+		gGLState.forgetVertexArray(vao);
+	}
+	if (buffer != NULL_HANDLE) glDeleteBuffers(1, &buffer);
+	program = vao = buffer = NULL_HANDLE;
+	texturedLoc = -1;
+	triedProgram = false; //The next window builds it again.
+}
+void ParticleRenderer::printStats(void) const
+{
+	printf("\tParticles: %d from %d emitters in %d draw calls.\n", numParticles, (int)emitters.size(), numDraws);
+	printf("\tDepth sorted: %d particles in %d groups, %.3f ms.\n", numSorted, numSortGroups, sortTime * 1000.0);
+	if (!isBudgeted()) {
+		printf("\tParticle budget: none, last step %.3f ms.\n", simulateTime * 1000.0);
+		return;
+	}
+	printf("\tParticle budget: %d particles, from a cap of %d and %.2f ms at %.1f ns each. Last step %.3f ms.\n",
+		effectiveBudget, particleBudget, timeBudget * 1000.0, timePerParticle * 1e9, simulateTime * 1000.0);
+	for (int i = 0; i < (int)allocations.size(); ++i) {
+		const EmitterAllocation &a = allocations[i];
+		const char *name = (a.emitter->node != nullptr) ? a.emitter->node->name.c_str() : "";
+		if (!a.inView) printf("\t\t%-20s %8.1f away, out of view, %d live, no spawns\n", name, a.distance, a.emitter->getNumParticles());
+		else printf("\t\t%-20s %8.1f away, %7.4f of screen, %d live, %d of %d allowed, %3.0f%% rate\n", name, a.distance, a.coverage,
+			a.emitter->getNumParticles(), a.allowance, a.demand, a.rateScale * 100.0f);
+	}
+}
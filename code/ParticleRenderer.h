@@ -0,0 +1,114 @@
+#pragma once
+#include "EngineUtil.h"
+
+//-------------------------------------------------------------------------//
+// PARTICLE RENDERER
+//-------------------------------------------------------------------------//
+
+//Once per fixed step, after the nodes' update(), simulate() steps every emitter in parallel. Once per frame render()
+//has every registered emitter write its live particles into one array, which goes up in a single streaming upload,
+//and then draws each emitter's range of it with one instanced call. A particle is an instance: the vertex shader
+//builds its camera-facing quad from gl_VertexID and the camera's right and up axes, so no per-particle matrix or
+//uniform is ever set. Emitters step once per fixed tick but are drawn once per frame, between their last two steps,
+//so neither the tick count nor the frame rate changes the other's cost and motion stays smooth when they differ.
+//Before each step, allocate() shares out the budget, a cap on live particles and on the milliseconds a step may
+//take, the latter turned into particles at the measured cost of one. Emitters whose reach is outside the view spawn
+//nothing. Those in view get shares by the fraction of the screen their reach covers, which shrinks with distance, so
+//far emitters spawn more slowly and cap out lower. An emitter wanting less than its share leaves the rest to others.
+//Emitters with depthSort on are drawn after the rest, back to front. Those whose particles overlap in space are
+//sorted as one group, so their cards interleave correctly, and draw in runs of the same texture.
+#define PARTICLE_JOB_SIZE 8192 //Emitters up to this many particles step in one job, bigger ones in ranges of it.
+#define PARTICLE_BUDGET 200000 //Default cap on live particles over every emitter, 0 for none.
+#define PARTICLE_BUDGET_MS 2.0 //Default cap on the milliseconds simulate() takes, 0 for none. With both 0, nothing is culled either.
+#define PARTICLE_TIMING_MIN 1024 //Fewest particles a step needs for its time to update the cost of one.
+#define PARTICLE_DEPTH_BITS 22 //Of the quantized view depth sort keys: two passes of 11-bit digits.
+#define P_POSITION 0 //Attribute locations of the particle program, all advancing once per instance.
+#define P_SIZE_ROTATION 1
+#define P_FRAME 2
+#define P_COLOR 3
+
+struct ParticleVertex {
+	glm::vec3 position; //World space.
+	float size; //Full width of the quad in world units.
+	float rotation; //Radians about the view axis.
+	glm::vec4 frame; //[x y w h] of the sheet to show, as Sprite::frames.
+	unsigned int color; //RGBA8, multiplies the texture.
+};
+
+inline unsigned int packColor(const glm::vec4 &c)
+{
+	unsigned int packed = 0;
+	for (int i = 0; i < 4; ++i) packed |= (unsigned int)(min(max(c[i], 0.0f), 1.0f) * 255.0f + 0.5f) << (8 * i);
+	return packed;
+}
+
+struct ParticleSortKey {
+	uint32_t key; //Quantized depth, 0 the farthest of its group.
+	uint32_t index; //Into the sorted emitters' vertices.
+};
+
+class EmitterScript;
+struct EmitterAllocation {
+	EmitterScript *emitter;
+	float distance; //From the camera to the center of its reach.
+	float coverage; //Fraction of the screen's height its reach spans, squared.
+	bool inView;
+	int demand; //Its particleMax.
+	int allowance; //Live particles it may spawn up to.
+	float rateScale; //Of its emitRate.
+};
+
+class ParticleRenderer
+{
+public:
+	int particleBudget; //Live particles, 0 for none.
+	double timeBudget; //Seconds per simulate(), 0 for none.
+	int effectiveBudget; //The smaller of the two in particles, as of the last allocate().
+	double simulateTime; //Seconds the last simulate() took.
+	double timePerParticle; //Seconds, smoothed over steps.
+	int numOutOfView; //Emitters the last allocate() stopped spawning.
+	int numParticles, numDraws; //Of the last draw().
+	int numSorted, numSortGroups; //Particles drawn back to front in the last draw(), and how many groups they sorted in.
+	double sortTime; //Seconds the last draw() spent finding groups, sorting and merging.
+
+	ParticleRenderer(void) : particleBudget(PARTICLE_BUDGET), timeBudget(PARTICLE_BUDGET_MS / 1000.0), effectiveBudget(0), simulateTime(0.0), timePerParticle(0.0), numOutOfView(0),
+		numParticles(0), numDraws(0), numSorted(0), numSortGroups(0), sortTime(0.0), program(NULL_HANDLE), vao(NULL_HANDLE), buffer(NULL_HANDLE), texturedLoc(-1), triedProgram(false) {}
+	void addEmitter(EmitterScript *emitter); //From the emitters' constructors and destructors.
+	void removeEmitter(EmitterScript *emitter);
+	void simulate(const Camera &camera); //Runs the steps the emitters queued in update() on gJobs, and waits for them.
+	bool isBudgeted(void) const { return particleBudget > 0 || timeBudget > 0.0; }
+	void draw(Camera &camera, float alpha); //After the scene, with the camera block already uploaded. alpha as render()'s.
+	void dropGL(void); //Before the window closes.
+	void printStats(void) const;
+
+private:
+	struct EmitterRange { const RGBAImage *texture; int first, count; };
+	struct SortedEmitter {
+		const RGBAImage *texture;
+		int first, count; //In sortVertices.
+		glm::vec3 boundsMin, boundsMax; //Of its cards.
+		float nearDepth, farDepth;
+		int group; //Index of the first emitter in its group.
+	};
+	vector<EmitterScript*> emitters;
+	vector<EmitterScript*> bigEmitters; //Of the current simulate().
+	vector<EmitterAllocation> allocations; //Of the last allocate(), the ones stepped.
+	vector<int> fillOrder;
+	vector<ParticleVertex> vertices; //Kept between frames, so steady state allocates nothing.
+	vector<EmitterRange> ranges;
+	vector<ParticleVertex> sortVertices; //Of depth-sorted emitters, before they are merged into vertices.
+	vector<const RGBAImage*> sortTextures; //Of each of sortVertices.
+	vector<SortedEmitter> sortedEmitters;
+	vector<int> groupOrder; //First emitters of the groups, farthest first.
+	vector<ParticleSortKey> keys, keyScratch;
+	GLuint program, vao, buffer;
+	GLint texturedLoc;
+	bool triedProgram;
+
+	void allocate(const Camera &camera); //Sets every stepping emitter's allowance.
+	void step(void);
+	bool buildProgram(void);
+	void pointAttributes(int first); //At the range starting with vertices[first].
+	void sortByDepth(const Camera &camera); //Appends the sorted emitters' particles to vertices and ranges.
+};
+extern ParticleRenderer gParticleRenderer;
@@ -0,0 +1,182 @@
+#include "RenderQueue.h"
+#include "GLState.h"
+
+RenderQueue gRenderQueue;
+
+//-------------------------------------------------------------------------//
+// RENDER QUEUE
+//-------------------------------------------------------------------------//
+
+static uint64_t getKeyBits(const void *p)
+{
+	return (p == nullptr) ? 0 : (hashBytes(&p, sizeof(p)) & 0xFFFF);
+}
+static void countStateChanges(const vector<RenderPacket> &packets, FrameStats &stats)
+{
+	stats = FrameStats();
+	stats.numPackets = (int)packets.size();
+	for (int i = 0; i < (int)packets.size(); ++i) {
+		const RenderPacket &p = packets[i];
+		const RenderPacket *last = (i > 0) ? &packets[i - 1] : nullptr; //The first draw sets everything.
+		if (last == nullptr || p.shaderProgram != last->shaderProgram) ++stats.programChanges;
+		if (last == nullptr || p.material != last->material) ++stats.materialChanges;
+		if (last == nullptr || p.texture != last->texture) ++stats.textureChanges;
+		if (last == nullptr || p.mesh != last->mesh) ++stats.meshChanges;
+	}
+}
+//LSD radix sort on 8-bit digits, stable, so equal keys keep their submission order. A pass where every key has
+//the same digit is skipped, which is most of them when a scene only has a handful of programs and materials.
+static void radixSort(vector<RenderPacket> &packets, vector<RenderPacket> &scratch)
+{
+	size_t n = packets.size();
+	if (n < 2) return;
+	scratch.resize(n);
+	for (int shift = 0; shift < 64; shift += 8) {
+		size_t offsets[256] = { 0 };
+		for (size_t i = 0; i < n; ++i) ++offsets[(packets[i].key >> shift) & 0xFF];
+		if (offsets[(packets[0].key >> shift) & 0xFF] == n) continue;
+
+		size_t start = 0;
+		for (int d = 0; d < 256; ++d) {
+			size_t count = offsets[d];
+			offsets[d] = start;
+			start += count;
+		}
+		for (size_t i = 0; i < n; ++i) scratch[offsets[(packets[i].key >> shift) & 0xFF]++] = packets[i];
+		packets.swap(scratch);
+	}
+}
+
+static bool isInstanceable(const RenderPacket &p)
+{
+	return p.drawable->type == Drawable::TRIMESHINSTANCE && p.material->activeShaderProgram == 0;
+}
+static bool isSameBatch(const RenderPacket &a, const RenderPacket &b)
+{
+	return a.shaderProgram == b.shaderProgram && a.material == b.material && a.mesh == b.mesh
+		&& a.drawable->diffuseTexture == b.drawable->diffuseTexture && b.drawable->type == Drawable::TRIMESHINSTANCE;
+}
+
+void RenderQueue::clear(const Camera &camera)
+{
+	packets.clear();
+	frustum.fromMatrix(camera.worldViewProject);
+	numCulled = 0;
+}
+void RenderQueue::submit(SceneGraphNode *node)
+{
+	if (node->LODstack.size() == 0 || !node->isRendered || node->activeLOD == -1) return;
+	add(node->LODstack[node->activeLOD], &node->T);
+
+	SphereCollider *collider = node->collider; //One shared mesh and material, so colliders batch well.
+	if (collider != nullptr && collider->isRendered && collider->meshInstance->material != nullptr && collider->meshInstance->triMesh != nullptr)
+		add(collider->meshInstance, &collider->T);
+}
+//Mesh bounds taken to world space through the transform update() left, the same one the draw will use.
+static Bounds getWorldBounds(const Drawable *drawable, const Transform *T)
+{
+	Bounds world = drawable->triMesh->bounds.transformed(T->transform);
+	if (drawable->type == Drawable::TRIMESHINSTANCE || world.isEmpty()) return world;
+
+	//Sprites and billboards are turned to face the camera in the vertex shader, about their node's origin, so the
+	//flat card's box says nothing about what gets drawn. Anything the card can turn into fits a sphere about the
+	//origin reaching the far side of its own, and the box becomes the cube around that.
+	glm::vec3 origin(T->transform[3]);
+	world.radius += glm::length(world.center - origin);
+	world.center = origin;
+	world.boxMin = origin - glm::vec3(world.radius);
+	world.boxMax = origin + glm::vec3(world.radius);
+	return world;
+}
+void RenderQueue::add(Drawable *drawable, Transform *T)
+{
+	if (drawable->triMesh != nullptr && !frustum.intersects(getWorldBounds(drawable, T))) {
+		++numCulled;
+		return;
+	}
+	const Material *material = drawable->material;
+
+	RenderPacket p;
+	p.drawable = drawable;
+	p.T = T;
+	p.shaderProgram = material->shaderProgramHandles[material->activeShaderProgram];
+	p.material = material;
+	p.texture = drawable->diffuseTexture; //Sprites carry their own sheet, the rest use the material's first map.
+	if (p.texture == nullptr && !material->textures.empty()) p.texture = material->textures[0]->val;
+	p.mesh = drawable->triMesh;
+	p.key = ((uint64_t)(p.shaderProgram & 0xFFFF) << 48) | (getKeyBits(p.material) << 32) | (getKeyBits(p.texture) << 16) | getKeyBits(p.mesh);
+	packets.push_back(p);
+}
+void RenderQueue::sort(void)
+{
+	countStateChanges(packets, unsorted);
+	radixSort(packets, scratch);
+	countStateChanges(packets, sorted);
+}
+void RenderQueue::draw(Camera &camera)
+{
+	//Group first, so every transform an instanced batch needs is gathered before the one upload.
+	batches.clear();
+	instances.clear();
+	for (int i = 0; i < (int)packets.size();) {
+		RenderBatch b = { i, 1, -1 };
+		if (isInstanceable(packets[i]))
+			while (i + b.count < (int)packets.size() && isSameBatch(packets[i], packets[i + b.count])) ++b.count;
+		if (b.count >= INSTANCE_MIN_BATCH && packets[i].drawable->material->buildInstancedProgram()) {
+			b.firstInstance = (int)instances.size();
+			for (int k = i; k < i + b.count; ++k) {
+				InstanceData d;
+				d.worldM = packets[k].T->transform;
+				d.worldInverseM = packets[k].T->invTransform;
+				instances.push_back(d);
+			}
+		}
+		batches.push_back(b);
+		i += b.count;
+	}
+	if (!instances.empty()) {
+		if (instanceBuffer == NULL_HANDLE) glGenBuffers(1, &instanceBuffer);
+		glBindBuffer(GL_ARRAY_BUFFER, instanceBuffer);
+		glBufferData(GL_ARRAY_BUFFER, instances.size() * sizeof(InstanceData), &instances[0], GL_STREAM_DRAW); //Orphans last frame's.
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+	}
+
+	numDraws = numInstancedDraws = 0;
+	for (int i = 0; i < (int)batches.size(); ++i) {
+		const RenderBatch &b = batches[i];
+		if (b.firstInstance != -1) {
+			drawInstanced(camera, b);
+			++numInstancedDraws;
+			++numDraws;
+		}
+		else for (int k = b.first; k < b.first + b.count; ++k) {
+			drawObject(camera, *packets[k].drawable, *packets[k].T);
+			++numDraws;
+		}
+	}
+}
+void RenderQueue::drawInstanced(Camera &camera, const RenderBatch &batch)
+{
+	//The whole batch shares everything but the transforms, so its first packet stands in for the rest.
+	Drawable *drawable = packets[batch.first].drawable;
+	Material *material = drawable->material;
+	gGLState.useProgram(material->instancedProgram);
+	drawable->bindDiffuseTexture(*material->instancedUniforms);
+	setObjectUniforms(*material->instancedUniforms, camera, *packets[batch.first].T); //The per-object ones are attributes here.
+	material->applyMaterial(true);
+	drawable->triMesh->drawInstanced(instanceBuffer, batch.firstInstance * sizeof(InstanceData), batch.count);
+}
+void RenderQueue::dropGL(void)
+{
+	if (instanceBuffer != NULL_HANDLE) glDeleteBuffers(1, &instanceBuffer);
+	instanceBuffer = NULL_HANDLE;
+}
+void RenderQueue::printStats(void) const
+{
+	printf("\tCulled: %d, drawn: %d.\n", numCulled, sorted.numPackets);
+	printf("\tDraw calls: %d for %d packets, %d of them instanced.\n", numDraws, sorted.numPackets, numInstancedDraws);
+	printf("\tState changes unsorted -> sorted: %d -> %d (programs %d -> %d, materials %d -> %d, textures %d -> %d, meshes %d -> %d).\n",
+		unsorted.getNumChanges(), sorted.getNumChanges(),
+		unsorted.programChanges, sorted.programChanges, unsorted.materialChanges, sorted.materialChanges,
+		unsorted.textureChanges, sorted.textureChanges, unsorted.meshChanges, sorted.meshChanges);
+}
@@ -0,0 +1,63 @@
+#pragma once
+#include "EngineUtil.h"
+
+//-------------------------------------------------------------------------//
+// RENDER QUEUE
+//-------------------------------------------------------------------------//
+
+//Each frame render() submits the visible nodes, and the queue draws them grouped by state instead of in gNodes'
+//alphabetical order. The sort key packs program | material | diffuse texture | mesh into 16 bits each, most
+//expensive change first, and a radix sort orders it. Materials, textures and meshes enter the key as a 16-bit hash
+//of their address, so a rare collision only splits a group, it never changes what gets drawn.
+//Sorted runs of TriMeshInstance packets that share all of that become a single instanced draw, see draw().
+#define INSTANCE_MIN_BATCH 2 //Shorter runs draw one by one, the instanced program isn't even built for them.
+
+struct RenderPacket {
+	uint64_t key;
+	Drawable *drawable; //The node's active LOD, or its collider.
+	Transform *T;
+	GLuint shaderProgram; //The rest is kept for counting state changes, the key alone might collide.
+	const Material *material;
+	const RGBAImage *texture;
+	const TriMesh *mesh;
+};
+
+//State changes between consecutive draws, counted over the same packets in submission and in sorted order.
+struct FrameStats {
+	int numPackets;
+	int programChanges, materialChanges, textureChanges, meshChanges;
+	FrameStats(void) : numPackets(0), programChanges(0), materialChanges(0), textureChanges(0), meshChanges(0) {}
+	int getNumChanges(void) const { return programChanges + materialChanges + textureChanges + meshChanges; }
+};
+
+//Consecutive sorted packets drawn together. firstInstance is -1 when they go one by one.
+struct RenderBatch {
+	int first, count, firstInstance;
+};
+
+class RenderQueue
+{
+public:
+	FrameStats unsorted, sorted; //Of the last sort().
+	int numDraws, numInstancedDraws; //Of the last draw().
+	int numCulled; //Since the last clear(), drawables outside the frustum. The rest became packets.
+
+	RenderQueue(void) : numDraws(0), numInstancedDraws(0), numCulled(0), instanceBuffer(NULL_HANDLE) {}
+	void clear(const Camera &camera); //Also takes the camera's frustum to cull against.
+	void submit(SceneGraphNode *node); //Skipped unless it would draw, see SceneGraphNode::draw(), and in view.
+	void sort(void);
+	void draw(Camera &camera);
+	void dropGL(void); //Before the window closes.
+	void printStats(void) const;
+
+private:
+	vector<RenderPacket> packets, scratch; //Kept between frames, so steady state allocates nothing.
+	vector<RenderBatch> batches;
+	Frustum frustum;
+	vector<InstanceData> instances; //Of every instanced batch this frame, uploaded in one go.
+	GLuint instanceBuffer;
+
+	void add(Drawable *drawable, Transform *T);
+	void drawInstanced(Camera &camera, const RenderBatch &batch);
+};
+extern RenderQueue gRenderQueue;
@@ -0,0 +1,483 @@
+#include "SceneBinary.h"
+
+namespace sceneb {
+
+	static const size_t RECORD_SIZES[NUM_SECTIONS] = {
+		sizeof(WorldRecord), sizeof(LibraryRecord), sizeof(MeshRecord), sizeof(MaterialRecord),
+		sizeof(ColorRecord), sizeof(TextureRecord), sizeof(LightRecord), sizeof(CameraRecord),
+		sizeof(NodeRecord), sizeof(uint32_t), sizeof(DrawableRecord), sizeof(float),
+		sizeof(ScriptRecord), sizeof(PairRecord), sizeof(SoundRecord)
+	};
+
+	//Every reference a record makes is checked here once, so the loader can follow them without checking.
+	struct Validator {
+		const char *base;
+		const Header *h;
+		template<class T> const T* records(SECTION s) const { return (const T*)(base + h->sections[s].first); }
+		bool isString(StrRef ref) const { return ref == SCENEB_NONE || ref < h->stringsSize; } //The table ends in a 0, so any offset in it is terminated.
+		bool isRange(const Range &r, SECTION s) const { return r.first <= h->sections[s].count && r.count <= h->sections[s].count - r.first; }
+		bool isIndex(int32_t i, SECTION s, bool canBeNone) const { return (canBeNone && i == -1) || (i >= 0 && (uint32_t)i < h->sections[s].count); }
+		bool check(void) const;
+	};
+	bool Validator::check(void) const
+	{
+		const WorldRecord *world = records<WorldRecord>(WORLD);
+		for (uint32_t i = 0; i < h->sections[WORLD].count; ++i) {
+			const WorldRecord &r = world[i];
+			if (!isString(r.windowTitle) || !isString(r.backgroundMusic) || !isString(r.debugFont) || r.hasBackgroundColor > 3) return false;
+		}
+		const LibraryRecord *libraries = records<LibraryRecord>(LIBRARIES);
+		for (uint32_t i = 0; i < h->sections[LIBRARIES].count; ++i) if (!isString(libraries[i].file)) return false;
+		const MeshRecord *meshes = records<MeshRecord>(MESHES);
+		for (uint32_t i = 0; i < h->sections[MESHES].count; ++i) if (!isString(meshes[i].name) || !isString(meshes[i].file)) return false;
+		const MaterialRecord *materials = records<MaterialRecord>(MATERIALS);
+		for (uint32_t i = 0; i < h->sections[MATERIALS].count; ++i) {
+			const MaterialRecord &r = materials[i];
+			if (!isString(r.name) || !isString(r.vertexShader) || !isString(r.fragmentShader)) return false;
+			if (!isRange(r.colors, COLORS) || !isRange(r.textures, TEXTURES)) return false;
+		}
+		const ColorRecord *colors = records<ColorRecord>(COLORS);
+		for (uint32_t i = 0; i < h->sections[COLORS].count; ++i) if (!isString(colors[i].uniformName) || colors[i].numFloats > 4) return false;
+		const TextureRecord *textures = records<TextureRecord>(TEXTURES);
+		for (uint32_t i = 0; i < h->sections[TEXTURES].count; ++i) if (!isString(textures[i].uniformName) || !isString(textures[i].file)) return false;
+		const CameraRecord *cameras = records<CameraRecord>(CAMERAS);
+		for (uint32_t i = 0; i < h->sections[CAMERAS].count; ++i) if (!isString(cameras[i].name) || !isIndex(cameras[i].node, NODES, true)) return false;
+		const NodeRecord *nodes = records<NodeRecord>(NODES);
+		for (uint32_t i = 0; i < h->sections[NODES].count; ++i) {
+			const NodeRecord &r = nodes[i];
+			if (!isString(r.name) || (r.parent != -1 && (r.parent < 0 || (uint32_t)r.parent >= i))) return false; //Parents come first.
+			if (!isRange(r.drawables, DRAWABLES) || !isRange(r.distances, DISTANCES) || !isRange(r.cameras, NODE_CAMERAS) || !isRange(r.sounds, SOUNDS)) return false;
+		}
+		const uint32_t *nodeCameras = records<uint32_t>(NODE_CAMERAS);
+		for (uint32_t i = 0; i < h->sections[NODE_CAMERAS].count; ++i) if (nodeCameras[i] >= h->sections[CAMERAS].count) return false;
+		const DrawableRecord *drawables = records<DrawableRecord>(DRAWABLES);
+		for (uint32_t i = 0; i < h->sections[DRAWABLES].count; ++i) {
+			const DrawableRecord &r = drawables[i];
+			if (r.type > Drawable::BILLBOARD || !isString(r.mesh) || !isString(r.material) || !isString(r.image)) return false;
+		}
+		const ScriptRecord *scripts = records<ScriptRecord>(SCRIPTS);
+		for (uint32_t i = 0; i < h->sections[SCRIPTS].count; ++i) {
+			const ScriptRecord &r = scripts[i];
+			if (!isString(r.type) || !isIndex(r.node, NODES, false) || !isRange(r.pairs, PAIRS)) return false;
+		}
+		const PairRecord *pairs = records<PairRecord>(PAIRS);
+		for (uint32_t i = 0; i < h->sections[PAIRS].count; ++i) if (!isString(pairs[i].name) || !isString(pairs[i].value)) return false;
+		const SoundRecord *sounds = records<SoundRecord>(SOUNDS);
+		for (uint32_t i = 0; i < h->sections[SOUNDS].count; ++i) if (!isString(sounds[i].file)) return false;
+		return true;
+	}
+
+	bool View::attach(const MappedFile &file)
+	{
+		header = nullptr;
+		base = file.data;
+		if (file.data == nullptr || file.size < sizeof(Header)) return false;
+
+		const Header *h = (const Header*)file.data;
+		if (h->magic != SCENEB_MAGIC) { ERROR("Not a compiled scene (bad magic).", false); return false; }
+		if (h->version != SCENEB_VERSION) { ERROR("Compiled scene version mismatch, recompile the .scene file.", false); return false; }
+		if (h->fileSize != file.size) { ERROR("Compiled scene is truncated.", false); return false; }
+		if ((uint64_t)h->stringsOffset + h->stringsSize > file.size || (h->stringsSize > 0 && file.data[h->stringsOffset + h->stringsSize - 1] != '\0')) {
+			ERROR("Compiled scene string table out of bounds.", false);
+			return false;
+		}
+		for (int s = 0; s < NUM_SECTIONS; ++s)
+			if ((uint64_t)h->sections[s].first + (uint64_t)h->sections[s].count * RECORD_SIZES[s] > file.size || h->sections[s].first % 4 != 0) {
+				ERROR("Compiled scene section out of bounds.", false);
+				return false;
+			}
+		Validator v = { file.data, h };
+		if (!v.check()) {
+			ERROR("Compiled scene refers to a record or string it doesn't have, recompile the .scene file.", false);
+			return false;
+		}
+		header = h;
+		return true;
+	}
+	bool isCompiledSceneName(const string &fileName)
+	{
+		size_t extLength = strlen(SCENEB_EXTENSION);
+		return fileName.length() > extLength && fileName.compare(fileName.length() - extLength, extLength, SCENEB_EXTENSION) == 0;
+	}
+
+	//-------------------------------------------------------------------------//
+	// COMPILER
+	//-------------------------------------------------------------------------//
+
+	//Mirrors the grammar of loadScene() and friends in main.cpp, but only records what it reads.
+	class Compiler
+	{
+	public:
+		string strings;
+		map<string, StrRef> stringRefs;
+		vector<WorldRecord> world;
+		vector<LibraryRecord> libraries;
+		vector<MeshRecord> meshes;
+		vector<MaterialRecord> materials;
+		vector<ColorRecord> colors;
+		vector<TextureRecord> textures;
+		vector<LightRecord> lights;
+		vector<CameraRecord> cameras;
+		vector<NodeRecord> nodes;
+		vector<uint32_t> nodeCameras;
+		vector<DrawableRecord> drawables;
+		vector<float> distances;
+		vector<ScriptRecord> scripts;
+		vector<PairRecord> pairs;
+		vector<SoundRecord> sounds;
+
+		StrRef addString(const string &s)
+		{
+			auto it = stringRefs.find(s);
+			if (it != stringRefs.end()) return it->second;
+			StrRef ref = (StrRef)strings.size();
+			strings.append(s);
+			strings.push_back('\0');
+			stringRefs[s] = ref;
+			return ref;
+		}
+		StrRef readString(Tokenizer &F)
+		{
+			string token;
+			getToken(F, token, SCENE_CHARS);
+			return addString(token);
+		}
+		void skipBlock(Tokenizer &F)
+		{
+			TokenView token;
+			while (getToken(F, token, SCENE_CHARS)) if (token == "}") break;
+		}
+
+		void compileWorldSettings(Tokenizer &F)
+		{
+			WorldRecord w;
+			w.windowTitle = w.backgroundMusic = w.debugFont = SCENEB_NONE;
+			w.width = w.height = w.spp = -1; //-1 keeps whatever the engine currently has, like the text loader does.
+			w.fontTexNumRows = w.fontTexNumCols = -1;
+			w.hasBackgroundColor = 0;
+			w.backgroundColor[0] = w.backgroundColor[1] = w.backgroundColor[2] = 0.0f;
+			TokenView token;
+			while (getToken(F, token, SCENE_CHARS)) {
+				if (token == "}") break;
+				if (token == "windowTitle") w.windowTitle = readString(F);
+				else if (token == "width") getInts(F, &w.width, 1);
+				else if (token == "height") getInts(F, &w.height, 1);
+				else if (token == "spp") getInts(F, &w.spp, 1);
+				else if (token == "debugFont") w.debugFont = readString(F);
+				else if (token == "fontTexNumRows") getInts(F, &w.fontTexNumRows, 1);
+				else if (token == "fontTexNumCols") getInts(F, &w.fontTexNumCols, 1);
+				else if (token == "backgroundColor") w.hasBackgroundColor = getFloats(F, w.backgroundColor, 3);
+				else if (token == "backgroundMusic") w.backgroundMusic = readString(F);
+			}
+			world.assign(1, w);
+		}
+		void compileMesh(Tokenizer &F, bool inLibrary)
+		{
+			MeshRecord m;
+			m.name = m.file = addString("");
+			m.inLibrary = inLibrary;
+			TokenView token;
+			while (getToken(F, token, SCENE_CHARS)) {
+				if (token == "}") break;
+				else if (token == "name") m.name = readString(F);
+				else if (token == "file") m.file = readString(F);
+			}
+			meshes.push_back(m);
+		}
+		void compileMaterial(Tokenizer &F, bool inLibrary)
+		{
+			MaterialRecord m;
+			m.name = addString("");
+			m.vertexShader = m.fragmentShader = SCENEB_NONE;
+			m.inLibrary = inLibrary;
+			vector<ColorRecord> matColors;
+			vector<TextureRecord> matTextures;
+			TokenView token;
+			while (getToken(F, token, SCENE_CHARS)) {
+				if (token == "}") break;
+				else if (token == "name") m.name = readString(F);
+				else if (token == "vertexShader") m.vertexShader = readString(F);
+				else if (token == "fragmentShader") m.fragmentShader = readString(F);
+				else if (token == "color") {
+					ColorRecord c;
+					c.uniformName = readString(F);
+					c.val[0] = c.val[1] = c.val[2] = c.val[3] = 0.0f;
+					c.numFloats = getFloats(F, c.val, 4);
+					matColors.push_back(c);
+				}
+				else if (token == "texture") {
+					TextureRecord t;
+					t.uniformName = readString(F);
+					t.file = readString(F);
+					matTextures.push_back(t);
+				}
+			}
+			m.colors.first = (uint32_t)colors.size(); m.colors.count = (uint32_t)matColors.size();
+			m.textures.first = (uint32_t)textures.size(); m.textures.count = (uint32_t)matTextures.size();
+			colors.insert(colors.end(), matColors.begin(), matColors.end());
+			textures.insert(textures.end(), matTextures.begin(), matTextures.end());
+			materials.push_back(m);
+		}
+		void compileLight(Tokenizer &F)
+		{
+			LightRecord l;
+			memset(&l, 0, sizeof(l));
+			l.isOn = 1;
+			TokenView token;
+			while (getToken(F, token, SCENE_CHARS)) {
+				if (token == "}") break;
+				else if (token == "type") {
+					string lightType;
+					getToken(F, lightType, SCENE_CHARS);
+					if (lightType == "point") l.type = (int32_t)Light::LIGHT_TYPE::POINT;
+					else if (lightType == "directional") l.type = (int32_t)Light::LIGHT_TYPE::DIRECTIONAL;
+					else if (lightType == "spot") l.type = (int32_t)Light::LIGHT_TYPE::SPOT_LIGHT;
+				}
+				else if (token == "isOn") getInts(F, &l.isOn, 1);
+				else if (token == "alpha") getFloats(F, &l.alpha, 1);
+				else if (token == "theta") getFloats(F, &l.theta, 1);
+				else if (token == "intensity") getFloats(F, l.intensity, 3);
+				else if (token == "position") getFloats(F, l.position, 3);
+				else if (token == "direction") getFloats(F, l.direction, 3);
+				else if (token == "attenuation") getFloats(F, l.attenuation, 3);
+			}
+			lights.push_back(l);
+		}
+		uint32_t compileCamera(Tokenizer &F, int32_t node)
+		{
+			CameraRecord c;
+			memset(&c, 0, sizeof(c));
+			c.name = addString("");
+			c.node = node;
+			TokenView token;
+			while (getToken(F, token, SCENE_CHARS)) {
+				if (token == "}") break;
+				else if (token == "name") c.name = readString(F);
+				else if (token == "eye") getFloats(F, c.eye, 3);
+				else if (token == "center") getFloats(F, c.center, 3);
+				else if (token == "vup") getFloats(F, c.vup, 3);
+				else if (token == "znear") getFloats(F, &c.znear, 1);
+				else if (token == "zfar") getFloats(F, &c.zfar, 1);
+				else if (token == "fovy") getFloats(F, &c.fovy, 1);
+			}
+			cameras.push_back(c);
+			return (uint32_t)cameras.size() - 1;
+		}
+		DrawableRecord compileDrawable(Tokenizer &F, Drawable::TYPE type)
+		{
+			DrawableRecord d;
+			d.type = type;
+			d.mesh = d.material = d.image = SCENEB_NONE;
+			d.animDir = 1; d.animRate = 1.0f; //Sprite() defaults.
+			d.frameWidth = d.frameHeight = 0;
+			TokenView token;
+			while (getToken(F, token, SCENE_CHARS)) {
+				if (token == "}") break;
+				else if (token == "material") d.material = readString(F);
+				else if (token == "mesh" && type == Drawable::TRIMESHINSTANCE) d.mesh = readString(F);
+				else if (token == "image") d.image = readString(F);
+				else if (type == Drawable::SPRITE) {
+					if (token == "animDir") getInts(F, &d.animDir, 1);
+					else if (token == "animRate") getFloats(F, &d.animRate, 1);
+					else if (token == "frameWidth") getInts(F, &d.frameWidth, 1);
+					else if (token == "frameHeight") getInts(F, &d.frameHeight, 1);
+				}
+			}
+			if (type == Drawable::SPRITE && d.image == SCENEB_NONE) ERROR("Sprite needs an image uSheetName \"img.png\"!", false);
+			return d;
+		}
+		void compileScript(Tokenizer &F, int32_t node)
+		{
+			ScriptRecord s;
+			s.type = SCENEB_NONE;
+			s.node = node;
+			s.pairs.first = (uint32_t)pairs.size();
+			s.pairs.count = 0;
+			string token;
+			while (getToken(F, token, SCENE_CHARS)) {
+				if (token == "}") break;
+				else if (token == "type") s.type = readString(F);
+				else if (token == "pairs") {
+					string propertyName, propertyVal;
+					getToken(F, token, SCENE_CHARS); //Gets '{'.
+					while (getToken(F, propertyName, SCENE_CHARS)) {
+						if (propertyName == "}") break;
+						getToken(F, propertyVal, SCENE_CHARS);
+						if (propertyVal == "[") {
+							while (propertyVal.find(']') == string::npos && getToken(F, token, SCENE_CHARS)) propertyVal += token;
+						}
+						PairRecord p;
+						p.name = addString(propertyName);
+						p.value = addString(propertyVal);
+						pairs.push_back(p);
+						s.pairs.count++;
+					}
+				}
+			}
+			scripts.push_back(s);
+		}
+		int32_t compileNode(Tokenizer &F, int32_t parent)
+		{
+			int32_t index = (int32_t)nodes.size(); //Claimed before children so nodes stay pre-order.
+			nodes.push_back(NodeRecord());
+			NodeRecord n;
+			memset(&n, 0, sizeof(n));
+			n.name = addString("");
+			n.parent = parent;
+			n.flags = IS_RENDERED | IS_UPDATED;
+			n.scale[0] = n.scale[1] = n.scale[2] = 1.0f;
+			float renderThreshold = -1.0f;
+			vector<DrawableRecord> lods;
+			vector<uint32_t> nodeCams;
+			vector<SoundRecord> nodeSounds;
+
+			TokenView token;
+			while (getToken(F, token, SCENE_CHARS)) {
+				if (token == "}") break;
+				else if (token == "name") {
+					string nodeName;
+					getToken(F, nodeName, SCENE_CHARS);
+					if (nodeName == "") ERROR("Scene file does not name node!");
+					n.name = addString(nodeName);
+				}
+				else if (token == "meshInstance") lods.push_back(compileDrawable(F, Drawable::TRIMESHINSTANCE));
+				else if (token == "sprite") lods.push_back(compileDrawable(F, Drawable::SPRITE));
+				else if (token == "billboard") lods.push_back(compileDrawable(F, Drawable::BILLBOARD));
+				else if (token == "maxRenderDist") getFloats(F, &renderThreshold, 1);
+				else if (token == "translation") getFloats(F, n.translation, 3);
+				else if (token == "rotation") getFloats(F, n.rotation, 3);
+				else if (token == "scale") getFloats(F, n.scale, 3);
+				else if (token == "node") compileNode(F, index);
+				else if (token == "camera") nodeCams.push_back(compileCamera(F, index));
+				else if (token == "script") compileScript(F, index);
+				else if (token == "sound") { SoundRecord s; s.file = readString(F); nodeSounds.push_back(s); }
+				else if (token == "collider") {
+					n.flags |= HAS_COLLIDER;
+					while (getToken(F, token, SCENE_CHARS)) {
+						if (token == "}") break;
+						else if (token == "offset") getFloats(F, n.colliderOffset, 3);
+						else if (token == "radius") getFloats(F, &n.colliderRadius, 1);
+					}
+				}
+				else if (token == "isRendered") {
+					int tmpBool;
+					getInts(F, &tmpBool, 1);
+					if (tmpBool) n.flags |= IS_RENDERED; else n.flags &= ~IS_RENDERED;
+				}
+				else if (token == "isUpdated") {
+					int tmpBool;
+					getInts(F, &tmpBool, 1);
+					if (tmpBool) n.flags |= IS_UPDATED; else n.flags &= ~IS_UPDATED;
+				}
+			}
+
+			//Precompute switchingDistances exactly as loadAndReturnNode() does.
+			if (renderThreshold == -1.0f) {
+				ERROR("Need to specify maxRenderDist in node " + string(&strings[n.name]) + "!", false);
+				renderThreshold = 100;
+			}
+			n.distances.first = (uint32_t)distances.size();
+			n.distances.count = (uint32_t)lods.size();
+			for (float div = 1.0f; div <= (int)lods.size(); ++div) distances.push_back(renderThreshold / div);
+
+			n.drawables.first = (uint32_t)drawables.size(); n.drawables.count = (uint32_t)lods.size();
+			n.cameras.first = (uint32_t)nodeCameras.size(); n.cameras.count = (uint32_t)nodeCams.size();
+			n.sounds.first = (uint32_t)sounds.size(); n.sounds.count = (uint32_t)nodeSounds.size();
+			drawables.insert(drawables.end(), lods.begin(), lods.end());
+			nodeCameras.insert(nodeCameras.end(), nodeCams.begin(), nodeCams.end());
+			sounds.insert(sounds.end(), nodeSounds.begin(), nodeSounds.end());
+			nodes[index] = n;
+			return index;
+		}
+		bool compileLibrary(const string &lib)
+		{
+			LibraryRecord l;
+			l.file = addString(lib);
+			libraries.push_back(l);
+			addFileDirectoryToPath(lib);
+
+			Tokenizer F;
+			if (!F.open(lib)) return false;
+			TokenView token;
+			while (getToken(F, token, SCENE_CHARS)) {
+				if (token == "mesh") compileMesh(F, true);
+				else if (token == "material") compileMaterial(F, true);
+			}
+			return true;
+		}
+		bool compile(const char *sceneFile)
+		{
+			addFileDirectoryToPath(sceneFile);
+
+			Tokenizer F;
+			if (!F.open(sceneFile)) return false;
+			TokenView token;
+			while (getToken(F, token, SCENE_CHARS)) {
+				if (token == "worldSettings") compileWorldSettings(F);
+				else if (token == "library") { getToken(F, token, SCENE_CHARS); compileLibrary(token.str()); }
+				else if (token == "node") compileNode(F, -1);
+				else if (token == "mesh") compileMesh(F, false);
+				else if (token == "material") compileMaterial(F, false);
+				else if (token == "meshInstance") skipBlock(F); //The text loader builds and drops these, so there is nothing to keep.
+				else if (token == "camera") compileCamera(F, -1);
+				else if (token == "light") compileLight(F);
+			}
+			return true;
+		}
+
+		template<class T> void writeSection(FILE *F, Header &h, SECTION s, const vector<T> &records)
+		{
+			h.sections[s].first = (uint32_t)ftell(F);
+			h.sections[s].count = (uint32_t)records.size();
+			if (!records.empty()) fwrite(&records[0], sizeof(T), records.size(), F);
+		}
+		bool write(const char *outFile)
+		{
+			FILE *F = fopen(outFile, "wb");
+			if (F == NULL) { ERROR(string("Could not open '") + outFile + "' for writing.", false); return false; }
+
+			while (strings.size() % 4 != 0) strings.push_back('\0'); //Keep the record arrays aligned.
+			Header h;
+			memset(&h, 0, sizeof(h));
+			h.magic = SCENEB_MAGIC;
+			h.version = SCENEB_VERSION;
+			fwrite(&h, sizeof(h), 1, F); //Placeholder, rewritten once the offsets are known.
+			h.stringsOffset = (uint32_t)ftell(F);
+			h.stringsSize = (uint32_t)strings.size();
+			fwrite(strings.data(), 1, strings.size(), F);
+
+			writeSection(F, h, WORLD, world);
+			writeSection(F, h, LIBRARIES, libraries);
+			writeSection(F, h, MESHES, meshes);
+			writeSection(F, h, MATERIALS, materials);
+			writeSection(F, h, COLORS, colors);
+			writeSection(F, h, TEXTURES, textures);
+			writeSection(F, h, LIGHTS, lights);
+			writeSection(F, h, CAMERAS, cameras);
+			writeSection(F, h, NODES, nodes);
+			writeSection(F, h, NODE_CAMERAS, nodeCameras);
+			writeSection(F, h, DRAWABLES, drawables);
+			writeSection(F, h, DISTANCES, distances);
+			writeSection(F, h, SCRIPTS, scripts);
+			writeSection(F, h, PAIRS, pairs);
+			writeSection(F, h, SOUNDS, sounds);
+
+			h.fileSize = (uint32_t)ftell(F);
+			fseek(F, 0, SEEK_SET);
+			fwrite(&h, sizeof(h), 1, F);
+			fclose(F);
+			return true;
+		}
+	};
+
+	bool compileScene(const char *sceneFile, const char *outFile)
+	{
+		Compiler compiler;
+		if (!compiler.compile(sceneFile)) return false;
+		if (!compiler.write(outFile)) return false;
+		printf("Compiled '%s' -> '%s': %d nodes, %d meshes, %d materials, %d cameras, %d lights, %d scripts.\n",
+			sceneFile, outFile, (int)compiler.nodes.size(), (int)compiler.meshes.size(), (int)compiler.materials.size(),
+			(int)compiler.cameras.size(), (int)compiler.lights.size(), (int)compiler.scripts.size());
+		return true;
+	}
+}
@@ -0,0 +1,101 @@
+#pragma once
+#include "EngineUtil.h"
+#include <stdint.h>
+
+//-------------------------------------------------------------------------//
+// COMPILED SCENES (.sceneb)
+//-------------------------------------------------------------------------//
+
+//A .sceneb file is the whole .scene hierarchy flattened into fixed-size records, so loading is a
+//file mapping plus pointer arithmetic instead of getToken() over every character.
+//Layout: Header | string table | one array of records per section. Everything is 4-byte aligned,
+//little-endian, and refers to other records by index and to strings by offset into the table.
+//Library contents are compiled inline (flagged inLibrary) so the loader never touches text.
+
+#define SCENEB_MAGIC 0x42534547 //"GESB" read as little-endian bytes.
+#define SCENEB_VERSION 1
+#define SCENEB_NONE 0xFFFFFFFFu //Absent string or index.
+#define SCENEB_EXTENSION ".sceneb"
+
+namespace sceneb {
+
+	enum SECTION {
+		WORLD, LIBRARIES, MESHES, MATERIALS, COLORS, TEXTURES, LIGHTS, CAMERAS,
+		NODES, NODE_CAMERAS, DRAWABLES, DISTANCES, SCRIPTS, PAIRS, SOUNDS,
+		NUM_SECTIONS
+	};
+
+	typedef uint32_t StrRef; //Byte offset into the string table, or SCENEB_NONE.
+
+	struct Range { uint32_t first, count; };
+
+	struct Header {
+		uint32_t magic, version, fileSize;
+		uint32_t stringsOffset, stringsSize;
+		Range sections[NUM_SECTIONS]; //first = byte offset of the array, count = number of records.
+	};
+
+	struct WorldRecord {
+		StrRef windowTitle, backgroundMusic, debugFont;
+		int32_t width, height, spp;
+		int32_t fontTexNumRows, fontTexNumCols;
+		uint32_t hasBackgroundColor;
+		float backgroundColor[3];
+	};
+	struct LibraryRecord { StrRef file; };
+	struct MeshRecord { StrRef name, file; uint32_t inLibrary; };
+	struct ColorRecord { StrRef uniformName; uint32_t numFloats; float val[4]; }; //numFloats mirrors what getFloats() would have filled.
+	struct TextureRecord { StrRef uniformName, file; };
+	struct MaterialRecord {
+		StrRef name, vertexShader, fragmentShader;
+		Range colors, textures; //Into COLORS and TEXTURES.
+		uint32_t inLibrary;
+	};
+	struct LightRecord {
+		int32_t type, isOn;
+		float alpha, theta;
+		float intensity[4], position[4], direction[4], attenuation[4];
+	};
+	struct CameraRecord { //Stored in the order they were met, so gCameras indices survive compilation.
+		StrRef name;
+		int32_t node; //Owning node index, or -1 for scene-level cameras.
+		float eye[3], center[3], vup[3];
+		float fovy, znear, zfar;
+	};
+	struct DrawableRecord {
+		uint32_t type; //Drawable::TYPE.
+		StrRef mesh, material, image; //SCENEB_NONE keeps the per-type default (e.g. flatCard for sprites).
+		int32_t animDir, frameWidth, frameHeight;
+		float animRate;
+	};
+	enum NODE_FLAGS { IS_RENDERED = 1, IS_UPDATED = 2, HAS_COLLIDER = 4 };
+	struct NodeRecord { //Stored pre-order, so a parent always precedes its children.
+		StrRef name;
+		int32_t parent; //Node index, or -1 for roots.
+		uint32_t flags;
+		float translation[3], rotation[3], scale[3]; //rotation is the euler triple from the scene file.
+		float colliderOffset[3], colliderRadius;
+		Range drawables, distances, cameras, sounds; //Into DRAWABLES, DISTANCES (precomputed switchingDistances), NODE_CAMERAS and SOUNDS.
+	};
+	struct ScriptRecord { StrRef type; int32_t node; Range pairs; }; //Stored in parse order, into PAIRS.
+	struct PairRecord { StrRef name, value; };
+	struct SoundRecord { StrRef file; };
+
+	//A validated view over a mapped .sceneb file. Only valid as long as the MappedFile stays open.
+	class View
+	{
+	public:
+		const Header *header;
+		View(void) : header(nullptr), base(nullptr) {}
+		bool attach(const MappedFile &file); //Checks magic, version, that every section lies inside the file and every index, range and string in its records.
+		const char* str(StrRef ref) const { return (ref == SCENEB_NONE) ? "" : base + header->stringsOffset + ref; }
+		bool has(StrRef ref) const { return ref != SCENEB_NONE; }
+		uint32_t count(SECTION s) const { return header->sections[s].count; }
+		template<class T> const T* records(SECTION s) const { return (const T*)(base + header->sections[s].first); }
+	private:
+		const char *base;
+	};
+
+	bool isCompiledSceneName(const string &fileName);
+	bool compileScene(const char *sceneFile, const char *outFile); //Offline: parses .scene text, writes .sceneb. No GL needed.
+}
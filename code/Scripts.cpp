@@ -1,4 +1,6 @@
 #include "Scripts.h"
+#include "AssetCache.h"
+#include "GLState.h"
 
 bool MoverScript::setProperty(const string& propertyName, const string& propertyVal) {
 	if (propertyName == "velocity") return sscanf(propertyVal.c_str(), "[%f,%f,%f]", &velocity.x, &velocity.y, &velocity.z);
@@ -45,99 +47,119 @@ EmitterScript::EmitterScript(SceneGraphNode *n) : Script(n) {
 	active = true; 
 	posOffset = rotOffset = avgVelocity = glm::vec3(0);
 	particleMax = emitRate = 0; 
-	currAccumulatedTime = 0.0f; 
-	if (gMeshes.count("flatCard") > 0) p.card.setMesh(gMeshes["flatCard"]);
-	else if (n != nullptr) ERROR("Unable to locate gMeshes[\"flatCard\"], check scene and library files?", false);
-	if (gMaterials.count("allAxes") > 0) p.card.setMaterial(gMaterials["allAxes"]);
-	else if (n != nullptr) ERROR("Unable to locate gMaterials[allAxes], check scene and library files?", false);
-	p.card.diffuseTexture = nullptr;
+	timeToLive = currAccumulatedTime = 0.0f; 
+	card.diffuseTexture = nullptr;
+	static uint32_t nextSeed = 0;
+	randomState = 0x9E3779B9u * ++nextSeed; //Never 0, which xorshift would keep.
+	if (n != nullptr) gParticleRenderer.addEmitter(this); //Not the prototype in gScripts.
+}
+EmitterScript::~EmitterScript()
+{
+	if (node != nullptr) gParticleRenderer.removeEmitter(this);
 }
 bool EmitterScript::setProperty(const string& propertyName, const string& propertyVal) {
 	if (propertyName == "avgVelocity") return sscanf(propertyVal.c_str(), "[%f,%f,%f]", &avgVelocity.x, &avgVelocity.y, &avgVelocity.z);
 	if (propertyName == "rotOffset") return sscanf(propertyVal.c_str(), "[%f,%f,%f]", &rotOffset.x, &rotOffset.y, &rotOffset.z);
 	if (propertyName == "posOffset") return sscanf(propertyVal.c_str(), "[%f,%f,%f]", &posOffset.x, &posOffset.y, &posOffset.z);
-	if (propertyName == "timeToLive") return sscanf(propertyVal.c_str(), "%f",  &p.timeToLive);
+	if (propertyName == "timeToLive") return sscanf(propertyVal.c_str(), "%f",  &timeToLive);
+	if (propertyName == "posSpread") return sscanf(propertyVal.c_str(), "[%f,%f,%f]", &posSpread.x, &posSpread.y, &posSpread.z);
+	if (propertyName == "velocitySpread") return sscanf(propertyVal.c_str(), "[%f,%f,%f]", &velocitySpread.x, &velocitySpread.y, &velocitySpread.z);
+	if (propertyName == "seed") {
+		unsigned int seed;
+		if (sscanf(propertyVal.c_str(), "%u", &seed) != 1) return false;
+		randomState = (uint32_t)hashBytes(&seed, sizeof(seed)) | 1; //Never 0, which xorshift would keep.
+		return true;
+	}
+	if (propertyName == "gravity") return sscanf(propertyVal.c_str(), "[%f,%f,%f]", &gravity.x, &gravity.y, &gravity.z);
+	if (propertyName == "drag") return sscanf(propertyVal.c_str(), "%f", &drag);
+	if (propertyName == "size") return sscanf(propertyVal.c_str(), "%f", &size);
+	if (propertyName == "color") return sscanf(propertyVal.c_str(), "[%f,%f,%f,%f]", &color.r, &color.g, &color.b, &color.a);
+	if (propertyName == "depthSort") {
+		int sorted;
+		if (sscanf(propertyVal.c_str(), "%d", &sorted) != 1) return false;
+		depthSort = sorted != 0;
+		return true;
+	}
 	if (propertyName == "active") return sscanf(propertyVal.c_str(), "%d", &active);
-	if (propertyName == "particleMax") return sscanf(propertyVal.c_str(), "%d", &particleMax);
+	if (propertyName == "particleMax") {
+		if (sscanf(propertyVal.c_str(), "%d", &particleMax) != 1) return false;
+		particles.setCapacity(particleMax); //The only allocation the emitter makes.
+		return true;
+	}
 	if (propertyName == "emitRate") return sscanf(propertyVal.c_str(), "%f", &emitRate);
 	if (propertyName == "image") {
-		p.card.diffuseTexture = new RGBAImage();
-		p.card.diffuseTexture->name = "uDiffuseTex";
-		p.card.diffuseTexture->fileName = propertyVal;
-		bool v = p.card.diffuseTexture->loadPNG(p.card.diffuseTexture->fileName);
-		p.card.diffuseTexture->sendToOpenGL();
-		return v;
+		gTextureCache.release(card.diffuseTexture);
+		card.diffuseTexture = gTextureCache.acquire(propertyVal); //Shared by every emitter using the file.
+		return true;
 	}
 }
+float EmitterScript::random(void) {
+	uint32_t x = randomState; //xorshift32.
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	randomState = x;
+	return (float)(x >> 8) * (2.0f / (1 << 24)) - 1.0f;
+}
 void EmitterScript::update(Camera& cam, double dt) {
-	//Spawn by adding to particle list if enough time has passed in lieu of sprite ticking.
-	if (currAccumulatedTime >= emitRate) {
-		if (particles.size() < particleMax) {
-			Particle * _p = new Particle();
-			_p->T.translation = posOffset + node->T.translation; //Add a rand().
-			_p->T.rotation = glm::quat(rotOffset); //Add a rand().
-			_p->T.scale = glm::vec3(1);
-			_p->velocity = avgVelocity; //Add a rand().
-			_p->card = p.card;
-			_p->timeToLive = p.timeToLive;
-			particles.push_back(_p);
-		}
-		currAccumulatedTime = 0.0f;
+	ParticleStep s = { (float)dt, gravity, drag };
+	step = s;
+	spawnOrigin = posOffset + node->T.translation;
+	hasStep = true;
+}
+void EmitterScript::beginStep(void) {
+	//Spawn into the pool if enough time has passed in lieu of sprite ticking, catching up when emitRate is below a step.
+	//The budget slows spawning by slowing this clock, so a scaled one-per-step emitter spawns on some steps only.
+	currAccumulatedTime += step.dt * spawnScale;
+	float interval = (emitRate > 0.0f) ? emitRate : step.dt;
+	int numSpawns = (int)(currAccumulatedTime / interval);
+	currAccumulatedTime -= numSpawns * interval;
+	numSpawns = max(min(numSpawns, min(particles.getCapacity(), particleAllowance) - particles.getNumAlive()), 0);
+	for (int k = 0; k < numSpawns; ++k) {
+		int i = particles.spawn();
+		particles.positionX[i] = spawnOrigin.x + posSpread.x * random();
+		particles.positionY[i] = spawnOrigin.y + posSpread.y * random();
+		particles.positionZ[i] = spawnOrigin.z + posSpread.z * random();
+		particles.velocityX[i] = avgVelocity.x + velocitySpread.x * random();
+		particles.velocityY[i] = avgVelocity.y + velocitySpread.y * random();
+		particles.velocityZ[i] = avgVelocity.z + velocitySpread.z * random();
+		particles.rotation[i] = rotOffset.z;
+		particles.timeToLive[i] = timeToLive;
+		particles.frame[i] = (unsigned short)card.activeFrame;
 	}
-	else currAccumulatedTime += dt;
-
-	//Iterate over all particles in the list, remove those past TTL, else add velocity, and then render.
-	for (auto it = particles.begin(); it != particles.end(); ++it) {
-
-		//Might add a line here to effectively repeat node::addTranslation().
-		(*it)->T.refreshTransform();
-		(*it)->card.prepareToDraw(cam, (*it)->T, *p.card.material);
-
-		glUseProgram(p.card.material->shaderProgramHandles[p.card.material->activeShaderProgram]);
-
-		GLint loc;
-
-		loc = glGetUniformLocation(p.card.material->shaderProgramHandles[p.card.material->activeShaderProgram], "uObjectWorldM");
-		if (loc != -1) glUniformMatrix4fv(loc, 1, GL_FALSE, glm::value_ptr((*it)->T.transform));
-#ifdef _DEBUG
-		//else ERROR("Could not load uniform uObjectWorldM.", false);
-#endif
-
-		loc = glGetUniformLocation(p.card.material->shaderProgramHandles[p.card.material->activeShaderProgram], "uObjectWorldInverseM");
-		if (loc != -1) glUniformMatrix4fv(loc, 1, GL_FALSE, glm::value_ptr((*it)->T.invTransform));
-#ifdef _DEBUG
-		//else ERROR("Could not load uniform uObjectWorldInverseM.", false);
-#endif
-
-		glm::mat4x4 objectWorldViewPerspect = cam.worldViewProject * (*it)->T.transform;
-		loc = glGetUniformLocation(p.card.material->shaderProgramHandles[p.card.material->activeShaderProgram], "uObjectPerpsectM");
-		if (loc != -1) glUniformMatrix4fv(loc, 1, GL_FALSE, glm::value_ptr(objectWorldViewPerspect));
-#ifdef _DEBUG
-		//else ERROR("Could not load uniform uObjectPerpsectM.", false);
-#endif
-
-		loc = glGetUniformLocation(p.card.material->shaderProgramHandles[p.card.material->activeShaderProgram], "uViewDirection");
-		if (loc != -1) glUniform4fv(loc, 1, glm::value_ptr(cam.center));
-#ifdef _DEBUG
-		//else ERROR("Could not load uniform uViewPosition.", false);
-#endif
-
-		loc = glGetUniformLocation(p.card.material->shaderProgramHandles[p.card.material->activeShaderProgram], "uViewPosition");
-		if (loc != -1) glUniform4fv(loc, 1, glm::value_ptr(cam.eye));
-#ifdef _DEBUG
-		//else ERROR("Could not load uniform uViewDirection.", false);
-#endif
-		(*it)->card.draw(cam);
-
-		glUseProgram(0);
-
-		if ((*it)->timeToLive <= 0) it = particles.erase(it);
-		else {
-			(*it)->timeToLive -= dt;
-			(*it)->T.translation += glm::vec3(dt) * (*it)->velocity;
-		}
+}
+Bounds EmitterScript::getReach(void) const {
+	//Around the middle of the average path's chord: half the chord, gravity's bow off it, the velocity spread over a
+	//lifetime and the spawn spread. Drag only shortens paths, so it's left out.
+	glm::vec3 halfPath = avgVelocity * (timeToLive * 0.5f) + gravity * (timeToLive * timeToLive * 0.25f);
+	Bounds b;
+	b.center = spawnOrigin + halfPath;
+	b.radius = glm::length(posSpread) + glm::length(halfPath) + glm::length(gravity) * (timeToLive * timeToLive * 0.125f)
+		+ glm::length(velocitySpread) * timeToLive + size * 0.5f;
+	b.boxMin = b.center - glm::vec3(b.radius);
+	b.boxMax = b.center + glm::vec3(b.radius);
+	return b;
+}
+void EmitterScript::endStep(void) {
+	//Drawing is left to render().
+	particles.removeDead();
+	lastStep = step.dt;
+	hasStep = false;
+}
+void EmitterScript::writeParticles(vector<ParticleVertex> &out, float alpha) const {
+	//A step ends with position += velocity*dt using the new velocity, so the position before it is recovered from
+	//the two without keeping a copy, and the particle is drawn that fraction of the way back.
+	float back = lastStep * (1.0f - alpha);
+	ParticleVertex v;
+	v.size = size;
+	v.color = packColor(color);
+	for (int i = 0; i < particles.getNumAlive(); ++i) {
+		v.position = glm::vec3(particles.positionX[i] - particles.velocityX[i] * back, particles.positionY[i] - particles.velocityY[i] * back,
+			particles.positionZ[i] - particles.velocityZ[i] * back);
+		v.rotation = particles.rotation[i];
+		v.frame = (particles.frame[i] < card.frames.size()) ? card.frames[particles.frame[i]] : glm::vec4(0, 0, 1, 1);
+		out.push_back(v);
 	}
-
 }
 void EmitterScript::toSDL(FILE *F, const char* tabs) {
 	/*
@@ -155,10 +177,17 @@ void EmitterScript::toSDL(FILE *F, const char* tabs) {
 	fprintf(F, "\t\t%savgVelocity [%f, %f, %f]\n", tabs, avgVelocity.x, avgVelocity.y, avgVelocity.z);
 	fprintf(F, "\t\t%srotOffset [%f, %f, %f]\n", tabs, rotOffset.x, rotOffset.y, rotOffset.z);
 	fprintf(F, "\t\t%sposOffset [%f, %f, %f]\n", tabs, posOffset.x, posOffset.y, posOffset.z);
-	fprintf(F, "\t\t%stimeToLive %f\n", tabs, p.timeToLive);
+	fprintf(F, "\t\t%sposSpread [%f, %f, %f]\n", tabs, posSpread.x, posSpread.y, posSpread.z);
+	fprintf(F, "\t\t%svelocitySpread [%f, %f, %f]\n", tabs, velocitySpread.x, velocitySpread.y, velocitySpread.z);
+	fprintf(F, "\t\t%sgravity [%f, %f, %f]\n", tabs, gravity.x, gravity.y, gravity.z);
+	fprintf(F, "\t\t%sdrag %f\n", tabs, drag);
+	fprintf(F, "\t\t%stimeToLive %f\n", tabs, timeToLive);
+	fprintf(F, "\t\t%ssize %f\n", tabs, size);
+	fprintf(F, "\t\t%scolor [%f, %f, %f, %f]\n", tabs, color.r, color.g, color.b, color.a);
+	fprintf(F, "\t\t%sdepthSort %d\n", tabs, depthSort ? 1 : 0);
 	fprintf(F, "\t\t%sparticleMax %d\n", tabs, particleMax);
 	fprintf(F, "\t\t%semitRate %f\n", tabs, emitRate);
-	fprintf(F, "\t\t%simage \"%s\"\n", tabs, p.card.diffuseTexture->fileName.c_str());
+	fprintf(F, "\t\t%simage \"%s\"\n", tabs, card.diffuseTexture->fileName.c_str());
 	fprintf(F, "\t%s}\n", tabs);
 	fprintf(F, "%s}\n", tabs);
 }
@@ -210,11 +239,13 @@ bool RGBGameScript::setProperty(const string& propertyName, const string& proper
 	if (propertyName == "initEnemyHP") return sscanf(propertyVal.c_str(), "%d", &initEnemyHP);
 	if (propertyName == "maxPlayerHP") return sscanf(propertyVal.c_str(), "%d", &maxPlayerHP);
 	if (propertyName == "maxEnemyHP") return sscanf(propertyVal.c_str(), "%d", &maxEnemyHP);
-	if (propertyName == "winSound") winSound = soundEngine->play2D(propertyVal.c_str(), false, true, true, irrklang::ESM_AUTO_DETECT, true);
-	if (propertyName == "lossSound") lossSound = soundEngine->play2D(propertyVal.c_str(), false, true, true, irrklang::ESM_AUTO_DETECT, true);
-	if (propertyName == "deathSound") deathSound = soundEngine->play2D(propertyVal.c_str(), false, true, true, irrklang::ESM_AUTO_DETECT, true);
-	if (propertyName == "hitSound") hitSound = soundEngine->play2D(propertyVal.c_str(), false, true, true, irrklang::ESM_AUTO_DETECT, true);
-	if (propertyName == "enemySound") enemySound = soundEngine->play2D(propertyVal.c_str(), false, true, true, irrklang::ESM_AUTO_DETECT, true);
+	string soundFile; //Sounds resolve through PATH like every other asset. irrKlang reports a miss.
+	if (propertyName.find("Sound") != string::npos && !getFullFileName(propertyVal, soundFile)) soundFile = propertyVal;
+	if (propertyName == "winSound") winSound = soundEngine->play2D(soundFile.c_str(), false, true, true, irrklang::ESM_AUTO_DETECT, true);
+	if (propertyName == "lossSound") lossSound = soundEngine->play2D(soundFile.c_str(), false, true, true, irrklang::ESM_AUTO_DETECT, true);
+	if (propertyName == "deathSound") deathSound = soundEngine->play2D(soundFile.c_str(), false, true, true, irrklang::ESM_AUTO_DETECT, true);
+	if (propertyName == "hitSound") hitSound = soundEngine->play2D(soundFile.c_str(), false, true, true, irrklang::ESM_AUTO_DETECT, true);
+	if (propertyName == "enemySound") enemySound = soundEngine->play2D(soundFile.c_str(), false, true, true, irrklang::ESM_AUTO_DETECT, true);
 	return true;
 }
 SceneGraphNode* RGBGameScript::getAttackerFromInt(int id) {
@@ -253,7 +284,7 @@ void RGBGameScript::update(Camera& cam, double dt) {
 	}
 	
 	//Will not reach this code if ticking an enemy, so we can take player input here.
-	if (!cooldown) {
+	if (!cooldown && gWindow != nullptr) { //No keyboard when headless.
 		if (glfwGetKey(gWindow, GLFW_KEY_UP)) currTarget = N;
 		else if (glfwGetKey(gWindow, GLFW_KEY_DOWN)) currTarget = S;
 		else if (glfwGetKey(gWindow, GLFW_KEY_RIGHT)) currTarget = E;
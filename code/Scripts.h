@@ -1,5 +1,7 @@
 #pragma once
 #include "SceneState.h"
+#include "ParticleRenderer.h"
+#include "ParticlePool.h"
 
 class MoverScript : public Script {
 protected:
@@ -15,31 +17,61 @@ public:
 	void toSDL(FILE *F, const char* tabs) override;
 };
 
+//update() only queues a step on the main thread, gParticleRenderer.simulate() runs every queued one on gJobs.
+//An emitter's step touches nothing but the emitter, its random numbers included, so steps never share state and
+//give the same particles however many workers run them.
 class EmitterScript : public Script {
 protected:
-	struct Particle {
-		Billboard card; //Generalize to Drawable?
-		Transform T;
-		glm::vec3 velocity;
-		float timeToLive;
-	};
-	Particle p;
-	glm::vec3 rotOffset = glm::vec3(0);
+	Billboard card; //Only its sheet and current frame are used, gParticleRenderer draws the particles.
+	float timeToLive;
+	float size = 1.0f;
+	glm::vec4 color = glm::vec4(1);
+	bool depthSort = false; //Draw back to front, for blending that isn't additive.
+	glm::vec3 rotOffset = glm::vec3(0); //z is the particles' roll about the view axis.
 	glm::vec3 posOffset = glm::vec3(0); //Offsets used to vary pos/rot around the node this emitterScript attaches to.
 	glm::vec3 avgVelocity = glm::vec3(0);
-	list<Particle*> particles; //List to enable faster removal from head--oldest particles will always be at or near [0].
+	glm::vec3 posSpread = glm::vec3(0), velocitySpread = glm::vec3(0); //Spawns land up to this far either side of the offset and average.
+	glm::vec3 gravity = glm::vec3(0); //Acceleration on every particle.
+	float drag = 0.0f; //Fraction of velocity lost per second.
+	ParticlePool particles; //Sized from particleMax.
+	float lastStep = 0.0f; //dt of the last step, to find where the particles were before it.
 	bool active;
 	int particleMax;
-	float emitRate; //Particles per update frame.
+	float emitRate; //Seconds between spawns, at most one per step when not above 0.
 	float currAccumulatedTime;
+
+	//Queued by update(), so the step doesn't read the scene graph from a worker.
+	bool hasStep = false;
+	ParticleStep step;
+	glm::vec3 spawnOrigin;
+	int particleAllowance = INT_MAX; //From gParticleRenderer's budget each step: spawning stops at this many live.
+	float spawnScale = 1.0f; //Of the emitRate the budget lets through.
+	uint32_t randomState; //Per emitter, so the workers share no generator. Set from the "seed" property to repeat a run.
+	float random(void); //In [-1, 1).
+
 public:
 	EmitterScript(SceneGraphNode *n);
 	Script* clone(SceneGraphNode *n) override { return new EmitterScript(n); }
 	void postParseInit() override { return; }
-	~EmitterScript() { for (auto it = particles.begin(); it != particles.end(); ++it) delete *it; }
+	~EmitterScript();
 	bool setProperty(const string& propertyName, const string& propertyVal) override;
 	void update(Camera& cam, double dt) override;
 	void toSDL(FILE *F, const char* tabs) override;
+
+	//A queued step is beginStep(), integrate() over every live particle, in one call or in ranges, then endStep().
+	bool hasPendingStep(void) const { return hasStep; }
+	void beginStep(void); //Spawns.
+	void integrate(int first, int last) { particles.integrate(step, first, last); } //first a multiple of 32.
+	void endStep(void); //Removes the dead.
+	int getNumParticles(void) const { return particles.getNumAlive(); }
+	int getCapacity(void) const { return particles.getCapacity(); }
+	Bounds getReach(void) const; //Everywhere the queued step's particles can be over their lifetime, from the spawn rules.
+	void setAllowance(int maxAlive, float rateScale) { particleAllowance = maxAlive; spawnScale = rateScale; }
+
+	void writeParticles(vector<ParticleVertex> &out, float alpha) const; //Appends one per live particle, alpha of the way through the last step.
+	const RGBAImage* getTexture(void) const { return card.diffuseTexture; }
+	bool isDepthSorted(void) const { return depthSort; }
+	float getSize(void) const { return size; }
 };
 
 class RGBGameScript : public Script {
@@ -69,6 +101,7 @@ public:
 	bool setProperty(const string& propertyName, const string& propertyVal) override;
 	void update(Camera& cam, double dt) override;
 	void toSDL(FILE *F, const char* tabs) override;
+	bool holdsOtherNodes(void) const override { return true; } //The enemies, player, texts and their health nodes.
 	SceneGraphNode* getAttackerFromInt(int id);
 	int getNextEnemyFromOrder();
 	void healPlayer();
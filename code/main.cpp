@@ -1,5 +1,16 @@
 #include "SceneState.h"
 #include "Scripts.h"
+#include "SceneBinary.h"
+#include "Benchmarks.h"
+#include "AssetCache.h"
+#include "JobSystem.h"
+#include "FileWatcher.h"
+#include "RenderQueue.h"
+#include "GLState.h"
+#include "Octree.h"
+#include "ParticleRenderer.h"
+#include <algorithm>
+#include <memory>
 
 //Keyboard input and camera manipulation.
 void keyCallback(GLFWwindow* window, int key, int scancode, int action, int mods)
@@ -121,6 +132,7 @@ void keyboardBuildModeController() {
 
 //Parsing.
 string ONE_TOKENS = "{}[]()<>+-*/,;";
+const CharClasses SCENE_CHARS(ONE_TOKENS); //Table form of ONE_TOKENS for the Tokenizer.
 void saveWorldSettings(FILE *F) {
 	/* worldSettings windowTitle "Sprint 2: Simple Scene Graph (Parent-Child Transforms)" {
 	width 800
@@ -145,132 +157,241 @@ void saveWorldSettings(FILE *F) {
 #endif
 	fprintf(F, "}\n");
 }
-void loadWorldSettings(FILE *F)
+//Creation helpers shared by the text loaders below and loadSceneBinary().
+void openSceneWindow(void)
 {
-	string token, t;
+	// Initialize the window with OpenGL context, unless the recording device stands in for one.
+	if (isRecordingGL()) gGLState.reset();
+	else {
+		gWindow = createOpenGLWindow(gWidth, gHeight, gWindowTitle.c_str(), gSPP);
+		glfwSetKeyCallback(gWindow, keyCallback);
+	}
+
+	// Prepare the lights and the camera.
+	initLightBuffer();
+	initCameraBuffer();
+}
+void loadBackgroundMusic(const string &fileName)
+{
+	string fullFileName;
+	if (!getFullFileName(fileName, fullFileName)) fullFileName = fileName; //irrKlang reports it.
+	gBackgroundMusic = soundEngine->play2D(fullFileName.c_str(), true, true, true, irrklang::ESM_AUTO_DETECT, true);
+	//Only returns ISound* if 'track', 'startPaused' or 'enableSoundEffects' are true.
+}
+Material* findMaterial(const string &materialName)
+{
+	auto it = gMaterials.find(materialName);
+	if (it != gMaterials.end()) return it->second;
+	ERROR("Unable to locate gMaterials[" + materialName + "], check scene and library files?", false);
+	return nullptr;
+}
+TriMesh* findMesh(const string &meshName)
+{
+	auto it = gMeshes.find(meshName);
+	if (it != gMeshes.end()) return it->second;
+	ERROR("Unable to locate gMeshes[" + meshName + "], check scene and library files?", false);
+	return nullptr;
+}
+//Meshes and textures come back empty and fill in on gJobs workers. Names are resolved here rather than
+//there, since PATH still changes as libraries load. The uploads, and anything that needs the pixels or
+//texture ids (bindMaterial, sprite frames), are queued for the GL thread and done by loadScene()'s waitAll().
+TriMesh* createMesh(const string &meshName, const string &fileName, bool inLibrary)
+{
+	TriMesh *mesh = new TriMesh();
+	mesh->setName(meshName);
+	mesh->filename = fileName;
+	mesh->inLibrary = inLibrary;
+	gMeshes[meshName] = mesh;
+
+	string fullFileName;
+	if (!getFullFileName(fileName, fullFileName)) { ERROR("Could not open file " + fileName, false); return mesh; }
+	shared_ptr<CachedMesh> cached(new CachedMesh()); //Shared so both halves can reach it, lives until the upload.
+	shared_ptr<bool> ok(new bool(false));
+	gJobs.submit([=]() { *ok = mesh->readFromPlyCached(fullFileName, false, *cached); },
+		[=]() { if (*ok) mesh->sendToOpenGL(*cached); });
+	gJobs.runCompletions(); //Upload whatever is ready while the parse goes on.
+	return mesh;
+}
+RGBAImage* createTexture(const string &fileName)
+{
+	return gTextureCache.acquire(fileName); //Shared with every other user of the file, decoded once.
+}
+void finishMaterial(Material *m, const string &materialName, bool inLibrary)
+{
+	m->setShaderProgram(gProgramCache.acquire(m->vertexShaderName, m->fragmentShaderName, &m->shaderFiles)); //Shared by every material with the same shader source.
+	if (materialName != "") gMaterials[materialName] = m;
+	m->name = materialName;
+	m->inLibrary = inLibrary;
+	gJobs.afterAll([m]() { m->bindMaterial(); }); //Very important line! Waits on the texture ids.
+}
+void fillSpriteFrames(Sprite *sprite)
+{
+	sprite->sheetWidth = sprite->diffuseTexture->width;
+	sprite->sheetHeight = sprite->diffuseTexture->height;
+	sprite->amtRows = sprite->sheetHeight / sprite->frameHeight;
+	sprite->amtCols = sprite->sheetWidth / sprite->frameWidth;
+
+	//Sheet properties can be accessed via textures[0]; frames assigned as below:
+	for (int r = 0; r < sprite->amtRows; ++r)
+		for (int c = 0; c < sprite->amtCols; ++c)
+			sprite->frames.push_back({
+				round((c*sprite->sheetWidth) / sprite->amtCols) / (float)sprite->sheetWidth, //u1
+				round((r*sprite->sheetHeight) / sprite->amtRows) / (float)sprite->sheetHeight, //v1
+				sprite->frameWidth / (float)sprite->sheetWidth, //u2 = currently the normalized location of the top-right, needs to be a normalized absolute width amount
+				sprite->frameHeight / (float)sprite->sheetHeight //v2
+			});
+}
+void buildSpriteFrames(Sprite *sprite)
+{
+	if (sprite->diffuseTexture == nullptr) ERROR("Sprite needs an image uSheetName \"img.png\"!");
+	gJobs.afterAll([sprite]() { fillSpriteFrames(sprite); }); //The sheet size is only known once it has decoded.
+}
+void attachSound(SceneGraphNode *n, const string &fileName)
+{
+	string fullFileName;
+	if (!getFullFileName(fileName, fullFileName)) fullFileName = fileName; //irrKlang reports it.
+	n->sounds.push_back(soundEngine->play2D(fullFileName.c_str(), false, false, true));
+	n->sounds.back()->stop();
+	//Only returns ISound* if 'track', 'startPaused' or 'enableSoundEffects' are true.
+}
+void attachCollider(SceneGraphNode *n, const glm::vec3 &offset, float radius)
+{
+	n->collider = new SphereCollider(offset, radius);
+	//Assign collider material since there's only ever one for it to be.
+	if (gMaterials.count("collider") > 0) n->collider->meshInstance->setMaterial(gMaterials["collider"]);
+	else ERROR("Unable to locate gMaterials[\"collider\"], check scene and library files?", false);
+	//Assign collider mesh.
+	if (gMeshes.count("collider") > 0) n->collider->meshInstance->setMesh(gMeshes["collider"]);
+	else ERROR("Unable to locate gMeshes[\"collider\"], check scene and library files?", false);
+}
+Script* attachScript(SceneGraphNode *n, const string &scriptType)
+{
+	if (gScripts.count(scriptType) == 0) {
+		ERROR("Unable to locate gScripts[" + scriptType + "], check scene and library files?", false);
+		return nullptr;
+	}
+	n->scripts.push_back(gScripts[scriptType]->clone(n));
+	return n->scripts.back();
+}
+void finishNode(SceneGraphNode *n, float renderThreshold)
+{
+	//Auto-generate the other class members that the parser isn't supplying.
+
+	//First, the switching distances. 
+		//Given n items on the LODstack, we consider [0, n->renderThreshold].
+		//We subdivide this interval by the amount of objects in the LOD stack.
+	if (renderThreshold == -1.0f) {
+		ERROR("Need to specify maxRenderDist in node{}!", false);
+		renderThreshold = 100; //Just a default, but really should specify, so I'm leaving in the warning.
+	}
+	for (float div = 1.0f; div <= (int)n->LODstack.size(); ++div)
+		n->switchingDistances.push_back(renderThreshold / div); //Note this implies descending order! But makes switchingDistances[0] our easy-access for a render cutoff.
+		//For now, the subdivision is binary, but it could gradually skew to one side of the interval too!
+		//The node isn't rendered when the distance to the camera center is past its threshold.
+	
+	//Second, configure cameras to be oriented to the node.
+	n->setTranslation(n->T.translation); //Also handles camera updates.
+}
+
+void loadWorldSettings(Tokenizer &F)
+{
+	TokenView token;
 	string fontFileName;
 	int fontTexNumRows(-1), fontTexNumCols(-1);
-	while (getToken(F, token, ONE_TOKENS)) {
+	while (getToken(F, token, SCENE_CHARS)) {
 		//cout << "  " << token << endl;
 		if (token == "}") break;
-		if (token == "windowTitle") getToken(F, gWindowTitle, ONE_TOKENS);
+		if (token == "windowTitle") getToken(F, gWindowTitle, SCENE_CHARS);
 		else if (token == "width") getInts(F, &gWidth, 1);
 		else if (token == "height") getInts(F, &gHeight, 1);
 		else if (token == "spp") getInts(F, &gSPP, 1);
-		else if (token == "debugFont") getToken(F, fontFileName, ONE_TOKENS);
+		else if (token == "debugFont") getToken(F, fontFileName, SCENE_CHARS);
 		else if (token == "fontTexNumRows") getInts(F, &fontTexNumRows, 1);
 		else if (token == "fontTexNumCols") getInts(F, &fontTexNumCols, 1);
 		else if (token == "backgroundColor") getFloats(F, &gBackgroundColor[0], 3);
 		else if (token == "backgroundMusic") {
-			string fileName, fullFileName;
-			getToken(F, fileName, ONE_TOKENS);
-			getFullFileName(fileName, fullFileName);
-			gBackgroundMusic = soundEngine->play2D(fullFileName.c_str(), true, true, true, irrklang::ESM_AUTO_DETECT, true);
-			//Only returns ISound* if 'track', 'startPaused' or 'enableSoundEffects' are true.
+			string fileName;
+			getToken(F, fileName, SCENE_CHARS);
+			loadBackgroundMusic(fileName);
 		}
 	}
 
-	// Initialize the window with OpenGL context
-	gWindow = createOpenGLWindow(gWidth, gHeight, gWindowTitle.c_str(), gSPP);
-	glfwSetKeyCallback(gWindow, keyCallback);
+	openSceneWindow();
 
 	//if (fontTexNumRows != -1) initText2D(fontFileName.c_str(), fontTexNumRows, fontTexNumCols); //Loading font.
-
-	// Prepare the lights.
-	initLightBuffer();
 }
-void loadMesh(FILE *F, bool inLibrary = false)
+TriMesh* loadMesh(Tokenizer &F, bool inLibrary = false)
 {
-	string token, meshName(""), fileName("");
+	TokenView token;
+	string meshName(""), fileName("");
 
-	while (getToken(F, token, ONE_TOKENS)) {
+	while (getToken(F, token, SCENE_CHARS)) {
 		if (token == "}") break;
-		else if (token == "name") getToken(F, meshName, ONE_TOKENS);
-		else if (token == "file") getToken(F, fileName, ONE_TOKENS);
-	}
-	gMeshes[meshName] = new TriMesh();
-	gMeshes[meshName]->setName(meshName);
-	gMeshes[meshName]->filename = fileName;
-	gMeshes[meshName]->inLibrary = inLibrary;
-	gMeshes[meshName]->readFromPly(fileName, false);
-	gMeshes[meshName]->sendToOpenGL();
+		else if (token == "name") getToken(F, meshName, SCENE_CHARS);
+		else if (token == "file") getToken(F, fileName, SCENE_CHARS);
+	}
+	return createMesh(meshName, fileName, inLibrary);
 }
-void loadMaterial(FILE *F, bool inLibrary = false)
+Material* loadMaterial(Tokenizer &F, bool inLibrary = false)
 {
-	string token, materialName("");
-	GLuint vertexShader = NULL_HANDLE;
-	GLuint fragmentShader = NULL_HANDLE;
+	TokenView token;
+	string materialName("");
 
 	Material *m = new Material();
 
-	while (getToken(F, token, ONE_TOKENS)) {
+	while (getToken(F, token, SCENE_CHARS)) {
 		if (token == "}") break;
-		else if (token == "name") getToken(F, materialName, ONE_TOKENS);
-		else if (token == "vertexShader") {
-			getToken(F, m->vertexShaderName, ONE_TOKENS);
-			vertexShader = loadShader(m->vertexShaderName.c_str(), GL_VERTEX_SHADER);
-		}
-		else if (token == "fragmentShader") {
-			getToken(F, m->fragmentShaderName, ONE_TOKENS);
-			fragmentShader = loadShader(m->fragmentShaderName.c_str(), GL_FRAGMENT_SHADER);
-		}
+		else if (token == "name") getToken(F, materialName, SCENE_CHARS);
+		else if (token == "vertexShader") getToken(F, m->vertexShaderName, SCENE_CHARS);
+		else if (token == "fragmentShader") getToken(F, m->fragmentShaderName, SCENE_CHARS);
 		else if (token == "color") {
 			NameIdVal<glm::vec4> * color = new NameIdVal<glm::vec4>();
-			getToken(F, color->name, ONE_TOKENS); //Store uniform name in NameIdVal<>.
-			if (color->name == "uDiffuseColor")	getFloats(F, &m->colors[0]->val[0], 4); //As per ctor.
+			getToken(F, color->name, SCENE_CHARS); //Store uniform name in NameIdVal<>.
+			if (color->name == "uDiffuseColor")	{ getFloats(F, &m->colors[0]->val[0], 4); delete color; } //As per ctor.
 			else { getFloats(F, &color->val[0], 4);	m->colors.push_back(color); }
 		}
 		else if (token == "texture") {
-			m->textures.push_back(new RGBAImage());
-			getToken(F, m->textures.back()->name, ONE_TOKENS); //Store uniform name in RGBAImage.
-			string texFileName;	getToken(F, texFileName, ONE_TOKENS);
-			m->textures.back()->loadPNG(texFileName);
-			m->textures.back()->sendToOpenGL();
+			string uniformName, texFileName;
+			getToken(F, uniformName, SCENE_CHARS);
+			getToken(F, texFileName, SCENE_CHARS);
+			m->addTexture(uniformName, createTexture(texFileName));
 		}
 	}
 
-	m->setShaderProgram(createShaderProgram(vertexShader, fragmentShader)); //Return to modify this to take a container of shaders.
-	if (materialName != "") gMaterials[materialName] = m;
-	m->name = materialName;
-	m->inLibrary = inLibrary;
-	m->bindMaterial(); //Very important line!
+	finishMaterial(m, materialName, inLibrary);
+	return m;
 }
-Drawable* loadAndReturnMeshInstance(FILE *F)
+Drawable* loadAndReturnMeshInstance(Tokenizer &F)
 {
-	string token;
+	TokenView token;
 
 	TriMeshInstance *instance = new TriMeshInstance();
 
-	while (getToken(F, token, ONE_TOKENS)) {
+	while (getToken(F, token, SCENE_CHARS)) {
 		if (token == "}") {
 			break;
 		}
 		else if (token == "material") {
 			string materialName;
-			getToken(F, materialName, ONE_TOKENS);
-			if (gMaterials.count(materialName) > 0)	instance->setMaterial(gMaterials[materialName]);
-			else ERROR("Unable to locate gMaterials[" + materialName + "], check scene and library files?", false);
+			getToken(F, materialName, SCENE_CHARS);
+			if (Material *m = findMaterial(materialName)) instance->setMaterial(m);
 		}
 		else if (token == "mesh") {
 			string meshName;
-			getToken(F, meshName, ONE_TOKENS);
-			if (gMeshes.count(meshName) > 0) instance->setMesh(gMeshes[meshName]);
-			else ERROR("Unable to locate gMeshes[" + meshName + "], check scene and library files?", false);
+			getToken(F, meshName, SCENE_CHARS);
+			if (TriMesh *mesh = findMesh(meshName)) instance->setMesh(mesh);
 		}
 		else if (token == "image") {
-			instance->diffuseTexture = new RGBAImage();
-			instance->diffuseTexture->name = "uDiffuseTex";
-			string texFileName;	getToken(F, texFileName, ONE_TOKENS);
-			instance->diffuseTexture->loadPNG(texFileName);
-			instance->diffuseTexture->sendToOpenGL();
+			string texFileName;	getToken(F, texFileName, SCENE_CHARS);
+			instance->diffuseTexture = createTexture(texFileName);
 		}
 	}
 	
 	return instance;
 }
-Drawable* loadAndReturnSprite(FILE *F) 
+Drawable* loadAndReturnSprite(Tokenizer &F) 
 {
-	string token;
+	TokenView token;
 
 	Sprite *sprite = new Sprite();
 
@@ -282,20 +403,16 @@ Drawable* loadAndReturnSprite(FILE *F)
 	if (gMeshes.count("flatCard") > 0) sprite->setMesh(gMeshes["flatCard"]);
 	else ERROR("Unable to locate gMeshes[\"flatCard\"], check scene and library files?", false);
 
-	while (getToken(F, token, ONE_TOKENS)) {
+	while (getToken(F, token, SCENE_CHARS)) {
 		if (token == "}") break;
 		else if (token == "material") {
 			string materialName;
-			getToken(F, materialName, ONE_TOKENS);
-			if (gMaterials.count(materialName) > 0)	sprite->setMaterial(gMaterials[materialName]);
-			else ERROR("Unable to locate gMaterials[" + materialName + "], check scene and library files?", false);
+			getToken(F, materialName, SCENE_CHARS);
+			if (Material *m = findMaterial(materialName)) sprite->setMaterial(m);
 		}
 		else if (token == "image") {
-			sprite->diffuseTexture = new RGBAImage();
-			sprite->diffuseTexture->name = "uDiffuseTex";
-			string texFileName;	getToken(F, texFileName, ONE_TOKENS);
-			sprite->diffuseTexture->loadPNG(texFileName);
-			sprite->diffuseTexture->sendToOpenGL();
+			string texFileName;	getToken(F, texFileName, SCENE_CHARS);
+			sprite->diffuseTexture = createTexture(texFileName);
 		}
 		else if (token == "animDir") getInts(F, &sprite->animDir, 1);
 		else if (token == "animRate") getFloats(F, &sprite->animRate, 1);
@@ -303,27 +420,13 @@ Drawable* loadAndReturnSprite(FILE *F)
 		else if (token == "frameHeight") getInts(F, &sprite->frameHeight, 1);
 	}
 
-	if (sprite->diffuseTexture == nullptr) ERROR("Sprite needs an image uSheetName \"img.png\"!");
-	sprite->sheetWidth = sprite->diffuseTexture->width;
-	sprite->sheetHeight = sprite->diffuseTexture->height;
-	sprite->amtRows = sprite->sheetHeight / sprite->frameHeight;
-	sprite->amtCols = sprite->sheetWidth / sprite->frameWidth;
-
-	//Sheet properties can be accessed via textures[0]; frames assigned as below:
-	for (int r = 0; r < sprite->amtRows; ++r)
-		for (int c = 0; c < sprite->amtCols; ++c)
-			sprite->frames.push_back({
-				round((c*sprite->sheetWidth) / sprite->amtCols) / (float)sprite->sheetWidth, //u1
-				round((r*sprite->sheetHeight) / sprite->amtRows) / (float)sprite->sheetHeight, //v1
-				sprite->frameWidth / (float)sprite->sheetWidth, //u2 = currently the normalized location of the top-right, needs to be a normalized absolute width amount
-				sprite->frameHeight / (float)sprite->sheetHeight //v2
-			});
+	buildSpriteFrames(sprite);
 
 	return sprite;
 }
-Drawable* loadAndReturnBillboard(FILE *F)
+Drawable* loadAndReturnBillboard(Tokenizer &F)
 {
-	string token;
+	TokenView token;
 
 	Billboard *billboard = new Billboard();
 
@@ -331,39 +434,35 @@ Drawable* loadAndReturnBillboard(FILE *F)
 	if (gMeshes.count("flatCard") > 0) billboard->setMesh(gMeshes["flatCard"]);
 	else ERROR("Unable to locate gMeshes[\"flatCard\"], check scene and library files?", false);
 
-	while (getToken(F, token, ONE_TOKENS)) {
+	while (getToken(F, token, SCENE_CHARS)) {
 		if (token == "}") break;
 		else if (token == "material") {
 			string materialName;
-			getToken(F, materialName, ONE_TOKENS);
-			if (gMaterials.count(materialName) > 0)	billboard->setMaterial(gMaterials[materialName]);
-			else ERROR("Unable to locate gMaterials[" + materialName + "], check scene and library files?", false);
+			getToken(F, materialName, SCENE_CHARS);
+			if (Material *m = findMaterial(materialName)) billboard->setMaterial(m);
 		}
 		else if (token == "image") {
-			billboard->diffuseTexture = new RGBAImage();
-			billboard->diffuseTexture->name = "uDiffuseTex";
-			string texFileName;	getToken(F, texFileName, ONE_TOKENS);
-			billboard->diffuseTexture->loadPNG(texFileName);
-			billboard->diffuseTexture->sendToOpenGL();
+			string texFileName;	getToken(F, texFileName, SCENE_CHARS);
+			billboard->diffuseTexture = createTexture(texFileName);
 		}
 	}
 
 	return billboard;
 }
-void loadLight(FILE *F)
+void loadLight(Tokenizer &F)
 {
-	string token;
+	TokenView token;
 
 	if (gNumLights + 1 > MAX_LIGHTS) ERROR("Too many lights in scene.");
 	gLights[gNumLights] = Light();
 	gLights[gNumLights].isOn = 1;
 	gLights[gNumLights].alpha = gLights[gNumLights].theta = 0;
 
-	while (getToken(F, token, ONE_TOKENS)) {
+	while (getToken(F, token, SCENE_CHARS)) {
 		if (token == "}") break;
 		else if (token == "type") {
 			string lightType;
-			getToken(F, lightType, ONE_TOKENS);
+			getToken(F, lightType, SCENE_CHARS);
 			if (lightType == "point") gLights[gNumLights].type = Light::LIGHT_TYPE::POINT;
 			else if (lightType == "directional") gLights[gNumLights].type = Light::LIGHT_TYPE::DIRECTIONAL;
 			else if (lightType == "spot") gLights[gNumLights].type = Light::LIGHT_TYPE::SPOT_LIGHT;
@@ -379,15 +478,15 @@ void loadLight(FILE *F)
 
 	++gNumLights;
 }
-Camera* loadCamera(FILE *F)
+Camera* loadCamera(Tokenizer &F)
 {
-	string token;
+	TokenView token;
 
 	gCameras.push_back(new Camera());
 
-	while (getToken(F, token, ONE_TOKENS)) {
+	while (getToken(F, token, SCENE_CHARS)) {
 		if (token == "}") break;
-		else if (token == "name") getToken(F, gCameras.back()->name, ONE_TOKENS);
+		else if (token == "name") getToken(F, gCameras.back()->name, SCENE_CHARS);
 		else if (token == "eye") getFloats(F, &(gCameras.back()->eye[0]), 3);
 		else if (token == "center") getFloats(F, &(gCameras.back()->center[0]), 3);
 		else if (token == "vup") getFloats(F, &(gCameras.back()->vup[0]), 3);
@@ -400,17 +499,18 @@ Camera* loadCamera(FILE *F)
 
 	return gCameras.back();
 }
-SceneGraphNode* loadAndReturnNode(FILE *F) 
+SceneGraphNode* loadAndReturnNode(Tokenizer &F) 
 {
 	SceneGraphNode *n = new SceneGraphNode();
-	string token, nodeName("");
+	TokenView token;
+	string nodeName("");
 	float renderThreshold = -1.0f;
 
-	while (getToken(F, token, ONE_TOKENS)) {
+	while (getToken(F, token, SCENE_CHARS)) {
 		if (token == "}") break;
 		else if (token == "name")
 		{
-			getToken(F, nodeName, ONE_TOKENS);
+			getToken(F, nodeName, SCENE_CHARS);
 			if (nodeName == "") ERROR("Scene file does not name node!");
 			gNodes[nodeName] = n;
 			n->name = nodeName;
@@ -454,56 +554,47 @@ SceneGraphNode* loadAndReturnNode(FILE *F)
 					}
 				}
 			*/
-			while (getToken(F, token, ONE_TOKENS)) {
+			Script *script = nullptr;
+			while (getToken(F, token, SCENE_CHARS)) {
 				if (token == "}") break;
 				else if (token == "type") {
-					getToken(F, token, ONE_TOKENS);
-					if (gScripts.count(token) > 0) n->scripts.push_back(gScripts[token]->clone(n));
-					else ERROR("Unable to locate gScripts[" + token + "], check scene and library files?", false);
+					getToken(F, token, SCENE_CHARS);
+					script = attachScript(n, token.str());
 				}
 				else if (token == "pairs") { //Assumes anything between { and } is a property key-value pair. Type is known on other side from property name.
 					string propertyName, propertyVal;
-					getToken(F, token, ONE_TOKENS); //Gets '{'. Loops over all key-value pairs.
+					getToken(F, token, SCENE_CHARS); //Gets '{'. Loops over all key-value pairs.
 					while (true) {
-						getToken(F, propertyName, ONE_TOKENS);
+						getToken(F, propertyName, SCENE_CHARS);
 						if (propertyName == "}") break;
-						getToken(F, propertyVal, ONE_TOKENS); //Need to know whether [vector] or scalar valued.
+						getToken(F, propertyVal, SCENE_CHARS); //Need to know whether [vector] or scalar valued.
 						if (propertyVal == "[") {
 							while (propertyVal.find(']') == string::npos) { //Until we find the closing bracket.
-								getToken(F, token, ONE_TOKENS);
-								propertyVal += token;
+								getToken(F, token, SCENE_CHARS);
+								propertyVal.append(token.ptr, token.len);
 							}
 						} //Else we have a scalar in the string without need for further processing.
-						if (!n->scripts.back()->setProperty(propertyName, propertyVal))
+						if (script == nullptr || !script->setProperty(propertyName, propertyVal))
 							ERROR("Failed to set property in script.", false);
 					}
 				}
 			}
-			n->scripts.back()->postParseInit();
+			if (script != nullptr) script->postParseInit();
 		}
 		else if (token == "sound") {
-			string fileName, fullFileName;
-			getToken(F, fileName, ONE_TOKENS);
-			getFullFileName(fileName, fullFileName);
-			n->sounds.push_back(soundEngine->play2D(fullFileName.c_str(), false, false, true));
-			n->sounds.back()->stop();
-			//Only returns ISound* if 'track', 'startPaused' or 'enableSoundEffects' are true.
+			string fileName;
+			getToken(F, fileName, SCENE_CHARS);
+			attachSound(n, fileName);
 		}
 		else if (token == "collider") {
 				glm::vec3 offset;
 				float radius;
-			while (getToken(F, token, ONE_TOKENS)) {
+			while (getToken(F, token, SCENE_CHARS)) {
 				if (token == "}") break;
 				else if (token == "offset") getFloats(F, &offset[0], 3);
 				else if (token == "radius") getFloats(F, &radius, 1);
 			}
-			n->collider = new SphereCollider(offset, radius);
-			//Assign collider material since there's only ever one for it to be.
-			if (gMaterials.count("collider") > 0) n->collider->meshInstance->setMaterial(gMaterials["collider"]);
-			else ERROR("Unable to locate gMaterials[\"collider\"], check scene and library files?", false);
-			//Assign collider mesh.
-			if (gMeshes.count("collider") > 0) n->collider->meshInstance->setMesh(gMeshes["collider"]);
-			else ERROR("Unable to locate gMeshes[\"collider\"], check scene and library files?", false);
+			attachCollider(n, offset, radius);
 		}
 		else if (token == "isRendered") {
 			int tmpBool;
@@ -517,51 +608,516 @@ SceneGraphNode* loadAndReturnNode(FILE *F)
 		}
 	}
 
-	//Auto-generate the other class members that the parser isn't supplying.
-
-	//First, the switching distances. 
-		//Given n items on the LODstack, we consider [0, n->renderThreshold].
-		//We subdivide this interval by the amount of objects in the LOD stack.
-	if (renderThreshold == -1.0f) {
-		ERROR("Need to specify maxRenderDist in node{}!", false);
-		renderThreshold = 100; //Just a default, but really should specify, so I'm leaving in the warning.
-	}
-	for (float div = 1.0f; div <= (int)n->LODstack.size(); ++div)
-		n->switchingDistances.push_back(renderThreshold / div); //Note this implies descending order! But makes switchingDistances[0] our easy-access for a render cutoff.
-		//For now, the subdivision is binary, but it could gradually skew to one side of the interval too!
-		//The node isn't rendered when the distance to the camera center is past its threshold.
-	
-	//Second, configure cameras to be oriented to the node.
-	n->setTranslation(n->T.translation); //Also handles camera updates.
+	finishNode(n, renderThreshold);
 
 	return n;
 }
+//What the text loaders built for each top-level mesh, material and camera block, in file order with each library's
+//blocks where it's listed, as scanSceneBlocks() finds them. recordSceneBlocks() pairs the two up.
+struct BuiltObjects {
+	vector<TriMesh*> meshes;
+	vector<Material*> materials;
+	vector<Camera*> cameras;
+};
+static BuiltObjects gBuiltObjects;
+
 void loadLibrary(const char *libFile) {
 	//No unloading needed. Add path used to EngineUtil PATH variable.
-	string lib = libFile;
-	gLibraries.push_back(lib);
-	int separatorIndex = lib.find_last_of("/");
-	if (separatorIndex < 0)	separatorIndex = lib.find_last_of("\\");
-	if (separatorIndex > 0)	addToPath(lib.substr(0, separatorIndex + 1));
+	gLibraries.push_back(libFile);
+	addFileDirectoryToPath(libFile);
 
-	FILE *F = openFileForReading(libFile);
-	string token;
+	Tokenizer F;
+	F.open(libFile);
+	TokenView token;
 
-	while (getToken(F, token, ONE_TOKENS)) {
+	while (getToken(F, token, SCENE_CHARS)) {
 		//cout << token << endl;
-		if (token == "mesh") loadMesh(F, true);
-		else if (token == "material") loadMaterial(F, true);
+		if (token == "mesh") gBuiltObjects.meshes.push_back(loadMesh(F, true));
+		else if (token == "material") gBuiltObjects.materials.push_back(loadMaterial(F, true));
 	}
-	fclose(F);
 }
-void loadScene(const char *sceneFile)
+
+//-------------------------------------------------------------------------//
+// COMPILED SCENES
+//-------------------------------------------------------------------------//
+
+Drawable* createDrawable(const sceneb::View &scene, const sceneb::DrawableRecord &d)
 {
-	//Unload the previous scene if there was one.
+	Drawable *drawable = nullptr;
+	switch (d.type) {
+	case Drawable::TRIMESHINSTANCE: drawable = new TriMeshInstance(); break;
+	case Drawable::SPRITE: {
+		Sprite *sprite = new Sprite();
+		sprite->animDir = d.animDir;
+		sprite->animRate = d.animRate;
+		sprite->frameWidth = d.frameWidth;
+		sprite->frameHeight = d.frameHeight;
+		if (gMaterials.count("sprite") > 0) sprite->setMaterial(gMaterials["sprite"]);
+		else ERROR("Unable to locate gMaterials[\"sprite\"], check scene and library files?", false);
+		drawable = sprite;
+		break;
+	}
+	case Drawable::BILLBOARD: drawable = new Billboard(); break;
+	default: ERROR("Compiled scene has an unknown drawable type, recompile it.");
+	}
+	drawable->type = (Drawable::TYPE)d.type;
+
+	if (d.type != Drawable::TRIMESHINSTANCE) {
+		//Assign flat card mesh.
+		if (gMeshes.count("flatCard") > 0) drawable->setMesh(gMeshes["flatCard"]);
+		else ERROR("Unable to locate gMeshes[\"flatCard\"], check scene and library files?", false);
+	}
+	if (scene.has(d.material)) if (Material *m = findMaterial(scene.str(d.material))) drawable->setMaterial(m);
+	if (scene.has(d.mesh)) if (TriMesh *mesh = findMesh(scene.str(d.mesh))) drawable->setMesh(mesh);
+	if (scene.has(d.image)) drawable->diffuseTexture = createTexture(scene.str(d.image));
+
+	if (d.type == Drawable::SPRITE) buildSpriteFrames((Sprite*)drawable);
+	return drawable;
+}
+//Builds the same objects the text loaders do, straight from the records of a mapped .sceneb file.
+//Order matters: assets before the nodes that reference them, and scripts last so postParseInit() sees every node.
+void loadSceneBinary(const char *sceneFile)
+{
+	using namespace sceneb;
+
+	string fullFileName;
+	MappedFile file;
+	View scene;
+	if (!getFullFileName(sceneFile, fullFileName) || !file.open(fullFileName) || !scene.attach(file))
+		ERROR(string("Failed to load compiled scene ") + sceneFile + ", check the file or recompile it.");
+
+	if (scene.count(WORLD) > 0) {
+		const WorldRecord &w = scene.records<WorldRecord>(WORLD)[0];
+		if (scene.has(w.windowTitle)) gWindowTitle = scene.str(w.windowTitle);
+		if (w.width != -1) gWidth = w.width;
+		if (w.height != -1) gHeight = w.height;
+		if (w.spp != -1) gSPP = w.spp;
+		for (uint32_t i = 0; i < w.hasBackgroundColor; ++i) gBackgroundColor[i] = w.backgroundColor[i];
+		if (scene.has(w.backgroundMusic)) loadBackgroundMusic(scene.str(w.backgroundMusic));
+		openSceneWindow();
+	}
+
+	const LibraryRecord *libraries = scene.records<LibraryRecord>(LIBRARIES);
+	for (uint32_t i = 0; i < scene.count(LIBRARIES); ++i) {
+		gLibraries.push_back(scene.str(libraries[i].file));
+		addFileDirectoryToPath(gLibraries.back()); //Library assets resolve against their own folder.
+	}
+
+	const MeshRecord *meshes = scene.records<MeshRecord>(MESHES);
+	for (uint32_t i = 0; i < scene.count(MESHES); ++i)
+		createMesh(scene.str(meshes[i].name), scene.str(meshes[i].file), meshes[i].inLibrary != 0);
+
+	const MaterialRecord *materials = scene.records<MaterialRecord>(MATERIALS);
+	const ColorRecord *colors = scene.records<ColorRecord>(COLORS);
+	const TextureRecord *textures = scene.records<TextureRecord>(TEXTURES);
+	for (uint32_t i = 0; i < scene.count(MATERIALS); ++i) {
+		const MaterialRecord &r = materials[i];
+		Material *m = new Material();
+		m->vertexShaderName = scene.str(r.vertexShader);
+		m->fragmentShaderName = scene.str(r.fragmentShader);
+		for (uint32_t c = r.colors.first; c < r.colors.first + r.colors.count; ++c) {
+			NameIdVal<glm::vec4> *color = m->colors[0]; //As per ctor.
+			if (strcmp(scene.str(colors[c].uniformName), "uDiffuseColor") != 0) {
+				color = new NameIdVal<glm::vec4>();
+				color->name = scene.str(colors[c].uniformName);
+				m->colors.push_back(color);
+			}
+			for (uint32_t f = 0; f < colors[c].numFloats; ++f) color->val[f] = colors[c].val[f];
+		}
+		for (uint32_t t = r.textures.first; t < r.textures.first + r.textures.count; ++t)
+			m->addTexture(scene.str(textures[t].uniformName), createTexture(scene.str(textures[t].file)));
+		finishMaterial(m, scene.str(r.name), r.inLibrary != 0);
+	}
+
+	const LightRecord *lights = scene.records<LightRecord>(LIGHTS);
+	for (uint32_t i = 0; i < scene.count(LIGHTS); ++i) {
+		if (gNumLights + 1 > MAX_LIGHTS) ERROR("Too many lights in scene.");
+		const LightRecord &l = lights[i];
+		Light &light = gLights[gNumLights++];
+		light = Light();
+		light.type = (Light::LIGHT_TYPE)l.type;
+		light.isOn = l.isOn;
+		light.alpha = l.alpha;
+		light.theta = l.theta;
+		light.intensity = glm::vec4(l.intensity[0], l.intensity[1], l.intensity[2], l.intensity[3]);
+		light.position = glm::vec4(l.position[0], l.position[1], l.position[2], l.position[3]);
+		light.direction = glm::vec4(l.direction[0], l.direction[1], l.direction[2], l.direction[3]);
+		light.attenuation = glm::vec4(l.attenuation[0], l.attenuation[1], l.attenuation[2], l.attenuation[3]);
+	}
+
+	//Scene-level and node cameras share one array so gActiveCamera indices match the text load.
+	size_t firstCamera = gCameras.size();
+	const CameraRecord *cameras = scene.records<CameraRecord>(CAMERAS);
+	for (uint32_t i = 0; i < scene.count(CAMERAS); ++i) {
+		const CameraRecord &r = cameras[i];
+		Camera *cam = new Camera();
+		cam->name = scene.str(r.name);
+		cam->eye = glm::vec3(r.eye[0], r.eye[1], r.eye[2]);
+		cam->center = glm::vec3(r.center[0], r.center[1], r.center[2]);
+		cam->vup = glm::vec3(r.vup[0], r.vup[1], r.vup[2]);
+		cam->fovy = r.fovy;
+		cam->znear = r.znear;
+		cam->zfar = r.zfar;
+		cam->inNode = (r.node != -1);
+		cam->refreshTransform((float)gWidth, (float)gHeight);
+		gCameras.push_back(cam);
+	}
+
+	//Nodes are pre-order, so every parent exists by the time its children come up.
+	const NodeRecord *nodeRecords = scene.records<NodeRecord>(NODES);
+	const uint32_t *nodeCameras = scene.records<uint32_t>(NODE_CAMERAS);
+	const DrawableRecord *drawables = scene.records<DrawableRecord>(DRAWABLES);
+	const float *distances = scene.records<float>(DISTANCES);
+	const SoundRecord *sounds = scene.records<SoundRecord>(SOUNDS);
+	vector<SceneGraphNode*> nodes(scene.count(NODES), nullptr);
+	for (uint32_t i = 0; i < scene.count(NODES); ++i) {
+		const NodeRecord &r = nodeRecords[i];
+		SceneGraphNode *n = nodes[i] = new SceneGraphNode();
+		n->name = scene.str(r.name);
+		gNodes[n->name] = n;
+		if (r.parent != -1) {
+			n->parent = nodes[r.parent];
+			n->parent->children.push_back(n);
+		}
+		n->isRendered = (r.flags & IS_RENDERED) != 0;
+		n->isUpdated = (r.flags & IS_UPDATED) != 0;
+		n->T.translation = glm::vec3(r.translation[0], r.translation[1], r.translation[2]);
+		n->T.rotation = glm::quat(glm::vec3(r.rotation[0], r.rotation[1], r.rotation[2]));
+		n->T.scale = glm::vec3(r.scale[0], r.scale[1], r.scale[2]);
+
+		for (uint32_t d = r.drawables.first; d < r.drawables.first + r.drawables.count; ++d)
+			n->LODstack.push_back(createDrawable(scene, drawables[d]));
+		for (uint32_t c = r.cameras.first; c < r.cameras.first + r.cameras.count; ++c)
+			n->cameras.push_back(gCameras[firstCamera + nodeCameras[c]]);
+		for (uint32_t s = r.sounds.first; s < r.sounds.first + r.sounds.count; ++s)
+			attachSound(n, scene.str(sounds[s].file));
+		if (r.flags & HAS_COLLIDER)
+			attachCollider(n, glm::vec3(r.colliderOffset[0], r.colliderOffset[1], r.colliderOffset[2]), r.colliderRadius);
+
+		n->switchingDistances.assign(distances + r.distances.first, distances + r.distances.first + r.distances.count);
+		n->setTranslation(n->T.translation); //Also handles camera updates.
+	}
+
+	const ScriptRecord *scripts = scene.records<ScriptRecord>(SCRIPTS);
+	const PairRecord *pairs = scene.records<PairRecord>(PAIRS);
+	for (uint32_t i = 0; i < scene.count(SCRIPTS); ++i) {
+		const ScriptRecord &r = scripts[i];
+		Script *script = attachScript(nodes[r.node], scene.str(r.type));
+		if (script == nullptr) continue;
+		for (uint32_t p = r.pairs.first; p < r.pairs.first + r.pairs.count; ++p)
+			if (!script->setProperty(scene.str(pairs[p].name), scene.str(pairs[p].value)))
+				ERROR("Failed to set property in script.", false);
+		script->postParseInit();
+	}
+}
+
+//-------------------------------------------------------------------------//
+// INCREMENTAL RELOAD
+//-------------------------------------------------------------------------//
+
+//A text scene is a list of top-level blocks (mesh, material, camera, light, node...), with each library's blocks
+//standing in for its library line. Blocks are keyed by kind and name and hashed over their text, so reloading
+//over a live scene only reparses what changed. Everything else, window and GL objects included, stays put.
+//Meshes, materials and cameras are found again by block key rather than by name, as unnamed ones have none.
+struct SceneBlock {
+	string kind, key; //key is kind:name, or kind#ordinal for unnamed blocks like lights.
+	const char *begin, *end; //From the kind token through its closing brace, into a Tokenizer's mapping.
+	uint64_t hash;
+	bool inLibrary;
+};
+struct LoadedBlock {
+	uint64_t hash;
+	TriMesh *mesh; //What a mesh, material or camera block built, else null.
+	Material *material;
+	Camera *camera;
+};
+static map<string, LoadedBlock> gLoadedBlocks; //What the live scene was built from. Empty after a .sceneb load.
+
+//Keeps the Tokenizers alive, since the blocks point into their mappings.
+static bool scanSceneBlocks(const string &fileName, bool inLibrary, vector<SceneBlock> &blocks, vector<string> &libraries, vector<unique_ptr<Tokenizer> > &files)
+{
+	files.push_back(unique_ptr<Tokenizer>(new Tokenizer()));
+	Tokenizer &F = *files.back();
+	if (!F.open(fileName)) return false;
+	map<string, int> ordinals;
+	TokenView token;
+
+	while (getToken(F, token, SCENE_CHARS)) {
+		if (token == "library") {
+			string libFile;
+			getToken(F, libFile, SCENE_CHARS);
+			libraries.push_back(libFile);
+			if (!scanSceneBlocks(libFile, true, blocks, libraries, files)) return false;
+			continue;
+		}
+		SceneBlock block;
+		block.kind = token.str();
+		block.begin = token.ptr;
+		block.inLibrary = inLibrary;
+		string name;
+		int depth = 0;
+		bool opened = false;
+		while (getToken(F, token, SCENE_CHARS)) {
+			bool quoted = (F.cur != token.ptr + token.len); //Consumed a closing quote, so a "}" here is just a string.
+			if (!quoted && token == "{") { ++depth; opened = true; }
+			else if (!quoted && token == "}") { if (--depth == 0) break; }
+			else if (depth <= 1 && name.empty() && token == "name") getToken(F, name, SCENE_CHARS);
+		}
+		if (!opened || depth != 0) return false; //Not something we can diff, let the full load report it.
+		block.end = token.ptr + token.len;
+		block.hash = hashBytes(block.begin, block.end - block.begin);
+		ostringstream key;
+		if (name.empty()) key << block.kind << '#' << ordinals[block.kind]++;
+		else key << block.kind << ':' << name;
+		block.key = key.str();
+		blocks.push_back(block);
+	}
+	return true;
+}
+static void recordSceneBlocks(const char *sceneFile)
+{
+	gLoadedBlocks.clear();
+	BuiltObjects built;
+	swap(built, gBuiltObjects);
+	vector<SceneBlock> blocks;
+	vector<string> libraries;
+	vector<unique_ptr<Tokenizer> > files;
+	if (!scanSceneBlocks(sceneFile, false, blocks, libraries, files)) return;
+
+	map<string, LoadedBlock> loaded;
+	size_t numMeshes = 0, numMaterials = 0, numCameras = 0;
+	for (int i = 0; i < (int)blocks.size(); ++i) {
+		const SceneBlock &b = blocks[i];
+		if (loaded.count(b.key) > 0) return; //Ambiguous, so never diffed.
+		LoadedBlock l = { b.hash, nullptr, nullptr, nullptr };
+		if (b.kind == "mesh" && numMeshes < built.meshes.size()) l.mesh = built.meshes[numMeshes];
+		if (b.kind == "material" && numMaterials < built.materials.size()) l.material = built.materials[numMaterials];
+		if (b.kind == "camera" && numCameras < built.cameras.size()) l.camera = built.cameras[numCameras];
+		numMeshes += (b.kind == "mesh");
+		numMaterials += (b.kind == "material");
+		numCameras += (b.kind == "camera");
+		loaded[b.key] = l;
+	}
+	//Blocks the loaders skip, like a camera in a library, would pair the rest up wrongly.
+	if (numMeshes != built.meshes.size() || numMaterials != built.materials.size() || numCameras != built.cameras.size()) return;
+	gLoadedBlocks.swap(loaded);
+}
+//The block minus its kind token, as the load* functions expect it.
+static void attachBlockBody(Tokenizer &F, const SceneBlock &block)
+{
+	F.attach(block.begin + block.kind.size(), block.end - block.begin - block.kind.size());
+}
+static void deleteNodeTree(SceneGraphNode *n)
+{
+	for (int i = 0; i < (int)n->children.size(); ++i) deleteNodeTree(n->children[i]);
+	for (int i = 0; i < (int)n->cameras.size(); ++i) {
+		gCameras.erase(find(gCameras.begin(), gCameras.end(), n->cameras[i]));
+		delete n->cameras[i];
+	}
+	auto it = gNodes.find(n->name);
+	if (it != gNodes.end() && it->second == n) gNodes.erase(it);
+	gSelected.erase(n->name);
+	delete n;
+}
+//Points a drawable at the replacements of its mesh and material, before the old ones are deleted.
+static void repointDrawable(Drawable *d, const map<TriMesh*, TriMesh*> &meshes, const map<Material*, Material*> &materials)
+{
+	auto mesh = meshes.find(d->triMesh);
+	if (mesh != meshes.end()) d->setMesh(mesh->second);
+	auto material = materials.find(d->material);
+	if (material != materials.end()) d->setMaterial(material->second);
+}
+
+//False when the change can't be applied in place, and loadScene() does a full load instead: the first load,
+//.sceneb files, a different library list or world settings, removed meshes, materials and cameras, or changed
+//nodes while a script holds on to other nodes, which rebuilding them would leave dangling.
+bool reloadScene(const char *sceneFile)
+{
+	if (gWindow == nullptr || gLoadedBlocks.empty() || sceneb::isCompiledSceneName(sceneFile)) return false;
+	double start = TIME();
+
+	vector<SceneBlock> blocks;
+	vector<string> libraries;
+	vector<unique_ptr<Tokenizer> > files;
+	addFileDirectoryToPath(sceneFile);
+	if (!scanSceneBlocks(sceneFile, false, blocks, libraries, files) || libraries != gLibraries) return false;
+
+	//Decide everything before touching the live scene, so a fallback never leaves it half updated.
+	map<string, LoadedBlock> newBlocks;
+	vector<bool> changed(blocks.size());
+	bool lightsChanged = false, nodesChanged = false;
+	int numChanged = 0;
+	for (int i = 0; i < (int)blocks.size(); ++i) {
+		const SceneBlock &b = blocks[i];
+		if (newBlocks.count(b.key) > 0) return false;
+		auto old = gLoadedBlocks.find(b.key);
+		changed[i] = (old == gLoadedBlocks.end() || old->second.hash != b.hash);
+		LoadedBlock l = { b.hash, nullptr, nullptr, nullptr };
+		if (old != gLoadedBlocks.end()) { l = old->second; l.hash = b.hash; } //Changed ones get their new objects below.
+		newBlocks[b.key] = l;
+		if (!changed[i]) continue;
+		++numChanged;
+		if (b.kind == "light") lightsChanged = true;
+		else if (b.kind == "node") nodesChanged = true;
+		else if (b.kind != "mesh" && b.kind != "material" && b.kind != "camera") return false; //worldSettings and the rest.
+	}
+	vector<string> removedNodes;
+	for (auto it = gLoadedBlocks.begin(); it != gLoadedBlocks.end(); ++it) {
+		if (newBlocks.count(it->first) > 0) continue;
+		++numChanged;
+		if (it->first.compare(0, 5, "node:") == 0) removedNodes.push_back(it->first.substr(5));
+		else if (it->first.compare(0, 6, "light#") == 0) lightsChanged = true;
+		else return false;
+	}
+	if (nodesChanged || !removedNodes.empty())
+		for (auto it = gNodes.begin(); it != gNodes.end(); ++it)
+			for (int i = 0; i < (int)it->second->scripts.size(); ++i)
+				if (it->second->scripts[i]->holdsOtherNodes()) return false;
+	gActiveSceneName = sceneFile;
+	Camera *activeCamera = gCameras.empty() ? nullptr : gCameras[gActiveCamera];
+	string activeCameraName = activeCamera ? activeCamera->name : "";
+
+	//First meshes, materials and scene cameras. Once their loads finish, whatever pointed at the objects they
+	//replace points at them instead and the old ones go. Nodes parsed after that find them by name as usual.
+	map<TriMesh*, TriMesh*> meshes;
+	map<Material*, Material*> materials;
+	vector<pair<Camera*, Camera*> > cameras;
+	for (int i = 0; i < (int)blocks.size(); ++i) {
+		if (!changed[i]) continue;
+		const SceneBlock &b = blocks[i];
+		LoadedBlock &l = newBlocks[b.key];
+		Tokenizer F;
+		attachBlockBody(F, b);
+		if (b.kind == "mesh") {
+			TriMesh *fresh = loadMesh(F, b.inLibrary);
+			if (l.mesh != nullptr) meshes[l.mesh] = fresh;
+			l.mesh = fresh;
+		}
+		else if (b.kind == "material") {
+			Material *fresh = loadMaterial(F, b.inLibrary);
+			if (l.material != nullptr) materials[l.material] = fresh;
+			l.material = fresh;
+		}
+		else if (b.kind == "camera") {
+			Camera *fresh = loadCamera(F);
+			if (l.camera != nullptr) cameras.push_back(make_pair(l.camera, fresh));
+			l.camera = fresh;
+		}
+	}
+	gJobs.waitAll();
+	if (!meshes.empty() || !materials.empty()) {
+		for (auto it = gNodes.begin(); it != gNodes.end(); ++it) {
+			SceneGraphNode *n = it->second;
+			for (int i = 0; i < (int)n->LODstack.size(); ++i) repointDrawable(n->LODstack[i], meshes, materials);
+			if (n->collider != nullptr) repointDrawable(n->collider->meshInstance, meshes, materials);
+			if (!meshes.empty()) n->markMoved(); //Their bounds may have changed.
+		}
+	}
+	for (auto it = meshes.begin(); it != meshes.end(); ++it) {
+		auto entry = gMeshes.find(it->first->name);
+		if (entry != gMeshes.end() && entry->second == it->first) gMeshes.erase(entry); //Renamed, so nothing took its place.
+		delete it->first;
+	}
+	for (auto it = materials.begin(); it != materials.end(); ++it) {
+		auto entry = gMaterials.find(it->first->name);
+		if (entry != gMaterials.end() && entry->second == it->first) gMaterials.erase(entry);
+		delete it->first;
+	}
+	for (int i = 0; i < (int)cameras.size(); ++i) {
+		Camera *live = cameras[i].first, *fresh = cameras[i].second;
+		gCameras.erase(find(gCameras.begin(), gCameras.end(), fresh)); //Takes the old one's place instead of the end.
+		*find(gCameras.begin(), gCameras.end(), live) = fresh;
+		if (activeCamera == live) activeCamera = fresh;
+		delete live;
+	}
+
+	//Then nodes, rebuilt whole, children and all. Untouched ones keep their drawables, scripts and playing sounds.
+	for (int i = 0; i < (int)removedNodes.size(); ++i)
+		if (gNodes.count(removedNodes[i]) > 0 && gNodes[removedNodes[i]]->parent == nullptr) deleteNodeTree(gNodes[removedNodes[i]]);
+	for (int i = 0; i < (int)blocks.size(); ++i) {
+		if (!changed[i] || blocks[i].kind != "node") continue;
+		string name = blocks[i].key.substr(5);
+		if (gNodes.count(name) > 0) deleteNodeTree(gNodes[name]);
+		Tokenizer F;
+		attachBlockBody(F, blocks[i]);
+		loadAndReturnNode(F);
+	}
+
+	//Lights live in one array in file order, so any change redoes all of them. The UBO is refilled every frame.
+	if (lightsChanged) {
+		gNumLights = 0;
+		for (int i = 0; i < (int)blocks.size(); ++i) {
+			if (blocks[i].kind != "light") continue;
+			Tokenizer F;
+			attachBlockBody(F, blocks[i]);
+			loadLight(F);
+		}
+		for (int i = gNumLights; i < MAX_LIGHTS; ++i) gLights[i] = Light();
+	}
+
+	gJobs.waitAll();
+	gTextureCache.purge();
+	gLoadedBlocks = newBlocks;
+
+	//Stay on the same camera if it survived, else one by that name, else the first.
+	gActiveCamera = 0;
+	for (int c = 0; c < (int)gCameras.size(); ++c) {
+		if (gCameras[c] == activeCamera) { gActiveCamera = c; break; }
+		if (gCameras[c]->name == activeCameraName) gActiveCamera = c;
+	}
+	printf("Reloaded '%s' in %.3f s, %d of %d blocks changed.\n", sceneFile, TIME() - start, numChanged, (int)blocks.size());
+	return true;
+}
+
+//-------------------------------------------------------------------------//
+// HOT RELOAD
+//-------------------------------------------------------------------------//
+
+//Runs on the frame after gFileWatcher saw writes. Textures refresh under their existing ids, so no drawable or
+//material notices; sprite frames keep the old sheet size. Only materials built from an edited shader relink.
+void applyFileChanges(void)
+{
+	vector<string> changed;
+	gFileWatcher.takeChanges(changed);
+
+	int numTextures = 0;
+	for (auto it = changed.cbegin(); it != changed.cend(); ++it) numTextures += gTextureCache.reload(*it);
+	if (numTextures > 0) gJobs.waitAll(); //Decodes run in parallel, the refreshes in here.
+
+	int numMaterials = 0, numFailed = 0;
+	for (auto m = gMaterials.begin(); m != gMaterials.end(); ++m) {
+		const vector<string> &files = m->second->shaderFiles;
+		bool isAffected = false;
+		for (auto it = changed.cbegin(); it != changed.cend() && !isAffected; ++it)
+			isAffected = find(files.begin(), files.end(), *it) != files.end();
+		if (!isAffected) continue;
+		if (m->second->reloadShaders()) ++numMaterials;
+		else ++numFailed;
+	}
+
+	if (numTextures + numMaterials + numFailed == 0) return; //Watched for something that isn't loaded now.
+	printf("Hot reload: %d textures, %d materials relinked", numTextures, numMaterials);
+	if (numFailed > 0) printf(", %d kept their old program", numFailed);
+	printf(".\n");
+}
+
+void unloadScene(void)
+{
+	//Deleted while the old window's context is still current. Drawables and materials hand their textures back
+	//to gTextureCache, which keeps the unheld ones until the next scene has had a chance to reuse them.
+	gOctree.clear(); //First, so the nodes don't leave it one by one.
+	for (auto it = gNodes.begin(); it != gNodes.end(); ++it) delete it->second;
+	for (auto it = gMaterials.begin(); it != gMaterials.end(); ++it) delete it->second;
+	for (auto it = gMeshes.begin(); it != gMeshes.end(); ++it) delete it->second;
+	for (auto it = gCameras.begin(); it != gCameras.end(); ++it) delete *it;
 	if (!gLibraries.empty()) gLibraries.clear();
 	if (!gMeshes.empty()) gMeshes.clear();
 	if (!gNodes.empty()) gNodes.clear();
 	if (!gCameras.empty()) gCameras.clear();
 	if (!gMaterials.empty()) gMaterials.clear();
+	gSelected.clear();
+	gLoadedBlocks.clear();
+	gBuiltObjects = BuiltObjects();
 	for (int i = 0; i < gNumLights; ++i) {
 		gLights[i].isOn = 0;
 		gLights[i].alpha = gLights[i].theta = 0.0f;
@@ -570,6 +1126,8 @@ void loadScene(const char *sceneFile)
 	if (gLightsUBO != NULL_HANDLE) glDeleteBuffers(1, &gLightsUBO);
 	gNumLights = 0;
 	gLightsUBO = NULL_HANDLE;
+	if (gCameraUBO != NULL_HANDLE) glDeleteBuffers(1, &gCameraUBO);
+	gCameraUBO = NULL_HANDLE;
 	gActiveCamera = 0;
 	if (gBackgroundMusic) {
 		gBackgroundMusic->stop();
@@ -578,30 +1136,102 @@ void loadScene(const char *sceneFile)
 	}
 	soundEngine->stopAllSounds();
 
-	//Add the path used for the scene to the EngineUtil's PATH variable.
-	gActiveSceneName = sceneFile;
-	int separatorIndex = gActiveSceneName.find_last_of("/");
-	if (separatorIndex < 0)	separatorIndex = gActiveSceneName.find_last_of("\\");
-	if (separatorIndex > 0)	addToPath(gActiveSceneName.substr(0, separatorIndex + 1));
+	//Every scene opens its own window, so the old context and every GL object in it go now.
+	gTextureCache.dropGL();
+	gProgramCache.dropGL();
+	gRenderQueue.dropGL();
+	gParticleRenderer.dropGL();
+	if (gWindow != nullptr) {
+		glfwTerminate();
+		gWindow = nullptr;
+	}
+}
+void loadScene(const char *sceneFile)
+{
+	//Over a live text scene, only the blocks that changed are redone and the window stays up.
+	if (reloadScene(sceneFile)) return;
 
-	FILE *F = openFileForReading(sceneFile);
-	string token;
+	//Unload the previous scene if there was one.
+	unloadScene();
+	double start = TIME();
 
-	while (getToken(F, token, ONE_TOKENS)) {
-		//cout << token << endl;
-		if (token == "worldSettings") loadWorldSettings(F);
-		else if (token == "library") { (getToken(F, token, ONE_TOKENS)); loadLibrary(token.c_str()); }
-		else if (token == "node") loadAndReturnNode(F);
-		else if (token == "mesh") loadMesh(F);
-		else if (token == "material") loadMaterial(F);
-		else if (token == "meshInstance") loadAndReturnMeshInstance(F);
-		else if (token == "camera") loadCamera(F);
-		else if (token == "light") loadLight(F);
+	//Add the path used for the scene to the EngineUtil's PATH variable.
+	gActiveSceneName = sceneFile;
+	addFileDirectoryToPath(gActiveSceneName);
+
+	if (sceneb::isCompiledSceneName(gActiveSceneName)) loadSceneBinary(sceneFile);
+	else {
+		Tokenizer F;
+		F.open(sceneFile);
+		TokenView token;
+
+		while (getToken(F, token, SCENE_CHARS)) {
+			//cout << token << endl;
+			if (token == "worldSettings") loadWorldSettings(F);
+			else if (token == "library") { (getToken(F, token, SCENE_CHARS)); loadLibrary(token.str().c_str()); }
+			else if (token == "node") loadAndReturnNode(F);
+			else if (token == "mesh") gBuiltObjects.meshes.push_back(loadMesh(F));
+			else if (token == "material") gBuiltObjects.materials.push_back(loadMaterial(F));
+			else if (token == "meshInstance") loadAndReturnMeshInstance(F);
+			else if (token == "camera") gBuiltObjects.cameras.push_back(loadCamera(F));
+			else if (token == "light") loadLight(F);
+		}
+		recordSceneBlocks(sceneFile);
 	}
-	fclose(F);
+
+	//Everything below expects the assets to be resident.
+	gJobs.waitAll();
+	gTextureCache.purge(); //Whatever the last scene used and this one didn't.
+	printf("Loaded '%s' in %.3f s with %d loader threads.\n", sceneFile, TIME() - start, gJobs.getNumWorkers());
+	gProgramCache.print();
 
 	if (gBackgroundMusic != nullptr) gBackgroundMusic->setIsPaused(false);
 }
+//Writes the live scene back out as .scene text through the toSDL() writers.
+void saveScene(const char *fileName)
+{
+	//Call toString() of all appropriate objects over all global state containers.
+	//fprintf(F, "\n%s\n", objOfInterestInRightOrder.toSDL());
+	FILE *F = fopen(fileName, "w"); //Will erase old file and create a new one over it.
+	if (F == nullptr) { ERROR(string("Could not open ") + fileName + " for writing.", false); return; }
+	saveWorldSettings(F); fprintf(F, "\n"); cout << "\tFinished saving worldSettings.\n";
+	for (auto it = gCameras.cbegin(); it != gCameras.cend(); ++it) if (!(*it)->inNode) (*it)->toSDL(F);	
+		fprintf(F, "\n"); cout << "\tFinished saving cameras.\n";
+	for (auto it = gLibraries.cbegin(); it != gLibraries.cend(); ++it) fprintf(F, "library \"%s\"\n", (*it).c_str());
+		fprintf(F, "\n"); cout << "\tFinished listing libraries.\n";
+	for (auto it = gMeshes.cbegin(); it != gMeshes.cend(); ++it) if (!it->second->inLibrary) it->second->toSDL(F); 
+		fprintf(F, "\n"); cout << "\tFinished saving meshes.\n";
+	for (int i = 0; i < gNumLights; ++i) gLights[i].toSDL(F); 
+		fprintf(F, "\n"); cout << "\tFinished saving lights.\n";
+	for (auto it = gMaterials.cbegin(); it != gMaterials.cend(); ++it) if (!it->second->inLibrary) it->second->toSDL(F); 
+		fprintf(F, "\n"); cout << "\tFinished saving materials.\n";
+	for (auto it = gNodes.cbegin(); it != gNodes.cend(); ++it) if (it->second->parent == nullptr) it->second->toSDL(F); fprintf(F, "\n"); cout << "\tFinished saving nodes.\n";
+	fclose(F);
+}
+//The .scene grammar is parsed twice, by the loaders here and by sceneb::Compiler, so every compile is checked by
+//building the scene both ways and writing each back out through the same toSDL() writers. A difference means the
+//two parsers have drifted. Both outputs are left next to the compiled file when they differ.
+bool checkCompiledScene(const char *sceneFile, const char *compiledFile)
+{
+	string textOut = string(compiledFile) + ".text.scene", binaryOut = string(compiledFile) + ".binary.scene";
+	loadScene(sceneFile);
+	saveScene(textOut.c_str());
+	loadScene(compiledFile);
+	saveScene(binaryOut.c_str());
+	unloadScene();
+
+	MappedFile a, b;
+	bool same = a.open(textOut) && b.open(binaryOut) && a.size == b.size && memcmp(a.data, b.data, a.size) == 0;
+	a.close();
+	b.close();
+	if (!same) {
+		ERROR(string(compiledFile) + " does not load back as " + sceneFile + " does, compare " + textOut + " with " + binaryOut + ".", false);
+		return false;
+	}
+	remove(textOut.c_str());
+	remove(binaryOut.c_str());
+	return true;
+}
 
 //Console and main loops.
 void consoleLoadCamera()
@@ -691,14 +1321,12 @@ SceneGraphNode* consoleLoadNode(const string& name = "") {
 
 			//Assign image or sprite sheet.
 			Material* m = sprite->getMaterial();
-			m->textures.push_back(new RGBAImage());
 			cout << "\tTip: uDiffuseTex is the image's sampler2D uniform name by default.\n";
-			m->textures.back()->name = "uDiffuseTex"; //Store uniform name in RGBAImage.
 			cout << "\tFilename, e.g. spritesheet.png (active paths besides cwd below): \n";
 			for (auto it = getPATH().cbegin(); it != getPATH().cend(); ++it) cout << '\t' << '\t' << *it << endl;
 			cin >> tmp;
-			m->textures.back()->loadPNG(tmp);
-			m->textures.back()->sendToOpenGL();
+			m->addTexture("uDiffuseTex", createTexture(tmp));
+			gJobs.waitAll();
 			m->bindMaterial();
 
 			cout << "\tAnimation Direction (1 or -1) -- Norm 1: "; cin >> sprite->animDir;
@@ -707,8 +1335,8 @@ SceneGraphNode* consoleLoadNode(const string& name = "") {
 			cout << "\tFrame Height in Pixels: "; cin >> sprite->frameHeight;
 
 			if (sprite->getMaterial()->textures.size() < 1) ERROR("Sprite lacks an image!");
-			sprite->sheetWidth = sprite->getMaterial()->textures[0]->width;
-			sprite->sheetHeight = sprite->getMaterial()->textures[0]->height;
+			sprite->sheetWidth = sprite->getMaterial()->textures[0]->val->width;
+			sprite->sheetHeight = sprite->getMaterial()->textures[0]->val->height;
 			sprite->amtRows = sprite->sheetHeight / sprite->frameHeight;
 			sprite->amtCols = sprite->sheetWidth / sprite->frameWidth;
 
@@ -745,14 +1373,12 @@ SceneGraphNode* consoleLoadNode(const string& name = "") {
 
 			//Assign image.
 			Material* m = billboard->getMaterial();
-			m->textures.push_back(new RGBAImage());
 			cout << "\tTip: Assigning uDiffuseTex as the image's corresponding sampler2D uniform name by default.\n";
-			m->textures.back()->name = "uDiffuseTex"; //Store uniform name in RGBAImage.
 			cout << "\tPlease enter the filename of the image.png located among the current paths below: \n";
 			for (auto it = getPATH().cbegin(); it != getPATH().cend(); ++it) cout << '\t' << '\t' << *it << endl;
 			cin >> tmp;
-			m->textures.back()->loadPNG(tmp);
-			m->textures.back()->sendToOpenGL();
+			m->addTexture("uDiffuseTex", createTexture(tmp));
+			gJobs.waitAll();
 			m->bindMaterial();
 
 			gNodes[nodeName]->LODstack.push_back(billboard);
@@ -799,8 +1425,7 @@ SceneGraphNode* consoleLoadNode(const string& name = "") {
 	do {
 		cout << "\tAdd sound (Y/N)? "; cin >> tmp; if (tmp == "N" || tmp == "n") break;
 		cout << "\tPlease enter the name of the sound, e.g. bell.wav: "; cin >> tmp;
-		gNodes[nodeName]->sounds.push_back(soundEngine->play2D(tmp.c_str(), false, false, true));
-		gNodes[nodeName]->sounds.back()->stop();
+		attachSound(gNodes[nodeName], tmp);
 	} while (true);
 
 	//Auto-generate the other class members that the parser isn't supplying.
@@ -821,18 +1446,21 @@ SceneGraphNode* consoleLoadNode(const string& name = "") {
 
 	return gNodes[nodeName];
 }
+#define SOUND_DISTANCE_SQR 10.0f //From the camera, for a node's sound to start.
+static vector<SceneGraphNode*> gNearbyNodes, gVisibleNodes; //Query results, kept so steady state allocates nothing.
 void update(double dt)
 {
 	gCameras[gActiveCamera]->refreshTransform((float)gWidth, (float)gHeight);
 
 	if (gShouldSwapScene) {
 		gShouldSwapScene = false;
-		glfwTerminate();
 		cout << "\n================================================================================\n";
 		loadScene(gSceneFileNames[gActiveScene].c_str());
 	}
 
 	for (auto it = gNodes.cbegin(); it != gNodes.cend(); ++it) it->second->update(*gCameras[gActiveCamera], dt);
+	gParticleRenderer.simulate(*gCameras[gActiveCamera]); //The emitters only queued their steps above.
+	gOctree.refresh(); //Transforms are current now, so what moved can change cells.
 
 	//Collision detection loop.
 	for (auto it = gNodes.begin(); it != gNodes.end(); ++it)
@@ -842,16 +1470,23 @@ void update(double dt)
 					it->second->hasCollided(it2->second);
 
 	//Play the sound of an object within the specified number range below, if it isn't yet played.
-	for (auto it = gNodes.cbegin(); it != gNodes.cend(); ++it) {
-		glm::vec3 camDistVec = it->second->T.translation - (*gCameras[gActiveCamera]).eye;
-		if (it->second->sounds.size() > 0
-			&& !soundEngine->isCurrentlyPlaying(it->second->sounds.back()->getSoundSource())
-			&& camDistVec.x*camDistVec.x + camDistVec.y*camDistVec.y + camDistVec.z*camDistVec.z <= 10.0)
-			soundEngine->play3D(it->second->sounds.back()->getSoundSource(), irrklang::vec3df(it->second->T.translation.x, it->second->T.translation.y, it->second->T.translation.z), false, false, false, false); //Outside all thresholds.
+	//The octree hands back whatever might be in range, the node's origin is what has to be.
+	const glm::vec3 &eye = gCameras[gActiveCamera]->eye;
+	gNearbyNodes.clear();
+	gOctree.querySphere(eye, sqrtf(SOUND_DISTANCE_SQR), gNearbyNodes);
+	for (int i = 0; i < (int)gNearbyNodes.size(); ++i) {
+		SceneGraphNode *n = gNearbyNodes[i];
+		glm::vec3 camDistVec = glm::vec3(n->T.transform[3]) - eye;
+		if (n->sounds.size() > 0
+			&& !soundEngine->isCurrentlyPlaying(n->sounds.back()->getSoundSource())
+			&& camDistVec.x*camDistVec.x + camDistVec.y*camDistVec.y + camDistVec.z*camDistVec.z <= SOUND_DISTANCE_SQR)
+			soundEngine->play3D(n->sounds.back()->getSoundSource(), irrklang::vec3df(n->T.translation.x, n->T.translation.y, n->T.translation.z), false, false, false, false); //Outside all thresholds.
 	}
 	//Could even add in a tick within the node class to check whether a sound is ready or should delay playing, so it's not just effectively looping.
 }
-void render(void)
+//alpha is how far the time since the last update() is into the next one, 0 to 1, for whatever interpolates between
+//its last two fixed steps. The rest draws the last step as is.
+void render(double alpha)
 {
 	// clear color and depth buffer
 	if (gBuildMode) glClearColor(0, 0, 0, 1.0f);
@@ -867,21 +1502,117 @@ void render(void)
 	glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(Light)*gNumLights, gLights); //Copy data into buffer w/o glBufferData()'s allocation.
 	glBindBuffer(GL_UNIFORM_BUFFER, 0);
 
-	// draw scene
-	for (auto it = gNodes.cbegin(); it != gNodes.cend(); ++it) it->second->draw(*gCameras[gActiveCamera]);
+	//Update the camera, once for every program instead of per object.
+	uploadCameraBuffer(*gCameras[gActiveCamera]);
+
+	// draw scene, grouped by state rather than by node name. Only the nodes in octree cells the camera sees are looked at.
+	Frustum frustum;
+	frustum.fromMatrix(gCameras[gActiveCamera]->worldViewProject);
+	gVisibleNodes.clear();
+	gOctree.queryFrustum(frustum, gVisibleNodes);
+	gRenderQueue.clear(*gCameras[gActiveCamera]);
+	for (int i = 0; i < (int)gVisibleNodes.size(); ++i) gRenderQueue.submit(gVisibleNodes[i]);
+	gRenderQueue.sort();
+	gRenderQueue.draw(*gCameras[gActiveCamera]);
+
+	//Particles last, blended over the scene, one draw per emitter.
+	gParticleRenderer.draw(*gCameras[gActiveCamera], (float)alpha);
+}
+//Frames of update() and render() against the recording GL device, for comparing CPU cost and GL traffic between
+//builds on machines without a GPU. Fixed steps, so every run does the same work.
+void runHeadless(int numFrames)
+{
+	double start = TIME();
+	loadScene(gSceneFileNames[0].c_str());
+	double loadTime = TIME() - start;
+	GLRecording load = gGLRecording;
+	gGLRecording.clear();
+
+	double updateTime = 0.0, renderTime = 0.0, maxFrameTime = 0.0;
+	for (int i = 0; i < numFrames; ++i) {
+		double frameStart = TIME();
+		update(FIXED_DT);
+		double renderStart = TIME();
+		render(1.0); //Exactly one step per frame, so draw where it ended.
+		double frameEnd = TIME();
+		updateTime += renderStart - frameStart;
+		renderTime += frameEnd - renderStart;
+		maxFrameTime = max(maxFrameTime, frameEnd - frameStart);
+		gUniformLookups = 0;
+		gGLState.endFrame();
+	}
+
+	double n = (double)max(numFrames, 1);
+	printf("Headless: %d frames of '%s', %d nodes.\n", numFrames, gSceneFileNames[0].c_str(), (int)gNodes.size());
+	printf("\tLoad: %.3f ms.\n", loadTime * 1000.0);
+	load.print();
+	printf("\tPer frame: update %.3f ms, render %.3f ms, slowest frame %.3f ms.\n", updateTime * 1000.0 / n, renderTime * 1000.0 / n, maxFrameTime * 1000.0);
+	gGLRecording.print(numFrames);
+	printf("\tLast frame:\n");
+	gRenderQueue.printStats();
+	gParticleRenderer.printStats();
+	gGLState.printStats();
+	gOctree.printStats();
+	unloadScene();
 }
 int main(int numArgs, char **args)
 {
 	// check usage
 	if (numArgs < 2) {
-		cout << "Proper Input: gameEngine.exe sceneFile.scene [sceneFile2.scene ...]" << endl;
+		cout << "Proper Input: gameEngine.exe [-b] sceneFile.scene|sceneFile.sceneb [sceneFile2.scene ...]" << endl;
+		cout << "              gameEngine.exe -compile sceneFile.scene sceneFile.sceneb" << endl;
+		cout << "              gameEngine.exe -decompile sceneFile.sceneb sceneFile.scene" << endl;
+		cout << "              gameEngine.exe -benchTokenizer [numNodes]" << endl;
+		cout << "              gameEngine.exe -benchPly [mesh.ply ...]" << endl;
+		cout << "              gameEngine.exe -benchLoading [numAssets]" << endl;
+		cout << "              gameEngine.exe -benchParticles [numParticles [numSteps]]" << endl;
+		cout << "              gameEngine.exe -benchEmitters [numEmitters [particlesPerEmitter [numSteps]]]" << endl;
+		cout << "              gameEngine.exe --headless numFrames sceneFile.scene|sceneFile.sceneb" << endl;
 		exit(0);
 	}
 
-	if (args[1] == "-b") gBuildMode = true;
+	if (strcmp(args[1], "-benchTokenizer") == 0) {
+		benchTokenizer(numArgs > 2 ? atoi(args[2]) : 100000);
+		return 0;
+	}
+	if (strcmp(args[1], "-benchPly") == 0) {
+		benchPly(vector<string>(args + 2, args + numArgs));
+		return 0;
+	}
+	if (strcmp(args[1], "-benchLoading") == 0) {
+		benchLoading(numArgs > 2 ? atoi(args[2]) : 32);
+		return 0;
+	}
+	if (strcmp(args[1], "-benchParticles") == 0) {
+		benchParticles(numArgs > 2 ? atoi(args[2]) : 1000000, numArgs > 3 ? atoi(args[3]) : 100);
+		return 0;
+	}
+	if (strcmp(args[1], "-benchEmitters") == 0) {
+		benchEmitters(numArgs > 2 ? atoi(args[2]) : 256, numArgs > 3 ? atoi(args[3]) : 4000, numArgs > 4 ? atoi(args[4]) : 100);
+		return 0;
+	}
+
+	//Compiling itself needs neither a window nor sound. Its round-trip check below builds the scene, offline like the rest.
+	bool isCompile = strcmp(args[1], "-compile") == 0;
+	if (isCompile) {
+		if (numArgs < 4) ERROR("Usage: -compile sceneFile.scene sceneFile.sceneb");
+		if (!sceneb::compileScene(args[2], args[3])) return 1;
+	}
+
+	if (strcmp(args[1], "-b") == 0) gBuildMode = true;
+	bool isHeadless = strcmp(args[1], "--headless") == 0;
+	bool isDecompile = strcmp(args[1], "-decompile") == 0;
+	bool isOffline = isHeadless || isDecompile || isCompile; //No GPU or audio needed.
+	if (isHeadless && numArgs < 4) ERROR("Usage: --headless numFrames sceneFile.scene");
+	if (isDecompile && numArgs < 4) ERROR("Usage: -decompile sceneFile.sceneb sceneFile.scene");
+	if (isOffline) useRecordingGL();
 
-	// Start sound engine
-	soundEngine = createIrrKlangDevice();
+	// Start asset loader threads and the hot reload watcher
+	gJobs.start();
+	if (!isOffline) gFileWatcher.start();
+
+	// Start sound engine, a silent one for offline runs on machines without audio
+	soundEngine = createIrrKlangDevice(isOffline ? ESOD_NULL : ESOD_AUTO_DETECT);
 	if (!soundEngine) return 0;
 	soundEngine->setListenerPosition(vec3df(0, 0, 0), vec3df(0, 0, 1));
 	soundEngine->setSoundVolume(0.25f); // master volume control
@@ -897,10 +1628,30 @@ int main(int numArgs, char **args)
 	//if (music) music->setMinDistance(5.0f); // distance of full volume
 
 	// Load all curernt args into gSceneFileNames to swap about later. i=1 for start because args[0] is just the program name.
-	for (int i = (gBuildMode ? 2 : 1); i < numArgs; ++i) gSceneFileNames.push_back(args[i]);
+	for (int i = (isHeadless ? 3 : (gBuildMode ? 2 : 1)); i < numArgs; ++i) gSceneFileNames.push_back(args[i]);
 
 	if (gSceneFileNames.size() == 0) ERROR("Failed to supply any scene file names, exiting engine.");
 
+	if (isCompile) {
+		bool same = checkCompiledScene(args[2], args[3]);
+		soundEngine->drop();
+		return same ? 0 : 1;
+	}
+
+	//Decompiling rebuilds the scene for real, on the recording device, so every object can write itself back out via toSDL().
+	if (isDecompile) {
+		loadScene(args[2]);
+		saveScene(args[3]);
+		soundEngine->drop();
+		return 0;
+	}
+
+	if (isHeadless) {
+		runHeadless(atoi(args[2]));
+		soundEngine->drop();
+		return 0;
+	}
+
 	// Load first scene.
 	loadScene(gSceneFileNames[0].c_str());
 
@@ -927,7 +1678,8 @@ int main(int numArgs, char **args)
 			accumulator -= FIXED_DT;
 			runningTime += FIXED_DT;
 		}	
-		render();
+		if (gFileWatcher.hasChanges()) applyFileChanges();
+		render(accumulator / FIXED_DT); //Once however many steps ran, between the last two of them.
 
 		// handle input
 		glfwPollEvents();
@@ -943,7 +1695,38 @@ int main(int numArgs, char **args)
 
 			//Print framerate.
 			printf("\rFPS: %1.0f  ", gFPS);
+
+			//Uniforms looked up by name this frame, should stay 0 outside of loads and console edits.
+			printf("Uniform lookups: %d  ", gUniformLookups);
+
+			//State changes between draws, as submitted and as sorted.
+			printf("State changes: %d -> %d  ", gRenderQueue.unsorted.getNumChanges(), gRenderQueue.sorted.getNumChanges());
+
+			//Draw calls, with runs of identical mesh instances drawn as one.
+			printf("Draws: %d  ", gRenderQueue.numDraws);
+
+			//Particles drawn, in one instanced call per emitter or per texture run of the depth-sorted ones.
+			printf("Particles: %d in %d draws  ", gParticleRenderer.numParticles, gParticleRenderer.numDraws);
+
+			//Particles drawn back to front, and the time their sort took.
+			printf("Sorted: %d in %.3f ms  ", gParticleRenderer.numSorted, gParticleRenderer.sortTime * 1000.0);
+
+			//Particle budget in use, emitters it stopped for being out of view, and the step's time against its own.
+			printf("Particle budget: %d/%d, %d out of view, %.2f/%.2f ms  ", gParticleRenderer.numParticles, gParticleRenderer.effectiveBudget,
+				gParticleRenderer.numOutOfView, gParticleRenderer.simulateTime * 1000.0, gParticleRenderer.timeBudget * 1000.0);
+
+			//Drawables outside the view frustum against those submitted.
+			printf("Culled: %d/%d  ", gRenderQueue.numCulled, gRenderQueue.numCulled + gRenderQueue.sorted.numPackets);
+
+			//Nodes the octree found in view, and how many it had to test to find them.
+			printf("Visible nodes: %d/%d tested of %d  ", gOctree.lastFrustum.nodesFound, gOctree.lastFrustum.nodesTested, gOctree.getNumNodes());
+
+			//GL state calls that reached the driver and those the state cache dropped as no-ops.
+			GLCallCount glCalls = GLState::getTotal(gGLState.calls);
+			printf("GL calls: %d issued, %d elided  ", glCalls.issued, glCalls.elided);
 		}
+		gUniformLookups = 0;
+		gGLState.endFrame();
 		//Update framerate.
 		gFPS = 1.0 / (newTime - currTime);
 		
@@ -952,6 +1735,8 @@ int main(int numArgs, char **args)
 		glfwSwapBuffers(gWindow);
 	}
 
+	gFileWatcher.stop();
+
 	// Shut down sound engine
 	if (gBackgroundMusic) gBackgroundMusic->drop(); // release music stream.
 	soundEngine->drop(); // delete engine
@@ -962,6 +1747,7 @@ int main(int numArgs, char **args)
 	for (auto it = gNodes.begin(); it != gNodes.end(); ++it) delete it->second;
 	for (auto it = gMaterials.begin(); it != gMaterials.end(); ++it) delete (*it).second;
 	for (auto it = gMeshes.begin(); it != gMeshes.end(); ++it) delete (*it).second;
+	gTextureCache.purge(); //Nothing holds them anymore.
 	//cleanupText2D(); // Delete font VBO, shader, texture.
 	glfwTerminate();
 
@@ -1009,7 +1795,6 @@ void useConsole(void)
 					if (f == nullptr) cout << "\tFile not found. Please ensure the name is correct and try again.\n";
 					else //Valid file on first try, so load it.
 					{
-						glfwTerminate();
 						if (flag) {
 							gSceneFileNames.push_back(token);
 							gActiveScene = gSceneFileNames.size() - 1; //Else gActiveScene stays on the scene before loading.
@@ -1035,23 +1820,15 @@ void useConsole(void)
 						cout << "\tReplace fileNameToSaveToScene.scene by \'this\' to save active scene.\n";
 						break;
 					}
-					else if (token == "this") token = gActiveSceneName;
-					//Call toString() of all appropriate objects over all global state containers.
-					//fprintf(F, "\n%s\n", objOfInterestInRightOrder.toSDL());
-					FILE *F = fopen(token.c_str(), "w"); //Will erase old file and create a new one over it.
-					saveWorldSettings(F); fprintf(F, "\n"); cout << "\tFinished saving worldSettings.\n";
-					for (auto it = gCameras.cbegin(); it != gCameras.cend(); ++it) if (!(*it)->inNode) (*it)->toSDL(F);	
-						fprintf(F, "\n"); cout << "\tFinished saving cameras.\n";
-					for (auto it = gLibraries.cbegin(); it != gLibraries.cend(); ++it) fprintf(F, "library \"%s\"\n", (*it).c_str());
-						fprintf(F, "\n"); cout << "\tFinished listing libraries.\n";
-					for (auto it = gMeshes.cbegin(); it != gMeshes.cend(); ++it) if (!it->second->inLibrary) it->second->toSDL(F); 
-						fprintf(F, "\n"); cout << "\tFinished saving meshes.\n";
-					for (int i = 0; i < gNumLights; ++i) gLights[i].toSDL(F); 
-						fprintf(F, "\n"); cout << "\tFinished saving lights.\n";
-					for (auto it = gMaterials.cbegin(); it != gMaterials.cend(); ++it) if (!it->second->inLibrary) it->second->toSDL(F); 
-						fprintf(F, "\n"); cout << "\tFinished saving materials.\n";
-					for (auto it = gNodes.cbegin(); it != gNodes.cend(); ++it) if (it->second->parent == nullptr) it->second->toSDL(F); fprintf(F, "\n"); cout << "\tFinished saving nodes.\n";
-					fclose(F);
+					else if (token == "this") {
+						token = gActiveSceneName;
+						if (sceneb::isCompiledSceneName(token)) { //Never write text over a compiled scene, save beside it instead.
+							token.erase(token.length() - strlen(SCENEB_EXTENSION));
+							token += ".scene";
+							cout << "\tActive scene is compiled, saving as " << token << " instead.\n";
+						}
+					}
+					saveScene(token.c_str());
 					if (flag) {
 						cout << "\n================================================================================";
 						cout << "\t\t\t\tExiting Console & Engine";
@@ -1225,10 +2002,8 @@ void useConsole(void)
 						cin >> gMaterials[token]->vertexShaderName;
 						cout << "\tFragment Shader Filename.fs: ";
 						cin >> gMaterials[token]->fragmentShaderName;
-						gMaterials[token]->setShaderProgram(createShaderProgram(
-							loadShader(gMaterials[token]->vertexShaderName, GL_VERTEX_SHADER),
-							loadShader(gMaterials[token]->fragmentShaderName, GL_FRAGMENT_SHADER)
-							)); //Return to modify this to take a container of shaders.
+						gMaterials[token]->setShaderProgram(gProgramCache.acquire(gMaterials[token]->vertexShaderName,
+							gMaterials[token]->fragmentShaderName, &gMaterials[token]->shaderFiles));
 
 						string tmp;
 						do {
@@ -1243,13 +2018,13 @@ void useConsole(void)
 
 						do {
 							cout << "\tAdd texture uniform (Y/N)? "; cin >> tmp; if (tmp == "N" || tmp == "n") break;
-							gMaterials[token]->textures.push_back(new RGBAImage());
-							cout << "\tSampler uniformName: "; cin >> gMaterials[token]->textures.back()->name;
-							cout << "\tTexture fileName.png: "; cin >> gMaterials[token]->textures.back()->fileName;
-							gMaterials[token]->textures.back()->loadPNG(gMaterials[token]->textures.back()->fileName);
-							gMaterials[token]->textures.back()->sendToOpenGL();
+							string uniformName, texFileName;
+							cout << "\tSampler uniformName: "; cin >> uniformName;
+							cout << "\tTexture fileName.png: "; cin >> texFileName;
+							gMaterials[token]->addTexture(uniformName, createTexture(texFileName));
 						} while (true);
 
+						gJobs.waitAll();
 						gMaterials[token]->bindMaterial(); //Very important line!
 						cout << "\tMaterial successfully created and added to gMaterials.\n";
 					}
@@ -1274,8 +2049,7 @@ void useConsole(void)
 							cin >> fileName;
 							if (fileName == "N") { cout << "\tReturning to top level console.\n"; break; }
 						}
-						if (!gMeshes[token]->readFromPly(token + ".ply", false)) { cout << "\tReadFromPly() returned false, erasing mesh and returning to top-level console.\n"; gMeshes.erase(token); break; }
-						if (!gMeshes[token]->sendToOpenGL()) { cout << "\tSendToOpenGL() returned false, erasing mesh and returning to top-level console.\n"; gMeshes.erase(token);  break; }
+						if (!gMeshes[token]->loadFromPly(token + ".ply", false)) { cout << "\tLoadFromPly() returned false, erasing mesh and returning to top-level console.\n"; gMeshes.erase(token); break; }
 						cout << "\tMesh object successfully created and added to gMeshes.\n";
 					}
 					else if (token == "node")
@@ -1375,10 +2149,27 @@ void useConsole(void)
 					else if (token == "scenes") for (auto it = gSceneFileNames.cbegin(); it != gSceneFileNames.cend(); ++it) cout << '\t' << *it << endl;
 					else if (token == "scripts") for (auto it = gScripts.cbegin(); it != gScripts.cend(); ++it) cout << '\t' << it->second->type << endl;
 					else if (token == "paths") for (auto it = getPATH().cbegin(); it != getPATH().cend(); ++it) cout << '\t' << *it << endl;
-					else cout << "\tValid Commands:\n\tprint cameras\n\tprint lights\n\tprint materials\n\tprint meshes\n\tprint nodes\n\tprint scenes\n\tprint scripts\n\tprint paths\n";
+					else if (token == "meshcache") printMeshCacheStats();
+					else if (token == "textures") gTextureCache.print();
+					else if (token == "programs") gProgramCache.print();
+					else if (token == "frame") {
+						gRenderQueue.printStats();
+						gParticleRenderer.printStats();
+						gGLState.printStats();
+						gOctree.printStats();
+					}
+					else cout << "\tValid Commands:\n\tprint cameras\n\tprint lights\n\tprint materials\n\tprint meshes\n\tprint nodes\n\tprint scenes\n\tprint scripts\n\tprint paths\n\tprint meshcache\n\tprint textures\n\tprint programs\n\tprint frame\n";
 				}
 				else if (token == "select") {
 					iss >> token;
+					if (token == "ahead") { //The nearest node in the active camera's line of sight.
+						Camera &cam = *gCameras[gActiveCamera];
+						vector<OctreeHit> hits;
+						gOctree.queryRay(cam.eye, cam.center - cam.eye, cam.zfar, hits);
+						token = "select";
+						for (int i = 0; i < (int)hits.size(); ++i) if (hits[i].distance > 0.0f) { token = hits[i].node->name; break; } //Not whatever holds the camera.
+						if (token == "select") cout << "\tNothing ahead.\n";
+					}
 					if (token == "select") token = "";
 					else if (token == "all") {
 						for (auto it = gNodes.begin(); it != gNodes.end(); ++it) {
@@ -1421,6 +2212,7 @@ void useConsole(void)
 					if (token == "") {
 						cout << "\tValid Commands:\n";
 						cout << "\tselect all\n";
+						cout << "\tselect ahead\n";
 						cout << "\tselect nodeName\n";
 						break;
 					}
@@ -1683,6 +2475,7 @@ void useConsole(void)
 								cin >> propVal;
 								if (gNodes[token]->scripts[scriptNum]->setProperty(name, propVal)) cout << "\tSuccessfully set in script.\n";
 								else cout << "\tFailed to set property in script.\n";
+								gJobs.waitAll(); //An emitter image loads through gTextureCache.
 								break;
 							case 5:
 								cout << "\tTranslation.x (Curr: " << gNodes[token]->T.translation.x << "): "; cin >> gNodes[token]->T.translation.x;
@@ -1703,10 +2496,16 @@ void useConsole(void)
 					}
 					else if (token == "script") {
 
+					}
+					else if (token == "particles") {
+						cout << "\tParticle budget, 0 for none (Curr: " << gParticleRenderer.particleBudget << "): "; cin >> gParticleRenderer.particleBudget;
+						double ms = gParticleRenderer.timeBudget * 1000.0;
+						cout << "\tSimulation ms budget, 0 for none (Curr: " << ms << "): "; cin >> ms;
+						gParticleRenderer.timeBudget = ms / 1000.0;
 					}
 					else {
 						cout << "\tValid Commands:\n";
-						cout << "\tset camera\n\tset light\n\tset material\n\tset node\n\tset scene\n";
+						cout << "\tset camera\n\tset light\n\tset material\n\tset node\n\tset particles\n\tset scene\n";
 					}
 				}
 				else if (token == "help" || token == "man")